@@ -0,0 +1,1453 @@
+#!/usr/bin/python
+"""
+Emulates the CC2540 side of the Bean serial transport, for driving and
+benchmarking the Arduino core over a USB-serial adapter wired to the ATmega's
+UART, without a phone or a CC.
+
+Frames are parsed whole and CRC checked exactly as the core's RX ISR does,
+every message the core sends is handled, and the requests it waits on in
+call_and_response() are answered from an emulated CC state.  Replies can be
+delayed and the emulated CC can be made to drop frames that arrive too soon
+after the last one, or too soon after the ATmega started waking it, to see
+how the core's pacing copes.
+
+    python BeanCCEmulator.py /dev/ttyUSB0              interactive console
+    python BeanCCEmulator.py /dev/ttyUSB0 --bench rx   sketch -> host rate
+    python BeanCCEmulator.py /dev/ttyUSB0 --bench echo round trip times
+    python BeanCCEmulator.py /dev/ttyUSB0 --bench tx   host -> sketch flood
+
+The echo benchmark needs transportBench/transportBench.ino on the Bean.  The
+tx benchmark streams Virtual Serial as fast as the link allows, for the rx_isr
+figure of resources/benchmark_sketches/transport.ino, and prints whatever the
+sketch sends meanwhile.
+
+Optional wiring: the ATmega's CC interrupt output (PD5 on the Bean) to the
+adapter's CTS, so the wake wait can be measured and emulated
+(--cc-line), and the adapter's RTS to the ATmega's INT1 (PD3), so the
+emulator can wake it from Bean.sleep() (--wake-line).  TTL adapters report a
+line as asserted while it is low; --invert-lines is for those that don't.
+
+Works with Python 2.7 and 3; needs pyserial for a real port.
+"""
+
+from __future__ import division, print_function
+
+import argparse
+import collections
+import logging
+import os
+import re
+import struct
+import sys
+import threading
+import time
+import zlib
+
+try:
+    import queue
+except ImportError:  # Python 2
+    import Queue as queue
+
+SOF_BYTE = 0x7E
+EOF_BYTE = 0x7F
+ESC_BYTE = 0x7D
+ESC_XOR = 0x20
+
+BAUD_RATE = 38400
+FAST_BAUD_RATES = (250000, 500000, 1000000)
+BAUD_CONFIRM_TIME = 0.1   # for a good frame at a new rate, or back to 38400
+RX_ACK_TIMEOUT = 0.1      # before a numbered frame is sent again
+RX_ACK_HOLDOFF = 0.02     # least time between two sends of one frame
+RX_ACK_WINDOW = 8         # numbered frames sent ahead of the ATmega's ACK
+MAX_BODY_LENGTH = 64      # APP_MSG_MAX_LENGTH - 2
+RESPONSE_BIT = 0x0080     # the core matches replies with or without it
+ANCS_APP_ID = 0           # the AppIdentifier notification attribute
+
+# Message ids as in applicationMessageHeaders and BeanSerialTransport.h.
+# load_message_ids() overrides these from the headers when they are checked
+# out, so an id that moved there can't go stale here.
+MESSAGE_IDS = {
+    'MSG_ID_SERIAL_DATA': 0x0000,
+    'MSG_ID_SERIAL_DATA_LZ': 0x0001,
+    'MSG_ID_BT_SET_ADV': 0x0500,
+    'MSG_ID_BT_SET_CONN': 0x0502,
+    'MSG_ID_BT_SET_LOCAL_NAME': 0x0504,
+    'MSG_ID_BT_SET_PIN': 0x0506,
+    'MSG_ID_BT_SET_TX_PWR': 0x0508,
+    'MSG_ID_BT_GET_CONFIG': 0x0510,
+    'MSG_ID_BT_ADV_ONOFF': 0x0512,
+    'MSG_ID_BT_SET_SCRATCH': 0x0514,
+    'MSG_ID_BT_GET_SCRATCH': 0x0515,
+    'MSG_ID_BT_SET_SCRATCH_MULTI': 0x0516,
+    'MSG_ID_BT_GET_SCRATCH_MULTI': 0x0517,
+    'MSG_ID_BT_SCRATCH_NOTIFY': 0x0518,
+    'MSG_ID_BT_SCRATCH_WRITTEN': 0x0519,
+    'MSG_ID_BT_RESTART': 0x0520,
+    'MSG_ID_BT_GET_STATES': 0x0530,
+    'MSG_ID_BT_STATES_NOTIFY': 0x0532,
+    'MSG_ID_BT_STATES_CHANGED': 0x0533,
+    'MSG_ID_BT_SET_CONFIG': 0x0540,
+    'MSG_ID_BT_SET_CONFIG_NOSAVE': 0x0541,
+    'MSG_ID_BT_DISCONNECT': 0x0550,
+    'MSG_ID_BT_ENABLE_PAIRING_PIN': 0x0560,
+    'MSG_ID_BL_CMD': 0x1000,
+    'MSG_ID_BL_FW_BLOCK': 0x1001,
+    'MSG_ID_BL_STATUS': 0x1002,
+    'MSG_ID_CC_LED_WRITE': 0x2000,
+    'MSG_ID_CC_LED_WRITE_ALL': 0x2001,
+    'MSG_ID_CC_LED_READ_ALL': 0x2002,
+    'MSG_ID_CC_LED_ANIMATE': 0x2003,
+    'MSG_ID_CC_ACCEL_READ': 0x2010,
+    'MSG_ID_CC_TEMP_READ': 0x2011,
+    'MSG_ID_CC_BATT_READ': 0x2015,
+    'MSG_ID_CC_ACCEL_GET_RANGE': 0x2030,
+    'MSG_ID_CC_ACCEL_SET_RANGE': 0x2035,
+    'MSG_ID_CC_ACCEL_READ_REG': 0x2040,
+    'MSG_ID_CC_ACCEL_WRITE_REG': 0x2041,
+    'MSG_ID_CC_ACCEL_TRANSACTION': 0x2042,
+    'MSG_ID_CC_ACCEL_STREAM': 0x2043,
+    'MSG_ID_CC_ACCEL_STREAM_DATA': 0x2044,
+    'MSG_ID_CC_ACCEL_EVENT_ENABLE': 0x2045,
+    'MSG_ID_CC_ACCEL_EVENT': 0x2046,
+    'MSG_ID_CC_WAKE_ON_ACCEL': 0x2050,
+    'MSG_ID_CC_ACCEL_READ_RSP': 0x2090,
+    'MSG_ID_AR_SET_POWER': 0x3000,
+    'MSG_ID_AR_GET_CONFIG': 0x3006,
+    'MSG_ID_AR_SLEEP': 0x3010,
+    'MSG_ID_AR_WAKE_INFO': 0x3011,
+    'MSG_ID_AR_WAKE_ON_CONNECT': 0x3020,
+    'MSG_ID_AR_SET_BAUD': 0x3030,
+    'MSG_ID_AR_SET_RX_ACKS': 0x3031,
+    'MSG_ID_AR_RX_ACK': 0x3032,
+    'MSG_ID_AR_RX_NAK': 0x3033,
+    'MSG_ID_GATT_SET_GATT': 0x4000,
+    'MSG_ID_GATT_GET_GATT': 0x4001,
+    'MSG_ID_GATT_SET_CUSTOM': 0x4002,
+    'MSG_ID_MIDI_WRITE': 0x8000,
+    'MSG_ID_MIDI_READ': 0x8001,
+    'MSG_ID_ANCS_READ': 0x9000,
+    'MSG_ID_ANCS_GET_NOTI': 0x9001,
+    'MSG_ID_ANCS_FILTER': 0x9002,
+    'MSG_ID_HID_SEND_REPORT': 0xA000,
+    'MSG_ID_OBSERVER_START': 0xB000,
+    'MSG_ID_OBSERVER_STOP': 0xB001,
+    'MSG_ID_OBSERVER_READ': 0xB002,
+    'MSG_ID_OBSERVER_FILTER': 0xB003,
+    'MSG_ID_DB_LOOPBACK': 0xFE00,
+    'MSG_ID_DB_COUNTER': 0xFE01,
+    'MSG_ID_DB_E2E_LOOPBACK': 0xFE02,
+    'MSG_ID_DB_PTM': 0xFE03,
+}
+
+CORE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..',
+                        'hardware', 'bean', 'avr', 'cores', 'bean')
+
+_ENUM_ID = re.compile(r'\b(MSG_ID_\w+)\s*=\s*(0x[0-9A-Fa-f]+)')
+_DEFINE_ID = re.compile(r'#define\s+(MSG_ID_\w+)\s+\(\(MSG_ID_T\)(0x[0-9A-Fa-f]+)\)')
+
+
+def load_message_ids(core_dir=CORE_DIR):
+    """
+    Returns MESSAGE_IDS updated from the message headers of the core, and the
+    reverse map from id to name.
+    """
+    ids = dict(MESSAGE_IDS)
+    paths = [os.path.join(core_dir, 'BeanSerialTransport.h')]
+    headers = os.path.join(core_dir, 'applicationMessageHeaders')
+    if os.path.isdir(headers):
+        paths.extend(os.path.join(headers, name)
+                     for name in sorted(os.listdir(headers))
+                     if name.endswith('.h'))
+    for path in paths:
+        try:
+            with open(path) as header:
+                text = header.read()
+        except IOError:
+            continue
+        for pattern in (_ENUM_ID, _DEFINE_ID):
+            for name, value in pattern.findall(text):
+                ids[name] = int(value, 16)
+    names = dict((value, name) for name, value in ids.items())
+    return ids, names
+
+
+def frame_crc(data):
+    """The core's CRC32 (bean_crc32), over the length, id and body."""
+    return zlib.crc32(bytes(bytearray(data))) & 0xFFFFFFFF
+
+
+def build_frame(message_id, body=b'', sequence=None):
+    """
+    Returns the wire bytes of one message: SOF, then the length, id, body
+    and big endian CRC32, escaped, then EOF.  A sequence number, with RX
+    acknowledgements on, goes in front of the body and doesn't count towards
+    its maximum length.
+    """
+    body = bytearray(body)
+    if len(body) > MAX_BODY_LENGTH:
+        raise ValueError('body of %d bytes is over %d' %
+                         (len(body), MAX_BODY_LENGTH))
+    if sequence is not None:
+        body.insert(0, sequence & 0xFF)
+    content = bytearray([len(body) + 2, message_id >> 8, message_id & 0xFF])
+    content += body
+    content += struct.pack('>I', frame_crc(content))
+
+    frame = bytearray([SOF_BYTE])
+    for byte in content:
+        if byte in (SOF_BYTE, EOF_BYTE, ESC_BYTE):
+            frame.append(ESC_BYTE)
+            frame.append(byte ^ ESC_XOR)
+        else:
+            frame.append(byte)
+    frame.append(EOF_BYTE)
+    return frame
+
+
+Frame = collections.namedtuple('Frame', 'message_id body started ended')
+
+
+class NumberedFrame(object):
+    """A frame sent with a sequence number, kept until the ATmega ACKs it."""
+
+    def __init__(self, sequence, data):
+        self.sequence = sequence
+        self.data = data
+        self.sent = None      # when the writer last sent it
+        self.resent = None    # when it was last queued to go again
+
+
+class FrameParser(object):
+    """
+    Incremental frame parser, the same state machine as the core's
+    rx_handle_char().  feed() takes whatever bytes arrived and returns the
+    frames they completed; frames with a bad CRC, and frames cut short by an
+    out of place SOF, EOF or escape, are counted and dropped.
+    """
+
+    def __init__(self):
+        self.frames = 0
+        self.crc_errors = 0
+        self.framing_resets = 0
+        self.bytes = 0
+        self._reset()
+
+    def _reset(self):
+        self._content = None      # bytes after SOF, unescaped
+        self._escaping = False
+        self._started = None
+
+    def feed(self, data, now=None):
+        if now is None:
+            now = time.time()
+        frames = []
+        for byte in bytearray(data):
+            self.bytes += 1
+            if self._content is None:
+                if byte == SOF_BYTE:
+                    self._content = bytearray()
+                    self._started = now
+                continue
+
+            if self._escaping:
+                self._escaping = False
+                self._content.append(byte ^ ESC_XOR)
+            elif byte == ESC_BYTE:
+                self._escaping = True
+                continue
+            elif byte == SOF_BYTE:
+                self.framing_resets += 1
+                self._content = bytearray()
+                self._started = now
+                continue
+            elif byte == EOF_BYTE:
+                frame = self._finish(now)
+                if frame is not None:
+                    frames.append(frame)
+                self._reset()
+                continue
+            else:
+                self._content.append(byte)
+
+            # a frame can't be longer than its length byte says
+            if len(self._content) > self._content[0] + 5:
+                self.framing_resets += 1
+                self._reset()
+        return frames
+
+    def _finish(self, now):
+        content = self._content
+        if len(content) < 7 or len(content) != content[0] + 5:
+            self.framing_resets += 1
+            return None
+        crc = struct.unpack('>I', bytes(content[-4:]))[0]
+        if crc != frame_crc(content[:-4]):
+            self.crc_errors += 1
+            return None
+        self.frames += 1
+        message_id = (content[1] << 8) | content[2]
+        return Frame(message_id, bytes(content[3:-4]), self._started, now)
+
+
+class LzDecoder(object):
+    """
+    Undoes Serial.setCompression(): decode() takes a MSG_ID_SERIAL_DATA_LZ
+    body and raw() a MSG_ID_SERIAL_DATA one, as both add to the stream.
+    After a lost message decode() returns None until the ATmega next clears
+    the history.
+    """
+
+    WINDOW = 256
+    RESET_BIT = 0x80
+
+    def __init__(self):
+        self.history = bytearray()
+        self.count = 0            # bytes since the last clear
+        self.synced = False
+        self.lost = 0
+        self.compressed_bytes = 0
+        self.decoded_bytes = 0
+
+    def raw(self, data):
+        self._append(bytearray(data))
+
+    def _append(self, data):
+        self.history += data
+        del self.history[:-self.WINDOW]
+        self.count += len(data)
+
+    def decode(self, body):
+        body = bytearray(body)
+        if not body:
+            return None
+        header = body[0]
+        if header & self.RESET_BIT:
+            self.history = bytearray()
+            self.count = 0
+            self.synced = True
+        elif not self.synced or \
+                self.count % 128 != header & ~self.RESET_BIT:
+            if self.synced:
+                self.lost += 1
+                self.synced = False
+            return None
+
+        out = bytearray()
+        i = 1
+        while i < len(body):
+            control = body[i]
+            i += 1
+            for bit in range(8):
+                if i >= len(body):
+                    break
+                if not control & (1 << bit):
+                    out.append(body[i])
+                    i += 1
+                    continue
+                if i + 1 >= len(body):
+                    raise ValueError('match cut short')
+                distance = body[i] + 1
+                length = body[i + 1] + 3
+                i += 2
+                if distance > len(self.history) + len(out):
+                    raise ValueError('match %d back, before the history' %
+                                     distance)
+                for _ in range(length):
+                    # overlapping matches repeat what they just copied
+                    out.append((self.history + out)[-distance])
+        self._append(out)
+        self.compressed_bytes += len(body)
+        self.decoded_bytes += len(out)
+        return bytes(out)
+
+
+class LatencyStats(object):
+    """Count, mean and percentiles of a series of durations, in seconds."""
+
+    def __init__(self):
+        self.samples = []
+
+    def add(self, value):
+        self.samples.append(value)
+
+    def summary(self):
+        if not self.samples:
+            return 'none'
+        ordered = sorted(self.samples)
+
+        def at(fraction):
+            return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+        return ('%d, mean %.2f ms, p50 %.2f, p90 %.2f, p99 %.2f, max %.2f' %
+                (len(ordered), 1000 * sum(ordered) / len(ordered),
+                 1000 * at(0.5), 1000 * at(0.9), 1000 * at(0.99),
+                 1000 * ordered[-1]))
+
+
+class CCState(object):
+    """Everything the emulated CC reports back to the ATmega."""
+
+    def __init__(self):
+        self.led = [0, 0, 0]
+        # BT_RADIOCONFIG_T: adv_int, conn_int, power, adv_mode, ibeacon
+        # uuid, major and minor, local_name[20], local_name_size
+        self.radio_config = struct.pack(
+            '<HHBBHHH20sB', 100, 20, 0, 0, 0xA495, 0, 0, b'Bean', 4)
+        self.radio_config_saves = 0
+        self.conn_state = 0
+        self.adv_state = 1
+        self.scratch = dict((bank, b'') for bank in range(1, 6))
+        self.accel = [0, 0, 256]
+        self.accel_range = 2
+        self.accel_regs = bytearray(0x40)
+        self.accel_regs[0x00] = 0xF9   # BMA250 chip id
+        self.temperature = 22
+        self.battery = 100
+        self.gatt = 0x01
+        self.wake_on_connect = False
+        self.debug_counter = 0
+        self.pairing_pin = None
+        self.advertising = True
+        self.ancs_attribute = b'Emulated notification'
+        self.ancs_app_id = b'com.apple.MobileSMS'
+
+
+class CCEmulator(object):
+    """
+    The CC end of the link.  link is an open pyserial port, or anything with
+    read(n), write(data) and a timeout, and optionally the modem line
+    properties named by cc_line and wake_line.
+
+    reply_delay     seconds between a request arriving and its reply
+    send_spacing    least time between two frames the emulator sends, and,
+                    with drop_spacing, between two frames it accepts
+    wake_latency    with cc_line, time the CC needs after the ATmega raises
+                    its interrupt line before it can receive
+    reply_id        'response' to reply with RESPONSE_BIT set, 'same' to
+                    echo the request id, 'none' not to answer requests
+    baud_rates      the rates above 38400 MSG_ID_AR_SET_BAUD may switch to
+    corrupt_every   corrupts one in this many frames sent, to exercise CRC
+                    errors and RX acknowledgements; 0 for none
+    """
+
+    def __init__(self, link, reply_delay=0.0, send_spacing=0.0,
+                 wake_latency=0.0, drop_spacing=False, reply_id='response',
+                 cc_line=None, wake_line=None, invert_lines=False,
+                 baud_rates=FAST_BAUD_RATES, corrupt_every=0):
+        self.link = link
+        self.corrupt_every = corrupt_every
+        self.baud_rates = tuple(baud_rates)
+        self.baud = BAUD_RATE
+        self.reply_delay = reply_delay
+        self.send_spacing = send_spacing
+        self.wake_latency = wake_latency
+        self.drop_spacing = drop_spacing
+        self.reply_id = reply_id
+        self.cc_line = cc_line
+        self.wake_line = wake_line
+        self.invert_lines = invert_lines
+
+        self.ids, self.names = load_message_ids()
+        self.state = CCState()
+        self.parser = FrameParser()
+        self.lock = threading.Lock()
+
+        self.received = collections.Counter()
+        self.received_bytes = collections.Counter()
+        self.frame_gaps = LatencyStats()
+        self.wake_waits = LatencyStats()
+        self.spacing_drops = 0
+        self.wake_drops = 0
+        self.unhandled = collections.Counter()
+        self.started = time.time()
+
+        self.serial_listeners = []
+        self.lz = LzDecoder()
+        self.message_listeners = []
+
+        self._last_frame_end = None
+        self._cc_line_rose = None
+        self._cc_line_high = False
+        self._tx = queue.Queue()
+        self._last_sent = 0.0
+        self._running = False
+        self._threads = []
+        self._sleep_timer = None
+        self._accel_stream = None
+        self._observer = None
+        self._led_animation = None
+        self._ancs_filter = None
+        self._scratch_notify = 0
+        self._states_notify = False
+        self._accel_events = 0
+        self._baud_timer = None
+
+        # RX acknowledgements, see Serial.setRxAcks()
+        self.rx_acks = False
+        self.frames_sent = 0
+        self.corrupted = 0
+        self.naks = 0
+        self.resent = 0
+        self._sequence = 0
+        self._unacked = collections.OrderedDict()
+
+        self._handlers = {}
+        for name, handler in (
+                ('MSG_ID_SERIAL_DATA', self._serial_data),
+                ('MSG_ID_SERIAL_DATA_LZ', self._serial_data_lz),
+                ('MSG_ID_BT_GET_CONFIG', self._get_config),
+                ('MSG_ID_BT_SET_CONFIG', self._set_config),
+                ('MSG_ID_BT_SET_CONFIG_NOSAVE', self._set_config),
+                ('MSG_ID_BT_GET_STATES', self._get_states),
+                ('MSG_ID_BT_STATES_NOTIFY', self._states_notify_enable),
+                ('MSG_ID_BT_SET_SCRATCH', self._set_scratch),
+                ('MSG_ID_BT_GET_SCRATCH', self._get_scratch),
+                ('MSG_ID_BT_SET_SCRATCH_MULTI', self._set_scratch_multi),
+                ('MSG_ID_BT_GET_SCRATCH_MULTI', self._get_scratch_multi),
+                ('MSG_ID_BT_SCRATCH_NOTIFY', self._scratch_notify_enable),
+                ('MSG_ID_BT_ADV_ONOFF', self._adv_onoff),
+                ('MSG_ID_BT_SET_PIN', self._set_pin),
+                ('MSG_ID_BT_DISCONNECT', self._disconnect),
+                ('MSG_ID_CC_LED_WRITE', self._led_write),
+                ('MSG_ID_CC_LED_WRITE_ALL', self._led_write_all),
+                ('MSG_ID_CC_LED_READ_ALL', self._led_read_all),
+                ('MSG_ID_CC_LED_ANIMATE', self._led_animate),
+                ('MSG_ID_CC_ACCEL_READ', self._accel_read),
+                ('MSG_ID_CC_ACCEL_GET_RANGE', self._accel_get_range),
+                ('MSG_ID_CC_ACCEL_SET_RANGE', self._accel_set_range),
+                ('MSG_ID_CC_ACCEL_READ_REG', self._accel_read_reg),
+                ('MSG_ID_CC_ACCEL_WRITE_REG', self._accel_write_reg),
+                ('MSG_ID_CC_ACCEL_TRANSACTION', self._accel_transaction),
+                ('MSG_ID_CC_ACCEL_EVENT_ENABLE', self._accel_event_enable),
+                ('MSG_ID_CC_ACCEL_STREAM', self._accel_stream_request),
+                ('MSG_ID_CC_TEMP_READ', self._temp_read),
+                ('MSG_ID_CC_BATT_READ', self._batt_read),
+                ('MSG_ID_GATT_GET_GATT', self._gatt_read),
+                ('MSG_ID_GATT_SET_GATT', self._gatt_write),
+                ('MSG_ID_AR_SLEEP', self._ar_sleep),
+                ('MSG_ID_AR_WAKE_ON_CONNECT', self._wake_on_connect),
+                ('MSG_ID_AR_SET_BAUD', self._set_baud),
+                ('MSG_ID_AR_SET_RX_ACKS', self._set_rx_acks),
+                ('MSG_ID_AR_RX_ACK', self._rx_ack),
+                ('MSG_ID_AR_RX_NAK', self._rx_ack),
+                ('MSG_ID_OBSERVER_START', self._observer_start),
+                ('MSG_ID_OBSERVER_STOP', self._observer_stop),
+                ('MSG_ID_OBSERVER_FILTER', self._ack),
+                ('MSG_ID_ANCS_GET_NOTI', self._ancs_get_noti),
+                ('MSG_ID_ANCS_FILTER', self._ancs_set_filter),
+                ('MSG_ID_DB_LOOPBACK', self._loopback),
+                ('MSG_ID_DB_E2E_LOOPBACK', self._loopback),
+                ('MSG_ID_DB_COUNTER', self._debug_counter)):
+            self._handlers[self.ids[name]] = handler
+        # taken and logged, with nothing to answer
+        for name in ('MSG_ID_BT_SET_ADV', 'MSG_ID_BT_SET_CONN',
+                     'MSG_ID_BT_SET_LOCAL_NAME', 'MSG_ID_BT_SET_TX_PWR',
+                     'MSG_ID_BT_RESTART', 'MSG_ID_BT_ENABLE_PAIRING_PIN',
+                     'MSG_ID_CC_WAKE_ON_ACCEL', 'MSG_ID_GATT_SET_CUSTOM',
+                     'MSG_ID_MIDI_WRITE', 'MSG_ID_HID_SEND_REPORT',
+                     'MSG_ID_AR_SET_POWER', 'MSG_ID_DB_PTM'):
+            self._handlers[self.ids[name]] = self._log_only
+
+    # Link ####################################################################
+
+    def start(self):
+        self._running = True
+        for target in (self._reader, self._writer, self._resender):
+            thread = threading.Thread(target=target)
+            thread.daemon = True
+            thread.start()
+            self._threads.append(thread)
+        if self.cc_line:
+            thread = threading.Thread(target=self._line_monitor)
+            thread.daemon = True
+            thread.start()
+            self._threads.append(thread)
+
+    def stop(self):
+        self._running = False
+        for timer in (self._sleep_timer, self._baud_timer):
+            if timer is not None:
+                timer.cancel()
+        self._accel_stream = None
+        self._observer = None
+        self._tx.put(None)
+        for thread in self._threads:
+            thread.join(1.0)
+
+    def _reader(self):
+        while self._running:
+            waiting = getattr(self.link, 'in_waiting', 0)
+            data = self.link.read(max(1, waiting))
+            if not data:
+                continue
+            now = time.time()
+            for frame in self.parser.feed(data, now):
+                self._frame_received(frame)
+
+    def _writer(self):
+        while True:
+            item = self._tx.get()
+            if item is None:
+                return
+            due, frame = item
+            wait = max(due, self._last_sent + self.send_spacing) - time.time()
+            if wait > 0:
+                time.sleep(wait)
+            if callable(frame):
+                # runs once everything queued before it has been written
+                frame()
+                continue
+            if isinstance(frame, NumberedFrame):
+                numbered, frame = frame, frame.data
+                numbered.sent = time.time()
+            self.frames_sent += 1
+            if self.corrupt_every and \
+                    self.frames_sent % self.corrupt_every == 0:
+                frame = bytearray(frame)
+                frame[-2] ^= 0x01    # in the CRC, or an escaped byte
+                self.corrupted += 1
+            self.link.write(bytes(frame))
+            self._last_sent = time.time()
+
+    def _line(self, name):
+        asserted = bool(getattr(self.link, name))
+        # TTL adapters assert a line by pulling it low
+        return asserted == self.invert_lines
+
+    def _line_monitor(self):
+        while self._running:
+            high = self._line(self.cc_line)
+            if high and not self._cc_line_high:
+                self._cc_line_rose = time.time()
+            self._cc_line_high = high
+            time.sleep(0.0002)
+
+    def wake_atmega(self, hold=0.005):
+        """Pulses the ATmega's INT1 low, as the CC does to end a sleep."""
+        if not self.wake_line:
+            return False
+        setattr(self.link, self.wake_line, not self.invert_lines)
+        time.sleep(hold)
+        setattr(self.link, self.wake_line, self.invert_lines)
+        return True
+
+    # Messages ################################################################
+
+    def name(self, message_id):
+        return self.names.get(message_id, '0x%04X' % message_id)
+
+    def send(self, message_id, body=b'', delay=0.0):
+        """Queues a message for the ATmega, to go out delay seconds from now."""
+        if isinstance(message_id, str):
+            message_id = self.ids[message_id]
+        with self.lock:
+            if not self.rx_acks:
+                self._tx.put((time.time() + delay,
+                              build_frame(message_id, body)))
+                return
+            sequence = self._sequence
+            self._sequence = (sequence + 1) & 0xFF
+            frame = NumberedFrame(sequence,
+                                  build_frame(message_id, body, sequence))
+            self._unacked[sequence] = frame
+            self._tx.put((time.time() + delay, frame))
+
+    def unacked_frames(self):
+        with self.lock:
+            return len(self._unacked)
+
+    def reply(self, request_id, body=b''):
+        if self.reply_id == 'none':
+            return
+        if self.reply_id == 'response':
+            request_id |= RESPONSE_BIT
+        self.send(request_id, body, self.reply_delay)
+
+    def _frame_received(self, frame):
+        # what the CC would have lost
+        if self.drop_spacing and self._last_frame_end is not None and \
+                frame.started - self._last_frame_end < self.send_spacing:
+            self.spacing_drops += 1
+            self._last_frame_end = frame.ended
+            return
+        if self._cc_line_rose is not None:
+            waited = frame.started - self._cc_line_rose
+            if waited >= 0:
+                self.wake_waits.add(waited)
+                self._cc_line_rose = None
+                if waited < self.wake_latency:
+                    self.wake_drops += 1
+                    self._last_frame_end = frame.ended
+                    return
+        if self._last_frame_end is not None:
+            self.frame_gaps.add(frame.started - self._last_frame_end)
+        self._last_frame_end = frame.ended
+        # a good frame confirms a new baud rate
+        if self._baud_timer is not None:
+            self._baud_timer.cancel()
+            self._baud_timer = None
+
+        with self.lock:
+            self.received[frame.message_id] += 1
+            self.received_bytes[frame.message_id] += len(frame.body)
+        logging.debug('<- %s %s', self.name(frame.message_id),
+                      _hex(frame.body))
+
+        handler = self._handlers.get(frame.message_id)
+        if handler is None:
+            self.unhandled[frame.message_id] += 1
+            logging.info('unhandled %s %s', self.name(frame.message_id),
+                         _hex(frame.body))
+        else:
+            handler(frame.message_id, bytearray(frame.body))
+        for listener in self.message_listeners:
+            listener(frame)
+
+    def _log_only(self, message_id, body):
+        logging.info('%s %s', self.name(message_id), _hex(body))
+
+    def _ack(self, message_id, body):
+        self.reply(message_id)
+
+    # Serial ##################################################################
+
+    def _serial_data(self, message_id, body):
+        self.lz.raw(body)
+        for listener in self.serial_listeners:
+            listener(bytes(body))
+
+    def _serial_data_lz(self, message_id, body):
+        try:
+            data = self.lz.decode(body)
+        except ValueError as e:
+            logging.warning('bad compressed serial data: %s', e)
+            self.lz.synced = False
+            return
+        if data is None:
+            logging.info('compressed serial data lost, waiting for a reset')
+            return
+        for listener in self.serial_listeners:
+            listener(data)
+
+    def send_serial(self, data):
+        """Sends data as Virtual Serial, split into full messages."""
+        data = bytearray(data)
+        for start in range(0, len(data), MAX_BODY_LENGTH):
+            self.send('MSG_ID_SERIAL_DATA', data[start:start + MAX_BODY_LENGTH])
+
+    # Radio ###################################################################
+
+    def _get_config(self, message_id, body):
+        self.reply(message_id, self.state.radio_config)
+
+    def _set_config(self, message_id, body):
+        size = len(self.state.radio_config)
+        if len(body) >= size:
+            self.state.radio_config = bytes(body[:size])
+        if message_id == self.ids['MSG_ID_BT_SET_CONFIG']:
+            self.state.radio_config_saves += 1
+        logging.info('radio config %s', _hex(body))
+
+    def _states(self):
+        return bytearray([self.state.conn_state, self.state.adv_state])
+
+    def _get_states(self, message_id, body):
+        self.reply(message_id, self._states())
+
+    def _states_notify_enable(self, message_id, body):
+        self._states_notify = bool(body and body[0])
+        self.reply(message_id, self._states())
+
+    def set_connected(self, connected):
+        """Emulates a central connecting, or disconnecting."""
+        self.state.conn_state = 1 if connected else 0
+        self.state.adv_state = 0 if connected else int(self.state.advertising)
+        if self._states_notify:
+            self.send('MSG_ID_BT_STATES_CHANGED', self._states())
+
+    def _disconnect(self, message_id, body):
+        self.set_connected(False)
+
+    def _adv_onoff(self, message_id, body):
+        self.state.advertising = bool(body and body[0])
+        if not self.state.conn_state:
+            self.state.adv_state = int(self.state.advertising)
+
+    def _set_pin(self, message_id, body):
+        if len(body) >= 4:
+            self.state.pairing_pin = struct.unpack('<I', bytes(body[:4]))[0]
+
+    def _set_scratch(self, message_id, body):
+        if body and 1 <= body[0] <= 5:
+            self.state.scratch[body[0]] = bytes(body[1:21])
+
+    def _get_scratch(self, message_id, body):
+        bank = body[0] if body else 1
+        self.reply(message_id,
+                   bytearray([bank]) + bytearray(self.state.scratch.get(bank, b'')))
+
+    def _set_scratch_multi(self, message_id, body):
+        i = 0
+        while i + 2 <= len(body):
+            bank, length = body[i], body[i + 1]
+            if 1 <= bank <= 5:
+                self.state.scratch[bank] = bytes(body[i + 2:i + 2 + length])
+            i += 2 + length
+        self.reply(message_id)
+
+    def _get_scratch_multi(self, message_id, body):
+        mask = body[0] if body else 0
+        reply = bytearray()
+        for bank in range(1, 6):
+            if mask & (1 << (bank - 1)):
+                data = bytearray(self.state.scratch[bank])
+                reply += bytearray([bank, len(data)]) + data
+        self.reply(message_id, reply[:MAX_BODY_LENGTH])
+
+    def _scratch_notify_enable(self, message_id, body):
+        self._scratch_notify = body[0] if body else 0
+        self.reply(message_id)
+
+    def client_write_scratch(self, bank, data):
+        """Emulates a BLE client writing a scratch characteristic."""
+        self.state.scratch[bank] = bytes(bytearray(data)[:20])
+        if self._scratch_notify & (1 << (bank - 1)):
+            self.send('MSG_ID_BT_SCRATCH_WRITTEN',
+                      bytearray([bank]) + bytearray(self.state.scratch[bank]))
+
+    def _gatt_read(self, message_id, body):
+        self.reply(message_id, bytearray([self.state.gatt]))
+
+    def _gatt_write(self, message_id, body):
+        if body:
+            self.state.gatt = body[0]
+
+    # LED #####################################################################
+
+    def _led_write(self, message_id, body):
+        self._led_animation = None
+        if len(body) >= 2 and body[0] < 3:
+            self.state.led[body[0]] = body[1]
+
+    def _led_write_all(self, message_id, body):
+        self._led_animation = None
+        if len(body) >= 3:
+            self.state.led = list(body[:3])
+
+    def _led_read_all(self, message_id, body):
+        self.reply(message_id, bytearray(self.state.led))
+
+    @staticmethod
+    def _led_ease(easing, t):
+        if easing == 0:
+            return 1.0
+        if easing == 2:
+            return t * t
+        if easing == 3:
+            return 1 - (1 - t) * (1 - t)
+        if easing == 4:
+            return 2 * t * t if t < 0.5 else 1 - 2 * (1 - t) * (1 - t)
+        return t
+
+    def _led_animate(self, message_id, body):
+        # [repeats][count], then [red][green][blue][easing][duration, 2] each
+        if self.reply_id == 'none' or len(body) < 2 or \
+                len(body) != 2 + 6 * body[1]:
+            return
+        repeats, count = body[0], body[1]
+        frames = [struct.unpack('<BBBBH', bytes(body[2 + 6 * i:8 + 6 * i]))
+                  for i in range(count)]
+        animation = object()
+        self._led_animation = animation if count else None
+        self.reply(message_id)
+        logging.info('LED animation of %d keyframes, %s', count,
+                     'repeating' if repeats == 0 else '%d times' % repeats)
+
+        def run():
+            played = 0
+            while self._led_animation is animation:
+                for red, green, blue, easing, duration in frames:
+                    start = time.time()
+                    start_color = list(self.state.led)
+                    while self._led_animation is animation:
+                        t = min((time.time() - start) * 1000.0 / duration, 1.0) \
+                            if duration else 1.0
+                        e = self._led_ease(easing, t)
+                        self.state.led = [int(a + (b - a) * e) for a, b in
+                                          zip(start_color, (red, green, blue))]
+                        if t >= 1.0:
+                            break
+                        time.sleep(0.02)
+                played += 1
+                if played == repeats:
+                    break
+
+        if count:
+            thread = threading.Thread(target=run)
+            thread.daemon = True
+            thread.start()
+
+    # Accelerometer ###########################################################
+
+    def _accel_reading(self):
+        return struct.pack('<hhhB', self.state.accel[0], self.state.accel[1],
+                           self.state.accel[2], self.state.accel_range)
+
+    def _accel_read(self, message_id, body):
+        self.reply(message_id, self._accel_reading())
+
+    def _accel_get_range(self, message_id, body):
+        self.reply(message_id, bytearray([self.state.accel_range]))
+
+    def _accel_set_range(self, message_id, body):
+        if body:
+            self.state.accel_range = body[0]
+
+    def _accel_read_reg(self, message_id, body):
+        if len(body) < 2:
+            return
+        reg, length = body[0] & 0x3F, body[1]
+        self.reply(message_id, self.state.accel_regs[reg:reg + length])
+
+    def _accel_write_reg(self, message_id, body):
+        if len(body) >= 2:
+            self.state.accel_regs[body[0] & 0x3F] = body[1]
+
+    def _accel_transaction(self, message_id, body):
+        reply = bytearray()
+        for i in range(0, len(body) - 1, 2):
+            reg, arg = body[i], body[i + 1]
+            if reg & 0x80:
+                reg &= 0x3F
+                reply += self.state.accel_regs[reg:reg + arg]
+            else:
+                self.state.accel_regs[reg & 0x3F] = arg
+        self.reply(message_id, reply)
+
+    def _accel_event_enable(self, message_id, body):
+        self._accel_events = body[0] if body else 0
+        self.reply(message_id)
+
+    def accel_event(self, status):
+        """Emulates the BMA250 raising interrupts, REG_INT_STATUS_X09 bits."""
+        if self._accel_events & status:
+            self.send('MSG_ID_CC_ACCEL_EVENT',
+                      bytearray([self._accel_events & status]))
+
+    def _accel_stream_request(self, message_id, body):
+        if len(body) < 3:
+            return
+        rate = body[0] | (body[1] << 8)
+        batch = body[2] or (MAX_BODY_LENGTH - 1) // 6
+        batch = min(batch, (MAX_BODY_LENGTH - 1) // 6)
+        self._accel_stream = None
+        if rate == 0:
+            return
+        stream = object()
+        self._accel_stream = stream
+
+        def run():
+            period = 1.0 / rate
+            next_sample = time.time()
+            samples = bytearray()
+            while self._accel_stream is stream:
+                next_sample += period
+                samples += struct.pack('<hhh', *self.state.accel)
+                if len(samples) // 6 == batch:
+                    self.send('MSG_ID_CC_ACCEL_STREAM_DATA',
+                              bytearray([self.state.accel_range]) + samples)
+                    samples = bytearray()
+                time.sleep(max(0, next_sample - time.time()))
+
+        thread = threading.Thread(target=run)
+        thread.daemon = True
+        thread.start()
+
+    # Other sensors ###########################################################
+
+    def _temp_read(self, message_id, body):
+        self.reply(message_id, struct.pack('<b', self.state.temperature))
+
+    def _batt_read(self, message_id, body):
+        self.reply(message_id, bytearray([self.state.battery]))
+
+    # Sleep ###################################################################
+
+    def _ar_sleep(self, message_id, body):
+        if len(body) < 4:
+            return
+        duration = struct.unpack('<I', bytes(body[:4]))[0]
+        slept_from = time.time()
+        logging.info('ATmega sleeping for %d ms', duration)
+        if self._sleep_timer is not None:
+            self._sleep_timer.cancel()
+        self._sleep_timer = threading.Timer(
+            duration / 1000.0, self.end_sleep, (1, slept_from))
+        self._sleep_timer.daemon = True
+        self._sleep_timer.start()
+
+    def end_sleep(self, reason=1, slept_from=None):
+        """
+        Wakes the ATmega from Bean.sleep() with one of Bean.h's WakeReasons
+        and tells it how long it slept in MSG_ID_AR_WAKE_INFO.
+        """
+        if self._sleep_timer is not None:
+            self._sleep_timer.cancel()
+            self._sleep_timer = None
+        slept = 0 if slept_from is None else int(1000 * (time.time() - slept_from))
+        self.wake_atmega()
+        self.send('MSG_ID_AR_WAKE_INFO', struct.pack('<BI', reason, slept))
+
+    def _wake_on_connect(self, message_id, body):
+        self.state.wake_on_connect = bool(body and body[0])
+
+    # Observer ################################################################
+
+    def _observer_start(self, message_id, body):
+        observer = object()
+        self._observer = observer
+
+        def run():
+            count = 0
+            while self._observer is observer:
+                # OBSERVER_INFO_MESSAGE_T: event type, address type, address,
+                # rssi, data length, data
+                data = bytearray([2, 1, 6, 5, 0xFF, 0x4C, 0x00, count & 0xFF])
+                message = bytearray([0, 0, 0x10, 0x20, 0x30, 0x40, 0x50,
+                                     count % 4]) + struct.pack('<b', -60)
+                message += bytearray([len(data)]) + data
+                self.send('MSG_ID_OBSERVER_READ', message)
+                count += 1
+                time.sleep(0.1)
+
+        thread = threading.Thread(target=run)
+        thread.daemon = True
+        thread.start()
+
+    def _observer_stop(self, message_id, body):
+        self._observer = None
+
+    # ANCS ####################################################################
+
+    def _ancs_get_noti(self, message_id, body):
+        if len(body) < 8 or body[0] != 0:
+            logging.info('ANCS action %s', _hex(body))
+            return
+        # [command][notification uid, 4][attribute id][length, 2], then the
+        # attribute split over as many messages as it takes
+        max_length = body[6] | (body[7] << 8)
+        if body[5] == ANCS_APP_ID:
+            attribute = bytearray(self.state.ancs_app_id[:max_length])
+        else:
+            attribute = bytearray(self.state.ancs_attribute[:max_length])
+        header = bytearray(body[:6]) + struct.pack('<H', len(attribute))
+        data = header + attribute
+        for start in range(0, len(data), MAX_BODY_LENGTH):
+            self.send(message_id, data[start:start + MAX_BODY_LENGTH],
+                      self.reply_delay)
+
+    def _ancs_set_filter(self, message_id, body):
+        # [categories, 2][events][flagsSet][flagsClear][appId length][appId]
+        if len(body) < 6 or len(body) != 6 + body[5]:
+            return
+        categories, events, flags_set, flags_clear = struct.unpack(
+            '<HBBB', bytes(body[:5]))
+        self._ancs_filter = (categories, events, flags_set, flags_clear,
+                             bytes(body[6:]))
+        self.reply(message_id)
+
+    def _ancs_accept(self, event, flags, category):
+        if self._ancs_filter is None:
+            return True
+        categories, events, flags_set, flags_clear, app_id = self._ancs_filter
+        if not events & (1 << event) or flags & flags_set != flags_set or \
+                flags & flags_clear:
+            return False
+        return bool(categories & (1 << category)) or \
+            (len(app_id) > 0 and app_id == self.state.ancs_app_id)
+
+    def ancs_notify(self, event=0, category=1, uid=1, flags=0):
+        """Emulates an ANCS notification source event."""
+        if not self._ancs_accept(event, flags, category):
+            logging.info('ANCS notification %d filtered out', uid)
+            return
+        self.send('MSG_ID_ANCS_READ', struct.pack('<BBBBI', event, flags,
+                                                  category, 1, uid))
+
+    # Debug ###################################################################
+
+    def _loopback(self, message_id, body):
+        self.reply(message_id, body)
+
+    # RX acknowledgements #####################################################
+
+    def _set_rx_acks(self, message_id, body):
+        if self.reply_id == 'none' or len(body) != 1:
+            return
+        # the answer goes out the old way, and the frames after it the new
+        self.send(message_id, body, self.reply_delay)
+        with self.lock:
+            self.rx_acks = body[0] != 0
+            self._sequence = 0
+            self._unacked.clear()
+        logging.info('RX acknowledgements %s',
+                     'on' if self.rx_acks else 'off')
+
+    def _rx_ack(self, message_id, body):
+        """An ACK or NAK: every frame before body[0] got through."""
+        if len(body) != 1:
+            return
+        expected = body[0]
+        now = time.time()
+        with self.lock:
+            for sequence in list(self._unacked):
+                if (sequence - expected) & 0x80:
+                    del self._unacked[sequence]
+            if message_id != self.ids['MSG_ID_AR_RX_NAK']:
+                return
+            self.naks += 1
+            # frames after the one asked for were dropped as out of order
+            for frame in self._unacked.values():
+                self._resend(frame, now)
+
+    def _resend(self, frame, now):
+        # several NAKs for one loss each end up here
+        if frame.sent is None or \
+                (frame.resent is not None and
+                 now - frame.resent < RX_ACK_HOLDOFF):
+            return
+        frame.sent = None
+        frame.resent = now
+        self.resent += 1
+        self._tx.put((now, frame))
+
+    def _resender(self):
+        while self._running:
+            time.sleep(0.01)
+            now = time.time()
+            with self.lock:
+                for frame in self._unacked.values():
+                    if frame.sent is not None and \
+                            now - frame.sent >= RX_ACK_TIMEOUT:
+                        self._resend(frame, now)
+
+    # Baud rate ###############################################################
+
+    def _set_baud(self, message_id, body):
+        baud = struct.unpack('<I', bytes(body[:4]))[0] if len(body) >= 4 else 0
+        accepted = baud if baud in self.baud_rates + (BAUD_RATE,) else 0
+        self.reply(message_id, struct.pack('<I', accepted))
+        if accepted and self.reply_id != 'none':
+            self._tx.put((time.time() + self.reply_delay,
+                          lambda: self._switch_baud(accepted, confirm=True)))
+
+    def _switch_baud(self, baud, confirm=False):
+        """Changes the link's rate once the reply has gone out."""
+        flush = getattr(self.link, 'flush', None)
+        if flush is not None:
+            flush()
+        if hasattr(self.link, 'baudrate'):
+            self.link.baudrate = baud
+        logging.info('baud rate %d -> %d', self.baud, baud)
+        self.baud = baud
+        if self._baud_timer is not None:
+            self._baud_timer.cancel()
+            self._baud_timer = None
+        if confirm and baud != BAUD_RATE:
+            self._baud_timer = threading.Timer(BAUD_CONFIRM_TIME,
+                                               self._baud_unconfirmed)
+            self._baud_timer.daemon = True
+            self._baud_timer.start()
+
+    def _baud_unconfirmed(self):
+        logging.warning('no good frame at %d baud, back to %d', self.baud,
+                        BAUD_RATE)
+        self._baud_timer = None
+        self._tx.put((time.time(), lambda: self._switch_baud(BAUD_RATE)))
+
+    def _debug_counter(self, message_id, body):
+        self.state.debug_counter = (self.state.debug_counter + 1) & 0xFFFF
+        self.reply(message_id, struct.pack('<H', self.state.debug_counter))
+
+    # Report ##################################################################
+
+    def report(self, out=sys.stdout):
+        elapsed = max(time.time() - self.started, 1e-6)
+        print('%.1f s at %d baud, %d bytes in, %d frames, %d CRC errors, %d '
+              'framing resets' % (elapsed, self.baud, self.parser.bytes,
+                                  self.parser.frames, self.parser.crc_errors,
+                                  self.parser.framing_resets),
+              file=out)
+        if self.rx_acks or self.corrupt_every:
+            print('sent %d frames, %d corrupted, %d NAKs, %d sent again' %
+                  (self.frames_sent, self.corrupted, self.naks, self.resent),
+                  file=out)
+        if self.drop_spacing or self.cc_line:
+            print('dropped as too close: %d, before the CC woke: %d' %
+                  (self.spacing_drops, self.wake_drops), file=out)
+        with self.lock:
+            for message_id in sorted(self.received):
+                count = self.received[message_id]
+                print('  %-30s %6d frames %8d body bytes %8.1f/s' %
+                      (self.name(message_id), count,
+                       self.received_bytes[message_id], count / elapsed),
+                      file=out)
+        print('gap between frames: %s' % self.frame_gaps.summary(), file=out)
+        if self.cc_line:
+            print('CC line rise to SOF: %s' % self.wake_waits.summary(),
+                  file=out)
+
+
+def _hex(data):
+    return ' '.join('%02X' % byte for byte in bytearray(data))
+
+
+# Benchmarks ##################################################################
+
+def bench_rx(emulator, seconds):
+    """Counts what the sketch sends as Virtual Serial."""
+    received = [0]
+
+    def count(data):
+        received[0] += len(data)
+
+    emulator.serial_listeners.append(count)
+    start = time.time()
+    time.sleep(seconds)
+    elapsed = time.time() - start
+    frames = emulator.received[emulator.ids['MSG_ID_SERIAL_DATA']] + \
+        emulator.received[emulator.ids['MSG_ID_SERIAL_DATA_LZ']]
+    print('serial data: %d bytes in %.1f s, %.0f bytes/s, %.1f bytes a frame'
+          % (received[0], elapsed, received[0] / elapsed,
+             received[0] / frames if frames else 0))
+    lz = emulator.lz
+    if lz.compressed_bytes:
+        print('compressed: %d bytes decoded from %d, %.2f:1, %d lost' %
+              (lz.decoded_bytes, lz.compressed_bytes,
+               lz.decoded_bytes / lz.compressed_bytes, lz.lost))
+
+
+def bench_tx(emulator, seconds, size):
+    """
+    Sends Virtual Serial frames of size bytes back to back for seconds.  The
+    bytes are below 0x7D, so none of them is escaped.
+    """
+    size = max(1, min(size, MAX_BODY_LENGTH))
+    emulator.serial_listeners.append(
+        lambda data: (sys.stdout.write(data.decode('latin-1')),
+                      sys.stdout.flush()))
+    body = bytes(bytearray(0x20 + i % 0x40 for i in range(size)))
+    frames = 0
+    start = time.time()
+    while time.time() - start < seconds:
+        # keep only a couple of frames waiting in the writer
+        if emulator._tx.qsize() > 2 or \
+                emulator.unacked_frames() >= RX_ACK_WINDOW:
+            time.sleep(0.001)
+            continue
+        emulator.send('MSG_ID_SERIAL_DATA', body)
+        frames += 1
+    elapsed = time.time() - start
+    print('tx: %d frames of %d bytes in %.1f s, %.0f bytes/s'
+          % (frames, size, elapsed, frames * size / elapsed))
+
+
+def bench_echo(emulator, count, size, window, timeout):
+    """
+    Sends count frames of size bytes as Virtual Serial, at most window in
+    flight, and times each one's echo from transportBench.ino.  A frame not
+    back within timeout seconds is counted lost.
+    """
+    size = max(4, min(size, MAX_BODY_LENGTH))
+    sent = {}
+    rtt = LatencyStats()
+    pending = bytearray()
+    changed = threading.Condition()
+
+    def on_serial(data):
+        with changed:
+            pending.extend(data)
+            while len(pending) >= size:
+                sequence = struct.unpack('<I', bytes(pending[:4]))[0]
+                del pending[:size]
+                started = sent.pop(sequence, None)
+                if started is not None:
+                    rtt.add(time.time() - started)
+            changed.notify()
+
+    def expire():
+        now = time.time()
+        for sequence, started in list(sent.items()):
+            if now - started > timeout:
+                del sent[sequence]
+                lost[0] += 1
+
+    lost = [0]
+    emulator.serial_listeners.append(on_serial)
+    start = time.time()
+    with changed:
+        for sequence in range(count):
+            while len(sent) >= window:
+                changed.wait(0.05)
+                expire()
+            body = struct.pack('<I', sequence) + bytes(bytearray(
+                (sequence + i) & 0x7F for i in range(size - 4)))
+            sent[sequence] = time.time()
+            emulator.send('MSG_ID_SERIAL_DATA', body)
+        while sent:
+            changed.wait(0.05)
+            expire()
+    elapsed = time.time() - start
+    echoed = len(rtt.samples)
+    print('echo: %d of %d frames of %d bytes back, %d lost, in %.1f s, '
+          '%.0f bytes/s each way' % (echoed, count, size, lost[0], elapsed,
+                                     echoed * size / elapsed))
+    print('round trip: %s' % rtt.summary())
+
+
+# Console #####################################################################
+
+CONSOLE_HELP = """\
+  serial TEXT          send TEXT as Virtual Serial
+  connect / disconnect a central connects or disconnects
+  scratch BANK HEX     a client writes a scratch bank
+  accel X Y Z          set the accelerometer reading
+  accelevent MASK      the BMA250 raises these interrupt status bits
+  ancs [CAT [UID]]     an ANCS notification arrives, by default category 1
+  wake [REASON]        end Bean.sleep(), with a WakeReasons code
+  temp C / batt PCT    set the temperature or battery level
+  led                  show the LED
+  stats                show the transport report
+  quit"""
+
+
+def console(emulator):
+    emulator.serial_listeners.append(
+        lambda data: (sys.stdout.write(data.decode('latin-1')),
+                      sys.stdout.flush()))
+    print(CONSOLE_HELP)
+    while True:
+        try:
+            line = sys.stdin.readline()
+        except KeyboardInterrupt:
+            break
+        if not line:
+            break
+        words = line.split()
+        if not words:
+            continue
+        command, args = words[0], words[1:]
+        try:
+            if command == 'serial':
+                emulator.send_serial(line.split(None, 1)[1].rstrip('\n').encode())
+            elif command in ('connect', 'disconnect'):
+                emulator.set_connected(command == 'connect')
+            elif command == 'scratch':
+                emulator.client_write_scratch(
+                    int(args[0]), bytearray.fromhex(''.join(args[1:])))
+            elif command == 'accel':
+                emulator.state.accel = [int(value) for value in args[:3]]
+            elif command == 'accelevent':
+                emulator.accel_event(int(args[0], 0))
+            elif command == 'ancs':
+                emulator.ancs_notify(
+                    category=int(args[0]) if args else 1,
+                    uid=int(args[1]) if len(args) > 1 else 1)
+            elif command == 'wake':
+                emulator.end_sleep(int(args[0]) if args else 5)
+            elif command == 'temp':
+                emulator.state.temperature = int(args[0])
+            elif command == 'batt':
+                emulator.state.battery = int(args[0])
+            elif command == 'led':
+                print('LED 0x%02X%02X%02X' % tuple(emulator.state.led))
+            elif command == 'stats':
+                emulator.report()
+            elif command == 'quit':
+                break
+            else:
+                print(CONSOLE_HELP)
+        except (IndexError, ValueError) as error:
+            print('bad arguments: %s' % error)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Emulates the CC side of the Bean serial transport.')
+    parser.add_argument('port', help='serial port wired to the ATmega UART')
+    parser.add_argument('--baud', type=int, default=BAUD_RATE)
+    parser.add_argument('--bench', choices=('rx', 'tx', 'echo'))
+    parser.add_argument('--seconds', type=float, default=10.0,
+                        help='how long the rx and tx benchmarks run')
+    parser.add_argument('--count', type=int, default=500,
+                        help='frames the echo benchmark sends')
+    parser.add_argument('--size', type=int, default=MAX_BODY_LENGTH,
+                        help='bytes per echo and tx benchmark frame')
+    parser.add_argument('--window', type=int, default=1,
+                        help='echo benchmark frames in flight')
+    parser.add_argument('--reply-delay-ms', type=float, default=2.0,
+                        help='CC time to answer a request')
+    parser.add_argument('--send-spacing-ms', type=float, default=0.0,
+                        help='least time between frames, each way')
+    parser.add_argument('--drop-close-frames', action='store_true',
+                        help='drop frames from the ATmega that arrive within '
+                             '--send-spacing-ms of the last one')
+    parser.add_argument('--wake-latency-ms', type=float, default=0.0,
+                        help='with --cc-line, drop frames that start sooner '
+                             'than this after the ATmega wakes the CC')
+    parser.add_argument('--reply-id', choices=('response', 'same', 'none'),
+                        default='response')
+    parser.add_argument('--cc-line', choices=('cts', 'dsr', 'cd', 'ri'),
+                        help='modem input wired to the CC interrupt output')
+    parser.add_argument('--wake-line', choices=('rts', 'dtr'),
+                        help='modem output wired to the ATmega INT1 pin')
+    parser.add_argument('--invert-lines', action='store_true')
+    parser.add_argument('--cc-baud-rates', default=','.join(
+                            str(rate) for rate in FAST_BAUD_RATES),
+                        help='rates Serial.negotiateBaud() may switch to, '
+                             'comma separated; empty for none')
+    parser.add_argument('--corrupt-every', type=int, default=0,
+                        help='corrupt one in this many frames sent to the '
+                             'ATmega')
+    parser.add_argument('-v', '--verbose', action='count', default=0)
+    args = parser.parse_args()
+
+    logging.basicConfig(stream=sys.stderr,
+                        level=(logging.WARNING, logging.INFO,
+                               logging.DEBUG)[min(args.verbose, 2)])
+
+    import serial  # requires pip install pyserial
+    link = serial.serial_for_url(args.port, args.baud, timeout=0.01)
+    link.reset_input_buffer()
+
+    emulator = CCEmulator(link, reply_delay=args.reply_delay_ms / 1000.0,
+                          send_spacing=args.send_spacing_ms / 1000.0,
+                          wake_latency=args.wake_latency_ms / 1000.0,
+                          drop_spacing=args.drop_close_frames,
+                          reply_id=args.reply_id, cc_line=args.cc_line,
+                          wake_line=args.wake_line,
+                          invert_lines=args.invert_lines,
+                          baud_rates=[int(rate) for rate in
+                                      args.cc_baud_rates.split(',') if rate],
+                          corrupt_every=args.corrupt_every)
+    if args.wake_line:
+        setattr(link, args.wake_line, args.invert_lines)
+    emulator.start()
+    try:
+        if args.bench == 'rx':
+            bench_rx(emulator, args.seconds)
+        elif args.bench == 'tx':
+            bench_tx(emulator, args.seconds, args.size)
+        elif args.bench == 'echo':
+            bench_echo(emulator, args.count, args.size, max(1, args.window),
+                       timeout=1.0)
+        else:
+            console(emulator)
+    finally:
+        emulator.stop()
+        emulator.report()
+        link.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -87,7 +87,7 @@ serial_chooser = StringVar()
 
 def choose_serial(port):
     transport.close_port()
-    transport.open_port(port, 57600)
+    transport.open_port(port, BeanSerialTransport.BeanCCEmulator.BAUD_RATE)
 
 serial_chooser_menu = OptionMenu(serial_chooser_frame, serial_chooser,
     *(transport.get_available_serial_ports()),
@@ -3,7 +3,7 @@ import serial # requires pip install
 from serial.tools import list_ports 
 import logging
 import sys
-from enum import Enum  # requires pip install
+import BeanCCEmulator
 
 
 class Bean_Serial_Transport:
@@ -38,15 +38,6 @@ class Bean_Serial_Transport:
     MSG_ID_DB_LOOPBACK        = 0xFE, 0x00
     MSG_ID_DB_COUNTER         = 0xFE, 0x01
 
-    ParserStates = Enum("WAITING_FOR_SOF",
-                        "GETTING_LENGTH",
-                        "GETTING_MAJOR_TYPE",
-                        "GETTING_MINOR_TYPE",
-                        "GETTING_MESSAGE_BODY",
-                        "GETTING_EOF")
-
-
-
     def __init__(self):
         self.serial_port = None
         self.reset_parser()
@@ -54,77 +45,20 @@ class Bean_Serial_Transport:
 
 
     def reset_parser(self):
-        self.parser_state = self.ParserStates.WAITING_FOR_SOF
-        self.parser_length = 0
-        self.parser_message_buffer = []
-        self.parser_message_type = []
-        self.parser_escaping = False
+        self.frame_parser = BeanCCEmulator.FrameParser()
 
 
-    def parser(self):        
+    def parser(self):
         if(self.serial_port == None or self.serial_port.isOpen() == False):
             return
 
-        while(self.serial_port.inWaiting() > 0):
-            byte = map(ord, self.serial_port.read(1))[0]
-            #logging.error(byte)
-
-
-            if(self.parser_escaping == False and byte == self.ESC_BYTE):
-                # should anything else have escaping?
-                if(self.parser_state == self.ParserStates.GETTING_MESSAGE_BODY):
-                    self.parser_escaping = True
-                    continue
-
-            # reset the parser and handle the new message
-            if(self.parser_escaping == False and byte == self.SOF_BYTE):
-                self.reset_parser()
-
-            if(self.parser_escaping == True):
-                self.parser_escaping = False
-                byte = byte | 0x20
-
-            if(self.parser_state == self.ParserStates.WAITING_FOR_SOF):
-                if(byte == self.SOF_BYTE):
-                    self.parser_state = self.ParserStates.GETTING_LENGTH
-#                    logging.debug("SOF --> LEN")
-            
-            elif(self.parser_state == self.ParserStates.GETTING_LENGTH):
-                self.parser_length = byte
-                self.parser_state = self.ParserStates.GETTING_MAJOR_TYPE
-#                logging.debug("LEN --> MAJ")
-
-            elif(self.parser_state == self.ParserStates.GETTING_MAJOR_TYPE):
-                self.parser_message_type = []
-                self.parser_length -= 1
-                self.parser_message_type.append(byte)
-                self.parser_state = self.ParserStates.GETTING_MINOR_TYPE
-#                logging.debug("MAJ --> MIN")
-
-            elif(self.parser_state == self.ParserStates.GETTING_MINOR_TYPE):
-                self.parser_length -= 1
-                self.parser_message_type.append(byte)
-
-                if(self.parser_length > 0):
-                    self.parser_state = self.ParserStates.GETTING_MESSAGE_BODY
-                else:
-                    self.parser_state = self.ParserStates.GETTING_EOF
-#                logging.debug("MIN --> BODY")
-
-            elif(self.parser_state == self.ParserStates.GETTING_MESSAGE_BODY):
-                self.parser_message_buffer.append(byte)
-                self.parser_length -= 1
-                if(self.parser_length == 0):
-                    self.parser_state = self.ParserStates.GETTING_EOF
-#                    logging.debug("BODY --> EOF")
-
-            elif(self.parser_state == self.ParserStates.GETTING_EOF):
-                if(byte != self.EOF_BYTE):
-                    logging.error("Expected EOF but got: %d" % byte)                   
-                    continue
-                
-                self.handle_message(tuple(self.parser_message_type), self.parser_message_buffer)
-                self.reset_parser()
+        # whole frames only, and only those whose CRC checks out
+        waiting = self.serial_port.inWaiting()
+        if(waiting == 0):
+            return
+        for frame in self.frame_parser.feed(self.serial_port.read(waiting)):
+            message_type = (frame.message_id >> 8, frame.message_id & 0xFF)
+            self.handle_message(message_type, list(bytearray(frame.body)))
 
 
 
@@ -187,18 +121,14 @@ class Bean_Serial_Transport:
         return escaped
 
     def build_message(self, message_type, buffer):
-        message = [self.SOF_BYTE]
-        message_body = []
-        message_body.extend(message_type)
-        message_body.extend(buffer)
-        message.append(len(message_body))
-        message.extend(self.escape_buffer(message_body))
-        message.append(self.EOF_BYTE)
-        return message
+        message_id = (message_type[0] << 8) | message_type[1]
+        if(isinstance(buffer, str)):
+            buffer = map(ord, buffer)
+        return list(BeanCCEmulator.build_frame(message_id, bytearray(buffer)))
 
     def send_message(self, message_type, buffer):
         message = self.build_message(message_type, buffer)
-        self.serial_port.write(message)
+        self.serial_port.write(bytearray(message))
 
     def check_tuple(self, message):
         if(not isinstance(message, tuple)):
@@ -245,7 +175,7 @@ if __name__ == '__main__':
 
     transport = Bean_Serial_Transport()
     port = transport.get_available_serial_ports()[0]
-    transport.open_port(port, 57600)
+    transport.open_port(port, BeanCCEmulator.BAUD_RATE)
     transport.log_port()
     transport.close_port()
 
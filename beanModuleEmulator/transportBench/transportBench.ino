@@ -0,0 +1,15 @@
+// Echoes every Virtual Serial message straight back, for the echo benchmark
+// of BeanCCEmulator.py.  Each message goes back whole as one message, so the
+// round trip times are the transport's and not the write combining timeout's.
+
+void setup() {
+  Serial.setWriteCombining(false);
+}
+
+void loop() {
+  uint8_t buffer[64];
+  size_t length = Serial.readFrame(buffer, sizeof(buffer));
+  if (length > 0) {
+    Serial.write(buffer, length);
+  }
+}
@@ -0,0 +1,14 @@
+static const LedKeyframe breathe[] PROGMEM = {
+  {0, 0, 255, LED_EASE_IN_OUT, 1500},
+  {0, 0, 16, LED_EASE_IN_OUT, 1500},
+};
+
+void setup() {
+  Bean.setLed(0, 0, 16);
+  Bean.playLedAnimation(breathe, 2, 0, true);
+}
+
+void loop() {
+  // wakes in time for the next frame if the core plays the animation
+  Bean.sleep(BeanScheduler.nextTimeout());
+}
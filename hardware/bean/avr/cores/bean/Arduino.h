@@ -104,13 +104,34 @@ void analogWrite(uint8_t, int);
 
 unsigned long millis(void);
 unsigned long micros(void);
+// The low 16 bits of micros(), cheaper to read; wraps every 65.5 ms.
+unsigned int micros16(void);
+// Moves millis() and micros() on by ms, for time the CPU spent powered down
+// with Timer0 stopped.
+void advanceMillis(unsigned long ms);
 void delay(unsigned long);
 void delayMicroseconds(unsigned int us);
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
 
 void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val);
 uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder);
-
+// shiftOut() and shiftIn() of n bytes, the pins looked up once.
+void shiftOutBuffer(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, const uint8_t *buf, size_t n);
+void shiftInBuffer(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t *buf, size_t n);
+// The same through the SPI hardware, data on MOSI (or MISO) and the clock on
+// SCK, at F_CPU / 4: 2 MHz on the Bean and 4 MHz on the Bean+, several times
+// the bit-banged rate, which long or slow chains may not keep up with.  The
+// SPI takes over the other data pin too; while that pin is an output, or the
+// SPI is busy, the bytes are bit-banged on the same pins instead.
+void shiftOutSPI(uint8_t bitOrder, const uint8_t *buf, size_t n);
+void shiftInSPI(uint8_t bitOrder, uint8_t *buf, size_t n);
+
+// For the lowest latency a sketch can define ISR(INT0_vect) or
+// ISR(INT1_vect) itself, which replaces the core's dispatcher for that
+// interrupt at link time, and ISR(INT1_vect, ISR_NAKED) to save only what the
+// handler uses.  attachInterrupt(n, NULL, mode) still sets the trigger.  Bean
+// sleep() wakes on INT1 and restores its trigger afterwards; a handler of the
+// sketch's own on INT1 runs once for the wake.
 void attachInterrupt(uint8_t, void (*)(void), int mode);
 void detachInterrupt(uint8_t);
 
@@ -214,4 +235,111 @@ long map(long, long, long, long, long);
 
 #include "pins_arduino.h"
 
+// digitalWrite(), digitalRead() and pinMode() for a pin number known at
+// compile time, which become single sbi, cbi or sbic instructions instead of
+// table lookups.  Any other pin, or a variant without digitalPinToPortFast(),
+// gets the normal call.  Unlike digitalWrite() and digitalRead() these don't
+// turn off PWM on the pin, so after analogWrite() call one of those first.
+#ifdef digitalPinToPortFast
+#define digitalPinIsFast(P) \
+	(__builtin_constant_p(P) && digitalPinToPortFast(P) != 0)
+#define digitalPinToRegFast(P, B, C, D) \
+	(digitalPinToPortFast(P) == 'B' ? &B : \
+	 digitalPinToPortFast(P) == 'C' ? &C : &D)
+
+#define digitalWriteFast(P, V) do { \
+	if (digitalPinIsFast(P)) { \
+		if (V) *digitalPinToRegFast(P, PORTB, PORTC, PORTD) |= _BV(digitalPinToBitFast(P)); \
+		else *digitalPinToRegFast(P, PORTB, PORTC, PORTD) &= ~_BV(digitalPinToBitFast(P)); \
+	} else { \
+		digitalWrite(P, V); \
+	} \
+} while (0)
+
+#define digitalReadFast(P) (digitalPinIsFast(P) ? \
+	((*digitalPinToRegFast(P, PINB, PINC, PIND) & _BV(digitalPinToBitFast(P))) ? HIGH : LOW) : \
+	digitalRead(P))
+
+#define pinModeFast(P, M) do { \
+	if (digitalPinIsFast(P)) { \
+		if ((M) == OUTPUT) { \
+			*digitalPinToRegFast(P, DDRB, DDRC, DDRD) |= _BV(digitalPinToBitFast(P)); \
+		} else { \
+			*digitalPinToRegFast(P, DDRB, DDRC, DDRD) &= ~_BV(digitalPinToBitFast(P)); \
+			digitalWriteFast(P, (M) == INPUT_PULLUP); \
+		} \
+	} else { \
+		pinMode(P, M); \
+	} \
+} while (0)
+
+// shiftOut() of one byte on pins known at compile time, as sbi and cbi.
+#define shiftOutFast(D, C, O, V) do { \
+	if (digitalPinIsFast(D) && digitalPinIsFast(C)) { \
+		uint8_t _value = (V); \
+		for (uint8_t _i = 0; _i < 8; _i++) { \
+			if ((O) == LSBFIRST) { \
+				digitalWriteFast(D, _value & 1); \
+				_value >>= 1; \
+			} else { \
+				digitalWriteFast(D, _value & 0x80); \
+				_value <<= 1; \
+			} \
+			digitalWriteFast(C, HIGH); \
+			digitalWriteFast(C, LOW); \
+		} \
+	} else { \
+		shiftOut(D, C, O, V); \
+	} \
+} while (0)
+#else
+#define digitalPinIsFast(P) 0
+#define digitalWriteFast(P, V) digitalWrite(P, V)
+#define digitalReadFast(P) digitalRead(P)
+#define pinModeFast(P, M) pinMode(P, M)
+#define shiftOutFast(D, C, O, V) shiftOut(D, C, O, V)
+#endif
+
+#ifdef __cplusplus
+// shiftOut() and shiftIn() of n bytes.  Inlined, pins known at compile time
+// are clocked with sbi and cbi, which interrupts can't split; other pins go
+// through shiftOutBuffer() and shiftInBuffer().
+inline void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, const uint8_t *buf, size_t n) __attribute__((always_inline));
+inline void shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t *buf, size_t n) __attribute__((always_inline));
+
+inline void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, const uint8_t *buf, size_t n)
+{
+	if (digitalPinIsFast(dataPin) && digitalPinIsFast(clockPin)) {
+		// and turn PWM off the pins, as shiftOutBuffer() would
+		digitalWrite(dataPin, LOW);
+		digitalWrite(clockPin, LOW);
+		while (n--)
+			shiftOutFast(dataPin, clockPin, bitOrder, *buf++);
+	} else {
+		shiftOutBuffer(dataPin, clockPin, bitOrder, buf, n);
+	}
+}
+
+inline void shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t *buf, size_t n)
+{
+	if (digitalPinIsFast(dataPin) && digitalPinIsFast(clockPin)) {
+		digitalWrite(clockPin, LOW);
+		while (n--) {
+			uint8_t value = 0;
+			for (uint8_t i = 0; i < 8; i++) {
+				digitalWriteFast(clockPin, HIGH);
+				if (bitOrder == LSBFIRST)
+					value = (value >> 1) | (digitalReadFast(dataPin) ? 0x80 : 0);
+				else
+					value = (value << 1) | (digitalReadFast(dataPin) ? 1 : 0);
+				digitalWriteFast(clockPin, LOW);
+			}
+			*buf++ = value;
+		}
+	} else {
+		shiftInBuffer(dataPin, clockPin, bitOrder, buf, n);
+	}
+}
+#endif
+
 #endif
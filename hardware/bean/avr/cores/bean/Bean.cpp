@@ -7,6 +7,11 @@
 #include <avr/wdt.h>
 #include <applicationMessageHeaders/AppMessages.h>
 #include "wiring_private.h"
+#include "BeanCrc32.h"
+
+extern "C" {
+#include "avr-libc/stdlib_private.h"
+}
 
 #ifndef sleep_bod_disable()  // not included in Arduino AVR toolset
 #define sleep_bod_disable()                         \
@@ -34,17 +39,78 @@
 
 BeanClass Bean;
 
-static void wakeUp(void) {
-  // Do nothing.
-  // This function is called as an interrupt purely to wake
-  // us up.
-  return;
-}
-
 #define MAX_SLEEP_POLL (30)
-#define MAX_DELAY (30000)
+#define MAX_SLEEP_BACKOFF (1000)
 #define MIN_SLEEP_TIME (10)
 
+// How long to wait after waking for the CC's MSG_ID_AR_WAKE_INFO.  Once a
+// CC has woken us without sending one BEAN_CC_PROBE_ATTEMPTS times in a row,
+// we stop waiting for it.
+#ifndef BEAN_WAKE_INFO_WAIT
+#define BEAN_WAKE_INFO_WAIT (10)
+#endif
+
+static BeanCcProbe wakeInfoProbe;
+
+// Set by BeanAdc.begin(), see BeanAdc.h.
+void (*bean_adc_resume_hook)(void) = NULL;
+
+// Waits in idle mode, which keeps the timers and UART running.
+static void idleDelay(uint32_t duration_ms) {
+  unsigned long start = millis();
+  while (millis() - start < duration_ms) {
+    bean_idle_sleep();
+  }
+}
+
+// The custom advertisement being built, and a CRC32 of the last one sent so
+// that sending the same bytes again is skipped.
+#define MAX_ADVERTISEMENT_SIZE (31)
+
+static uint8_t advertisement[MAX_ADVERTISEMENT_SIZE];
+static uint8_t advertisementLength = 0;
+static uint32_t advertisementSent;
+static bool advertisementSentKnown = false;
+
+// The GATT services as last read or written.  They are trusted until
+// restartBluetooth(), so the profiles' isEnabled() costs no round trip and
+// enable() or disable() at most one write.
+static ADV_SWITCH_ENABLED_T servicesCache;
+static bool servicesKnown = false;
+
+// Connection and advertising states are pushed by the CC when its firmware
+// supports MSG_ID_BT_STATES_NOTIFY, and then read for free.  Otherwise each
+// getter asks the CC, and while connection callbacks are attached
+// pollEvents() asks every BEAN_CONNECTION_POLL_INTERVAL ms, and the push is
+// asked for again until the CC has missed BEAN_CC_PROBE_ATTEMPTS in a row.
+#ifndef BEAN_CONNECTION_POLL_INTERVAL
+#define BEAN_CONNECTION_POLL_INTERVAL (250)
+#endif
+
+static enum {
+  STATES_PUSH_OFF,
+  STATES_PUSH_ON
+} statesPush = STATES_PUSH_OFF;
+static BeanCcProbe statesPushProbe;
+
+static ConnectionCallback connectCallback = NULL;
+static ConnectionCallback disconnectCallback = NULL;
+static bool polledConnected = false;
+static unsigned long connectionLastPoll;
+
+static uint32_t uptimeLast = 0;
+static uint32_t uptimeWraps = 0;
+
+// Counts millis() wrapping.  Must run at least every 49 days, so
+// pollEvents() calls it after every loop().
+static void uptimeUpdate(void) {
+  uint32_t now = millis();
+  if (now < uptimeLast) {
+    uptimeWraps++;
+  }
+  uptimeLast = now;
+}
+
 void BeanClass::keepAwake(bool enable) {
   if (enable) {
     Serial.BTConfigUartSleep(UART_SLEEP_NEVER);
@@ -57,33 +123,141 @@ bool BeanClass::attemptSleep(uint32_t duration_ms) {
   // ensure that our interrupt line is an input
   DDRD &= ~(_BV(3));
 
-  bool sleepLineSet = false;
-  uint8_t pollCount = 0;
-
   // Send the sleep message to the TI and wait for it to
   // finish sending.
+  Serial.wakeInfoClear();
   Serial.sleep(duration_ms);
   Serial.flush();
 
-  while (sleepLineSet == false && pollCount++ < MAX_SLEEP_POLL) {
-    delay(1);
-    if ((PIND & _BV(3)) > 0) {
-      sleepLineSet = true;
+  unsigned long start = millis();
+  while (millis() - start < MAX_SLEEP_POLL) {
+    if (bit_is_set(PIND, 3)) {
+      return true;
     }
+    bean_idle_sleep();
   }
 
-  return sleepLineSet;
+  return bit_is_set(PIND, 3);
 }
 
 void BeanClass::enableConfigSave(bool enableSave) {
   Serial.BTSetEnableConfigSave(enableSave);
 }
 
+void BeanClass::beginRadioConfig(void) {
+  Serial.radioConfigBegin();
+}
+
+bool BeanClass::commitRadioConfig(void) {
+  return Serial.radioConfigCommit();
+}
+
 void BeanClass::restartBluetooth(void) {
   Serial.BTRestart();
+  advertisementSentKnown = false;
+  servicesKnown = false;
+  if (statesPush == STATES_PUSH_ON) {
+    // the CC forgets it was asked to push; ask again when next needed
+    statesPush = STATES_PUSH_OFF;
+  }
 }
 
-void BeanClass::sleep(uint32_t duration_ms) {
+TransportStats BeanClass::getTransportStats(void) {
+  TransportStats stats;
+  Serial.getTransportStats(&stats);
+  return stats;
+}
+
+void BeanClass::resetTransportStats(void) {
+  Serial.resetTransportStats();
+}
+
+EnergyStats BeanClass::getEnergyStats(void) {
+  EnergyStats stats;
+  bean_energy_read(&stats);
+  return stats;
+}
+
+void BeanClass::resetEnergyStats(void) {
+  bean_energy_reset();
+}
+
+#ifndef BEAN_STACK_PAINT
+#define BEAN_STACK_PAINT 1
+#endif
+
+#define STACK_PAINT (0xC5)
+
+#if BEAN_STACK_PAINT
+// Fills the RAM above the static data with STACK_PAINT before the C runtime
+// is set up, so getMemoryStats() can find how deep the stack has been.  This
+// runs before r1 is zeroed and the stack is set up, hence the assembly.
+extern "C" void stackPaint(void) __attribute__((naked, used, section(".init1")));
+
+void stackPaint(void) {
+  __asm__ __volatile__(
+      "ldi r30, lo8(__heap_start)\n\t"
+      "ldi r31, hi8(__heap_start)\n\t"
+      "ldi r24, %[paint]\n\t"
+      "ldi r25, hi8(%[end])\n\t"
+      "1: st Z+, r24\n\t"
+      "cpi r30, lo8(%[end])\n\t"
+      "cpc r31, r25\n\t"
+      "brne 1b\n\t"
+      :
+      : [paint] "M"(STACK_PAINT), [end] "i"(RAMEND + 1)
+      : "r24", "r25", "r30", "r31", "memory");
+}
+#endif
+
+MemoryStats BeanClass::getMemoryStats(void) {
+  MemoryStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  char *heapStart = __malloc_heap_start;
+  char *heapTop = __brkval ? __brkval : heapStart;
+  char *heapPeak = __malloc_brkval_max > heapTop ? __malloc_brkval_max : heapTop;
+  stats.heapUsed = heapTop - heapStart;
+  stats.heapPeak = heapPeak - heapStart;
+  stats.failedAllocations = __malloc_failures;
+
+  for (struct __freelist *block = __flp; block; block = block->nx) {
+    stats.heapFree += block->sz + sizeof(size_t);
+    stats.freeBlocks++;
+    if (block->sz > stats.largestFreeBlock) {
+      stats.largestFreeBlock = block->sz;
+    }
+  }
+
+  char *stack = STACK_POINTER();
+  SREG = oldSREG;
+
+  stats.stackUsed = (char *)RAMEND - stack;
+  stats.freeMemory = stack > heapTop ? stack - heapTop : 0;
+
+  char *stackPeak = stack;
+#if BEAN_STACK_PAINT
+  // The lowest byte the stack overwrote is where the stack pointer once
+  // pushed to, so it's been one below that.
+  for (char *p = heapPeak; p < stack; p++) {
+    if ((uint8_t)*p != STACK_PAINT) {
+      stackPeak = p - 1;
+      break;
+    }
+  }
+#endif
+  stats.stackPeak = (char *)RAMEND - stackPeak;
+  stats.unusedMemory = stackPeak > heapPeak ? stackPeak - heapPeak : 0;
+
+  return stats;
+}
+
+WakeInfo BeanClass::sleep(uint32_t duration_ms) {
+  WakeInfo info = {WAKE_REASON_NONE, 0};
+
   // ensure that our interrupt line is an input
   DDRD &= ~(_BV(3));
 
@@ -92,32 +266,29 @@ void BeanClass::sleep(uint32_t duration_ms) {
   // There's no point in sleeping if the duration is <= 10ms
   if (duration_ms < MIN_SLEEP_TIME) {
     delay(duration_ms);
-    return;
+    return info;
   }
 
-  // poll and wait for interrupt line to go HIGH (sleep)
-
-  // attempt sleep, if it fails, waited a total of 10ms
-  bool sleeping = false;
-
-  sleeping = attemptSleep(duration_ms);
-
-  if (!sleeping && duration_ms > MAX_DELAY) {
-    // keep trying until the end of delay period
-    while (duration_ms > 0 && false == sleeping) {
-      duration_ms =
-          (duration_ms >= MAX_SLEEP_POLL) ? duration_ms - MAX_SLEEP_POLL : 0;
-      sleeping = attemptSleep(duration_ms);
+  // Ask the CC to put us to sleep; it raises the interrupt line to agree.
+  // If it doesn't, wait a growing while in idle mode and ask again.  The
+  // time spent trying comes out of the duration, as the timers keep running.
+  unsigned long start = millis();
+  uint32_t remaining = duration_ms;
+  uint16_t backoff = MAX_SLEEP_POLL;
+
+  while (!attemptSleep(remaining)) {
+    uint32_t elapsed = millis() - start;
+    if (elapsed >= duration_ms) {
+      return info;
     }
-  } else if (!sleeping && duration_ms > MAX_SLEEP_POLL) {
-    // take out the time we've already delayed
-    delay(duration_ms - MAX_SLEEP_POLL);
-    sleeping = false;
-  }
-
-  // if we never slept, don't set interrupts
-  if (sleeping == false) {
-    return;
+    remaining = duration_ms - elapsed;
+    if (remaining < (uint32_t)backoff + MIN_SLEEP_TIME + MAX_SLEEP_POLL) {
+      idleDelay(remaining);
+      return info;
+    }
+    idleDelay(backoff);
+    remaining -= backoff;
+    backoff = backoff * 2 < MAX_SLEEP_BACKOFF ? backoff * 2 : MAX_SLEEP_BACKOFF;
   }
 
   // set our interrupt pin to input:
@@ -211,31 +382,89 @@ void BeanClass::sleep(uint32_t duration_ms) {
   *             RISING     a rising edge of a level triggers
   *             FALLING    a falling edge of a level triggers
   *
-  * In all but the IDLE sleep modes only LOW can be used.
+  * In all but the IDLE sleep modes only LOW can be used.  The low level is
+  * borrowed from whatever the sketch attached to the interrupt, which gets
+  * its own trigger and function back once awake.
   */
-  attachInterrupt(interruptNum, wakeUp, LOW);
+  bool slept = false;
   set_sleep_mode(SLEEP_MODE_PWR_DOWN);
   cli();
   if (bit_is_set(PIND, 3)) {
+    bean_wake_interrupt_arm(interruptNum);
     sleep_enable();
     sleep_bod_disable();
     sei();
     sleep_cpu();
+    // the low level interrupts again after every instruction until the CC
+    // lets go of the line, so this has to be the first one
+    EIMSK &= ~_BV(interruptNum);
     sleep_disable();
+    bean_wake_interrupt_disarm();
+    slept = true;
   }
   sei();
 
-  detachInterrupt(interruptNum);
+  // the CC drops the line to wake us; anything else was another interrupt
+  bool ccWoke = bit_is_clear(PIND, 3);
 
   if (adc_was_set) {
     // re-enable adc
     ADCSRA |= _BV(ADEN);
+    if (bean_adc_resume_hook) {
+      bean_adc_resume_hook();
+    }
   }
 
   if (ac_was_set) {
     // re-enable analog compareter
     ACSR |= _BV(ACD);
   }
+
+  if (!slept) {
+    // the CC woke us before we got to sleep
+    return info;
+  }
+
+  uint8_t reason;
+  uint32_t sleptMs;
+  bool haveInfo = Serial.wakeInfoTake(&reason, &sleptMs);
+  if (!haveInfo && ccWoke && bean_cc_probe_open(&wakeInfoProbe)) {
+    unsigned long waitStart = millis();
+    while (!haveInfo && millis() - waitStart < BEAN_WAKE_INFO_WAIT) {
+      bean_idle_sleep();
+      haveInfo = Serial.wakeInfoTake(&reason, &sleptMs);
+    }
+    bean_cc_probe_result(&wakeInfoProbe, haveInfo);
+  } else if (haveInfo) {
+    bean_cc_probe_result(&wakeInfoProbe, true);
+  }
+
+  // Timer0 was stopped the whole time
+  if (haveInfo && reason >= WAKE_REASON_TIMER &&
+      reason <= WAKE_REASON_PIN_CHANGE) {
+    info.reason = (WakeReasons)reason;
+    info.sleptMs = sleptMs < remaining ? sleptMs : remaining;
+  } else if (ccWoke) {
+    // without the CC's word, assume it woke us on time
+    info.reason = WAKE_REASON_TIMER;
+    info.sleptMs = remaining;
+  } else {
+    // how long we were down is unknown
+    info.reason = WAKE_REASON_PIN_CHANGE;
+  }
+
+  // millis() may wrap while Bean sleeps, so note where it was first
+  uptimeUpdate();
+  advanceMillis(info.sleptMs);
+  BEAN_ENERGY_SLEPT(info.sleptMs);
+  uptimeUpdate();
+
+  return info;
+}
+
+uint64_t BeanClass::uptimeMs(void) {
+  uptimeUpdate();
+  return ((uint64_t)uptimeWraps << 32) | uptimeLast;
 }
 
 void BeanClass::setAdvertisingInterval(uint16_t interval_ms) {
@@ -250,9 +479,24 @@ void BeanClass::enableAdvertising(bool enable) {
   Serial.BTSetAdvertisingOnOff(enable, 0);
 }
 
+bool BeanClass::readStates(BT_STATES_T *states) {
+  if (statesPush == STATES_PUSH_OFF && bean_cc_probe_open(&statesPushProbe)) {
+    bool answered = Serial.BTStatesNotifyEnable(true) == 0;
+    bean_cc_probe_result(&statesPushProbe, answered);
+    if (answered) {
+      statesPush = STATES_PUSH_ON;
+    }
+  }
+  if (statesPush == STATES_PUSH_ON) {
+    Serial.BTPushedStates(states);
+    return true;
+  }
+  return Serial.BTGetStates(states) == 0;
+}
+
 bool BeanClass::getConnectionState(void) {
   BT_STATES_T btStates;
-  if (Serial.BTGetStates(&btStates) == 0) {
+  if (readStates(&btStates)) {
     return (bool)btStates.conn_state;
   }
   return 0;
@@ -260,33 +504,142 @@ bool BeanClass::getConnectionState(void) {
 
 bool BeanClass::getAdvertisingState(void) {
   BT_STATES_T btStates;
-  if (Serial.BTGetStates(&btStates) == 0) {
+  if (readStates(&btStates)) {
     return (bool)btStates.adv_state;
   }
   return 0;
 }
 
+void BeanClass::onConnect(ConnectionCallback callback) {
+  connectCallback = callback;
+  polledConnected = getConnectionState();
+  connectionLastPoll = millis();
+}
+
+void BeanClass::onDisconnect(ConnectionCallback callback) {
+  disconnectCallback = callback;
+  polledConnected = getConnectionState();
+  connectionLastPoll = millis();
+}
+
+void BeanClass::pollConnectionEvents(void) {
+  uint8_t events = 0;
+  bool connected;
+
+  if (statesPush == STATES_PUSH_ON) {
+    events = Serial.BTStateEventsTake();
+    if (events == 0) {
+      return;
+    }
+    BT_STATES_T btStates;
+    Serial.BTPushedStates(&btStates);
+    connected = btStates.conn_state;
+  } else if ((connectCallback || disconnectCallback) &&
+             millis() - connectionLastPoll >= BEAN_CONNECTION_POLL_INTERVAL) {
+    connectionLastPoll = millis();
+    BT_STATES_T btStates;
+    if (Serial.BTGetStates(&btStates) != 0) {
+      return;
+    }
+    connected = btStates.conn_state;
+    if (connected != polledConnected) {
+      events = connected ? BEAN_BT_CONNECTED : BEAN_BT_DISCONNECTED;
+    }
+    polledConnected = connected;
+  } else {
+    return;
+  }
+
+  // both happened: run them in the order that ends in the current state
+  if ((events & BEAN_BT_DISCONNECTED) && connected && disconnectCallback) {
+    disconnectCallback();
+  }
+  if ((events & BEAN_BT_CONNECTED) && connectCallback) {
+    connectCallback();
+  }
+  if ((events & BEAN_BT_DISCONNECTED) && !connected && disconnectCallback) {
+    disconnectCallback();
+  }
+}
+
+// Values read from the CC, reused until they are maxAge ms old.  Defaults
+// can be set from compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_TEMPERATURE_MAX_AGE
+#define BEAN_TEMPERATURE_MAX_AGE (1000)
+#endif
+#ifndef BEAN_BATTERY_MAX_AGE
+#define BEAN_BATTERY_MAX_AGE (1000)
+#endif
+#ifndef BEAN_LED_MAX_AGE
+#define BEAN_LED_MAX_AGE (250)
+#endif
+
+struct CacheEntry {
+  unsigned long readAt;
+  uint16_t maxAge;
+  bool valid;
+};
+
+static CacheEntry cache[3] = {{0, BEAN_TEMPERATURE_MAX_AGE, false},
+                              {0, BEAN_BATTERY_MAX_AGE, false},
+                              {0, BEAN_LED_MAX_AGE, false}};
+static int8_t cachedTemperature;
+static uint8_t cachedBatteryLevel;
+static LED_SETTING_T cachedLed;
+
+static bool cacheFresh(CachedValues value) {
+  CacheEntry *entry = &cache[value];
+  return entry->valid && millis() - entry->readAt < entry->maxAge;
+}
+
+static void cacheStore(CachedValues value) {
+  cache[value].readAt = millis();
+  cache[value].valid = true;
+}
+
+void BeanClass::setCacheMaxAge(CachedValues value, uint16_t max_age_ms) {
+  if (value <= CACHED_LED) {
+    cache[value].maxAge = max_age_ms;
+  }
+}
+
 int8_t BeanClass::getTemperature(void) {
   int8_t temp = 0;
 
-  Serial.temperatureRead(&temp);
+  if (cacheFresh(CACHED_TEMPERATURE)) {
+    return cachedTemperature;
+  }
+
+  if (Serial.temperatureRead(&temp) == 0) {
+    cachedTemperature = temp;
+    cacheStore(CACHED_TEMPERATURE);
+  }
 
   return temp;
 }
 
-uint8_t BeanClass::getBatteryLevel(void) {
+uint8_t BeanClass::readBatteryLevel(void) {
   uint8_t level = 0;
 
-  Serial.batteryRead(&level);
+  if (cacheFresh(CACHED_BATTERY)) {
+    return cachedBatteryLevel;
+  }
+
+  if (Serial.batteryRead(&level) == 0) {
+    cachedBatteryLevel = level;
+    cacheStore(CACHED_BATTERY);
+  }
 
   return level;
 }
 
+uint8_t BeanClass::getBatteryLevel(void) {
+  return readBatteryLevel();
+}
+
 uint16_t BeanClass::getBatteryVoltage(void) {
   uint32_t actualVoltage = 0;
-  uint8_t level = 0;
-
-  Serial.batteryRead(&level);
+  uint8_t level = readBatteryLevel();
 
   // This may not return accurate readings.  Conversion is subject to change.
   // The conversion function from voltage to level is as follows:
@@ -302,7 +655,45 @@ uint16_t BeanClass::getBatteryVoltage(void) {
   return (uint16_t)actualVoltage;
 }
 
+// The value last written to REG_LATCH_CFG_X21, so checkAccelInterrupts() can
+// reset the latch without reading it back first.
+static uint8_t accelLatchCfg = 0;
+static bool accelLatchCfgKnown = false;
+
+static void accelWriteOp(BeanAccelOp *op, uint8_t reg, uint8_t value) {
+  op->reg = reg;
+  op->length = 0;
+  op->value = value;
+  op->data = NULL;
+  if (reg == REG_LATCH_CFG_X21) {
+    accelLatchCfg = value;
+    accelLatchCfgKnown = true;
+  }
+}
+
+static void accelReadOp(BeanAccelOp *op, uint8_t reg, uint8_t length,
+                        uint8_t *data) {
+  op->reg = reg;
+  op->length = length;
+  op->value = 0;
+  op->data = data;
+}
+
+// Fills in the four writes of accelerometerConfig(), returning the count.
+static uint8_t accelConfigOps(BeanAccelOp *ops, uint16_t interrupts,
+                              uint8_t power_mode) {
+  accelWriteOp(&ops[0], REG_POWER_MODE_X11, power_mode);
+  accelWriteOp(&ops[1], REG_LATCH_CFG_X21, VALUE_LATCHED);
+  accelWriteOp(&ops[2], REG_INT_SETTING_X16, (uint8_t)(interrupts >> 8));
+  accelWriteOp(&ops[3], REG_INT_SETTING_X17, (uint8_t)(interrupts & 0xFF));
+  return 4;
+}
+
 void BeanClass::accelRegisterWrite(uint8_t reg, uint8_t value) {
+  if (reg == REG_LATCH_CFG_X21) {
+    accelLatchCfg = value;
+    accelLatchCfgKnown = true;
+  }
   Serial.accelRegisterWrite(reg, value);
 }
 
@@ -310,6 +701,16 @@ int BeanClass::accelRegisterRead(uint8_t reg, uint8_t length, uint8_t *value) {
   return Serial.accelRegisterRead(reg, length, value);
 }
 
+int BeanClass::accelRegisterTransaction(AccelRegisterOp *ops, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (ops[i].length == 0 && ops[i].reg == REG_LATCH_CFG_X21) {
+      accelLatchCfg = ops[i].value;
+      accelLatchCfgKnown = true;
+    }
+  }
+  return Serial.accelTransaction(ops, count);
+}
+
 void BeanClass::setAccelerometerPowerMode(uint8_t mode) {
   Serial.accelRegisterWrite(REG_POWER_MODE_X11, mode);
 }
@@ -321,8 +722,10 @@ uint8_t BeanClass::getAccelerometerPowerMode() {
 }
 
 void BeanClass::enableWakeOnAccelerometer(uint8_t sources) {
-  Serial.accelRegisterWrite(REG_LATCH_CFG_X21, VALUE_TEMPORARY_250MS);
-  Serial.accelRegisterWrite(REG_INT_MAPPING_X19, sources);
+  BeanAccelOp ops[2];
+  accelWriteOp(&ops[0], REG_LATCH_CFG_X21, VALUE_TEMPORARY_250MS);
+  accelWriteOp(&ops[1], REG_INT_MAPPING_X19, sources);
+  Serial.accelTransaction(ops, 2);
   Serial.wakeOnAccel(1);
 }
 
@@ -360,8 +763,92 @@ ACC_READING_T BeanClass::getAcceleration(void) {
   return reading;
 }
 
+bool BeanClass::startAccelerationStream(uint16_t rate_hz,
+                                        uint8_t samplesPerMessage) {
+  return Serial.accelStreamBegin(rate_hz, samplesPerMessage);
+}
+
+void BeanClass::stopAccelerationStream(void) {
+  Serial.accelStreamEnd();
+}
+
+uint8_t BeanClass::accelerationSamplesAvailable(void) {
+  return Serial.accelSamplesAvailable();
+}
+
+uint8_t BeanClass::readAccelerationSamples(AccelerationSample *samples,
+                                           uint8_t count) {
+  return Serial.readAccelSamples(samples, count);
+}
+
 static uint8_t enabledEvents = 0x00;
 static uint8_t triggeredEvents = 0x00;
+
+// Motion events are pushed by the CC when its firmware supports
+// MSG_ID_CC_ACCEL_EVENT_ENABLE; otherwise they are polled from the BMA250,
+// by checkMotionEvent() and, while callbacks are attached, every
+// BEAN_MOTION_POLL_INTERVAL ms by pollEvents().
+#ifndef BEAN_MOTION_POLL_INTERVAL
+#define BEAN_MOTION_POLL_INTERVAL (100)
+#endif
+
+static BeanCcPush motionPush;
+
+// One callback per AccelEventTypes bit, LOW_G_EVENT first.
+static MotionEventCallback motionCallbacks[8];
+static uint8_t motionCallbackEvents = 0;
+static unsigned long motionLastPoll;
+
+void BeanClass::motionPushEnable(uint8_t events) {
+  bean_cc_push_enable(&motionPush, &BeanSerialTransport::accelEventsEnable,
+                      events);
+}
+
+void BeanClass::attachMotionEvent(AccelEventTypes events,
+                                  MotionEventCallback callback) {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (events & (1 << i)) {
+      motionCallbacks[i] = callback;
+    }
+  }
+  motionCallbackEvents |= events;
+  motionLastPoll = millis();
+  enableMotionEvent(events);
+}
+
+void BeanClass::detachMotionEvent(AccelEventTypes events) {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (events & (1 << i)) {
+      motionCallbacks[i] = NULL;
+    }
+  }
+  motionCallbackEvents &= ~events;
+}
+
+void BeanClass::pollEvents(void) {
+  uptimeUpdate();
+  pollScratchWrites();
+  pollConnectionEvents();
+
+  if (motionPush.on) {
+    triggeredEvents |= Serial.accelEventsTake();
+  } else if (motionCallbackEvents &&
+             millis() - motionLastPoll >= BEAN_MOTION_POLL_INTERVAL) {
+    motionLastPoll = millis();
+    triggeredEvents |= checkAccelInterrupts();
+  }
+
+  uint8_t fired = triggeredEvents & motionCallbackEvents;
+  if (fired == 0) {
+    return;
+  }
+  triggeredEvents &= ~fired;
+  for (uint8_t i = 0; i < 8; i++) {
+    if ((fired & (1 << i)) && motionCallbacks[i]) {
+      motionCallbacks[i]((AccelEventTypes)(1 << i));
+    }
+  }
+}
 void BeanClass::enableMotionEvent(AccelEventTypes events) {
   uint16_t enableRegister = 0x0000;
   uint8_t wakeRegister = 0x00;
@@ -406,20 +893,34 @@ void BeanClass::enableMotionEvent(AccelEventTypes events) {
 
   // Clear triggered event flags for newly enabled events
   triggeredEvents &= ~events;
-  accelerometerConfig(enableRegister, VALUE_LOW_POWER_10MS);
-  enableWakeOnAccelerometer(wakeRegister);
+
+  // accelerometerConfig() and enableWakeOnAccelerometer() in one transaction
+  BeanAccelOp ops[6];
+  uint8_t count = accelConfigOps(ops, enableRegister, VALUE_LOW_POWER_10MS);
+  accelWriteOp(&ops[count++], REG_LATCH_CFG_X21, VALUE_TEMPORARY_250MS);
+  accelWriteOp(&ops[count++], REG_INT_MAPPING_X19, wakeRegister);
+  Serial.accelTransaction(ops, count);
+  Serial.wakeOnAccel(1);
+  motionPushEnable(enabledEvents);
 }
 
 void BeanClass::disableMotionEvents() {
   enabledEvents = 0;
   accelerometerConfig(0, VALUE_LOW_POWER_1S);
+  if (motionPush.on) {
+    motionPushEnable(0);
+  }
 }
 
 // This function returns true if any one of the "events" param had been
 // triggered
 // It clears all corresponding "events" flags
 bool BeanClass::checkMotionEvent(AccelEventTypes events) {
-  triggeredEvents |= checkAccelInterrupts();
+  if (motionPush.on) {
+    triggeredEvents |= Serial.accelEventsTake();
+  } else {
+    triggeredEvents |= checkAccelInterrupts();
+  }
 
   bool eventOccurred = (triggeredEvents & events) ? true : false;
   triggeredEvents &= ~events;
@@ -428,85 +929,335 @@ bool BeanClass::checkMotionEvent(AccelEventTypes events) {
 }
 
 void BeanClass::accelerometerConfig(uint16_t interrupts, uint8_t power_mode) {
-  Serial.accelRegisterWrite(REG_POWER_MODE_X11, power_mode);
-  Serial.accelRegisterWrite(REG_LATCH_CFG_X21, VALUE_LATCHED);
-  Serial.accelRegisterWrite(REG_INT_SETTING_X16, (uint8_t)(interrupts >> 8));
-  Serial.accelRegisterWrite(REG_INT_SETTING_X17, (uint8_t)(interrupts & 0xFF));
+  BeanAccelOp ops[4];
+  Serial.accelTransaction(ops, accelConfigOps(ops, interrupts, power_mode));
 }
 
 uint8_t BeanClass::checkAccelInterrupts() {
-  uint8_t value;
+  uint8_t value = 0;
   uint8_t latch_cfg;
-  Serial.accelRegisterRead(REG_INT_STATUS_X09, 2, &value);
-  Serial.accelRegisterRead(REG_LATCH_CFG_X21, 1, &latch_cfg);
-  latch_cfg |= MASK_RESET_INT_LATCH;
-  Serial.accelRegisterWrite(REG_LATCH_CFG_X21, latch_cfg);
+  BeanAccelOp ops[2];
+
+  if (!accelLatchCfgKnown) {
+    accelReadOp(&ops[0], REG_LATCH_CFG_X21, 1, &latch_cfg);
+    if (Serial.accelTransaction(ops, 1) != 0) {
+      return 0;
+    }
+    accelLatchCfg = latch_cfg & ~MASK_RESET_INT_LATCH;
+    accelLatchCfgKnown = true;
+  }
+
+  // read the status and reset the latch in one go
+  accelReadOp(&ops[0], REG_INT_STATUS_X09, 1, &value);
+  ops[1].reg = REG_LATCH_CFG_X21;
+  ops[1].length = 0;
+  ops[1].value = accelLatchCfg | MASK_RESET_INT_LATCH;
+  ops[1].data = NULL;
+  Serial.accelTransaction(ops, 2);
   return value;
 }
 
+// LED animations.  One the CC took is only timed here, for
+// ledAnimationPlaying(); otherwise ledAnimationTick() plays it from a
+// BeanScheduler timer.  The setters reach ledAnimationHalt() through a
+// pointer, set while an animation plays, so a sketch that never animates
+// doesn't link the player.
+#ifndef BEAN_LED_FRAME_INTERVAL
+#define BEAN_LED_FRAME_INTERVAL (20)  // ms between frames of a fade
+#endif
+
+static void (*ledAnimationHaltHook)(void) = NULL;
+
+#define LED_ANIMATION_HALT()          \
+  do {                                \
+    if (ledAnimationHaltHook) {       \
+      ledAnimationHaltHook();         \
+    }                                 \
+  } while (0)
+
+static BeanCcProbe ledAnimateProbe;
+static bool ledCcPlaying = false;
+static bool ledCcForever;
+static unsigned long ledCcStart;
+static uint32_t ledCcLength;
+
+static const LedKeyframe *ledFrames = NULL;  // NULL unless the core plays one
+static uint8_t ledFrameCount;
+static bool ledFramesProgmem;
+static uint8_t ledRepeatsLeft;  // 0 to repeat forever
+static uint8_t ledFrame;
+static unsigned long ledFrameStart;
+static LED_SETTING_T ledFrom;
+static int8_t ledTimer = -1;
+static bool ledTickDeferred = false;  // a tick waits in BeanScheduler.defer()
+
+// fadeLed() and blinkLed() keyframes, which have to outlast the call
+static LedKeyframe ledOwnFrames[2];
+
+static LedKeyframe ledLoadFrame(uint8_t index) {
+  LedKeyframe frame;
+  if (ledFramesProgmem) {
+    memcpy_P(&frame, &ledFrames[index], sizeof(frame));
+  } else {
+    frame = ledFrames[index];
+  }
+  return frame;
+}
+
+// Where the curve is at t, both out of 256.
+static uint16_t ledEase(uint8_t easing, uint16_t t) {
+  uint32_t rest = 256 - t;
+  switch (easing) {
+    case LED_EASE_STEP:
+      return 256;
+    case LED_EASE_IN:
+      return ((uint32_t)t * t) >> 8;
+    case LED_EASE_OUT:
+      return 256 - ((rest * rest) >> 8);
+    case LED_EASE_IN_OUT:
+      return t < 128 ? ((uint32_t)t * t) >> 7 : 256 - ((rest * rest) >> 7);
+    default:
+      return t;
+  }
+}
+
+static uint8_t ledMix(uint8_t from, uint8_t to, uint16_t e) {
+  return from + (int16_t)(((int32_t)((int16_t)to - from) * e) >> 8);
+}
+
+void BeanClass::ledAnimationHalt(void) {
+  if (ledTimer >= 0) {
+    BeanScheduler.cancel(ledTimer);
+    ledTimer = -1;
+  }
+  ledTickDeferred = false;
+  ledFrames = NULL;
+  ledCcPlaying = false;
+  ledAnimationHaltHook = NULL;
+}
+
+void BeanClass::ledAnimationTick(void *arg) {
+  if (arg == &ledTickDeferred) {
+    // a deferred tick can't be cancelled, so one for a halted animation
+    // lapses here rather than start a second chain beside the new one
+    if (!ledTickDeferred) {
+      return;
+    }
+    ledTickDeferred = false;
+  }
+  ledTimer = -1;
+  if (ledFrames == NULL) {
+    return;
+  }
+
+  // move on past the keyframes that are over; a late tick skips to where the
+  // animation should be by now
+  unsigned long now = millis();
+  LedKeyframe frame = ledLoadFrame(ledFrame);
+  while (now - ledFrameStart >= frame.durationMs) {
+    ledFrom.red = frame.red;
+    ledFrom.green = frame.green;
+    ledFrom.blue = frame.blue;
+    ledFrameStart += frame.durationMs;
+    if (++ledFrame == ledFrameCount) {
+      ledFrame = 0;
+      if (ledRepeatsLeft != 0 && --ledRepeatsLeft == 0) {
+        if (memcmp(&cachedLed, &ledFrom, sizeof(ledFrom)) != 0) {
+          cachedLed = ledFrom;
+          Serial.ledSet(ledFrom);
+        }
+        ledAnimationHalt();
+        return;
+      }
+    }
+    frame = ledLoadFrame(ledFrame);
+  }
+
+  uint16_t elapsed = now - ledFrameStart;
+  uint16_t e = ledEase(frame.easing,
+                       (uint16_t)(((uint32_t)elapsed << 8) / frame.durationMs));
+  LED_SETTING_T color = {ledMix(ledFrom.red, frame.red, e),
+                         ledMix(ledFrom.green, frame.green, e),
+                         ledMix(ledFrom.blue, frame.blue, e)};
+  if (memcmp(&cachedLed, &color, sizeof(color)) != 0) {
+    cachedLed = color;
+    Serial.ledSet(color);
+  }
+
+  // a color that isn't changing needs no frames until the next keyframe
+  uint16_t wait = frame.durationMs - elapsed;
+  bool fading = frame.easing != LED_EASE_STEP &&
+                (frame.red != ledFrom.red || frame.green != ledFrom.green ||
+                 frame.blue != ledFrom.blue);
+  if (fading && wait > BEAN_LED_FRAME_INTERVAL) {
+    wait = BEAN_LED_FRAME_INTERVAL;
+  }
+  ledTimer = BeanScheduler.setTimeout(wait, ledAnimationTick);
+  if (ledTimer < 0) {
+    // try for a timer after loop()
+    ledTickDeferred = BeanScheduler.defer(ledAnimationTick, &ledTickDeferred);
+  }
+}
+
+bool BeanClass::playLedAnimation(const LedKeyframe *frames, uint8_t count,
+                                 uint8_t repeat, bool progmem) {
+  if (count == 0) {
+    return false;
+  }
+  ledAnimationHalt();
+  ledFrames = frames;
+  ledFramesProgmem = progmem;
+
+  uint32_t length = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    length += ledLoadFrame(i).durationMs;
+  }
+  if (length == 0 && repeat == 0) {
+    ledFrames = NULL;
+    return false;
+  }
+
+  if (count <= BEAN_LED_CC_MAX_KEYFRAMES &&
+      bean_cc_probe_open(&ledAnimateProbe)) {
+    uint8_t body[2 + 6 * BEAN_LED_CC_MAX_KEYFRAMES];
+    uint8_t *out = body;
+    *out++ = repeat;
+    *out++ = count;
+    for (uint8_t i = 0; i < count; i++) {
+      LedKeyframe frame = ledLoadFrame(i);
+      *out++ = frame.red;
+      *out++ = frame.green;
+      *out++ = frame.blue;
+      *out++ = frame.easing;
+      *out++ = (uint8_t)(frame.durationMs & 0xFF);
+      *out++ = (uint8_t)(frame.durationMs >> 8);
+    }
+
+    bool answered = Serial.ledAnimate(body, out - body) == 0;
+    bean_cc_probe_result(&ledAnimateProbe, answered);
+    if (answered) {
+      ledFrames = NULL;
+      ledCcPlaying = true;
+      ledCcForever = repeat == 0;
+      ledCcStart = millis();
+      ledCcLength = length * repeat;
+      ledAnimationHaltHook = ledAnimationHalt;
+      cache[CACHED_LED].valid = false;
+      return true;
+    }
+  }
+
+  // the color showing, which only changes when the core sets it
+  if (!cache[CACHED_LED].valid) {
+    getLed();
+  }
+  ledFrom = cachedLed;
+  ledFrameCount = count;
+  ledRepeatsLeft = repeat;
+  ledFrame = 0;
+  ledFrameStart = millis();
+  ledAnimationHaltHook = ledAnimationHalt;
+  ledAnimationTick(NULL);
+  return true;
+}
+
+bool BeanClass::fadeLed(uint8_t red, uint8_t green, uint8_t blue,
+                        uint16_t durationMs, LedEasing easing) {
+  LedKeyframe frame = {red, green, blue, (uint8_t)easing, durationMs};
+  ledAnimationHalt();
+  ledOwnFrames[0] = frame;
+  return playLedAnimation(ledOwnFrames, 1);
+}
+
+bool BeanClass::blinkLed(uint8_t red, uint8_t green, uint8_t blue,
+                         uint16_t onMs, uint16_t offMs, uint8_t count) {
+  LedKeyframe on = {red, green, blue, LED_EASE_STEP, onMs};
+  LedKeyframe off = {0, 0, 0, LED_EASE_STEP, offMs};
+  ledAnimationHalt();
+  ledOwnFrames[0] = on;
+  ledOwnFrames[1] = off;
+  return playLedAnimation(ledOwnFrames, 2, count);
+}
+
+void BeanClass::stopLedAnimation(void) {
+  if (ledCcPlaying) {
+    uint8_t body[2] = {0, 0};
+    Serial.ledAnimate(body, sizeof(body));
+  }
+  ledAnimationHalt();
+}
+
+bool BeanClass::ledAnimationPlaying(void) {
+  if (ledCcPlaying && !ledCcForever &&
+      millis() - ledCcStart >= ledCcLength) {
+    ledAnimationHalt();
+  }
+  return ledCcPlaying || ledFrames != NULL;
+}
+
 void BeanClass::setLedRed(uint8_t intensity) {
+  LED_ANIMATION_HALT();
   LED_IND_SETTING_T setting;
   setting.color = (uint8_t)LED_RED;
   setting.intensity = intensity;
 
+  // the other channels stay as cached
+  cachedLed.red = intensity;
   Serial.ledSetSingle(setting);
 }
 
 void BeanClass::setLedGreen(uint8_t intensity) {
+  LED_ANIMATION_HALT();
   LED_IND_SETTING_T setting;
   setting.color = (uint8_t)LED_GREEN;
   setting.intensity = intensity;
 
+  // the other channels stay as cached
+  cachedLed.green = intensity;
   Serial.ledSetSingle(setting);
 }
 
 void BeanClass::setLedBlue(uint8_t intensity) {
+  LED_ANIMATION_HALT();
   LED_IND_SETTING_T setting;
   setting.color = (uint8_t)LED_BLUE;
   setting.intensity = intensity;
 
+  // the other channels stay as cached
+  cachedLed.blue = intensity;
   Serial.ledSetSingle(setting);
 }
 
 void BeanClass::setLed(uint8_t red, uint8_t green, uint8_t blue) {
+  LED_ANIMATION_HALT();
   LED_SETTING_T setting = {red, green, blue};
+  cachedLed = setting;
+  cacheStore(CACHED_LED);
   Serial.ledSet(setting);
 }
 
 uint8_t BeanClass::getLedRed(void) {
-  LED_SETTING_T reading;
-
-  if (Serial.ledRead(&reading) == 0) {
-    return reading.red;
-  }
-
-  return 0;
+  return getLed().red;
 }
 
 uint8_t BeanClass::getLedGreen(void) {
-  LED_SETTING_T reading;
-
-  if (Serial.ledRead(&reading) == 0) {
-    return reading.green;
-  }
-
-  return 0;
+  return getLed().green;
 }
 
 uint8_t BeanClass::getLedBlue(void) {
-  LED_SETTING_T reading;
-
-  if (Serial.ledRead(&reading) == 0) {
-    return reading.blue;
-  }
-
-  return 0;
+  return getLed().blue;
 }
 
 LED_SETTING_T BeanClass::getLed(void) {
   LED_SETTING_T reading;
 
+  if (cacheFresh(CACHED_LED)) {
+    return cachedLed;
+  }
+
   if (Serial.ledRead(&reading) == 0) {
+    cachedLed = reading;
+    cacheStore(CACHED_LED);
     return reading;
   }
 
@@ -516,7 +1267,12 @@ LED_SETTING_T BeanClass::getLed(void) {
 
 ADV_SWITCH_ENABLED_T BeanClass::getServices(void) {
   ADV_SWITCH_ENABLED_T services;
+  if (servicesKnown) {
+    return servicesCache;
+  }
   if (Serial.readGATT(&services) == 0) {
+    servicesCache = services;
+    servicesKnown = true;
     return services;
   }
 
@@ -532,7 +1288,13 @@ void BeanClass::resetServices(void) {
 }
 
 void BeanClass::setServices(ADV_SWITCH_ENABLED_T services) {
+  if (servicesKnown &&
+      memcmp(&servicesCache, &services, sizeof(services)) == 0) {
+    return;
+  }
   Serial.writeGATT(services);
+  servicesCache = services;
+  servicesKnown = true;
 }
 
 void BeanClass::setPairingPin(uint32_t pin) {
@@ -558,7 +1320,117 @@ void BeanClass::disableCustom(void) {
 }
 
 void BeanClass::setCustomAdvertisement(uint8_t *buf, int len) {
-  Serial.setCustomAdvertisement(buf, len);
+  if (len < 0 || len > MAX_ADVERTISEMENT_SIZE) {
+    return;
+  }
+  uint32_t crc = bean_crc32(buf, len);
+  if (advertisementSentKnown && advertisementSent == crc) {
+    return;
+  }
+  if (Serial.setCustomAdvertisement(buf, len) == 0) {
+    advertisementSent = crc;
+    advertisementSentKnown = true;
+  }
+}
+
+void BeanClass::advertisementBegin(uint8_t flags) {
+  advertisementLength = 0;
+  if (flags != 0) {
+    advertisementAdd(GAP_ADTYPE_FLAGS, &flags, 1);
+  }
+}
+
+uint8_t *BeanClass::advertisementReserve(uint8_t type, uint8_t length) {
+  if (advertisementLength + 2 + length > MAX_ADVERTISEMENT_SIZE) {
+    return NULL;
+  }
+  uint8_t *field = &advertisement[advertisementLength];
+  field[0] = length + 1;
+  field[1] = type;
+  advertisementLength += 2 + length;
+  return &field[2];
+}
+
+bool BeanClass::advertisementAdd(uint8_t type, const uint8_t *data,
+                                 uint8_t length) {
+  uint8_t *field = advertisementReserve(type, length);
+  if (field == NULL) {
+    return false;
+  }
+  memcpy(field, data, length);
+  return true;
+}
+
+bool BeanClass::advertisementAddName(const char *name) {
+  uint8_t length = strlen(name);
+  uint8_t room = MAX_ADVERTISEMENT_SIZE - advertisementLength;
+  if (room < 3) {
+    return false;
+  }
+  if (length + 2 <= room) {
+    return advertisementAdd(GAP_ADTYPE_LOCAL_NAME_COMPLETE,
+                            (const uint8_t *)name, length);
+  }
+  return advertisementAdd(GAP_ADTYPE_LOCAL_NAME_SHORT, (const uint8_t *)name,
+                          room - 2);
+}
+
+bool BeanClass::advertisementAddManufacturerData(uint16_t companyId,
+                                                 const uint8_t *data,
+                                                 uint8_t length) {
+  uint8_t *field =
+      advertisementReserve(GAP_ADTYPE_MANUFACTURER_SPECIFIC, length + 2);
+  if (field == NULL) {
+    return false;
+  }
+  field[0] = companyId & 0xFF;
+  field[1] = companyId >> 8;
+  memcpy(&field[2], data, length);
+  return true;
+}
+
+bool BeanClass::advertisementAddServiceData(uint16_t uuid,
+                                            const uint8_t *data,
+                                            uint8_t length) {
+  uint8_t *field = advertisementReserve(GAP_ADTYPE_SERVICE_DATA, length + 2);
+  if (field == NULL) {
+    return false;
+  }
+  field[0] = uuid & 0xFF;
+  field[1] = uuid >> 8;
+  memcpy(&field[2], data, length);
+  return true;
+}
+
+uint8_t *BeanClass::advertisementField(uint8_t type, uint8_t *length) {
+  uint8_t i = 0;
+  while (i + 1 < advertisementLength) {
+    uint8_t fieldLength = advertisement[i];
+    if (fieldLength == 0 || i + 1 + fieldLength > advertisementLength) {
+      break;
+    }
+    if (advertisement[i + 1] == type) {
+      if (length) {
+        *length = fieldLength - 1;
+      }
+      return &advertisement[i + 2];
+    }
+    i += fieldLength + 1;
+  }
+  return NULL;
+}
+
+bool BeanClass::advertisementSend(void) {
+  uint32_t crc = bean_crc32(advertisement, advertisementLength);
+  if (advertisementSentKnown && advertisementSent == crc) {
+    return false;
+  }
+  if (Serial.setCustomAdvertisement(advertisement, advertisementLength) != 0) {
+    return false;
+  }
+  advertisementSent = crc;
+  advertisementSentKnown = true;
+  return true;
 }
 
 int BeanClass::getObserverMessage(ObserverAdvertisementInfo *message,
@@ -566,12 +1438,58 @@ int BeanClass::getObserverMessage(ObserverAdvertisementInfo *message,
   return Serial.getObserverMessage(message, timeout);
 }
 
+bool BeanClass::startObserver(void) {
+  return Serial.observerStart();
+}
+
+void BeanClass::stopObserver(void) {
+  Serial.observerStop();
+}
+
+uint8_t BeanClass::observerMessagesAvailable(void) {
+  return Serial.observerAvailable();
+}
+
+bool BeanClass::readObserverMessage(ObserverAdvertisementInfo *message) {
+  return Serial.readObserverMessage(message);
+}
+
+bool BeanClass::setObserverFilter(const ObserverFilter *filter) {
+  return Serial.observerFilter(filter) == 0;
+}
+
+bool BeanClass::setObserverFilter(int8_t minRssi, uint16_t dedupeWindowMs) {
+  ObserverFilter filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.minRssi = minRssi;
+  filter.dedupeMs = dedupeWindowMs;
+  return setObserverFilter(&filter);
+}
+
 void BeanClass::enableiBeacon(void) {
   ADV_SWITCH_ENABLED_T curServices = getServices();
   curServices.ibeacon = 1;
   setServices(curServices);
 }
 
+// What each scratch bank last held, as far as Bean knows: a CRC32 over the
+// length and data, valid for the banks set in scratchKnown.
+static uint32_t scratchHash[BEAN_SCRATCH_BANKS];
+static uint8_t scratchKnown = 0;
+
+static uint32_t scratchCrc(const uint8_t *data, uint8_t length) {
+  uint32_t state = bean_crc32_update_byte(bean_crc32_begin(), length);
+  return bean_crc32_finish(bean_crc32_update(state, data, length));
+}
+
+static void scratchRemember(uint8_t bank, const uint8_t *data,
+                            uint8_t length) {
+  if (bank >= 1 && bank <= BEAN_SCRATCH_BANKS) {
+    scratchHash[bank - 1] = scratchCrc(data, length);
+    scratchKnown |= 1 << (bank - 1);
+  }
+}
+
 bool BeanClass::setScratchData(uint8_t bank, const uint8_t *data,
                                uint8_t dataLength) {
   bool errorRtn = true;
@@ -582,6 +1500,7 @@ bool BeanClass::setScratchData(uint8_t bank, const uint8_t *data,
     memcpy((void *)scratch.scratch, (void *)data, dataLength);
     // magic: +1 due to bank byte
     Serial.BTSetScratchChar(&scratch, (uint8_t)(dataLength + 1));
+    scratchRemember(bank, scratch.scratch, dataLength);
   } else {
     errorRtn = false;
   }
@@ -601,6 +1520,7 @@ bool BeanClass::setScratchNumber(uint8_t bank, uint32_t data) {
 
   // magic: 4 for data, 1 for scratch bank
   Serial.BTSetScratchChar(&scratch, 4 + 1);
+  scratchRemember(bank, scratch.scratch, 4);
 
   return errorRtn;
 }
@@ -609,7 +1529,9 @@ ScratchData BeanClass::readScratchData(uint8_t bank) {
   ScratchData scratchTempBuffer;
 
   memset(scratchTempBuffer.data, 0, 20);
-  Serial.BTGetScratchChar(bank, &scratchTempBuffer);
+  if (Serial.BTGetScratchChar(bank, &scratchTempBuffer) == 0) {
+    scratchRemember(bank, scratchTempBuffer.data, scratchTempBuffer.length);
+  }
 
   return scratchTempBuffer;
 }
@@ -619,7 +1541,9 @@ long BeanClass::readScratchNumber(uint8_t bank) {
   static ScratchData scratchNumBuffer;
 
   memset(scratchNumBuffer.data, 0, 20);
-  Serial.BTGetScratchChar(bank, &scratchNumBuffer);
+  if (Serial.BTGetScratchChar(bank, &scratchNumBuffer) == 0) {
+    scratchRemember(bank, scratchNumBuffer.data, scratchNumBuffer.length);
+  }
 
   returnNum |= (long)scratchNumBuffer.data[0] & 0xFF;
   returnNum |= (long)scratchNumBuffer.data[1] << 8UL;
@@ -629,8 +1553,153 @@ long BeanClass::readScratchNumber(uint8_t bank) {
   return returnNum;
 }
 
+uint8_t BeanClass::setScratchBanks(const ScratchData *banks,
+                                   uint8_t bankMask) {
+  uint8_t changed = 0;
+  uint32_t hashes[BEAN_SCRATCH_BANKS];
+
+  for (uint8_t i = 0; i < BEAN_SCRATCH_BANKS; i++) {
+    if (!(bankMask & (1 << i)) || banks[i].length > MAX_SCRATCH_SIZE) {
+      continue;
+    }
+    hashes[i] = scratchCrc(banks[i].data, banks[i].length);
+    if (!(scratchKnown & (1 << i)) || scratchHash[i] != hashes[i]) {
+      changed |= 1 << i;
+    }
+  }
+
+  if (changed == 0) {
+    return 0;
+  }
+
+  uint8_t written = Serial.BTSetScratchChars(banks, changed);
+  for (uint8_t i = 0; i < BEAN_SCRATCH_BANKS; i++) {
+    if (written & (1 << i)) {
+      scratchHash[i] = hashes[i];
+      scratchKnown |= 1 << i;
+    }
+  }
+  return written;
+}
+
+uint8_t BeanClass::readScratchBanks(ScratchData *banks, uint8_t bankMask) {
+  for (uint8_t i = 0; i < BEAN_SCRATCH_BANKS; i++) {
+    if (bankMask & (1 << i)) {
+      banks[i].length = 0;
+      memset(banks[i].data, 0, sizeof(banks[i].data));
+    }
+  }
+
+  uint8_t read = Serial.BTGetScratchChars(banks, bankMask);
+  for (uint8_t i = 0; i < BEAN_SCRATCH_BANKS; i++) {
+    if (read & (1 << i)) {
+      scratchRemember(i + 1, banks[i].data, banks[i].length);
+    }
+  }
+  return read;
+}
+
+void BeanClass::markScratchDirty(uint8_t bankMask) {
+  scratchKnown &= ~bankMask;
+}
+
+// Client writes are pushed by the CC when its firmware supports
+// MSG_ID_BT_SCRATCH_NOTIFY; otherwise the watched banks are read every
+// BEAN_SCRATCH_POLL_INTERVAL ms by pollEvents() and checked against
+// scratchHash.  The CC is asked again on each change of banks until it has
+// missed BEAN_CC_PROBE_ATTEMPTS in a row.
+#ifndef BEAN_SCRATCH_POLL_INTERVAL
+#define BEAN_SCRATCH_POLL_INTERVAL (250)
+#endif
+
+static BeanCcPush scratchPush;
+
+static ScratchWriteCallback scratchCallbacks[BEAN_SCRATCH_BANKS];
+static uint8_t scratchWatched = 0;
+static unsigned long scratchLastPoll;
+
+void BeanClass::scratchPushEnable(uint8_t bankMask) {
+  bean_cc_push_enable(&scratchPush, &BeanSerialTransport::scratchNotifyEnable,
+                      bankMask);
+}
+
+bool BeanClass::onScratchWrite(uint8_t bank, ScratchWriteCallback callback) {
+  if (bank < 1 || bank > BEAN_SCRATCH_BANKS) {
+    return false;
+  }
+  uint8_t bit = 1 << (bank - 1);
+
+  scratchCallbacks[bank - 1] = callback;
+  if (callback) {
+    scratchWatched |= bit;
+  } else {
+    scratchWatched &= ~bit;
+  }
+  scratchPushEnable(scratchWatched);
+
+  if (callback && !scratchPush.on) {
+    // what's there now isn't a write; only changes from here on are
+    ScratchData banks[BEAN_SCRATCH_BANKS];
+    readScratchBanks(banks, bit);
+    scratchLastPoll = millis();
+  }
+  return true;
+}
+
+void BeanClass::scratchCheckBanks(uint8_t bankMask) {
+  uint32_t oldHash[BEAN_SCRATCH_BANKS];
+  uint8_t oldKnown = scratchKnown;
+  memcpy(oldHash, scratchHash, sizeof(oldHash));
+
+  ScratchData banks[BEAN_SCRATCH_BANKS];
+  uint8_t read = readScratchBanks(banks, bankMask);
+  for (uint8_t i = 0; i < BEAN_SCRATCH_BANKS; i++) {
+    uint8_t bit = 1 << i;
+    if ((read & bit) && (!(oldKnown & bit) || oldHash[i] != scratchHash[i]) &&
+        scratchCallbacks[i]) {
+      scratchCallbacks[i](i + 1, banks[i].data, banks[i].length);
+    }
+  }
+}
+
+void BeanClass::pollScratchWrites(void) {
+  if (scratchPush.on) {
+    uint8_t bank;
+    ScratchData data;
+    while (Serial.readScratchWrite(&bank, &data)) {
+      if (bank < 1 || bank > BEAN_SCRATCH_BANKS) {
+        continue;
+      }
+      scratchRemember(bank, data.data, data.length);
+      if (scratchCallbacks[bank - 1]) {
+        scratchCallbacks[bank - 1](bank, data.data, data.length);
+      }
+    }
+    if (Serial.scratchWritesLost()) {
+      scratchCheckBanks(scratchWatched);
+    }
+  } else if (scratchWatched &&
+             millis() - scratchLastPoll >= BEAN_SCRATCH_POLL_INTERVAL) {
+    scratchLastPoll = millis();
+    scratchCheckBanks(scratchWatched);
+  }
+}
+
 void BeanClass::setBeanName(const String &name) {
-  Serial.BTSetLocalName((const char *)name.c_str());
+  Serial.BTSetLocalName(name.c_str(), name.length(), false);
+}
+
+void BeanClass::setBeanName(const char *name) {
+  Serial.BTSetLocalName(name);
+}
+
+void BeanClass::setBeanName(const char *name, size_t length) {
+  Serial.BTSetLocalName(name, length, false);
+}
+
+void BeanClass::setBeanName(const __FlashStringHelper *name) {
+  PGM_P p = reinterpret_cast<PGM_P>(name);
+  Serial.BTSetLocalName(p, strlen_P(p), true);
 }
 
 const char *BeanClass::getBeanName(void) {
@@ -4,6 +4,13 @@
 #include "BeanHID.h"
 #include "BeanMidi.h"
 #include "BeanAncs.h"
+#include "BeanScheduler.h"
+#include "BeanAdc.h"
+#include "BeanEncoder.h"
+#include "BeanTone.h"
+#include "BeanPulse.h"
+#include "BeanPwm.h"
+#include "BeanEnergy.h"
 #include "bma250.h"
 
 /**
@@ -19,6 +26,22 @@ typedef enum AccelEventTypes {
   LOW_G_EVENT = 0x01        /**< triggers when the accelerometer is in free fall or experiences no gravitational *  pull */
 };
 
+/**
+ * Called with the event that fired, see `attachMotionEvent()`
+ */
+typedef void (*MotionEventCallback)(AccelEventTypes event);
+
+/**
+ * Called with a scratch characteristic a client wrote, see `onScratchWrite()`
+ */
+typedef void (*ScratchWriteCallback)(uint8_t bank, const uint8_t *data,
+                                     uint8_t length);
+
+/**
+ * Called when a client connects or disconnects, see `onConnect()` and `onDisconnect()`
+ */
+typedef void (*ConnectionCallback)(void);
+
 /**
  * Advertisement data types
  */
@@ -59,6 +82,35 @@ typedef enum AdvertisementDataTypes {
                                                     /**< manufacturer specific data */
 };
 
+/**
+ * Why Bean woke from `sleep()`
+ */
+typedef enum WakeReasons {
+  WAKE_REASON_NONE = 0,           /**< Bean didn't sleep: the duration was too short, the LBM313 didn't agree to it in time, or woke Bean right away */
+  WAKE_REASON_TIMER = 1,          /**< the requested time elapsed */
+  WAKE_REASON_CONNECTION = 2,     /**< a client connected while wake on connect was enabled */
+  WAKE_REASON_ACCELEROMETER = 3,  /**< an accelerometer wake event, see `enableMotionEvent()` */
+  WAKE_REASON_SERIAL = 4,         /**< a serial message arrived from a connected client */
+  WAKE_REASON_PIN_CHANGE = 5      /**< a pin change or other ATmega interrupt */
+};
+
+/**
+ * What happened during a `sleep()`
+ */
+typedef struct {
+  WakeReasons reason;  /**< why Bean woke */
+  uint32_t sleptMs;    /**< how long Bean was asleep, in milliseconds; 0 if it didn't sleep or woke from a pin change, as then it can't tell */
+} WakeInfo;
+
+/**
+ * Values read from the CC2540 that Bean keeps for a while, see `setCacheMaxAge()`
+ */
+typedef enum CachedValues {
+  CACHED_TEMPERATURE = 0,   /**< `getTemperature()`, 1000 ms by default */
+  CACHED_BATTERY = 1,       /**< `getBatteryLevel()` and `getBatteryVoltage()`, 1000 ms by default */
+  CACHED_LED = 2            /**< the `getLed` functions, 250 ms by default */
+};
+
 /**
  * Advertisement Type
  */
@@ -85,6 +137,28 @@ typedef ACC_READING_T AccelerationReading;
  */
 typedef LED_SETTING_T LedReading;
 
+/**
+ *  How a keyframe of an LED animation gets from the previous color to its own, see `playLedAnimation()`
+ */
+typedef enum LedEasing {
+  LED_EASE_STEP = 0,  /**< show the keyframe's color straight away and hold it */
+  LED_EASE_LINEAR,    /**< change at a steady rate */
+  LED_EASE_IN,        /**< start slowly and speed up */
+  LED_EASE_OUT,       /**< start quickly and slow down */
+  LED_EASE_IN_OUT     /**< start and end slowly */
+} LedEasing;
+
+/**
+ *  One keyframe of an LED animation: the color reached `durationMs` after the previous keyframe's, along the `easing` curve
+ */
+typedef struct LedKeyframe {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t easing;       /**< a LedEasing */
+  uint16_t durationMs;  /**< how long the keyframe lasts */
+} LedKeyframe;
+
 /**
  *  Currently enabled advertisements in the rotating advertisement controller.
  */
@@ -95,6 +169,60 @@ typedef ADV_SWITCH_ENABLED_T BluetoothServices;
  */
 typedef OBSERVER_INFO_MESSAGE_T ObserverAdvertisementInfo;
 
+/**
+ *  Which advertisements the observer role passes on, see `setObserverFilter()`. An advertisement must meet every rule that is set:
+ *
+ *  * `minRssi`: the weakest signal to accept, in dBm, or -128 for any
+ *  * `dedupeMs`: drop repeats from an address for this long after one is passed on, or 0 to keep them all
+ *  * `addresses`: accept only these addresses, the first `addressCount` of up to BEAN_OBSERVER_MAX_ADDRESSES (4 by default); an `addressCount` of 0 accepts any
+ *  * `manufacturerPrefix`: accept only advertisements with manufacturer specific data starting with these `manufacturerPrefixLength` bytes, company identifier first, up to 8; a length of 0 accepts any
+ */
+typedef BEAN_OBSERVER_FILTER_T ObserverFilter;
+
+/**
+ *  An acceleration reading pushed by the accelerometer stream, see `startAccelerationStream()`. Same as AccelerationReading, plus `timestamp`: the `millis()` time the sample was taken.
+ */
+typedef BEAN_ACCEL_SAMPLE_T AccelerationSample;
+
+/**
+ *  One accelerometer register access for `accelRegisterTransaction()`. Set `length` to the number of bytes to read into `data`, starting at `reg`, or to 0 to write `value` to `reg`.
+ */
+typedef BeanAccelOp AccelRegisterOp;
+
+/**
+ *  Counters kept by the serial transport between the ATmega and the CC2540: frames sent and received, receive errors, bytes dropped per channel because its buffer was full, and the longest time spent in the transport's interrupts.
+ */
+typedef BEAN_TRANSPORT_STATS_T TransportStats;
+
+/**
+ *  Where the time went, see `getEnergyStats()`, in milliseconds since power up or the last `resetEnergyStats()`:
+ *
+ *  * `activeMs`: the CPU running, including while it spins in a wait loop
+ *  * `idleMs`: the CPU in idle sleep, see `BeanScheduler.enableIdleSleep()`
+ *  * `sleepMs`: powered down in `sleep()`
+ *  * `waitMs`: in the core's wait loops, for a reply from the CC2540, in `delay()` or for room in a full transmit queue, whether spinning or in idle sleep
+ *  * `ccAwakeMs`: holding the CC2540 awake to talk to it, between frames or for good with `keepAwake()`
+ *
+ *  `activeMs`, `idleMs` and `sleepMs` add up to the time accounted for; `waitMs` and `ccAwakeMs` overlap them. `framesSent` and `framesReceived` count transport frames, and `chargePerHourUah` estimates the average current in microamps, which is also the charge drawn per hour in µAh.
+ */
+typedef BEAN_ENERGY_STATS_T EnergyStats;
+
+/**
+ *  How the ATmega's 2 KB of RAM is used, see `getMemoryStats()`. The heap grows up from the end of the static data and the stack grows down from the top of RAM; every field is in bytes except `freeBlocks` and `failedAllocations`.
+ */
+typedef struct {
+  uint16_t heapUsed;           /**< from the start of the heap to its top, including free blocks below the top */
+  uint16_t heapPeak;           /**< the most `heapUsed` has been */
+  uint16_t heapFree;           /**< in free blocks below the top of the heap, which only allocations that fit in them can reuse */
+  uint16_t freeBlocks;         /**< how many free blocks there are; many small ones mean a fragmented heap */
+  uint16_t largestFreeBlock;   /**< the largest allocation the free blocks could satisfy without growing the heap */
+  uint16_t failedAllocations;  /**< `malloc()`, `realloc()` and `new` requests that failed since power up */
+  uint16_t stackUsed;          /**< by the stack right now */
+  uint16_t stackPeak;          /**< the most the stack has used since power up, or `stackUsed` if built with `-DBEAN_STACK_PAINT=0` */
+  uint16_t freeMemory;         /**< between the top of the heap and the stack right now */
+  uint16_t unusedMemory;       /**< never reached by either the heap or the stack: the headroom left at their peaks */
+} MemoryStats;
+
 class BeanClass {
  public:
   /****************************************************************************/
@@ -128,6 +256,23 @@ class BeanClass {
    */
   bool checkMotionEvent(AccelEventTypes events);
 
+  /**
+   *  Enables accelerometer interrupts and calls a function whenever one of them fires. The callback runs between calls to `loop()`, not from an interrupt, so it can do anything `loop()` can. Events handled by a callback are not reported by `checkMotionEvent()`.
+   *
+   *  The CC2540 pushes events to the ATmega as they happen, so nothing needs to be polled, and Bean wakes from `sleep()` for them. With CC2540 firmware that can't push events, the accelerometer is polled every 100 ms instead.
+   *
+   *  @param events one or more AccelEventTypes, OR'd together
+   *  @param callback the function to call, with the event that fired
+   */
+  void attachMotionEvent(AccelEventTypes events, MotionEventCallback callback);
+
+  /**
+   *  Stops calling the callbacks attached to these events. The events stay enabled; use `disableMotionEvents()` to turn them off.
+   *
+   *  @param events one or more AccelEventTypes, OR'd together
+   */
+  void detachMotionEvent(AccelEventTypes events);
+
   /**
    *  Get the current value of the Bean accelerometer X axis.
    *
@@ -156,6 +301,36 @@ class BeanClass {
    */
   AccelerationReading getAcceleration(void);
 
+  /**
+   *  Start streaming accelerometer samples. The CC2540 samples the accelerometer at a steady rate and sends the readings over in batches, which are buffered until the sketch reads them with `readAccelerationSamples()`. This is much faster, and more evenly spaced, than calling `getAcceleration()` in a loop.
+   *
+   *  The sample buffer (BEAN_ACCEL_BUFFER_SIZE, 128 bytes by default) is allocated the first time this is called. Batches that arrive while it is full are dropped.
+   *
+   *  @param rate_hz samples per second
+   *  @param samplesPerMessage samples to batch into each message, or 0 to let the CC2540 fit as many as it can
+   *  @return false if rate_hz is 0 or the buffer could not be allocated
+   */
+  bool startAccelerationStream(uint16_t rate_hz, uint8_t samplesPerMessage = 0);
+
+  /**
+   *  Stop streaming accelerometer samples. Samples already buffered can still be read.
+   */
+  void stopAccelerationStream(void);
+
+  /**
+   *  @return the number of streamed samples waiting to be read
+   */
+  uint8_t accelerationSamplesAvailable(void);
+
+  /**
+   *  Read streamed accelerometer samples, oldest first.
+   *
+   *  @param samples array to fill
+   *  @param count the most samples to read
+   *  @return the number of samples read
+   */
+  uint8_t readAccelerationSamples(AccelerationSample *samples, uint8_t count);
+
   /**
    *  Low level function for writing directly to the accelerometers registers.
    *
@@ -180,6 +355,17 @@ class BeanClass {
    */
   int accelRegisterRead(uint8_t reg, uint8_t length, uint8_t *value);
 
+  /**
+   *  Low level function for several accelerometer register reads and writes at once. The accesses run in order, but take a single message to the CC2540 and a single reply, instead of one round trip each.
+   *
+   *  If the CC2540 firmware doesn't support transactions, the accesses are made one at a time instead.
+   *
+   *  @param ops the register accesses to make
+   *  @param count the number of entries in ops, at most 32
+   *  @return 0 on success, -1 if a read failed
+   */
+  int accelRegisterTransaction(AccelRegisterOp *ops, uint8_t count);
+
   /**
    *  Get the current sensitivity setting of the Bean accelerometer.
    *
@@ -305,6 +491,65 @@ class BeanClass {
    *  @param intensity the intensity of the blue LED. 0 is off and 255 is on.
    */
   void setLedBlue(uint8_t intensity);
+
+  /**
+   *  Plays a sequence of colors on the LED in the background, so `loop()` doesn't have to time it. The animation starts from the color showing; each keyframe then moves to its own color over its duration.
+   *
+   *  A sequence of up to BEAN_LED_CC_MAX_KEYFRAMES (10) keyframes is handed to the CC2540 in a single message, if its firmware can play animations, and costs nothing more. Otherwise the core plays it between calls to `loop()`, from a BeanScheduler timer, and sends the LED a frame only when its color changes: at most one every BEAN_LED_FRAME_INTERVAL ms (20 by default) while fading and one per keyframe for steps. The keyframes are then read as they play, so the array has to stay until `ledAnimationPlaying()` is false.
+   *
+   *  Setting the LED any other way stops the animation where it is. While the CC2540 plays one, `getLed()` can be up to 250 ms behind. To sleep while it plays, use `Bean.sleep(BeanScheduler.nextTimeout())`, which wakes Bean in time for each frame the core sends.
+   *
+   *  @param frames the keyframes
+   *  @param count how many keyframes there are
+   *  @param repeat how many times to play the sequence, or 0 to repeat it until it is stopped
+   *  @param progmem true if frames is in PROGMEM
+   *  @return false if there are no keyframes, or a repeating sequence has no duration
+   *
+   *  # Examples
+   *
+   *  This example breathes the LED blue, again and again, without any code in `loop()`:
+   *
+   *  @include led/ledAnimation.ino
+   */
+  bool playLedAnimation(const LedKeyframe *frames, uint8_t count,
+                        uint8_t repeat = 1, bool progmem = false);
+
+  /**
+   *  Fades the LED from the color showing to a new one in the background, see `playLedAnimation()`.
+   *
+   *  @param red the intensity of the red LED to end on
+   *  @param green the intensity of the green LED to end on
+   *  @param blue the intensity of the blue LED to end on
+   *  @param durationMs how long the fade lasts
+   *  @param easing the curve it follows
+   *  @return true if the fade started
+   */
+  bool fadeLed(uint8_t red, uint8_t green, uint8_t blue, uint16_t durationMs,
+               LedEasing easing = LED_EASE_IN_OUT);
+
+  /**
+   *  Blinks the LED in the background, see `playLedAnimation()`. It is off between blinks and when they end.
+   *
+   *  @param red the intensity of the red LED while on
+   *  @param green the intensity of the green LED while on
+   *  @param blue the intensity of the blue LED while on
+   *  @param onMs how long each blink lasts
+   *  @param offMs how long the LED is off after each blink
+   *  @param count how many blinks, or 0 to blink until stopped
+   *  @return true if the blinking started
+   */
+  bool blinkLed(uint8_t red, uint8_t green, uint8_t blue, uint16_t onMs,
+                uint16_t offMs, uint8_t count = 0);
+
+  /**
+   *  Stops the LED animation, leaving the LED showing the color it had reached.
+   */
+  void stopLedAnimation(void);
+
+  /**
+   *  @return true while an LED animation plays
+   */
+  bool ledAnimationPlaying(void);
   ///@}
 
   /****************************************************************************/
@@ -332,6 +577,54 @@ class BeanClass {
    *  @include observer/observer.ino
    */
   int getObserverMessage(ObserverAdvertisementInfo *message, unsigned long timeout);
+
+  /**
+   *  Starts listening for advertisements continuously. They are queued as they arrive, up to BEAN_OBSERVER_QUEUE_SIZE (4 by default) at a time; read them with `readObserverMessage()`. Advertisements that arrive while the queue is full are dropped.
+   *
+   *  While a scan is running, `getObserverMessage()` takes its advertisement from the queue too.
+   *
+   *  @return false if there wasn't enough memory for the queue
+   */
+  bool startObserver(void);
+
+  /**
+   *  Stops listening for advertisements. Those already queued can still be read.
+   */
+  void stopObserver(void);
+
+  /**
+   *  Gets the number of queued advertisements.
+   *
+   *  @return the number of advertisements `readObserverMessage()` can read
+   */
+  uint8_t observerMessagesAvailable(void);
+
+  /**
+   *  Takes the oldest queued advertisement.
+   *
+   *  @param message filled in with the advertisement
+   *  @return false if no advertisement is queued
+   */
+  bool readObserverMessage(ObserverAdvertisementInfo *message);
+
+  /**
+   *  Sets which advertisements the observer role passes on, for both `getObserverMessage()` and the queue.
+   *
+   *  The filter is sent to the LBM313, so advertisements it rejects never reach the ATmega. With LBM313 firmware that doesn't support filters, Bean applies the same filter as advertisements arrive, so rejected ones still never take up room in the queue. Bean only remembers the last BEAN_OBSERVER_DEDUPE_SIZE (4 by default) addresses for `dedupeMs`.
+   *
+   *  @param filter the rules to apply
+   *  @return true if the LBM313 applies the filter, false if Bean does
+   */
+  bool setObserverFilter(const ObserverFilter *filter);
+
+  /**
+   *  Sets an observer filter on signal strength and repeats only, see `setObserverFilter(const ObserverFilter *)`.
+   *
+   *  @param minRssi the weakest signal to accept, in dBm, or -128 for any
+   *  @param dedupeWindowMs drop repeat advertisements from an address for this long after one is passed on, or 0 to keep them all
+   *  @return true if the LBM313 applies the filter, false if Bean does
+   */
+  bool setObserverFilter(int8_t minRssi, uint16_t dedupeWindowMs);
   ///@}
 
 
@@ -341,7 +634,7 @@ class BeanClass {
    *
    *  Scratch characteristics are Bluetooth Low Energy characteristics that Bean provides for arbitrary use by developers. Each characteristic can hold up to 20 bytes due to BLE restrictions.
    *
-   *  Scratch characteristics will trigger Notify events on BLE Central clients when they are changed by Bean's Arduino sketch. Bean sketches must poll to find out when a client changes scratch characteristic data.
+   *  Scratch characteristics will trigger Notify events on BLE Central clients when they are changed by Bean's Arduino sketch. Bean sketches can find out when a client changes scratch characteristic data with `onScratchWrite()`, or by polling.
    *
    *  Bean and Bean+ have five scratch characteristics. All scratch chars are contained in a single BLE service.
    *
@@ -420,6 +713,47 @@ class BeanClass {
    *  @include scratchChars/setScratchNumber.ino
    */
   long readScratchNumber(uint8_t bank);
+
+  /**
+   *  Write several scratch characteristics at once. Banks whose contents are the same as Bean last wrote or read are skipped, and the rest go to the CC2540 packed into as few messages as fit, rather than one message each. Triggers a BLE Notify event for each bank that changes.
+   *
+   *  Client writes to banks watched with `onScratchWrite()` are taken into account. For other banks Bean can't tell when a client writes them, so after one might have, call `markScratchDirty()` to make sure the next call writes those banks again.
+   *
+   *  @param banks        An array of five `ScratchData`, bank 1 first
+   *  @param bankMask     Which entries of `banks` to write: bit 0 for bank 1 up to bit 4 for bank 5
+   *
+   *  @return             The mask of banks actually written. Banks that were unchanged, or whose `length` is greater than 20, are left out.
+   */
+  uint8_t setScratchBanks(const ScratchData *banks, uint8_t bankMask = 0x1F);
+
+  /**
+   *  Read several scratch characteristics at once, in as few round trips to the CC2540 as fit.
+   *
+   *  @param banks        An array of five `ScratchData`, bank 1 first, to read into. Entries that aren't in `bankMask` are left alone.
+   *  @param bankMask     Which banks to read: bit 0 for bank 1 up to bit 4 for bank 5
+   *
+   *  @return             The mask of banks read
+   */
+  uint8_t readScratchBanks(ScratchData *banks, uint8_t bankMask = 0x1F);
+
+  /**
+   *  Forget what Bean knows about some scratch characteristics, so the next `setScratchBanks()` writes them whether or not they look unchanged.
+   *
+   *  @param bankMask     Which banks: bit 0 for bank 1 up to bit 4 for bank 5
+   */
+  void markScratchDirty(uint8_t bankMask = 0x1F);
+
+  /**
+   *  Calls a function whenever a BLE client writes a scratch characteristic. The callback runs between calls to `loop()`, not from an interrupt, so it can do anything `loop()` can. Writes made by the sketch itself don't call it.
+   *
+   *  The CC2540 pushes writes to the ATmega as they happen, so nothing needs to be polled. With CC2540 firmware that can't push them, the watched banks are read every 250 ms (BEAN_SCRATCH_POLL_INTERVAL) instead, and the callback runs when their contents change. If writes arrive faster than the sketch handles them, the watched banks are read again so the latest contents are never missed, though some of the writes in between may be.
+   *
+   *  @param bank         The scratch char to watch: `1`, `2`, `3`, `4`, or `5`
+   *  @param callback     The function to call with the bank and the data written, or NULL to stop watching the bank
+   *
+   *  @return             false if `bank` is out of range
+   */
+  bool onScratchWrite(uint8_t bank, ScratchWriteCallback callback);
   ///@}
 
 
@@ -441,13 +775,18 @@ class BeanClass {
    *  * A client connects to Bean while wake on connect is enabled
    *  * A pin change interrupt occurs
    *
-   *  `Bean.sleep()` is more power-efficient than Arduino `sleep()` because it puts the ATmega into a low-power mode known as "power-down". This disables the ATmega's internal timers, so functions like `millis()` will not track time elapsed during `Bean.sleep()`.
+   *  `Bean.sleep()` is more power-efficient than Arduino `sleep()` because it puts the ATmega into a low-power mode known as "power-down". This stops the ATmega's internal timers, so when Bean wakes it moves `millis()` and `micros()` on by the time it slept (`sleptMs` in the result). After a wake from a pin change that time is unknown and isn't added.
    *
    *  The ATmega can take up to 7 ms to wake from `Bean.sleep()`. If you are looking for more precise timings, please consider using [delay()](https://www.arduino.cc/en/Reference/Delay) or [delayMicroseconds()](https://www.arduino.cc/en/Reference/DelayMicroseconds).
    *
    *  For more information on low-power mode on the ATmega328, check out this [Sparkfun tutorial](https://www.sparkfun.com/tutorials/309).
    *
+   *  If the LBM313 doesn't agree to the sleep in time, Bean asks again after a while, waiting in a lighter idle mode in between, until the duration is up.
+   *
+   *  The reason Bean woke and the time it was asleep come from the LBM313. With LBM313 firmware that doesn't report them, a wake by the LBM313 is assumed to be the timer, after the full requested time.
+   *
    *  @param duration_ms The duration to sleep for, in milliseconds
+   *  @return why Bean woke and how long it slept
    *
    *  # Examples
    *
@@ -455,7 +794,7 @@ class BeanClass {
    *
    *  @include sleep/sleep.ino
    */
-  void sleep(uint32_t duration_ms);
+  WakeInfo sleep(uint32_t duration_ms);
 
   /**
    *  Enable or disable keep-awake mode.
@@ -476,6 +815,13 @@ class BeanClass {
    */
   void keepAwake(bool enable);
 
+  /**
+   *  Gets the time since Bean powered up, including time spent in `sleep()`. Unlike `millis()`, it doesn't wrap around after 49 days.
+   *
+   *  @return the uptime, in milliseconds
+   */
+  uint64_t uptimeMs(void);
+
   /**
    *  Enable or disable wake on connect. By default, Bean does not wake up when a BLE client connects.
    *
@@ -514,6 +860,28 @@ class BeanClass {
    */
   void setBeanName(const String &s);
 
+  /**
+   *  Set the advertising name of the Bean, without building a String. BLE advertising names are truncated at 20 bytes.
+   *
+   *  @param name The name to be advertised, null-terminated
+   */
+  void setBeanName(const char *name);
+
+  /**
+   *  Set the advertising name of the Bean from part of a buffer. BLE advertising names are truncated at 20 bytes.
+   *
+   *  @param name The name to be advertised; it needn't be null-terminated
+   *  @param length The length of name
+   */
+  void setBeanName(const char *name, size_t length);
+
+  /**
+   *  Set the advertising name of the Bean from a string in flash, e.g. `Bean.setBeanName(F("Kitchen"))`. BLE advertising names are truncated at 20 bytes.
+   *
+   *  @param name The name to be advertised
+   */
+  void setBeanName(const __FlashStringHelper *name);
+
   /**
    *  Read the currently-advertised name of the Bean.
    *
@@ -594,6 +962,7 @@ class BeanClass {
    *  The first 3 bytes specify the advertisement mode.  They take the form 0x2, GAP_ADTYPE_FLAGS, any sum of advertisement types (as defined by AdvertisementType)
    *  All following data are up to the user to define and follow the pattern of [length, AdvertisementDataTypes, data1, data2, ...] where length includes the number of data plus 1 (for the AdvertisementDataTypes)
    *  The data can be chained together into the single buffer up to the maxiumum length.
+   *  A packet that is the same as the last one sent is not sent again; see `advertisementSend()`.
    *  For example:
    *  [0x02, GAP_ADTYPE_FLAGS, GAP_ADTYPE_FLAGS_BREDR_NOT_SUPPORTED + GAP_ADTYPE_FLAGS_GENERAL, 0x02, GAP_ADTYPE_MANUFACTURER_SPECIFIC, 42, 0x02, GAP_ADTYPE_POWER_LEVEL, 10, ...]
    *
@@ -612,6 +981,76 @@ class BeanClass {
    *  @include observer/advertiser.ino
    */
   void setCustomAdvertisement(uint8_t *buf, int len);
+
+  /**
+   *  Starts building a new custom advertisement packet, replacing the one being built. Add AD structures with the `advertisementAdd` functions, in the order they should appear, then send it with `advertisementSend()`. The packet is built in place, in a 31 byte buffer inside Bean, so nothing is allocated.
+   *
+   *  @param flags the GAP_ADTYPE_FLAGS structure's value, a sum of AdvertisementType; 0 leaves it out
+   *
+   *  # Examples
+   *
+   *  A rotating beacon can rebuild its packet every `loop()`; only packets that differ from the last one sent reach the CC2540:
+   *
+   *      Bean.advertisementBegin();
+   *      Bean.advertisementAddName("Sensor");
+   *      Bean.advertisementAddManufacturerData(0x0A5C, reading, sizeof(reading));
+   *      Bean.advertisementSend();
+   */
+  void advertisementBegin(uint8_t flags = GAP_ADTYPE_FLAGS_GENERAL | GAP_ADTYPE_FLAGS_BREDR_NOT_SUPPORTED);
+
+  /**
+   *  Adds an AD structure to the advertisement being built.
+   *
+   *  @param type one of AdvertisementDataTypes
+   *  @param data the structure's data, after the type
+   *  @param length the number of bytes in data
+   *  @return false, leaving the advertisement unchanged, if it doesn't fit in the 31 byte packet
+   */
+  bool advertisementAdd(uint8_t type, const uint8_t *data, uint8_t length);
+
+  /**
+   *  Adds the local name to the advertisement being built, shortened to fit if the complete name doesn't.
+   *
+   *  @param name the name, null-terminated
+   *  @return false if not even one character fits
+   */
+  bool advertisementAddName(const char *name);
+
+  /**
+   *  Adds manufacturer specific data to the advertisement being built.
+   *
+   *  @param companyId the Bluetooth SIG company identifier, sent first
+   *  @param data the data after the company identifier
+   *  @param length the number of bytes in data
+   *  @return false if it doesn't fit
+   */
+  bool advertisementAddManufacturerData(uint16_t companyId, const uint8_t *data, uint8_t length);
+
+  /**
+   *  Adds service data to the advertisement being built.
+   *
+   *  @param uuid the 16-bit service UUID, sent first
+   *  @param data the data after the UUID
+   *  @param length the number of bytes in data
+   *  @return false if it doesn't fit
+   */
+  bool advertisementAddServiceData(uint16_t uuid, const uint8_t *data, uint8_t length);
+
+  /**
+   *  Finds an AD structure in the advertisement being built, so its data can be changed in place before the next `advertisementSend()`.
+   *
+   *  @param type one of AdvertisementDataTypes
+   *  @param length if not NULL, set to the number of data bytes
+   *  @return the data of the first structure of that type, after the type byte, or NULL if there is none
+   */
+  uint8_t *advertisementField(uint8_t type, uint8_t *length = NULL);
+
+  /**
+   *  Sends the advertisement being built as the custom advertisement packet, as `setCustomAdvertisement()` would. Bean remembers a CRC of the last packet sent by either function until `restartBluetooth()`, and doesn't resend a packet that hasn't changed.
+   *
+   *  @return true if the packet was sent, false if it was the same as the last one
+   */
+  bool advertisementSend(void);
   ///@}
 
 
@@ -722,7 +1161,7 @@ class BeanClass {
   void disconnect(void);
 
   /**
-   *  Check if any BLE Central devices are currently connected to Bean.
+   *  Check if any BLE Central devices are currently connected to Bean. With CC2540 firmware that pushes connection changes this reads a copy kept by the ATmega, so it costs no message to the CC2540.
    *
    *  @return true if a device is connected, false otherwise
    *
@@ -733,6 +1172,22 @@ class BeanClass {
    *  @include connection/getConnectionState.ino
    */
   bool getConnectionState(void);
+
+  /**
+   *  Calls a function whenever a BLE Central device connects to Bean. The callback runs between calls to `loop()`, not from an interrupt, so it can do anything `loop()` can.
+   *
+   *  The CC2540 pushes connection changes to the ATmega as they happen, which also makes `getConnectionState()` and `getAdvertisingState()` free to call. With CC2540 firmware that can't push them, the connection state is polled every 250 ms (BEAN_CONNECTION_POLL_INTERVAL) while a callback is attached, and a connection shorter than that may be missed.
+   *
+   *  @param callback the function to call, or NULL to stop
+   */
+  void onConnect(ConnectionCallback callback);
+
+  /**
+   *  Calls a function whenever the connected BLE Central device disconnects from Bean. See `onConnect()`.
+   *
+   *  @param callback the function to call, or NULL to stop
+   */
+  void onDisconnect(ConnectionCallback callback);
   ///@}
 
 
@@ -744,12 +1199,16 @@ class BeanClass {
 
   /**
    *  Returns a struct of all of the currently services and whether or not they are enabled.
+   *
+   *  The services are read from the CC2540 once and then remembered, along with every change made by `setServices()`, until `restartBluetooth()`.
    */
   BluetoothServices getServices(void);
 
   /**
    *  Sets services for the Bean to use (NOTE: disabling the standard service will no longer allow the Bean to connect to the Bean Loader)
    *
+   *  Nothing is sent if the services are already set this way.
+   *
    *  @param services the services to change
    */
   void setServices(BluetoothServices services);
@@ -816,6 +1275,28 @@ class BeanClass {
    */
   void enableConfigSave(bool enableSave);
 
+  /**
+   *  Starts a batch of radio configuration changes. Until `commitRadioConfig()`, `setBeanName()`, `setAdvertisingInterval()`, `setBeaconParameters()` and `setBeaconEnable()` change a copy of the configuration fetched from the CC2540 once, and nothing is written. Batches nest; only the outermost commit writes.
+   *
+   *  Outside a batch each of those functions fetches and writes the configuration itself, and skips the write if nothing changed.
+   *
+   *  # Examples
+   *
+   *      Bean.beginRadioConfig();
+   *      Bean.setBeanName("Porch");
+   *      Bean.setAdvertisingInterval(500);
+   *      Bean.setBeaconParameters(0xBEEF, 1, 2);
+   *      Bean.commitRadioConfig();  // one write, one NVRAM save
+   */
+  void beginRadioConfig(void);
+
+  /**
+   *  Ends a batch started with `beginRadioConfig()`, writing the configuration to the CC2540 if anything in it changed, and saving it to NVRAM unless `enableConfigSave(false)` was called.
+   *
+   *  @return false if the configuration couldn't be fetched from the CC2540, so some of the batch's changes were dropped
+   */
+  bool commitRadioConfig(void);
+
 
   /**
    *  Performs a hard reset on the bluetooth module.
@@ -825,9 +1306,65 @@ class BeanClass {
    */
   void restartBluetooth(void);
 
+  /**
+   *  Sets how long a value read from the CC2540 is reused before it is read again. Each read takes a round trip over the serial link, so reusing recent values keeps loops that read them often fast.
+   *
+   *  Setting the LED also updates the cached LED color, so the `getLed` functions don't need to ask the CC2540 what the sketch just set. A color set from elsewhere, e.g. by a connected app, shows up once the cached value expires.
+   *
+   *  @param value which value to configure
+   *  @param max_age_ms how long in milliseconds to reuse it, or 0 to read it every time
+   */
+  void setCacheMaxAge(CachedValues value, uint16_t max_age_ms);
+
+  /**
+   *  Reads the serial transport counters since power up or the last `resetTransportStats()`.
+   *
+   *  Frequent overflows on a channel mean its buffer is too small, or the sketch reads it too rarely. CRC errors and framing resets point to a noisy or overrun link. The counters can be compiled out by building with `-DBEAN_TRANSPORT_STATS=0`, in which case every field reads 0.
+   *
+   *  @return the current counters
+   */
+  TransportStats getTransportStats(void);
+
+  /**
+   *  Zeroes the serial transport counters.
+   */
+  void resetTransportStats(void);
+
+  /**
+   *  Reads how long Bean has spent in each power state, for finding the code paths that drain the battery. Compare the figures before and after a change, or over each part of a sketch with `resetEnergyStats()` in between.
+   *
+   *  Accounting is off unless the core is built with `-DBEAN_ENERGY_STATS=1`; otherwise every field reads 0. Time is sampled at each Timer0 tick, 1 or 2 ms, so it is accurate over seconds rather than for single calls. A sleep ended by a pin change counts 0 ms if the CC2540 firmware can't say how long it lasted.
+   *
+   *  The charge estimate multiplies the times by the currents BEAN_ENERGY_ACTIVE_UA, BEAN_ENERGY_IDLE_UA, BEAN_ENERGY_SLEEP_UA and BEAN_ENERGY_CC_AWAKE_UA, rough datasheet figures that can be set at build time from measurements, plus BEAN_ENERGY_BASE_UA, drawn all the time by the rest of the board and 0 by default. The radio's own current depends on advertising and connection settings and is not counted.
+   *
+   *  @return the current times and counters
+   */
+  EnergyStats getEnergyStats(void);
+
+  /**
+   *  Zeroes the energy accounting.
+   */
+  void resetEnergyStats(void);
+
+  /**
+   *  Reports heap and stack use, to size buffers such as `SERIAL_BUFFER_SIZE` or a library's receive buffer from measurements rather than guesses.
+   *
+   *  Run the sketch through its busiest paths, then read `unusedMemory`: that much RAM could still go to buffers. A growing `freeBlocks` with a `largestFreeBlock` much smaller than `heapFree` means the heap is fragmenting.
+   *
+   *  The stack peak is found by filling free RAM with a known byte at power up and looking for the lowest byte the stack has overwritten, so a stack that happens to write that same byte at its deepest point reads a little short. `malloc()` keeps the stack from coming closer than `__malloc_margin` (128 bytes) to the heap, so allocations start failing before `freeMemory` reaches 0. Blocks from the fixed-size pools enabled with `-DBEAN_POOL_ALLOC=1` are static data, not heap, and aren't counted.
+   *
+   *  @return the current numbers
+   */
+  MemoryStats getMemoryStats(void);
+
   ///@}
 
 
+  /**
+   *  Runs the callbacks for events that have happened, such as those attached with `attachMotionEvent()`. This is called after every `loop()`; a sketch that stays inside `loop()` for a long time can call it to run them sooner.
+   */
+  void pollEvents(void);
+
   BeanClass() {}
 
  private:
@@ -840,6 +1377,56 @@ class BeanClass {
    */
   bool attemptSleep(uint32_t duration_ms);
 
+  /**
+   *  Battery level for getBatteryLevel() and getBatteryVoltage(), from the cache if fresh enough
+   */
+  uint8_t readBatteryLevel(void);
+
+  /**
+   *  Asks the CC2540 to push these motion events, noting whether it can
+   */
+  void motionPushEnable(uint8_t events);
+
+  /**
+   *  Appends an AD structure header to the advertisement being built, returning where its data goes, or NULL if it doesn't fit
+   */
+  uint8_t *advertisementReserve(uint8_t type, uint8_t length);
+
+  /**
+   *  Asks the CC2540 to push client writes to these scratch banks, noting whether it can
+   */
+  void scratchPushEnable(uint8_t bankMask);
+
+  /**
+   *  Connection and advertising states, pushed by the CC2540 if it can, or asked for
+   */
+  bool readStates(BT_STATES_T *states);
+
+  /**
+   *  Runs the `onConnect()` and `onDisconnect()` callbacks for changes pushed or polled since the last call
+   */
+  void pollConnectionEvents(void);
+
+  /**
+   *  Shows the next color of an LED animation the core plays, and sets the timer for the one after
+   */
+  static void ledAnimationTick(void *arg);
+
+  /**
+   *  Forgets the animation playing, when it ends or the LED is set some other way
+   */
+  static void ledAnimationHalt(void);
+
+  /**
+   *  Reads scratch banks and runs the `onScratchWrite()` callbacks for those that changed
+   */
+  void scratchCheckBanks(uint8_t bankMask);
+
+  /**
+   *  Runs the `onScratchWrite()` callbacks for writes pushed or polled since the last call
+   */
+  void pollScratchWrites(void);
+
   /**
    *  Needs docs
    */
@@ -0,0 +1,286 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include "Arduino.h"
+#include "wiring_private.h"
+#include "BeanAdc.h"
+
+BeanAdcClass BeanAdc;
+
+extern "C" uint8_t analog_reference;  // wiring_analog.c
+
+#define NO_SCAN (0xFF)
+
+// The ADMUX value for each pin of the scan, with the reference.
+static uint8_t adc_mux[BEAN_ADC_MAX_CHANNELS];
+static uint8_t adc_count = 0;
+static uint8_t adc_trigger = BEAN_ADC_CONTINUOUS;
+static volatile bool adc_running = false;
+
+// The ISR fills samples[adc_fill] while samples[adc_ready] holds the last
+// complete scan, then swaps them.
+static volatile uint16_t adc_samples[2][BEAN_ADC_MAX_CHANNELS];
+static volatile uint8_t adc_index = 0;
+static volatile uint8_t adc_fill = 0;
+static volatile uint8_t adc_ready = NO_SCAN;
+static volatile uint8_t adc_scans = 0;
+static uint8_t adc_scans_read = 0;
+
+// The first conversion after begin() may still see the old reference.
+static volatile bool adc_discard = false;
+
+// Oversampling adds up adc_sum_target conversions of a pin in adc_sum, then
+// keeps the sum shifted right by adc_extra_bits.
+static uint8_t adc_extra_bits = 0;
+static uint16_t adc_sum_target = 1;
+static volatile uint16_t adc_sum_count = 0;
+static volatile uint32_t adc_sum = 0;
+
+// readOversampled() takes each conversion from the ISR through these.
+static volatile uint16_t adc_single_value;
+static volatile bool adc_single_done;
+
+static BeanTask adc_task = NULL;
+static void *adc_task_arg = NULL;
+static volatile bool adc_task_pending = false;
+
+static void adc_run_task(void *) {
+  adc_task_pending = false;
+  BeanTask task = adc_task;
+  if (task != NULL) {
+    task(adc_task_arg);
+  }
+}
+
+// An auto trigger only starts a conversion on the rising edge of its flag, so
+// a flag no interrupt handler clears has to be cleared here.
+static void adc_rearm_trigger(void) {
+  switch (adc_trigger) {
+    case BEAN_ADC_COMPARATOR:
+      if (bit_is_clear(ACSR, ACIE)) {
+        sbi(ACSR, ACI);
+      }
+      break;
+    case BEAN_ADC_EXTERNAL_INT0:
+      if (bit_is_clear(EIMSK, INT0)) {
+        EIFR = _BV(INTF0);
+      }
+      break;
+    case BEAN_ADC_TIMER0_COMPARE_A:
+      if (bit_is_clear(TIMSK0, OCIE0A)) {
+        TIFR0 = _BV(OCF0A);
+      }
+      break;
+    case BEAN_ADC_TIMER0_OVERFLOW:
+      if (bit_is_clear(TIMSK0, TOIE0)) {
+        TIFR0 = _BV(TOV0);
+      }
+      break;
+    case BEAN_ADC_TIMER1_COMPARE_B:
+      if (bit_is_clear(TIMSK1, OCIE1B)) {
+        TIFR1 = _BV(OCF1B);
+      }
+      break;
+    case BEAN_ADC_TIMER1_OVERFLOW:
+      if (bit_is_clear(TIMSK1, TOIE1)) {
+        TIFR1 = _BV(TOV1);
+      }
+      break;
+    case BEAN_ADC_TIMER1_CAPTURE:
+      if (bit_is_clear(TIMSK1, ICIE1)) {
+        TIFR1 = _BV(ICF1);
+      }
+      break;
+  }
+}
+
+bool BeanAdcClass::begin(const uint8_t *pins, uint8_t count,
+                         BeanAdcTrigger trigger, uint8_t oversampleBits) {
+  if (count == 0 || count > BEAN_ADC_MAX_CHANNELS ||
+      oversampleBits > BEAN_ADC_MAX_OVERSAMPLE_BITS) {
+    return false;
+  }
+  end();
+
+  for (uint8_t i = 0; i < count; i++) {
+    adc_mux[i] =
+        (analog_reference << 6) | (analog_pin_to_channel(pins[i]) & 0x07);
+  }
+  adc_count = count;
+  adc_trigger = trigger;
+  adc_index = 0;
+  adc_fill = 0;
+  adc_ready = NO_SCAN;
+  adc_scans = 0;
+  adc_scans_read = 0;
+  adc_discard = true;
+  adc_extra_bits = oversampleBits;
+  adc_sum_target = (uint16_t)1 << (2 * oversampleBits);
+  adc_sum_count = 0;
+  adc_sum = 0;
+  adc_running = true;
+  bean_adc_resume_hook = resume;
+
+  ADMUX = adc_mux[0];
+  ADCSRA |= _BV(ADEN) | _BV(ADIF);  // writing ADIF clears it
+  if (trigger == BEAN_ADC_CONTINUOUS) {
+    ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+    ADCSRA |= _BV(ADIE) | _BV(ADSC);
+  } else {
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | trigger;
+    adc_rearm_trigger();
+    ADCSRA |= _BV(ADIE) | _BV(ADATE);
+  }
+  return true;
+}
+
+void BeanAdcClass::end(void) {
+  if (!adc_running) {
+    return;
+  }
+  ADCSRA &= ~(_BV(ADIE) | _BV(ADATE));
+  adc_running = false;
+
+  // let a conversion that already started finish, so analogRead() doesn't
+  // pick up its result
+  while (bit_is_set(ADCSRA, ADSC) && bit_is_set(ADCSRA, ADEN)) {
+  }
+  ADCSRA |= _BV(ADIF);
+  ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+}
+
+bool BeanAdcClass::running(void) {
+  return adc_running;
+}
+
+void BeanAdcClass::onScan(BeanTask task, void *arg) {
+  uint8_t oldSREG = SREG;
+  cli();
+  adc_task = task;
+  adc_task_arg = arg;
+  SREG = oldSREG;
+}
+
+uint8_t BeanAdcClass::scans(void) {
+  return adc_scans;
+}
+
+uint16_t BeanAdcClass::value(uint8_t index) {
+  uint16_t value = 0;
+  uint8_t oldSREG = SREG;
+  cli();
+  if (index < adc_count && adc_ready != NO_SCAN) {
+    value = adc_samples[adc_ready][index];
+  }
+  SREG = oldSREG;
+  return value;
+}
+
+bool BeanAdcClass::readScan(uint16_t *values) {
+  uint8_t oldSREG = SREG;
+  cli();
+  for (uint8_t i = 0; i < adc_count; i++) {
+    values[i] = adc_ready != NO_SCAN ? adc_samples[adc_ready][i] : 0;
+  }
+  bool fresh = adc_scans != adc_scans_read;
+  adc_scans_read = adc_scans;
+  SREG = oldSREG;
+  return fresh;
+}
+
+uint16_t BeanAdcClass::readOversampled(uint8_t pin, uint8_t extraBits,
+                                       bool noiseReduction) {
+  if (adc_running || extraBits > BEAN_ADC_MAX_OVERSAMPLE_BITS) {
+    return 0;
+  }
+
+  ADMUX = (analog_reference << 6) | (analog_pin_to_channel(pin) & 0x07);
+  ADCSRA |= _BV(ADEN) | _BV(ADIF);
+  ADCSRA |= _BV(ADIE);
+  set_sleep_mode(noiseReduction ? SLEEP_MODE_ADC : SLEEP_MODE_IDLE);
+
+  uint32_t sum = 0;
+  uint16_t conversions = (uint16_t)1 << (2 * extraBits);
+  for (uint16_t i = 0; i < conversions; i++) {
+    adc_single_done = false;
+    // entering noise reduction mode starts the conversion itself
+    if (!noiseReduction) {
+      sbi(ADCSRA, ADSC);
+    }
+    // other interrupts wake us too, so go back to sleep until it's done; with
+    // interrupts off between the check and sleep_cpu(), sei's one
+    // instruction delay means the ADC interrupt can't slip in between
+    cli();
+    while (!adc_single_done) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      cli();
+    }
+    sei();
+    sum += adc_single_value;
+  }
+
+  ADCSRA &= ~_BV(ADIE);
+  return sum >> extraBits;
+}
+
+void BeanAdcClass::resume(void) {
+  if (adc_running && adc_trigger == BEAN_ADC_CONTINUOUS) {
+    ADMUX = adc_mux[adc_index];
+    sbi(ADCSRA, ADSC);
+  }
+}
+
+void BeanAdcClass::conversionComplete(void) {
+  // ADCL first, which locks the result until ADCH is read
+  uint8_t low = ADCL;
+  uint8_t high = ADCH;
+
+  if (!adc_running) {
+    adc_single_value = (high << 8) | low;
+    adc_single_done = true;
+    return;
+  }
+
+  uint8_t next = adc_index;
+  bool complete = false;
+  if (adc_discard) {
+    adc_discard = false;
+  } else if (++adc_sum_count < adc_sum_target) {
+    // the same pin again
+    adc_sum += (high << 8) | low;
+  } else {
+    uint32_t sum = adc_sum + ((high << 8) | low);
+    adc_samples[adc_fill][next] = sum >> adc_extra_bits;
+    adc_sum_count = 0;
+    adc_sum = 0;
+    if (++next == adc_count) {
+      next = 0;
+      complete = true;
+    }
+  }
+
+  // the multiplexer is latched when the next conversion starts
+  ADMUX = adc_mux[next];
+  if (adc_trigger == BEAN_ADC_CONTINUOUS) {
+    sbi(ADCSRA, ADSC);
+  } else {
+    adc_rearm_trigger();
+  }
+
+  adc_index = next;
+  if (complete) {
+    adc_ready = adc_fill;
+    adc_fill ^= 1;
+    adc_scans++;
+    if (adc_task != NULL && !adc_task_pending) {
+      adc_task_pending = BeanScheduler.defer(adc_run_task);
+    }
+  }
+}
+
+ISR(ADC_vect) {
+  BeanAdc.conversionComplete();
+}
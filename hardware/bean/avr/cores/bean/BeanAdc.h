@@ -0,0 +1,131 @@
+#ifndef BEAN_ADC_H
+#define BEAN_ADC_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "BeanScheduler.h"
+
+// The most pins a scan can take.  It can be set from compiler.cpp.extra_flags
+// in platform.local.txt.
+#ifndef BEAN_ADC_MAX_CHANNELS
+#define BEAN_ADC_MAX_CHANNELS (4)
+#endif
+
+// The most resolution oversampling can add: 4 bits, 14-bit readings from 256
+// conversions each.
+#define BEAN_ADC_MAX_OVERSAMPLE_BITS (4)
+
+/**
+ *  What starts each conversion of an ADC scan, see `BeanAdc.begin()`
+ */
+typedef enum BeanAdcTrigger {
+  BEAN_ADC_CONTINUOUS = 0xFF,        /**< the next conversion starts as soon as one finishes */
+  BEAN_ADC_COMPARATOR = 1,           /**< the analog comparator output rising */
+  BEAN_ADC_EXTERNAL_INT0 = 2,        /**< a rising edge on INT0 */
+  BEAN_ADC_TIMER0_COMPARE_A = 3,     /**< Timer0 matching OCR0A */
+  BEAN_ADC_TIMER0_OVERFLOW = 4,      /**< Timer0 overflowing, every 2.048 ms with the core's `millis()` setup */
+  BEAN_ADC_TIMER1_COMPARE_B = 5,     /**< Timer1 matching OCR1B */
+  BEAN_ADC_TIMER1_OVERFLOW = 6,      /**< Timer1 overflowing */
+  BEAN_ADC_TIMER1_CAPTURE = 7        /**< a Timer1 input capture */
+} BeanAdcTrigger;
+
+class BeanAdcClass {
+  friend class BeanClass;
+
+ public:
+  /****************************************************************************/
+  /** @name ADC
+   *  Read analog pins in the background. The ADC interrupt converts each pin of a scan in turn and keeps the last complete scan, so `loop()` never waits on a conversion.
+   */
+  ///@{
+
+  /**
+   *  Starts scanning pins, round-robin, until `end()`. Each conversion takes about 13 ADC clocks, 208 µs with the core's ADC clock, so a continuous scan of n pins completes every n * 208 µs.
+   *
+   *  While a scan runs `analogRead()` would change the ADC under it, so read through `value()` and `readScan()` instead. The reference is the one set with `analogReference()`.
+   *
+   *  A trigger other than `BEAN_ADC_CONTINUOUS` converts one pin per trigger event, using the ADC's auto trigger. The timer or pin has to be set up to produce the event; if its interrupt isn't enabled, the event flag is cleared for the next trigger.
+   *
+   *  With oversampling each pin is converted 4^oversampleBits times in a row and the sum is decimated to a 10 + oversampleBits bit reading, all in the interrupt. The extra bits are only real if the signal carries at least 1 LSB of noise, which most sensors do; a very clean signal needs dither added to it. A scan takes 4^oversampleBits times as long.
+   *
+   *  @param pins analog pins, as for `analogRead()`, copied
+   *  @param count how many, up to BEAN_ADC_MAX_CHANNELS (4 by default)
+   *  @param trigger what starts each conversion
+   *  @param oversampleBits bits of resolution to add, 0 to BEAN_ADC_MAX_OVERSAMPLE_BITS (4)
+   *  @return false if count is 0 or too large, or oversampleBits is too large
+   */
+  bool begin(const uint8_t *pins, uint8_t count,
+             BeanAdcTrigger trigger = BEAN_ADC_CONTINUOUS,
+             uint8_t oversampleBits = 0);
+
+  /**
+   *  Stops scanning, after which `analogRead()` can be used again.
+   */
+  void end(void);
+
+  /**
+   *  @return true between `begin()` and `end()`
+   */
+  bool running(void);
+
+  /**
+   *  Runs a task after each complete scan, between calls to `loop()`. Scans that complete before it runs run it once.
+   *
+   *  @param task the function to run, or NULL for none
+   *  @param arg passed to task
+   */
+  void onScan(BeanTask task, void *arg = NULL);
+
+  /**
+   *  @return how many scans have completed since `begin()`, wrapping at 255; compare with an earlier value to tell whether there is a new one
+   */
+  uint8_t scans(void);
+
+  /**
+   *  Reads one pin from the last complete scan.
+   *
+   *  @param index the pin's position in the list given to `begin()`
+   *  @return its 10-bit reading, more with oversampling, or 0 before the first scan completes
+   */
+  uint16_t value(uint8_t index);
+
+  /**
+   *  Copies the last complete scan, all from the same pass over the pins.
+   *
+   *  @param values where to put one reading per pin, in the order given to `begin()`
+   *  @return true if a scan completed since the last `readScan()`
+   */
+  bool readScan(uint16_t *values);
+
+  /**
+   *  Reads one pin with more than 10 bits of resolution, converting it 4^extraBits times and decimating the sum, as `begin()` does for a scan. The CPU sleeps between conversions instead of polling, waking from the ADC interrupt; 14 bits take 256 conversions, about 53 ms.
+   *
+   *  With noiseReduction the CPU sleeps in ADC noise reduction mode, which stops the I/O clock during each conversion for a quieter reading. Nothing that needs that clock runs meanwhile: `millis()` falls behind by the conversion time, and bytes arriving from the CC2540 or on a serial pin can be lost, so use it only while the link is quiet.
+   *
+   *  @param pin an analog pin, as for `analogRead()`
+   *  @param extraBits bits of resolution to add, 0 to BEAN_ADC_MAX_OVERSAMPLE_BITS (4)
+   *  @param noiseReduction true to sleep in ADC noise reduction mode
+   *  @return the 10 + extraBits bit reading, or 0 if a scan is running or extraBits is too large
+   */
+  uint16_t readOversampled(uint8_t pin, uint8_t extraBits,
+                           bool noiseReduction = false);
+  ///@}
+
+  // Called from the ADC interrupt.
+  void conversionComplete(void);
+
+  BeanAdcClass() {}
+
+ private:
+  // Restarts a continuous scan that Bean.sleep() stopped by turning the ADC
+  // off.
+  static void resume(void);
+};
+
+extern BeanAdcClass BeanAdc;
+
+// Bean.sleep() restarts a scan through this, set by begin(), so sketches
+// that never scan don't link BeanAdc and its ADC interrupt.
+extern void (*bean_adc_resume_hook)(void);
+
+#endif
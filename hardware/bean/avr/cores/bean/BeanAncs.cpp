@@ -1,9 +1,66 @@
 #include "BeanAncs.h"
 #include "BeanSerialTransport.h"
+#include "BeanScheduler.h"
 
 BeanAncsClass BeanAncs;
 
+static AncsAttributeCallback attributeCallback = NULL;
+static bool attributeCallbackDone = true;
+
+// Prefetching.  Once it is on, notifications are taken out of the
+// transport's ANCS buffer as they arrive and held in the prefetch queue
+// until their attributes are in: the app identifier, when the CC didn't take
+// the filter and the category alone doesn't pass it, then the attribute set
+// with prefetchAttribute().  Entries from prefetchTail to prefetchDone are
+// ready for the sketch and those from prefetchDone to prefetchHead are still
+// being fetched, one at a time.  Entries before prefetchTail have been read
+// but keep their attribute for getNotificationAttributes() until their slot
+// is taken again.
+#if (BEAN_ANCS_PREFETCH_QUEUE_SIZE & (BEAN_ANCS_PREFETCH_QUEUE_SIZE - 1))
+#error BEAN_ANCS_PREFETCH_QUEUE_SIZE must be a power of two
+#endif
+
+#define ANCS_EVENT_REMOVED (2)
+#define ANCS_ATTRIBUTE_APP_ID ((NOTI_ATTR_ID_T)0)  // AppIdentifier
+
+enum {
+  PREFETCH_APP_ID = 1,
+  PREFETCH_ATTRIBUTE,
+  PREFETCH_READY,
+  PREFETCH_DROPPED,
+};
+
+struct AncsPrefetched {
+  ANCS_SOURCE_MSG_T header;
+  uint8_t state;
+  uint8_t length;  // 0 if the attribute isn't here
+  uint8_t data[BEAN_ANCS_PREFETCH_LENGTH];
+};
+
+struct AncsPrefetch {
+  AncsPrefetched entries[BEAN_ANCS_PREFETCH_QUEUE_SIZE];
+  AncsFilter filter;
+  uint8_t appId[BEAN_ANCS_MAX_APP_ID];
+};
+
+static AncsPrefetch *prefetch = NULL;
+static uint8_t prefetchHead = 0;
+static uint8_t prefetchDone = 0;
+static uint8_t prefetchTail = 0;
+static bool prefetchFetching = false;
+static bool prefetchAppCheck = false;
+static NOTI_ATTR_ID_T prefetchType;
+static uint8_t prefetchLength = 0;
+static uint32_t prefetchStarted;
+static int8_t prefetchTimer = -1;
+
+// A requestNotificationAttributes() of the sketch's, which prefetching
+// leaves alone until it is done and read.
+static bool requestActive = false;
+static uint32_t requestStarted;
+
 void BeanAncsClass::enable(void) {
+  Serial.ancsRxBegin();
   ADV_SWITCH_ENABLED_T curServices = Bean.getServices();
   curServices.ancs = 1;
   Bean.setServices(curServices);
@@ -20,40 +77,401 @@ void BeanAncsClass::disable(void) {
   Bean.setServices(curServices);
 }
 
-int BeanAncsClass::notificationsAvailable() { return Serial.ancsAvailable(); }
 
+// The get notification attributes command (command ID 0) for one attribute,
+// as segments that point into the caller's variables.
+struct AttributeRequest {
+  uint8_t command;
+  uint8_t attribute;
+  uint8_t maxLen[2];
+  BeanTxSegment segments[4];
+};
+
+static void attributeRequestInit(AttributeRequest *request,
+                                 NOTI_ATTR_ID_T type, uint32_t *ID,
+                                 uint16_t len) {
+  request->command = 0;
+  request->attribute = type;
+  request->maxLen[0] = (uint8_t)(len & 0xFF);
+  request->maxLen[1] = (uint8_t)((len >> 8) & 0xFF);
+  BeanTxSegment segments[] = {
+      {&request->command, 1, false},
+      {ID, 4, false},
+      {&request->attribute, 1, false},
+      {request->maxLen, 2, false},
+  };
+  memcpy(request->segments, segments, sizeof(segments));
+}
+
+static AncsPrefetched *prefetchEntry(uint8_t index) {
+  return &prefetch->entries[index & (BEAN_ANCS_PREFETCH_QUEUE_SIZE - 1)];
+}
+
+// The newest ready entry for a notification, or NULL.
+static AncsPrefetched *prefetchFind(uint32_t ID) {
+  for (uint8_t i = 1; i <= BEAN_ANCS_PREFETCH_QUEUE_SIZE; i++) {
+    AncsPrefetched *entry = prefetchEntry(prefetchHead - i);
+    if (entry->state == PREFETCH_READY && entry->header.notiUID == ID &&
+        entry->header.eventID != ANCS_EVENT_REMOVED) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static bool prefetchCategoryPasses(const ANCS_SOURCE_MSG_T *header) {
+  return header->catID < 16 &&
+         (prefetch->filter.categories & (1 << header->catID));
+}
+
+// Moves notifications from the transport's buffer into free slots.
+void BeanAncsClass::prefetchTake(void) {
+  while ((uint8_t)(prefetchHead - prefetchTail) < BEAN_ANCS_PREFETCH_QUEUE_SIZE &&
+         Serial.ancsAvailable() > 0) {
+    AncsPrefetched *entry = prefetchEntry(prefetchHead);
+    Serial.readAncs((uint8_t *)&entry->header, sizeof(entry->header));
+    entry->length = 0;
+
+    if (entry->header.eventID == ANCS_EVENT_REMOVED) {
+      // gone from the device, so there is nothing left to fetch
+      bool keep = !prefetchAppCheck || prefetchCategoryPasses(&entry->header) ||
+                  prefetchFind(entry->header.notiUID) != NULL;
+      entry->state = keep ? PREFETCH_READY : PREFETCH_DROPPED;
+    } else if (prefetchAppCheck && !prefetchCategoryPasses(&entry->header)) {
+      entry->state = PREFETCH_APP_ID;
+    } else {
+      entry->state = prefetchLength > 0 ? PREFETCH_ATTRIBUTE : PREFETCH_READY;
+    }
+    prefetchHead++;
+  }
+}
+
+// Takes what the fetch for entry got.  A fetch that timed out keeps the
+// notification, so nothing the sketch wants is lost for a slow answer.
+void BeanAncsClass::prefetchFinish(uint8_t index, bool complete) {
+  AncsPrefetched *entry = prefetchEntry(index);
+  uint16_t length = Serial.ancsNotiSinkLength();
+
+  if (entry->state == PREFETCH_APP_ID) {
+    bool match = length == prefetch->filter.appIdLength &&
+                 memcmp(prefetch->appId, prefetch->filter.appId, length) == 0;
+    if (complete && !match) {
+      entry->state = PREFETCH_DROPPED;
+    } else {
+      entry->state = prefetchLength > 0 ? PREFETCH_ATTRIBUTE : PREFETCH_READY;
+    }
+  } else {
+    entry->length = complete ? (uint8_t)length : 0;
+    entry->state = PREFETCH_READY;
+  }
+}
+
+bool BeanAncsClass::requestBusy(void) {
+  if (requestActive &&
+      (Serial.ancsNotiRemaining() != 0 || Serial.ancsNotiDetailsAvailable() > 0) &&
+      millis() - requestStarted < BEAN_ANCS_PREFETCH_TIMEOUT) {
+    return true;
+  }
+  requestActive = false;
+  return false;
+}
+
+void BeanAncsClass::prefetchRun(void *arg) {
+  if (prefetch == NULL) {
+    return;
+  }
+
+  for (;;) {
+    prefetchTake();
+
+    if (prefetchFetching) {
+      int32_t remaining = Serial.ancsNotiRemaining();
+      if (remaining != 0 &&
+          millis() - prefetchStarted < BEAN_ANCS_PREFETCH_TIMEOUT) {
+        return;
+      }
+      prefetchEnd(remaining == 0);
+    }
+
+    while (prefetchDone != prefetchHead &&
+           prefetchEntry(prefetchDone)->state >= PREFETCH_READY) {
+      prefetchDone++;
+    }
+    if (prefetchDone == prefetchHead || requestBusy()) {
+      return;
+    }
+    if (prefetchStart(prefetchDone)) {
+      return;
+    }
+    prefetchFinish(prefetchDone, false);
+  }
+}
+
+void BeanAncsClass::prefetchTimeout(void *arg) {
+  prefetchTimer = -1;
+  prefetchRun(NULL);
+}
+
+void BeanAncsClass::prefetchArmTimer(void) {
+  if (prefetchTimer < 0) {
+    prefetchTimer = BeanScheduler.setTimeout(BEAN_ANCS_PREFETCH_TIMEOUT + 1,
+                                             prefetchTimeout);
+  }
+}
+
+void BeanAncsClass::prefetchEnd(bool complete) {
+  prefetchFetching = false;
+  if (prefetchTimer >= 0) {
+    BeanScheduler.cancel(prefetchTimer);
+    prefetchTimer = -1;
+  }
+  prefetchFinish(prefetchDone, complete);
+}
+
+// A request of the sketch's waits for the fetch under way to end, or time
+// out, before it goes to the CC: the answers carry no request id, so the
+// fetch's would otherwise be read as the request's.  Fetching then waits
+// for the request, see requestBusy().
+void BeanAncsClass::prefetchWait(void) {
+  if (!prefetchFetching) {
+    return;
+  }
+  int32_t remaining;
+  while ((remaining = Serial.ancsNotiRemaining()) != 0 &&
+         millis() - prefetchStarted < BEAN_ANCS_PREFETCH_TIMEOUT) {
+    bean_idle();
+  }
+  prefetchEnd(remaining == 0);
+}
+
+bool BeanAncsClass::prefetchStart(uint8_t index) {
+  AncsPrefetched *entry = prefetchEntry(index);
+  AttributeRequest request;
+  uint32_t ID = entry->header.notiUID;
+  bool started;
+
+  if (entry->state == PREFETCH_APP_ID) {
+    attributeRequestInit(&request, ANCS_ATTRIBUTE_APP_ID, &ID,
+                         BEAN_ANCS_MAX_APP_ID);
+    started = Serial.ancsNotiBegin(request.segments, 4, prefetch->appId,
+                                   BEAN_ANCS_MAX_APP_ID);
+  } else {
+    attributeRequestInit(&request, prefetchType, &ID, prefetchLength);
+    started = Serial.ancsNotiBegin(request.segments, 4, entry->data,
+                                   prefetchLength);
+  }
+  if (!started) {
+    return false;
+  }
+
+  prefetchFetching = true;
+  prefetchStarted = millis();
+  prefetchArmTimer();
+  return true;
+}
+
+bool BeanAncsClass::prefetchBegin(void) {
+  if (prefetch != NULL) {
+    return true;
+  }
+  prefetch = (AncsPrefetch *)calloc(1, sizeof(AncsPrefetch));
+  if (prefetch == NULL) {
+    return false;
+  }
+  Serial.ancsRxBegin();
+  return true;
+}
+
+// Runs after each MSG_ID_ANCS_GET_NOTI frame, from BeanScheduler.
+void BeanAncsClass::attributeEvent(void *arg) {
+  prefetchRun(NULL);
+  attributeDrain(NULL);
+}
+
+bool BeanAncsClass::setFilter(const AncsFilter *filter) {
+  bool ccFilters = Serial.ancsFilter(filter) == 0;
+  bool appCheck = !ccFilters && filter->appIdLength > 0;
+
+  if (appCheck || prefetch != NULL) {
+    if (!prefetchBegin() ||
+        !BeanScheduler.onMessage(MSG_ID_ANCS_READ, prefetchRun) ||
+        !BeanScheduler.onMessage(MSG_ID_ANCS_GET_NOTI, attributeEvent)) {
+      prefetchAppCheck = false;
+      return !appCheck;
+    }
+    prefetch->filter = *filter;
+    if (prefetch->filter.appIdLength > BEAN_ANCS_MAX_APP_ID) {
+      prefetch->filter.appIdLength = BEAN_ANCS_MAX_APP_ID;
+    }
+  }
+  prefetchAppCheck = appCheck;
+  return true;
+}
+
+bool BeanAncsClass::setFilter(uint16_t categories, const char *appId) {
+  AncsFilter filter = {categories, 0xFF, 0, 0, 0, {0}};
+  if (appId != NULL) {
+    filter.appIdLength = min(strlen(appId), BEAN_ANCS_MAX_APP_ID);
+    memcpy(filter.appId, appId, filter.appIdLength);
+  }
+  return setFilter(&filter);
+}
+
+bool BeanAncsClass::prefetchAttribute(NOTI_ATTR_ID_T type, uint8_t len) {
+  if (len == 0 && prefetch == NULL) {
+    return true;
+  }
+  if (!prefetchBegin() ||
+      !BeanScheduler.onMessage(MSG_ID_ANCS_READ, prefetchRun) ||
+      !BeanScheduler.onMessage(MSG_ID_ANCS_GET_NOTI, attributeEvent)) {
+    return false;
+  }
+
+  // a prefetch is only ever for the attribute now asked for
+  for (uint8_t i = 0; i < BEAN_ANCS_PREFETCH_QUEUE_SIZE; i++) {
+    prefetch->entries[i].length = 0;
+  }
+  prefetchType = type;
+  prefetchLength = min(len, BEAN_ANCS_PREFETCH_LENGTH);
+  prefetchRun(NULL);
+  return true;
+}
+
+int BeanAncsClass::notificationsAvailable() {
+  if (prefetch == NULL) {
+    return Serial.ancsAvailable();
+  }
+
+  prefetchRun(NULL);
+  int count = 0;
+  for (uint8_t i = prefetchTail; i != prefetchDone; i++) {
+    if (prefetchEntry(i)->state == PREFETCH_READY) {
+      count++;
+    }
+  }
+  return count;
+}
 
 int BeanAncsClass::getNotificationHeaders(ANCS_SOURCE_MSG_T *buffer, size_t max_length) {
-  int numMsgs = Serial.ancsAvailable();
-  int bytes_written = Serial.readAncs((uint8_t *)buffer, min(max_length, numMsgs) * 8);
+  if (prefetch == NULL) {
+    int numMsgs = Serial.ancsAvailable();
+    int bytes_written = Serial.readAncs((uint8_t *)buffer, min(max_length, numMsgs) * 8);
+
+    return bytes_written/8;
+  }
 
-  return bytes_written/8;
+  prefetchRun(NULL);
+  size_t count = 0;
+  while (count < max_length && prefetchTail != prefetchDone) {
+    AncsPrefetched *entry = prefetchEntry(prefetchTail++);
+    if (entry->state == PREFETCH_READY) {
+      buffer[count++] = entry->header;
+    }
+  }
+  // the freed slots can take the notifications waiting in the ANCS buffer
+  prefetchRun(NULL);
+  return count;
 }
 
 ANCS_SOURCE_MSG_T BeanAncsClass::getNotificationHeader() {
   ANCS_SOURCE_MSG_T msg = {0};
-  Serial.readAncs((uint8_t *)&msg, 8);
+  if (prefetch == NULL) {
+    Serial.readAncs((uint8_t *)&msg, 8);
+  } else {
+    getNotificationHeaders(&msg, 1);
+  }
   return msg;
 }
 
 int BeanAncsClass::getNotificationAttributes(NOTI_ATTR_ID_T type, uint32_t ID,
                                                 uint16_t len, uint8_t* data,
                                                     uint32_t timeout) {
-  uint8_t reqBuf[8];
-  reqBuf[0] = 0;  // get notification attributes command ID == 0
-  memcpy((void *)&reqBuf[1], &ID, 4);
-  reqBuf[5] = type;
-  reqBuf[6] = len & 0xFF;
-  reqBuf[7] = (len >> 8) & 0xFF;
-  return Serial.getAncsNotiDetails(reqBuf, sizeof(reqBuf), data, timeout);
+  if (prefetch != NULL && prefetchLength > 0 && type == prefetchType) {
+    // a full size attribute may have been cut short, so only answer a longer
+    // request from a shorter one
+    AncsPrefetched *entry = prefetchFind(ID);
+    if (entry != NULL && entry->length > 0 &&
+        (len <= entry->length || entry->length < prefetchLength)) {
+      uint8_t length = min(len, entry->length);
+      memcpy(data, entry->data, length);
+      return length;
+    }
+  }
+
+  AttributeRequest request;
+  attributeRequestInit(&request, type, &ID, len);
+  if (prefetch != NULL) {
+    prefetchWait();
+    requestActive = true;
+    requestStarted = millis();
+  }
+  int length = Serial.getAncsNotiDetails(request.segments, 4, data, timeout, len);
+  if (prefetch != NULL) {
+    requestActive = false;
+    prefetchRun(NULL);
+  }
+  return length;
+}
+
+bool BeanAncsClass::requestNotificationAttributes(NOTI_ATTR_ID_T type,
+                                                  uint32_t ID, uint16_t len) {
+  AttributeRequest request;
+  attributeRequestInit(&request, type, &ID, len);
+  attributeCallbackDone = false;
+  if (prefetch != NULL) {
+    prefetchWait();
+    requestActive = true;
+    requestStarted = millis();
+    prefetchArmTimer();
+  }
+  return Serial.ancsNotiBegin(request.segments, 4, NULL, 0);
+}
+
+int BeanAncsClass::attributeAvailable() {
+  return Serial.ancsNotiDetailsAvailable();
+}
+
+int BeanAncsClass::readAttribute(uint8_t *data, size_t max_length) {
+  return Serial.readAncsMessage(data, max_length);
+}
+
+bool BeanAncsClass::attributeComplete() {
+  return Serial.ancsNotiRemaining() == 0;
+}
+
+// Runs after each MSG_ID_ANCS_GET_NOTI frame, from BeanScheduler.
+void BeanAncsClass::attributeDrain(void *arg) {
+  uint8_t chunk[32];
+
+  while (attributeCallback != NULL && !attributeCallbackDone) {
+    uint8_t length = Serial.readAncsMessage(chunk, sizeof(chunk));
+    bool last = Serial.ancsNotiRemaining() == 0 &&
+                Serial.ancsNotiDetailsAvailable() == 0;
+    if (length == 0 && !last) {
+      break;
+    }
+    attributeCallbackDone = last;
+    attributeCallback(chunk, length, last);
+  }
+}
+
+bool BeanAncsClass::onAttributeData(AncsAttributeCallback callback) {
+  attributeCallback = callback;
+  if (prefetch != NULL) {
+    return BeanScheduler.onMessage(MSG_ID_ANCS_GET_NOTI, attributeEvent);
+  }
+  return BeanScheduler.onMessage(MSG_ID_ANCS_GET_NOTI,
+                                 callback ? attributeDrain : NULL);
 }
 
 void BeanAncsClass::notificationAction(uint32_t ID, uint8_t actionID) {
-  uint8_t reqBuf[6];
-  reqBuf[0] = 2;  // command ID perform notifcation action
-  memcpy((void *)&reqBuf[1], &ID, sizeof(uint32_t));
-  reqBuf[5] = actionID;
-  Serial.write_message(MSG_ID_ANCS_GET_NOTI, reqBuf, sizeof(reqBuf));
+  uint8_t command = 2;  // command ID perform notifcation action
+  BeanTxSegment request[] = {
+      {&command, 1, false},
+      {&ID, sizeof(uint32_t), false},
+      {&actionID, 1, false},
+  };
+  Serial.write_message_v(MSG_ID_ANCS_GET_NOTI, request, 3);
 }
 
 
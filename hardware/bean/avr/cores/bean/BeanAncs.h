@@ -3,6 +3,19 @@
 
 #include "Arduino.h"
 #include "applicationMessageHeaders/AppMessages.h"
+#include "BeanSerialTransport.h"
+
+// Prefetching, see BeanAncs.prefetchAttribute().  These can be set from
+// compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_ANCS_PREFETCH_QUEUE_SIZE
+#define BEAN_ANCS_PREFETCH_QUEUE_SIZE (4)  // notifications, a power of two
+#endif
+#ifndef BEAN_ANCS_PREFETCH_LENGTH
+#define BEAN_ANCS_PREFETCH_LENGTH (24)  // attribute bytes kept for each
+#endif
+#ifndef BEAN_ANCS_PREFETCH_TIMEOUT
+#define BEAN_ANCS_PREFETCH_TIMEOUT (1000)  // ms to wait for an attribute
+#endif
 
 /**
  *  Needs docs
@@ -14,6 +27,26 @@ typedef ANCS_SOURCE_MSG_T AncsNotification;
  */
 typedef NOTI_ATTR_ID_T AncsNotificationAttribute;
 
+/**
+ *  Which notifications to keep, see `setFilter()`. A notification must meet every rule:
+ *
+ *  * `events`: bit n set accepts EventID n: 0 added, 1 modified, 2 removed; 0xFF accepts all
+ *  * `flagsSet`: EventFlags bits that must all be set, e.g. 0x02 for important notifications only
+ *  * `flagsClear`: EventFlags bits that must all be clear, e.g. 0x04 to skip the notifications already on the device when it connected
+ *  * `categories`: bit n set accepts CategoryID n, e.g. bit 1 for incoming calls; 0xFFFF accepts all
+ *  * `appId`: also accept notifications of any category from the app with this identifier, e.g. "com.apple.MobileSMS", the first `appIdLength` characters of up to BEAN_ANCS_MAX_APP_ID (32); a length of 0 accepts no app on top of `categories`
+ */
+typedef BEAN_ANCS_FILTER_T AncsFilter;
+
+/**
+ *  Called with each chunk of a notification attribute requested with `requestNotificationAttributes()`, see `onAttributeData()`.
+ *
+ *  @param data the next bytes of the attribute
+ *  @param length the number of bytes in data, which may be 0 for the last call
+ *  @param last true if this is the end of the attribute
+ */
+typedef void (*AncsAttributeCallback)(const uint8_t *data, uint8_t length, bool last);
+
 
 class BeanAncsClass {
  public:
@@ -68,6 +101,7 @@ class BeanAncsClass {
 
   /**
    *  This function can be used to request details about a particular notification.  It can only be used to access one type of notification at a time and will block the thread until it receives a message.
+   *  Incoming bytes are written straight into data as they arrive, so no part of a long attribute is lost while waiting.
    *  @param type is the type of data the user wishes to receive of type NOTI_ATTR_ID_T
    *  @param ID is the UUID of the notification as contained in ANCS_SOURCE_MSG_T.
    *  @param len is the max number of bytes to receive into data.  The maximum possible is 65535 bytes.
@@ -94,7 +128,89 @@ class BeanAncsClass {
    *  @param actionID the ID of the action to perform.  There are only two: ActionIDPositive(0x00) and ActionIDNegative(0x01).  The result of the action is dependent on the notification.
    */
   void notificationAction(uint32_t ID, uint8_t actionID);
+
+  /**
+   *  Requests details about a notification without waiting for them. Read the attribute as it arrives with `attributeAvailable()` and `readAttribute()`, or have it passed to a callback set with `onAttributeData()`.
+   *
+   *  The attribute passes through a buffer of BEAN_ANCS_MESSAGE_BUFFER_SIZE bytes (64 by default), so read it at least that often; bytes that arrive while it is full are lost. To receive a long attribute without reading it as it arrives, use `getNotificationAttributes()`.
+   *
+   *  @param type is the type of data the user wishes to receive of type NOTI_ATTR_ID_T
+   *  @param ID is the UUID of the notification as contained in ANCS_SOURCE_MSG_T.
+   *  @param len is the max number of bytes to receive
+   *  @return false if there wasn't enough memory to start
+   */
+  bool requestNotificationAttributes(NOTI_ATTR_ID_T type, uint32_t ID, uint16_t len);
+
+  /**
+   *  @return the number of attribute bytes ready for `readAttribute()`
+   */
+  int attributeAvailable();
+
+  /**
+   *  Reads the next bytes of the attribute requested with `requestNotificationAttributes()`.
+   *  @param data the user defined buffer to fill
+   *  @param max_length the size of data
+   *  @return the number of bytes read
+   */
+  int readAttribute(uint8_t *data, size_t max_length);
+
+  /**
+   *  @return true once all of the requested attribute has arrived. Some of it may still be waiting for `readAttribute()`.
+   */
+  bool attributeComplete();
+
+  /**
+   *  Passes the attribute requested with `requestNotificationAttributes()` to a callback as it arrives, instead of reading it with `readAttribute()`. The callback runs between calls to `loop()`, see BeanScheduler.
+   *
+   *  @param callback the function to call, or NULL to stop
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onAttributeData(AncsAttributeCallback callback);
+
+  /**
+   *  Keeps only the notifications that pass a filter, so the others don't take up room in the ANCS buffer and the sketch never has to read them. The filter is handed to the CC2540 where its firmware supports it, so unwanted notifications don't even cross to the ATmega.
+   *
+   *  Where it doesn't, the filter is checked as each notification arrives. The app identifier is not part of a notification, so with an `appId` set each notification outside `categories` is held back while its app identifier is fetched, as with `prefetchAttribute()`, and only counted by `notificationsAvailable()` if it matches. A removed event is kept if the notification it removes was.
+   *
+   *  @param filter the rules, see AncsFilter
+   *  @return false if there wasn't enough memory to hold notifications back to check their app
+   */
+  bool setFilter(const AncsFilter *filter);
+
+  /**
+   *  Keeps only notifications in some categories, or from one app, see `setFilter(const AncsFilter *)`. Added, modified and removed events are all kept.
+   *
+   *  @param categories bit n set accepts CategoryID n, e.g. `_BV(1)` for incoming calls
+   *  @param appId also accept notifications from this app, or NULL for none
+   *  @return false if there wasn't enough memory to hold notifications back to check their app
+   */
+  bool setFilter(uint16_t categories, const char *appId = NULL);
+
+  /**
+   *  Fetches an attribute of every new notification as soon as it arrives, before the notification can be removed from the iOS device and while the sketch is busy. A notification is only counted by `notificationsAvailable()` once its attribute is in, and `getNotificationAttributes()` for that attribute then returns straight away without asking the iOS device.
+   *
+   *  Up to BEAN_ANCS_PREFETCH_QUEUE_SIZE notifications (4 by default) are held with BEAN_ANCS_PREFETCH_LENGTH bytes of attribute each (24 by default), taking about 200 bytes of memory from the first call on, or the first `setFilter()` that needs it; more wait in the ANCS buffer. A fetch that gets no answer within BEAN_ANCS_PREFETCH_TIMEOUT ms (1000 by default) is given up and the notification passed on without it. Fetching runs between calls to `loop()`, and waits while a request of the sketch's own is under way; a request of the sketch's first waits, up to BEAN_ANCS_PREFETCH_TIMEOUT, for a fetch under way to end.
+   *
+   *  @param type the attribute to fetch, of type NOTI_ATTR_ID_T
+   *  @param len the most bytes to fetch, up to BEAN_ANCS_PREFETCH_LENGTH, or 0 to stop prefetching
+   *  @return false if there wasn't enough memory, or BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool prefetchAttribute(NOTI_ATTR_ID_T type, uint8_t len);
   ///@}
+
+ private:
+  static void attributeDrain(void *arg);
+  static void attributeEvent(void *arg);
+  static bool prefetchBegin(void);
+  static void prefetchTake(void);
+  static bool prefetchStart(uint8_t index);
+  static void prefetchFinish(uint8_t index, bool complete);
+  static void prefetchEnd(bool complete);
+  static void prefetchWait(void);
+  static bool requestBusy(void);
+  static void prefetchRun(void *arg);
+  static void prefetchTimeout(void *arg);
+  static void prefetchArmTimer(void);
 };
 
 extern BeanAncsClass BeanAncs;
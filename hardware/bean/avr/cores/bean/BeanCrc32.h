@@ -0,0 +1,101 @@
+#ifndef BEAN_CRC32_H
+#define BEAN_CRC32_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+// CRC32 (IEEE 802.3, reflected polynomial 0xEDB88320) used to frame every
+// message between the ATmega and the CC.
+//
+// Three implementations are provided.  The transport uses the one selected by
+// BEAN_CRC32_IMPL, which can be set from compiler.cpp.extra_flags in
+// platform.local.txt, e.g. -DBEAN_CRC32_IMPL=BEAN_CRC32_BYTE_TABLE.
+//
+//   BEAN_CRC32_BITWISE      no table, eight shift/XOR steps per byte
+//   BEAN_CRC32_NIBBLE_TABLE 64 byte PROGMEM table, two lookups per byte
+//   BEAN_CRC32_BYTE_TABLE   1 KB PROGMEM table, one lookup per byte
+//
+// All three are always available under their own names (the benchmark sketch
+// compares them); tables that are never referenced are dropped at link time
+// by --gc-sections.
+#define BEAN_CRC32_BITWISE (0)
+#define BEAN_CRC32_NIBBLE_TABLE (1)
+#define BEAN_CRC32_BYTE_TABLE (2)
+
+#ifndef BEAN_CRC32_IMPL
+#define BEAN_CRC32_IMPL BEAN_CRC32_NIBBLE_TABLE
+#endif
+
+extern const uint32_t PROGMEM bean_crc32_nibble_table[16];
+extern const uint32_t PROGMEM bean_crc32_byte_table[256];
+
+// Streaming API.  The running state is kept un-inverted so that the per byte
+// update (called from the RX ISR) is as cheap as possible:
+//
+//   uint32_t state = bean_crc32_begin();
+//   state = bean_crc32_update(state, buf, len);
+//   state = bean_crc32_update_byte(state, c);
+//   uint32_t crc = bean_crc32_finish(state);
+static inline uint32_t bean_crc32_begin(void) { return 0xFFFFFFFFUL; }
+static inline uint32_t bean_crc32_finish(uint32_t state) { return ~state; }
+
+static inline uint32_t bean_crc32_update_byte_bitwise(uint32_t state,
+                                                      uint8_t c) {
+  state ^= c;
+  for (uint8_t k = 0; k < 8; k++) {
+    // If CRC LSB is 1, right shift CRC, then XOR CRC with 0xEDB88320
+    // Otherwise, just right shift CRC
+    state = state & 1 ? (state >> 1) ^ 0xEDB88320UL : state >> 1;
+  }
+  return state;
+}
+
+static inline uint32_t bean_crc32_update_byte_nibble(uint32_t state,
+                                                     uint8_t c) {
+  state ^= c;
+  state = (state >> 4) ^ pgm_read_dword(&bean_crc32_nibble_table[state & 0x0F]);
+  state = (state >> 4) ^ pgm_read_dword(&bean_crc32_nibble_table[state & 0x0F]);
+  return state;
+}
+
+static inline uint32_t bean_crc32_update_byte_table(uint32_t state,
+                                                    uint8_t c) {
+  return (state >> 8) ^
+         pgm_read_dword(&bean_crc32_byte_table[(uint8_t)state ^ c]);
+}
+
+uint32_t bean_crc32_update_bitwise(uint32_t state, const uint8_t *buf,
+                                   uint16_t len);
+uint32_t bean_crc32_update_nibble(uint32_t state, const uint8_t *buf,
+                                  uint16_t len);
+uint32_t bean_crc32_update_table(uint32_t state, const uint8_t *buf,
+                                 uint16_t len);
+
+// The build-selected implementation.
+static inline uint32_t bean_crc32_update_byte(uint32_t state, uint8_t c) {
+#if BEAN_CRC32_IMPL == BEAN_CRC32_BYTE_TABLE
+  return bean_crc32_update_byte_table(state, c);
+#elif BEAN_CRC32_IMPL == BEAN_CRC32_NIBBLE_TABLE
+  return bean_crc32_update_byte_nibble(state, c);
+#else
+  return bean_crc32_update_byte_bitwise(state, c);
+#endif
+}
+
+static inline uint32_t bean_crc32_update(uint32_t state, const uint8_t *buf,
+                                         uint16_t len) {
+#if BEAN_CRC32_IMPL == BEAN_CRC32_BYTE_TABLE
+  return bean_crc32_update_table(state, buf, len);
+#elif BEAN_CRC32_IMPL == BEAN_CRC32_NIBBLE_TABLE
+  return bean_crc32_update_nibble(state, buf, len);
+#else
+  return bean_crc32_update_bitwise(state, buf, len);
+#endif
+}
+
+// One-shot helper, equivalent to begin/update/finish over a single buffer.
+static inline uint32_t bean_crc32(const uint8_t *buf, uint16_t len) {
+  return bean_crc32_finish(bean_crc32_update(bean_crc32_begin(), buf, len));
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "Arduino.h"
+#include "BeanScheduler.h"
+#include "BeanEncoder.h"
+#include "BeanPinChange.h"
+
+BeanEncoderClass BeanEncoder;
+
+// Marks a change of both pins at once in encoder_steps.
+#define MISSED (2)
+
+// The step for each change of pin state, indexed by the old state times
+// four plus the new one.  A state is A << 1 | B, and going forward runs
+// through 00, 01, 11, 10.
+static const int8_t encoder_steps[16] PROGMEM = {
+    0, 1, -1, MISSED,
+    -1, 0, MISSED, 1,
+    1, MISSED, 0, -1,
+    MISSED, -1, 1, 0,
+};
+
+typedef struct {
+  bool active;
+  // which pin register each pin is in, true for PIND and false for PINB
+  bool a_on_d;
+  bool b_on_d;
+  uint8_t a_mask;
+  uint8_t b_mask;
+  uint8_t state;
+  volatile int32_t count;
+  volatile uint8_t missed;
+  volatile bool overflowed;
+  int32_t last_count;
+  unsigned long last_time;
+  int32_t velocity;
+} encoder_t;
+
+static encoder_t encoders[BEAN_ENCODER_MAX];
+static int8_t encoder_ticker = -1;
+
+// The pin change mask each pin has on, so detach() doesn't turn off a pin
+// another encoder still uses.
+static uint8_t encoder_pins_b = 0;
+static uint8_t encoder_pins_d = 0;
+
+void bean_encoder_pin_change(uint8_t pinb, uint8_t pind) {
+  for (uint8_t i = 0; i < BEAN_ENCODER_MAX; i++) {
+    encoder_t *e = &encoders[i];
+    if (!e->active) {
+      continue;
+    }
+    uint8_t now = (((e->a_on_d ? pind : pinb) & e->a_mask) ? 2 : 0) |
+                  (((e->b_on_d ? pind : pinb) & e->b_mask) ? 1 : 0);
+    int8_t step = pgm_read_byte(&encoder_steps[(e->state << 2) | now]);
+    e->state = now;
+    if (step == MISSED) {
+      if (e->missed < 0xFF) {
+        e->missed++;
+      }
+    } else if (step != 0) {
+      int32_t count = e->count + step;
+      if ((uint32_t)count == (step > 0 ? 0x80000000UL : 0x7FFFFFFFUL)) {
+        e->overflowed = true;
+      }
+      e->count = count;
+    }
+  }
+}
+
+static void encoder_tick(void *) {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < BEAN_ENCODER_MAX; i++) {
+    encoder_t *e = &encoders[i];
+    if (!e->active) {
+      continue;
+    }
+    int32_t count = BeanEncoder.count(i);
+    unsigned long elapsed = now - e->last_time;
+    if (elapsed > 0) {
+      e->velocity = (count - e->last_count) * 1000L / (long)elapsed;
+    }
+    e->last_count = count;
+    e->last_time = now;
+  }
+}
+
+// Finds the pin change mask bit for a pin, or returns false if it isn't on
+// port B or D.  The variant's digitalPinToPCMSK() doesn't know about the
+// Bean's swapped pins, so this goes by the port and bit.
+static bool encoder_pin(uint8_t pin, bool *on_d, uint8_t *mask) {
+  uint8_t port = digitalPinToPort(pin);
+  if (port != PORT_B && port != PORT_D) {
+    return false;
+  }
+  *on_d = port == PORT_D;
+  *mask = digitalPinToBitMask(pin);
+  return true;
+}
+
+int8_t BeanEncoderClass::attach(uint8_t pinA, uint8_t pinB) {
+  bool a_on_d, b_on_d;
+  uint8_t a_mask, b_mask;
+  if (pinA == pinB || !encoder_pin(pinA, &a_on_d, &a_mask) ||
+      !encoder_pin(pinB, &b_on_d, &b_mask)) {
+    return -1;
+  }
+
+  int8_t slot = -1;
+  for (uint8_t i = 0; i < BEAN_ENCODER_MAX; i++) {
+    if (!encoders[i].active) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    return -1;
+  }
+
+  pinMode(pinA, INPUT_PULLUP);
+  pinMode(pinB, INPUT_PULLUP);
+
+  encoder_t *e = &encoders[slot];
+  uint8_t oldSREG = SREG;
+  cli();
+  e->a_on_d = a_on_d;
+  e->b_on_d = b_on_d;
+  e->a_mask = a_mask;
+  e->b_mask = b_mask;
+  e->state = (((a_on_d ? PIND : PINB) & a_mask) ? 2 : 0) |
+             (((b_on_d ? PIND : PINB) & b_mask) ? 1 : 0);
+  e->count = 0;
+  e->missed = 0;
+  e->overflowed = false;
+  e->last_count = 0;
+  e->last_time = millis();
+  e->velocity = 0;
+  e->active = true;
+
+  if (a_on_d) {
+    encoder_pins_d |= a_mask;
+  } else {
+    encoder_pins_b |= a_mask;
+  }
+  if (b_on_d) {
+    encoder_pins_d |= b_mask;
+  } else {
+    encoder_pins_b |= b_mask;
+  }
+  bean_pin_change_watch(BEAN_PIN_CHANGE_ENCODER, encoder_pins_b,
+                        encoder_pins_d);
+  SREG = oldSREG;
+
+  if (encoder_ticker < 0) {
+    encoder_ticker =
+        BeanScheduler.setInterval(BEAN_ENCODER_VELOCITY_MS, encoder_tick);
+  }
+  return slot;
+}
+
+void BeanEncoderClass::detach(uint8_t encoder) {
+  if (encoder >= BEAN_ENCODER_MAX || !encoders[encoder].active) {
+    return;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  encoders[encoder].active = false;
+  encoder_pins_b = encoder_pins_d = 0;
+  bool any = false;
+  for (uint8_t i = 0; i < BEAN_ENCODER_MAX; i++) {
+    encoder_t *e = &encoders[i];
+    if (!e->active) {
+      continue;
+    }
+    any = true;
+    *(e->a_on_d ? &encoder_pins_d : &encoder_pins_b) |= e->a_mask;
+    *(e->b_on_d ? &encoder_pins_d : &encoder_pins_b) |= e->b_mask;
+  }
+  bean_pin_change_watch(BEAN_PIN_CHANGE_ENCODER, encoder_pins_b,
+                        encoder_pins_d);
+  SREG = oldSREG;
+
+  if (!any && encoder_ticker >= 0) {
+    BeanScheduler.cancel(encoder_ticker);
+    encoder_ticker = -1;
+  }
+}
+
+int32_t BeanEncoderClass::count(uint8_t encoder) {
+  if (encoder >= BEAN_ENCODER_MAX) {
+    return 0;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  int32_t count = encoders[encoder].count;
+  SREG = oldSREG;
+  return count;
+}
+
+void BeanEncoderClass::write(uint8_t encoder, int32_t value) {
+  if (encoder >= BEAN_ENCODER_MAX) {
+    return;
+  }
+  encoder_t *e = &encoders[encoder];
+  uint8_t oldSREG = SREG;
+  cli();
+  e->count = value;
+  e->missed = 0;
+  e->overflowed = false;
+  SREG = oldSREG;
+  e->last_count = value;
+}
+
+int32_t BeanEncoderClass::velocity(uint8_t encoder) {
+  return encoder < BEAN_ENCODER_MAX ? encoders[encoder].velocity : 0;
+}
+
+bool BeanEncoderClass::overflowed(uint8_t encoder) {
+  return encoder < BEAN_ENCODER_MAX && encoders[encoder].overflowed;
+}
+
+uint8_t BeanEncoderClass::missed(uint8_t encoder) {
+  return encoder < BEAN_ENCODER_MAX ? encoders[encoder].missed : 0;
+}
@@ -0,0 +1,85 @@
+#ifndef BEAN_ENCODER_H
+#define BEAN_ENCODER_H
+
+#include <inttypes.h>
+
+// How many encoders can be attached at once.  It can be set from
+// compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_ENCODER_MAX
+#define BEAN_ENCODER_MAX (3)
+#endif
+
+// How often velocity() is brought up to date, in milliseconds.
+#ifndef BEAN_ENCODER_VELOCITY_MS
+#define BEAN_ENCODER_VELOCITY_MS (100)
+#endif
+
+class BeanEncoderClass {
+ public:
+  /****************************************************************************/
+  /** @name Encoders
+   *  Count quadrature encoders in the background. The pin change interrupts decode every edge with a lookup table, so the sketch only reads the totals; no callbacks are needed.
+   *
+   *  The encoder pins must be on port B or port D, which on the Bean is D0 to D5, so three encoders fit. The core then owns the PCINT0 and PCINT2 interrupts, which it shares with `BeanPulse`, and SoftwareSerial and PinChangeInt, which define them too, can't be used in the same sketch.
+   */
+  ///@{
+
+  /**
+   *  Starts counting an encoder. Both pins are made inputs with their pull-ups on, for the usual encoder whose contacts switch to ground.
+   *
+   *  Every edge on either pin counts, four per cycle of the encoder, so a mechanical encoder with one detent per cycle counts 4 per detent.
+   *
+   *  @param pinA the A (or CLK) pin
+   *  @param pinB the B (or DT) pin; swap the pins to count the other way
+   *  @return the encoder's number, for the other functions, or -1 if a pin isn't D0 to D5 or BEAN_ENCODER_MAX (3) encoders are attached
+   */
+  int8_t attach(uint8_t pinA, uint8_t pinB);
+
+  /**
+   *  Stops counting an encoder and frees its number.
+   *
+   *  @param encoder the number `attach()` returned
+   */
+  void detach(uint8_t encoder);
+
+  /**
+   *  @param encoder the number `attach()` returned
+   *  @return the count, up for one direction and down for the other
+   */
+  int32_t count(uint8_t encoder);
+
+  /**
+   *  Sets the count, and clears `overflowed()` and `missed()`.
+   *
+   *  @param encoder the number `attach()` returned
+   *  @param value the new count
+   */
+  void write(uint8_t encoder, int32_t value = 0);
+
+  /**
+   *  @param encoder the number `attach()` returned
+   *  @return counts per second, over the last BEAN_ENCODER_VELOCITY_MS (100 ms); it is brought up to date between calls to `loop()`
+   */
+  int32_t velocity(uint8_t encoder);
+
+  /**
+   *  @param encoder the number `attach()` returned
+   *  @return true if the count has wrapped from one end of its range to the other since `attach()` or `write()`
+   */
+  bool overflowed(uint8_t encoder);
+
+  /**
+   *  Counts changes of both pins at once. They mean an edge went by unseen, because the encoder turned faster than the interrupt could keep up or the contacts bounced, so the count may be off.
+   *
+   *  @param encoder the number `attach()` returned
+   *  @return how many there were since `attach()` or `write()`, stopping at 255
+   */
+  uint8_t missed(uint8_t encoder);
+  ///@}
+
+  BeanEncoderClass() {}
+};
+
+extern BeanEncoderClass BeanEncoder;
+
+#endif
@@ -0,0 +1,92 @@
+#include <string.h>
+#include <avr/interrupt.h>
+#include "Arduino.h"
+#include "BeanEnergy.h"
+
+#if BEAN_ENERGY_STATS
+// The state is sampled once per Timer0 overflow, 1.024 ms on the 16 MHz
+// Bean+ and 2.048 ms on the 8 MHz Bean, so each tick counts whole towards
+// whatever the CPU was doing when it fired.  Over seconds that comes out as
+// the share of time in each state without timing every transition.  Timer0
+// stops in power-down, so Bean.sleep() adds the time it slept instead.
+#define ENERGY_TICK_US (clockCyclesToMicroseconds(64 * 256))
+
+volatile uint8_t bean_energy_idle = 0;
+volatile uint8_t bean_energy_waiting = 0;
+volatile uint32_t bean_energy_frames_sent = 0;
+volatile uint32_t bean_energy_frames_received = 0;
+
+static uint32_t energy_active_ticks = 0;
+static uint32_t energy_idle_ticks = 0;
+static uint32_t energy_wait_ticks = 0;
+static uint32_t energy_cc_ticks = 0;
+static uint32_t energy_sleep_ms = 0;
+
+void bean_energy_tick(void) {
+  if (bean_energy_idle) {
+    energy_idle_ticks++;
+  } else {
+    energy_active_ticks++;
+  }
+  if (bean_energy_waiting) {
+    energy_wait_ticks++;
+    bean_energy_waiting = 0;
+  }
+  if (digitalReadFast(CC_INTERRUPT_PIN)) {
+    energy_cc_ticks++;
+  }
+}
+
+void bean_energy_slept(uint32_t ms) {
+  uint8_t oldSREG = SREG;
+  cli();
+  energy_sleep_ms += ms;
+  SREG = oldSREG;
+}
+
+static uint32_t energy_ms(uint32_t ticks) {
+  return (uint32_t)(((uint64_t)ticks * ENERGY_TICK_US) / 1000);
+}
+
+void bean_energy_read(BEAN_ENERGY_STATS_T *stats) {
+  uint8_t oldSREG = SREG;
+  cli();
+  stats->activeMs = energy_ms(energy_active_ticks);
+  stats->idleMs = energy_ms(energy_idle_ticks);
+  stats->sleepMs = energy_sleep_ms;
+  stats->waitMs = energy_ms(energy_wait_ticks);
+  stats->ccAwakeMs = energy_ms(energy_cc_ticks);
+  stats->framesSent = bean_energy_frames_sent;
+  stats->framesReceived = bean_energy_frames_received;
+  SREG = oldSREG;
+
+  // microamp milliseconds over milliseconds is the average current, which is
+  // also the charge drawn in an hour in microamp hours
+  uint64_t total = (uint64_t)stats->activeMs + stats->idleMs + stats->sleepMs;
+  uint64_t charge = (uint64_t)stats->activeMs * BEAN_ENERGY_ACTIVE_UA +
+                    (uint64_t)stats->idleMs * BEAN_ENERGY_IDLE_UA +
+                    (uint64_t)stats->sleepMs * BEAN_ENERGY_SLEEP_UA +
+                    (uint64_t)stats->ccAwakeMs * BEAN_ENERGY_CC_AWAKE_UA;
+  stats->chargePerHourUah =
+      total ? (uint32_t)(charge / total) + BEAN_ENERGY_BASE_UA : 0;
+}
+
+void bean_energy_reset(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  energy_active_ticks = 0;
+  energy_idle_ticks = 0;
+  energy_wait_ticks = 0;
+  energy_cc_ticks = 0;
+  energy_sleep_ms = 0;
+  bean_energy_frames_sent = 0;
+  bean_energy_frames_received = 0;
+  SREG = oldSREG;
+}
+#else
+void bean_energy_read(BEAN_ENERGY_STATS_T *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+void bean_energy_reset(void) {}
+#endif
@@ -0,0 +1,94 @@
+#ifndef BEAN_ENERGY_H
+#define BEAN_ENERGY_H
+
+#include <inttypes.h>
+
+// Energy accounting, see Bean.getEnergyStats().  It costs a few cycles in
+// every Timer0 tick and transport frame, so it is off unless the core is
+// built with -DBEAN_ENERGY_STATS=1, e.g. from compiler.c.extra_flags and
+// compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_ENERGY_STATS
+#define BEAN_ENERGY_STATS 0
+#endif
+
+// Currents in microamps for the charge estimate.  The defaults are rough
+// datasheet figures at 3 V: the ATmega328P running, in idle sleep and in
+// power-down, and what the CC2540 adds while the ATmega holds it awake.
+// BEAN_ENERGY_BASE_UA is drawn all the time, e.g. the regulator,
+// accelerometer and the radio's advertising; measure a board to set it.
+#ifndef BEAN_ENERGY_ACTIVE_UA
+#if F_CPU == 16000000L
+#define BEAN_ENERGY_ACTIVE_UA (6000)
+#else
+#define BEAN_ENERGY_ACTIVE_UA (3000)
+#endif
+#endif
+#ifndef BEAN_ENERGY_IDLE_UA
+#if F_CPU == 16000000L
+#define BEAN_ENERGY_IDLE_UA (1800)
+#else
+#define BEAN_ENERGY_IDLE_UA (900)
+#endif
+#endif
+#ifndef BEAN_ENERGY_SLEEP_UA
+#define BEAN_ENERGY_SLEEP_UA (1)
+#endif
+#ifndef BEAN_ENERGY_CC_AWAKE_UA
+#define BEAN_ENERGY_CC_AWAKE_UA (6700)
+#endif
+#ifndef BEAN_ENERGY_BASE_UA
+#define BEAN_ENERGY_BASE_UA (0)
+#endif
+
+// Time in each power state since power up or the last reset, in ms.  Active,
+// idle and sleep add up to the time accounted for; wait and ccAwake overlap
+// them.
+typedef struct {
+  uint32_t activeMs;    // the CPU running, including spinning in a wait loop
+  uint32_t idleMs;      // the CPU in idle sleep
+  uint32_t sleepMs;     // powered down in Bean.sleep()
+  uint32_t waitMs;      // in the core's wait loops, running or in idle sleep
+  uint32_t ccAwakeMs;   // CC_INTERRUPT_PIN high, holding the CC awake
+  uint32_t framesSent;
+  uint32_t framesReceived;  // frames with a good CRC
+  uint32_t chargePerHourUah;  // the average current, from the _UA figures
+} BEAN_ENERGY_STATS_T;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if BEAN_ENERGY_STATS
+// Set by the main thread around idle sleep, and by each wait loop pass.
+// The Timer0 overflow handler calls bean_energy_tick(), which counts the
+// tick towards the states they show and clears bean_energy_waiting.
+extern volatile uint8_t bean_energy_idle;
+extern volatile uint8_t bean_energy_waiting;
+extern volatile uint32_t bean_energy_frames_sent;
+extern volatile uint32_t bean_energy_frames_received;
+
+void bean_energy_tick(void);
+void bean_energy_slept(uint32_t ms);
+
+#define BEAN_ENERGY_IDLE(on) (bean_energy_idle = (on))
+#define BEAN_ENERGY_WAIT() (bean_energy_waiting = 1)
+#define BEAN_ENERGY_FRAME_SENT() (bean_energy_frames_sent++)
+#define BEAN_ENERGY_FRAME_RECEIVED() (bean_energy_frames_received++)
+#define BEAN_ENERGY_SLEPT(ms) bean_energy_slept(ms)
+#else
+#define BEAN_ENERGY_IDLE(on)
+#define BEAN_ENERGY_WAIT()
+#define BEAN_ENERGY_FRAME_SENT()
+#define BEAN_ENERGY_FRAME_RECEIVED()
+#define BEAN_ENERGY_SLEPT(ms)
+#endif
+
+// Both work, returning zeros, when accounting is compiled out.
+void bean_energy_read(BEAN_ENERGY_STATS_T *stats);
+void bean_energy_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
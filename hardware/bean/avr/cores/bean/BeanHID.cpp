@@ -18,6 +18,7 @@
 
 #include <Arduino.h>
 #include "BeanHID.h"
+#include "BeanScheduler.h"
 
 // Singleton
 BeanHidClass BeanHid;
@@ -267,11 +268,6 @@ uint8_t _hid_idle = 1;
 // void sendReport(CcReport *pReport);
 // void buttons(uint8_t b);
 
-BeanHidClass::BeanHidClass(void) {
-  _buttons = 0;
-  isShiftHeld = false;
-}
-
 // Private functions
 
 static void addCommandToCcReport(CcReport *pReport, uint8_t cmd) {
@@ -392,7 +388,11 @@ void BeanHidClass::sendReport(CcReport *pReport) {
 void BeanHidClass::buttons(uint8_t b) {
   if (b != _buttons) {
     _buttons = b;
-    moveMouse(0, 0, 0);
+    if (accumulateMouse) {
+      sendMouseMotion();  // a click shouldn't wait for the interval
+    } else {
+      moveMouse(0, 0, 0);
+    }
   }
 }
 
@@ -416,8 +416,88 @@ void BeanHidClass::disable(void) {
 }
 
 // Mouse
+
+// Accumulated motion.  moveMouse() adds to it, and it goes out at most one
+// report every BEAN_HID_REPORT_INTERVAL ms, each carrying as much of it as
+// fits in a signed byte per axis, until none is left.
+static int16_t mouseX = 0;
+static int16_t mouseY = 0;
+static int16_t mouseWheel = 0;
+static unsigned long lastMouseReport = 0;
+static int8_t mouseTimer = -1;
+
+static int16_t addMotion(int16_t sum, signed char delta) {
+  int16_t next = sum + delta;
+  if (delta > 0 && next < sum) return 32767;
+  if (delta < 0 && next > sum) return -32768;
+  return next;
+}
+
+static signed char takeMotion(int16_t *sum) {
+  int16_t part = *sum > 127 ? 127 : (*sum < -127 ? -127 : *sum);
+  *sum -= part;
+  return (signed char)part;
+}
+
+void BeanHidClass::sendMouseMotion(void) {
+  MouseReport m;
+  m.mouse[0] = _buttons;
+  m.mouse[1] = takeMotion(&mouseX);
+  m.mouse[2] = takeMotion(&mouseY);
+  m.mouse[3] = takeMotion(&mouseWheel);
+  sendReport(&m);
+  lastMouseReport = millis();
+}
+
+void BeanHidClass::pumpMouseMotion(void) {
+  if (mouseX == 0 && mouseY == 0 && mouseWheel == 0) {
+    return;
+  }
+  unsigned long elapsed = millis() - lastMouseReport;
+  if (elapsed >= BEAN_HID_REPORT_INTERVAL) {
+    sendMouseMotion();
+    elapsed = 0;
+    if (mouseX == 0 && mouseY == 0 && mouseWheel == 0) {
+      return;
+    }
+  }
+  if (mouseTimer < 0) {
+    mouseTimer = BeanScheduler.setTimeout(BEAN_HID_REPORT_INTERVAL - elapsed,
+                                          mouseTask);
+    if (mouseTimer < 0) {
+      BeanScheduler.defer(mouseTask);  // no timer free, so try next loop()
+    }
+  }
+}
+
+void BeanHidClass::mouseTask(void *arg) {
+  mouseTimer = -1;
+  BeanHid.pumpMouseMotion();
+}
+
+void BeanHidClass::enableMouseAccumulation(bool enable) {
+  if (accumulateMouse && !enable) {
+    while (mouseX != 0 || mouseY != 0 || mouseWheel != 0) {
+      sendMouseMotion();
+    }
+    if (mouseTimer >= 0) {
+      BeanScheduler.cancel(mouseTimer);
+      mouseTimer = -1;
+    }
+  }
+  accumulateMouse = enable;
+}
+
 void BeanHidClass::moveMouse(signed char delta_x, signed char delta_y,
                          signed char delta_wheel) {
+  if (accumulateMouse) {
+    mouseX = addMotion(mouseX, delta_x);
+    mouseY = addMotion(mouseY, delta_y);
+    mouseWheel = addMotion(mouseWheel, delta_wheel);
+    pumpMouseMotion();
+    return;
+  }
+
   MouseReport m;
   m.mouse[0] = _buttons;
   m.mouse[1] = delta_x;
@@ -474,6 +554,7 @@ void BeanHidClass::releaseAllMediaControls() {
 // call release(), releaseAll(), or otherwise clear the report and resend.
 size_t BeanHidClass::_holdKey(uint8_t k) {
   uint8_t i;
+  flushKeyReports();
   if (k >= 136) {  // it's a non-printing key (not a modifier)
     k = k - 136;
   } else if (k >= 128) {  // it's a modifier key
@@ -518,6 +599,7 @@ size_t BeanHidClass::_holdKey(uint8_t k) {
 // it shouldn't be repeated any more.
 size_t BeanHidClass::_releaseKey(uint8_t k) {
   uint8_t i;
+  flushKeyReports();
   if (k >= 136) {  // it's a non-printing key (not a modifier)
     k = k - 136;
   } else if (k >= 128) {  // it's a modifier key
@@ -570,6 +652,7 @@ int BeanHidClass::releaseKey(modifierKey key) {
  *  Needs docs
  */
 void BeanHidClass::releaseAllKeys(void) {
+  flushKeyReports();
   _keyReport.keys[0] = 0;
   _keyReport.keys[1] = 0;
   _keyReport.keys[2] = 0;
@@ -586,16 +669,130 @@ void BeanHidClass::releaseAllKeys(void) {
 int BeanHidClass::sendKey(char key) { return (int)_sendKey((uint8_t)key); }
 int BeanHidClass::sendKey(modifierKey key) { return (int)_sendKey((uint8_t)key); }
 
-/**
- *  Needs docs
- */
-int BeanHidClass::sendKeys(String charsToType) {
+// Typed text goes through a queue of keyboard reports, sent one every
+// BEAN_HID_REPORT_INTERVAL ms so the host sees each one.  The queue drains
+// from a BeanScheduler timeout, or by waiting when it is full; reports sent
+// any other way flush it first to stay in order.
+#if (BEAN_HID_KEY_QUEUE_SIZE & (BEAN_HID_KEY_QUEUE_SIZE - 1))
+#error BEAN_HID_KEY_QUEUE_SIZE must be a power of two
+#endif
+
+static KeyReport keyQueue[BEAN_HID_KEY_QUEUE_SIZE];
+static uint8_t keyQueueHead = 0;
+static uint8_t keyQueueTail = 0;
+static unsigned long lastKeyReport = 0;
+static int8_t keyQueueTimer = -1;
+
+// Sends the reports that are due, or with wait set all of them.
+void BeanHidClass::pumpKeyReports(bool wait) {
+  while (keyQueueHead != keyQueueTail) {
+    if (millis() - lastKeyReport < BEAN_HID_REPORT_INTERVAL) {
+      if (!wait) {
+        break;
+      }
+      bean_idle();
+      continue;
+    }
+    sendReport(&keyQueue[keyQueueTail & (BEAN_HID_KEY_QUEUE_SIZE - 1)]);
+    lastKeyReport = millis();
+    keyQueueTail++;
+  }
+}
+
+void BeanHidClass::keyQueueTask(void *arg) {
+  keyQueueTimer = -1;
+  BeanHid.pumpKeyReports(false);
+  BeanHid.scheduleKeyReports();
+}
+
+void BeanHidClass::scheduleKeyReports(void) {
+  if (keyQueueHead == keyQueueTail || keyQueueTimer >= 0) {
+    return;
+  }
+  unsigned long elapsed = millis() - lastKeyReport;
+  keyQueueTimer = BeanScheduler.setTimeout(
+      elapsed < BEAN_HID_REPORT_INTERVAL ? BEAN_HID_REPORT_INTERVAL - elapsed
+                                         : 0,
+      keyQueueTask);
+  if (keyQueueTimer < 0) {
+    pumpKeyReports(true);
+  }
+}
+
+void BeanHidClass::flushKeyReports(void) {
+  pumpKeyReports(true);
+  if (keyQueueTimer >= 0) {
+    BeanScheduler.cancel(keyQueueTimer);
+    keyQueueTimer = -1;
+  }
+}
+
+void BeanHidClass::queueKeyReport(const KeyReport *report) {
+  while ((uint8_t)(keyQueueHead - keyQueueTail) >= BEAN_HID_KEY_QUEUE_SIZE) {
+    pumpKeyReports(false);
+    bean_idle();
+  }
+  keyQueue[keyQueueHead & (BEAN_HID_KEY_QUEUE_SIZE - 1)] = *report;
+  keyQueueHead++;
+  pumpKeyReports(false);
+}
+
+// Each report releases the previous character's key as it presses the
+// next, so typing n characters takes n + 1 reports rather than 2n; only a
+// repeated key needs a release report of its own.  Keys and modifiers
+// already held with holdKey() stay held throughout.
+int BeanHidClass::_typeKeys(const char *chars, size_t length, bool progmem) {
+  flushKeyReports();
+
+  uint8_t slot = 0;
+  while (slot < 6 && _keyReport.keys[slot] != 0) {
+    slot++;
+  }
+  if (slot == 6) {
+    return 0;
+  }
+
+  KeyReport report = _keyReport;
+  uint8_t lastKey = 0;
   int status = 0;
-  int maxIndex = charsToType.length();
-  for (int i = 0; i < maxIndex; i++) {
-    status |= _sendKey(charsToType.charAt(i));
-    delay(5);  // Characters tend to drop if there's no delay between them
+
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = progmem ? pgm_read_byte(chars + i) : (uint8_t)chars[i];
+    uint8_t k = c < 128 ? pgm_read_byte(_asciimap + c) : 0;
+    if (!k) {
+      continue;
+    }
+
+    if ((k & 0x7F) == lastKey) {
+      queueKeyReport(&_keyReport);
+    }
+    report.keys[slot] = k & 0x7F;
+    report.modifiers = _keyReport.modifiers | ((k & 0x80) ? 0x02 : 0);
+    queueKeyReport(&report);
+    lastKey = k & 0x7F;
+    status = 1;
   }
 
+  if (lastKey) {
+    queueKeyReport(&_keyReport);
+  }
+  scheduleKeyReports();
   return status;
 }
+
+int BeanHidClass::sendKeys(const char *charsToType) {
+  return _typeKeys(charsToType, strlen(charsToType), false);
+}
+
+int BeanHidClass::sendKeys(const char *charsToType, size_t length) {
+  return _typeKeys(charsToType, length, false);
+}
+
+int BeanHidClass::sendKeys(const __FlashStringHelper *charsToType) {
+  PGM_P chars = reinterpret_cast<PGM_P>(charsToType);
+  return _typeKeys(chars, strlen_P(chars), true);
+}
+
+int BeanHidClass::sendKeys(const String &charsToType) {
+  return _typeKeys(charsToType.c_str(), charsToType.length(), false);
+}
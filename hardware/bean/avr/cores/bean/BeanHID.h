@@ -3,6 +3,16 @@
 
 #include "BeanSerialTransport.h"
 
+// Typed keyboard reports: how many can wait to be sent, and the time between
+// them, which should be at least the HID connection interval.  They can be
+// set from compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_HID_KEY_QUEUE_SIZE
+#define BEAN_HID_KEY_QUEUE_SIZE (8)  // a power of two
+#endif
+#ifndef BEAN_HID_REPORT_INTERVAL
+#define BEAN_HID_REPORT_INTERVAL (8)  // ms, the 7.5 ms minimum rounded up
+#endif
+
 /** Enumeration of mouse buttons
  */
 typedef enum mouseButtons {
@@ -99,9 +109,20 @@ class BeanHidClass {
   size_t _holdKey(uint8_t c);
   size_t _releaseKey(uint8_t c);
   size_t _sendKey(uint8_t c);
+  int _typeKeys(const char *chars, size_t length, bool progmem);
+  void queueKeyReport(const KeyReport *report);
+  void pumpKeyReports(bool wait);
+  void scheduleKeyReports(void);
+  void flushKeyReports(void);
+  static void keyQueueTask(void *arg);
+  void sendMouseMotion(void);
+  void pumpMouseMotion(void);
+  static void mouseTask(void *arg);
 
  public:
-  BeanHidClass(void);
+  // Every member starts at zero with BeanHid's static storage, so nothing
+  // runs at startup for it.
+  BeanHidClass(void) {}
   /****************************************************************************/
   /** @name HID
    * The user must enter a pairing code (default of 000000) to connect.
@@ -191,10 +212,35 @@ class BeanHidClass {
 
   /**
    *  Sends a string of characters as keyboard events
+   *
+   *  The key reports are queued and sent in the background, one every BEAN_HID_REPORT_INTERVAL ms (8 by default). Each one releases a key as it presses the next, so a string of n characters takes about n reports. This function only waits if the queue is full.
+   *
    *  @param charsToType a String of characters for the keyboard to emulate
    *  @return 1 if success 0 if failure
    */
-  int sendKeys(String charsToType);
+  int sendKeys(const String &charsToType);
+
+  /**
+   *  Sends a string of characters as keyboard events, see sendKeys(String)
+   *  @param charsToType the characters for the keyboard to emulate
+   *  @return 1 if success 0 if failure
+   */
+  int sendKeys(const char *charsToType);
+
+  /**
+   *  Sends part of a buffer of characters as keyboard events, see sendKeys(String)
+   *  @param charsToType the characters for the keyboard to emulate; they needn't be null-terminated
+   *  @param length the number of characters to send
+   *  @return 1 if success 0 if failure
+   */
+  int sendKeys(const char *charsToType, size_t length);
+
+  /**
+   *  Sends a string of characters stored in flash as keyboard events, e.g. `sendKeys(F("Hello"))`, see sendKeys(String)
+   *  @param charsToType the characters for the keyboard to emulate
+   *  @return 1 if success 0 if failure
+   */
+  int sendKeys(const __FlashStringHelper *charsToType);
 
   /**
    *  Sends a mouse move command
@@ -205,6 +251,15 @@ class BeanHidClass {
   void moveMouse(signed char delta_x, signed char delta_y,
                  signed char delta_wheel = 0);
 
+  /**
+   *  Turns accumulating mouse mode on or off. In this mode moveMouse() doesn't send a report itself: its movements are added up and sent at most once every BEAN_HID_REPORT_INTERVAL ms (8 by default), so calling it in a tight loop doesn't swamp the connection. Movement that doesn't fit in one report carries over to the next. Button changes are still sent straight away.
+   *
+   *  Reports are sent between calls to `loop()`, see BeanScheduler.
+   *
+   *  @param enable true to accumulate movements, false to send each one. Turning it off sends any movement still waiting.
+   */
+  void enableMouseAccumulation(bool enable);
+
   /**
    *  Holds a mouse button down
    *  @param button the button to hold of type mouseButtons.  Defaults to MOUSE_LEFT.
@@ -249,6 +304,7 @@ class BeanHidClass {
 
  private:
   bool isShiftHeld;
+  bool accumulateMouse;
 };
 extern BeanHidClass BeanHid;
 
@@ -1,6 +1,7 @@
 #include "BeanMidi.h"
 #include "Bean.h"
 #include "BeanSerialTransport.h"
+#include "BeanScheduler.h"
 #include "Arduino.h"
 
 
@@ -18,16 +19,13 @@ typedef struct {
 } midiMessage;
 
 static midiMessage midiMessages[MIDI_BUFFER_SIZE];
-uint8_t midiPacket[BLE_PACKET_SIZE];
 uint8_t midiWriteOffset = 0;
 uint8_t midiReadOffset = 0;
 
-uint8_t lastStatus = 0;
-long midiTimeStampDiff = 0;
-bool midiPacketBegin = true;
 
 
 void BeanMidiClass::enable(void) {
+  Serial.midiRxBegin();
   ADV_SWITCH_ENABLED_T curServices = Bean.getServices();
   curServices.midi = 1;
   Bean.setServices(curServices);
@@ -45,7 +43,13 @@ void BeanMidiClass::disable(void) {
 }
 
 int BeanMidiClass::loadMessage(uint8_t status, uint8_t byte1, uint8_t byte2) {
-  if ((midiWriteOffset + 1) % MIDI_BUFFER_SIZE == midiReadOffset) return 0;
+  if (autoFlushMs > 0) {
+    return loadAutoFlush(status, byte1, byte2);
+  }
+  if ((midiWriteOffset + 1) % MIDI_BUFFER_SIZE == midiReadOffset) {
+    if (midiDropped < 0xFFFF) midiDropped++;
+    return 0;
+  }
   uint32_t millisec = millis();
   midiMessages[midiWriteOffset].status = status;
   midiMessages[midiWriteOffset].byte1 = byte1;
@@ -56,87 +60,394 @@ int BeanMidiClass::loadMessage(uint8_t status, uint8_t byte1, uint8_t byte2) {
   return 1;
 }
 
+// A BLE-MIDI packet being built: a header byte with bits 12-7 of the 13 bit
+// millisecond timestamp, then for each message a timestamp byte with bits
+// 6-0, the status and the data.  Within a packet, a message with the same
+// status as the one before leaves the status out (running status), and one
+// that also has the same timestamp leaves that out too.  A receiver can only
+// follow one wrap of the low timestamp bits, so a packet spans under 128 ms.
+struct midiPacketBuilder {
+  uint8_t data[BLE_PACKET_SIZE];
+  uint8_t length;
+  uint16_t start;
+  uint8_t lastStatus;  // 0 when the next message needs its status
+  uint8_t lastTimestamp;
+};
+
+static uint8_t midiDataLength(uint8_t status) {
+  if (status < SYSTEMCOMMON) {
+    // program change and channel pressure have one data byte
+    return (status & 0xE0) == PROGRAMCHANGE ? 1 : 2;
+  }
+  switch (status) {
+    case 0xF1:  // MIDI time code quarter frame
+    case 0xF3:  // song select
+      return 1;
+    case 0xF2:  // song position pointer
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+static uint8_t midiPacketHeader(uint16_t timestamp) {
+  return 0x80 | ((timestamp >> 7) & 0x3F);
+}
+
+// Returns false, leaving the packet as it was, if the message doesn't fit.
+static bool midiPacketAdd(midiPacketBuilder *packet, uint32_t millisec,
+                          uint8_t status, uint8_t byte1, uint8_t byte2) {
+  uint16_t timestamp = millisec & 0x1FFF;
+
+  if (packet->length == 0) {
+    packet->data[packet->length++] = midiPacketHeader(timestamp);
+    packet->start = timestamp;
+    packet->lastStatus = 0;
+  } else if (((timestamp - packet->start) & 0x1FFF) >= 128) {
+    return false;
+  }
+
+  uint8_t timestampLow = 0x80 | (timestamp & 0x7F);
+  uint8_t dataLength = midiDataLength(status);
+  bool needStatus = status != packet->lastStatus;
+  bool needTimestamp = needStatus || timestampLow != packet->lastTimestamp;
+  if (packet->length + dataLength + needStatus + needTimestamp >
+      BLE_PACKET_SIZE) {
+    return false;
+  }
+
+  if (needTimestamp) packet->data[packet->length++] = timestampLow;
+  if (needStatus) packet->data[packet->length++] = status;
+  if (dataLength > 0) packet->data[packet->length++] = byte1 & 0x7F;
+  if (dataLength > 1) packet->data[packet->length++] = byte2 & 0x7F;
+
+  packet->lastTimestamp = timestampLow;
+  if (status < SYSTEMCOMMON) {
+    packet->lastStatus = status;
+  } else if (status < SYSTEMREALTIME) {
+    packet->lastStatus = 0;  // system common cancels running status
+  }
+  return true;
+}
+
+int BeanMidiClass::sendPacket(midiPacketBuilder *packet) {
+  int sent = packet->length;
+  if (sent > 0) {
+    Serial.write_message(MSG_ID_MIDI_WRITE, packet->data, packet->length);
+    packet->length = 0;
+  }
+  return sent;
+}
+
 int BeanMidiClass::sendMessages() {
-  if (midiReadOffset == midiWriteOffset) return 0;
-  uint8_t byteOffset = 0;
-  // send a 20 byte message
-  uint32_t millisec = midiMessages[midiReadOffset].timestamp;
-  // first the header
-  uint8_t head_ts = millisec >> 7;
-  head_ts |= 1 << 7;  // set the 7th bit to 1
-  head_ts &= ~(1 << 6);  // set the 6th bit to zero
-  midiPacket[byteOffset++] = head_ts;
-  // now some messages
-  int lastStatus = -1;
-  int lastTime = -1;
+  midiPacketBuilder packet;
+  packet.length = 0;
+  int sent = flushAutoPacket();
+
   while (midiReadOffset != midiWriteOffset) {
-    if (lastStatus == midiMessages[midiReadOffset].status &&
-        lastTime == midiMessages[midiReadOffset].timestamp) {
-      midiPacket[byteOffset++] = midiMessages[midiReadOffset].byte1;
-      midiPacket[byteOffset++] = midiMessages[midiReadOffset].byte2;
-    } else {
-      uint8_t msg_ts = midiMessages[midiReadOffset].timestamp;
-      msg_ts |= 1 << 7;  // set the 7th bit to 1.
-      midiPacket[byteOffset++] = msg_ts;
-      midiPacket[byteOffset++] = midiMessages[midiReadOffset].status;
-      midiPacket[byteOffset++] = midiMessages[midiReadOffset].byte1;
-      midiPacket[byteOffset++] = midiMessages[midiReadOffset].byte2;
+    midiMessage *message = &midiMessages[midiReadOffset];
+    if (!midiPacketAdd(&packet, message->timestamp, message->status,
+                       message->byte1, message->byte2)) {
+      sent += sendPacket(&packet);
+      continue;
     }
     midiReadOffset++;
     midiReadOffset = midiReadOffset % MIDI_BUFFER_SIZE;
-    if (byteOffset + 4 >
-        BLE_PACKET_SIZE)  // can we handle another midi message in this packet
-      break;
   }
-  Serial.write_message(MSG_ID_MIDI_WRITE, midiPacket, byteOffset);
-  return byteOffset;
+  return sent + sendPacket(&packet);
 }
 
-int BeanMidiClass::readMessage(uint8_t *status, uint8_t *byte1, uint8_t *byte2) {
-  uint8_t buffer[8];
-  if (midiPacketBegin) {
-    if (Serial.midiAvailable() > 4) {
-      Serial.readMidi(buffer, 1);  // header
-      midiPacketBegin = false;  // we are now in the body
+// Auto flush.  Messages go straight into autoPacket, which is sent when the
+// next message doesn't fit or autoFlushMs after its first message.  If no
+// timer is free it goes at the end of the current loop() instead.
+static midiPacketBuilder autoPacket = {{0}, 0, 0, 0, 0};
+static int8_t autoFlushTimer = -1;
+
+int BeanMidiClass::flushAutoPacket() {
+  if (autoFlushTimer >= 0) {
+    BeanScheduler.cancel(autoFlushTimer);
+    autoFlushTimer = -1;
+  }
+  return sendPacket(&autoPacket);
+}
+
+void BeanMidiClass::autoFlushTask(void *arg) {
+  autoFlushTimer = -1;
+  sendPacket(&autoPacket);
+}
+
+int BeanMidiClass::loadAutoFlush(uint8_t status, uint8_t byte1, uint8_t byte2) {
+  uint32_t millisec = millis();
+  if (!midiPacketAdd(&autoPacket, millisec, status, byte1, byte2)) {
+    flushAutoPacket();
+    midiPacketAdd(&autoPacket, millisec, status, byte1, byte2);
+  }
+
+  if (autoPacket.length == BLE_PACKET_SIZE) {
+    flushAutoPacket();
+  } else if (autoFlushTimer < 0) {
+    autoFlushTimer = BeanScheduler.setTimeout(autoFlushMs, autoFlushTask);
+    if (autoFlushTimer < 0 && !BeanScheduler.defer(autoFlushTask)) {
+      flushAutoPacket();
     }
   }
-  if (!midiPacketBegin) {
-    // read the first byte, check if its a status byte
-    if (Serial.midiAvailable() > 0) {
-      uint8_t peek = 0;
-      peek = Serial.peekMidi();
-      if (peek & 1 << 7) {
-        // is status/timestamp byte. we are looking at a 4 byte message
-        if (Serial.midiAvailable() >= 4) {
-          Serial.readMidi(buffer, 4);
-          uint8_t timestamp = buffer[0];
-          *status = buffer[1];
-          lastStatus = *status;
-          *byte1 = buffer[2];
-          *byte2 = buffer[3];
-          if (timestamp == 0xFF &&
-              *status == 0xFF &&
-              *byte1 == 0xFF &&
-              *byte2 == 0xFF) {
-            // end of packet
-            midiPacketBegin = true;
-            return 0;
-          } else {
-            return peek;
+  return 1;
+}
+
+void BeanMidiClass::setAutoFlush(uint16_t latency_ms) {
+  sendMessages();
+  autoFlushMs = latency_ms;
+}
+
+uint16_t BeanMidiClass::droppedMessages() {
+  return midiDropped;
+}
+
+int BeanMidiClass::sendSysEx(const uint8_t *data, uint16_t length) {
+  // the caller may or may not have framed it
+  if (length > 0 && data[0] == 0xF0) {
+    data++;
+    length--;
+  }
+  if (length > 0 && data[length - 1] == 0xF7) {
+    length--;
+  }
+
+  // keep the order of anything already queued
+  int sent = sendMessages();
+
+  // [header][timestamp][F0][data...], continued in packets of
+  // [header][data...], and ended by [timestamp][F7]
+  uint16_t timestamp = millis() & 0x1FFF;
+  uint8_t timestampLow = 0x80 | (timestamp & 0x7F);
+  midiPacketBuilder packet;
+  packet.data[0] = midiPacketHeader(timestamp);
+  packet.data[1] = timestampLow;
+  packet.data[2] = 0xF0;
+  packet.length = 3;
+
+  for (uint16_t i = 0; i < length; i++) {
+    if (packet.length == BLE_PACKET_SIZE) {
+      sent += sendPacket(&packet);
+      packet.data[packet.length++] = midiPacketHeader(timestamp);
+    }
+    packet.data[packet.length++] = data[i] & 0x7F;
+  }
+
+  if (packet.length + 2 > BLE_PACKET_SIZE) {
+    sent += sendPacket(&packet);
+    packet.data[packet.length++] = midiPacketHeader(timestamp);
+  }
+  packet.data[packet.length++] = timestampLow;
+  packet.data[packet.length++] = 0xF7;
+  return sent + sendPacket(&packet);
+}
+
+// Receive.  The parser decodes the packet at the front of midi_buffer in
+// place, through peekMidi(), and drops it once it has been read, so all it
+// keeps between calls is its place and the running status.  Only SysEx data
+// is copied, into sysExChunk for the callback.
+#define SYSEX_CHUNK_SIZE 16
+
+static uint8_t rxPacketLength = 0;  // 0 between packets
+static uint8_t rxOffset;            // next byte to decode, header is 0
+static uint8_t rxRunningStatus = 0;
+static uint8_t rxTimestamp;
+static bool rxInSysEx = false;
+
+static MidiNoteCallback noteOnCallback = NULL;
+static MidiNoteCallback noteOffCallback = NULL;
+static MidiControlChangeCallback controlChangeCallback = NULL;
+static MidiPitchBendCallback pitchBendCallback = NULL;
+static MidiMessageCallback messageCallback = NULL;
+static MidiSysExCallback sysExCallback = NULL;
+
+static uint8_t sysExChunk[SYSEX_CHUNK_SIZE];
+static uint8_t sysExLength = 0;
+
+static void sysExFlush(bool last) {
+  if (sysExCallback) {
+    sysExCallback(sysExChunk, sysExLength, last);
+  }
+  sysExLength = 0;
+}
+
+static void sysExByte(uint8_t c) {
+  sysExChunk[sysExLength++] = c;
+  if (sysExLength == SYSEX_CHUNK_SIZE) {
+    sysExFlush(false);
+  }
+}
+
+// The byte at offset in the current packet, after its length.
+#define RX_BYTE(offset) ((uint8_t)Serial.peekMidi((offset) + 1))
+
+bool BeanMidiClass::parseMessage(uint8_t *status, uint8_t *byte1,
+                                 uint8_t *byte2) {
+  for (;;) {
+    if (rxPacketLength == 0) {
+      int length = Serial.peekMidi(0);
+      if (length <= 0) {
+        return false;
+      }
+      rxPacketLength = length;
+      rxOffset = 1;
+    }
+    if (rxOffset >= rxPacketLength) {
+      Serial.skipMidi(rxPacketLength + 1);
+      rxPacketLength = 0;
+      continue;
+    }
+
+    uint8_t next = RX_BYTE(rxOffset);
+    uint8_t messageStatus = rxRunningStatus;
+    if (next & 0x80) {
+      rxTimestamp = next;
+      if (++rxOffset >= rxPacketLength) {
+        continue;
+      }
+      next = RX_BYTE(rxOffset);
+      if (next & 0x80) {
+        rxOffset++;
+        if (next == 0xF0) {
+          rxInSysEx = true;
+          sysExLength = 0;
+          continue;
+        }
+        if (next == 0xF7) {
+          if (rxInSysEx) {
+            rxInSysEx = false;
+            sysExFlush(true);
           }
+          continue;
         }
-      } else {  // running status
-        if (Serial.midiAvailable() >= 2) {
-          Serial.readMidi(buffer, 2);
-          *status = lastStatus;
-          *byte1 = buffer[0];
-          *byte2 = buffer[1];
-          return peek;
+        if (next >= SYSTEMREALTIME) {
+          // may come in the middle of anything, and changes nothing
+          *status = next;
+          *byte1 = *byte2 = 0;
+          return true;
         }
+        rxInSysEx = false;
+        rxRunningStatus = next < SYSTEMCOMMON ? next : 0;
+        messageStatus = next;
       }
     }
+
+    if (!(next & 0x80)) {
+      if (rxInSysEx) {
+        sysExByte(next);
+        rxOffset++;
+        continue;
+      }
+      if (messageStatus == 0) {
+        rxOffset++;  // data with no status to go with it
+        continue;
+      }
+    }
+
+    uint8_t dataLength = midiDataLength(messageStatus);
+    if (rxOffset + dataLength > rxPacketLength) {
+      rxOffset = rxPacketLength;  // cut short
+      continue;
+    }
+    *status = messageStatus;
+    *byte1 = dataLength > 0 ? RX_BYTE(rxOffset) : 0;
+    *byte2 = dataLength > 1 ? RX_BYTE(rxOffset + 1) : 0;
+    rxOffset += dataLength;
+    return true;
   }
-  return 0;
+}
+
+int BeanMidiClass::readMessage(uint8_t *status, uint8_t *byte1, uint8_t *byte2) {
+  if (!parseMessage(status, byte1, byte2)) {
+    return 0;
+  }
+  return rxTimestamp;
+}
+
+int BeanMidiClass::processMessages() {
+  uint8_t status, byte1, byte2;
+  int count = 0;
+
+  while (parseMessage(&status, &byte1, &byte2)) {
+    uint8_t channel = status & 0x0F;
+    count++;
+    switch (status & 0xF0) {
+      case NOTEON:
+        if (byte2 > 0 && noteOnCallback) {
+          noteOnCallback(channel, byte1, byte2);
+          continue;
+        }
+        // a note on with velocity 0 is a note off
+        if (byte2 == 0 && noteOffCallback) {
+          noteOffCallback(channel, byte1, 0);
+          continue;
+        }
+        break;
+      case NOTEOFF:
+        if (noteOffCallback) {
+          noteOffCallback(channel, byte1, byte2);
+          continue;
+        }
+        break;
+      case CONTROLCHANGE:
+        if (controlChangeCallback) {
+          controlChangeCallback(channel, byte1, byte2);
+          continue;
+        }
+        break;
+      case PITCHBENDCHANGE:
+        if (pitchBendCallback) {
+          pitchBendCallback(channel, byte1 | ((uint16_t)byte2 << 7));
+          continue;
+        }
+        break;
+    }
+    if (messageCallback) {
+      messageCallback(status, byte1, byte2);
+    }
+  }
+  return count;
+}
+
+static void processTask(void *arg) {
+  BeanMidi.processMessages();
+}
+
+// Callbacks run from BeanScheduler after each MIDI packet arrives.
+bool BeanMidiClass::watchMidi(void) {
+  Serial.midiRxBegin();
+  return BeanScheduler.onMessage(MSG_ID_MIDI_READ, processTask);
+}
+
+bool BeanMidiClass::onNoteOn(MidiNoteCallback callback) {
+  noteOnCallback = callback;
+  return watchMidi();
+}
+
+bool BeanMidiClass::onNoteOff(MidiNoteCallback callback) {
+  noteOffCallback = callback;
+  return watchMidi();
+}
+
+bool BeanMidiClass::onControlChange(MidiControlChangeCallback callback) {
+  controlChangeCallback = callback;
+  return watchMidi();
+}
+
+bool BeanMidiClass::onPitchBend(MidiPitchBendCallback callback) {
+  pitchBendCallback = callback;
+  return watchMidi();
+}
+
+bool BeanMidiClass::onMessage(MidiMessageCallback callback) {
+  messageCallback = callback;
+  return watchMidi();
+}
+
+bool BeanMidiClass::onSysEx(MidiSysExCallback callback) {
+  sysExCallback = callback;
+  return watchMidi();
 }
 
 
@@ -162,7 +473,7 @@ int BeanMidiClass::sendMessage(uint8_t *buff, uint8_t numBytes) {
  */
 int BeanMidiClass::sendMessage(uint8_t status, uint8_t byte1, uint8_t byte2) {
   loadMessage(status, byte1, byte2);
-  sendMessages();
+  return sendMessages();
 }
 
 /**
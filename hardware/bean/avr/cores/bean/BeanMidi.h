@@ -281,6 +281,33 @@ typedef enum  {
 } midiDrums;
 
 
+/**
+ *  Called for an incoming note on or note off, see `BeanMidiClass::onNoteOn()`
+ */
+typedef void (*MidiNoteCallback)(uint8_t channel, uint8_t note, uint8_t velocity);
+
+/**
+ *  Called for an incoming control change, see `BeanMidiClass::onControlChange()`
+ */
+typedef void (*MidiControlChangeCallback)(uint8_t channel, uint8_t control, uint8_t value);
+
+/**
+ *  Called for an incoming pitch bend, with a value from 0-16383 where 0x2000 is no bend, see `BeanMidiClass::onPitchBend()`
+ */
+typedef void (*MidiPitchBendCallback)(uint8_t channel, uint16_t value);
+
+/**
+ *  Called for any other incoming Midi message, see `BeanMidiClass::onMessage()`. Unused data bytes are 0.
+ */
+typedef void (*MidiMessageCallback)(uint8_t status, uint8_t byte1, uint8_t byte2);
+
+/**
+ *  Called with each piece of an incoming System Exclusive message, without the 0xF0 and 0xF7 that frame it, see `BeanMidiClass::onSysEx()`
+ */
+typedef void (*MidiSysExCallback)(const uint8_t *data, uint8_t length, bool last);
+
+struct midiPacketBuilder;
+
 class BeanMidiClass {
  public:
   /****************************************************************************/
@@ -331,23 +358,97 @@ class BeanMidiClass {
   int sendMessage(uint8_t status, uint8_t byte1, uint8_t byte2);
 
   /**
-   *  Reads a single incoming Midi message.
+   *  Reads a single incoming Midi message. Running status is filled in, so status is always set, and data bytes the message doesn't have are 0.
+   *  System Exclusive messages are only passed to a callback set with onSysEx().
    *  @param pointer to the status the status byte signifying the type of message
    *  @param pointer to the byte1 the first data byte of the midi message
    *  @param pointer to the byte2 the second data byte of the midi message
-   *  @return Midi status/timestamp byte
+   *  @return the BLE-MIDI timestamp byte of the message, or 0 if there is no message to read
    */
   int readMessage(uint8_t *status, uint8_t *byte1, uint8_t *byte2);
 
+  /**
+   *  Calls the callbacks set with onNoteOn(), onNoteOff(), onControlChange(), onPitchBend(), onMessage() and onSysEx() for each incoming Midi message.
+   *  This runs by itself between calls to `loop()` once any callback is set, see BeanScheduler; call it from `loop()` to handle messages sooner.
+   *  @return the number of messages handled
+   */
+  int processMessages();
+
+  /**
+   *  Sets a function to call for each incoming note on. A note on with velocity 0 goes to the note off callback instead, if there is one.
+   *  @param callback the function to call, or NULL to stop. Without one, note ons go to the onMessage() callback.
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onNoteOn(MidiNoteCallback callback);
+
+  /**
+   *  Sets a function to call for each incoming note off.
+   *  @param callback the function to call, or NULL to stop. Without one, note offs go to the onMessage() callback.
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onNoteOff(MidiNoteCallback callback);
+
+  /**
+   *  Sets a function to call for each incoming control change.
+   *  @param callback the function to call, or NULL to stop. Without one, control changes go to the onMessage() callback.
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onControlChange(MidiControlChangeCallback callback);
+
+  /**
+   *  Sets a function to call for each incoming pitch bend.
+   *  @param callback the function to call, or NULL to stop. Without one, pitch bends go to the onMessage() callback.
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onPitchBend(MidiPitchBendCallback callback);
+
+  /**
+   *  Sets a function to call for each incoming message that no other callback takes.
+   *  @param callback the function to call, or NULL to stop
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onMessage(MidiMessageCallback callback);
+
+  /**
+   *  Sets a function to call with incoming System Exclusive messages, in pieces of up to 16 bytes as they arrive.
+   *  @param callback the function to call, or NULL to stop
+   *  @return false if BeanScheduler is already watching BEAN_MAX_MESSAGE_EVENTS message ids
+   */
+  bool onSysEx(MidiSysExCallback callback);
+
   /**
    *  Sends Midi messages after they have been loaded to the midi buffer using loadMessage() commands.
    *
    *  The buffer has a maximum size of 20 messages before it must be dumped or sent using this function.
    *
-   *  @return number of Midi bytes sent, 0 if there are none to be sent
+   *  Messages are packed into as few BLE-MIDI packets as possible. Messages that share a status within a packet leave it out (running status), and those that also share a millisecond timestamp leave that out too, so one packet can carry 8 messages that share a status and timestamp.
+   *
+   *  @return number of BLE-MIDI bytes sent, 0 if there are none to be sent
    */
   int sendMessages();
 
+  /**
+   *  Sends a System Exclusive message, split across as many BLE-MIDI packets as it needs. Any messages already loaded with loadMessage() are sent first.
+   *  @param data the message's data bytes, each 0-127. The 0xF0 and 0xF7 that frame it are added if they aren't already there.
+   *  @param length length of data
+   *  @return number of BLE-MIDI bytes sent
+   */
+  int sendSysEx(const uint8_t *data, uint16_t length);
+
+  /**
+   *  Sends loaded messages automatically, so there is no need to call sendMessages(). A BLE-MIDI packet is sent as soon as it is full, or latency_ms after its first message was loaded. Loading a message never fails while auto flush is on.
+   *
+   *  The timer runs between calls to `loop()`, see BeanScheduler, so a `loop()` that takes longer than latency_ms delays the packet until it returns.
+   *
+   *  @param latency_ms the longest a message waits before it is sent, e.g. 5, or 0 to turn auto flush off
+   */
+  void setAutoFlush(uint16_t latency_ms);
+
+  /**
+   *  @return the number of messages loadMessage() has dropped because the buffer was full
+   */
+  uint16_t droppedMessages();
+
   /**
    *  Loads a message into the Midi buffer for sending using the sendMessages() function
    *  @param buff a buffer of Midi messages.  Will only send Midi messages in groups of 3.  Must conform to the [Midi spec](https://www.midi.org/specifications/item/table-1-summary-of-midi-message).
@@ -396,6 +497,22 @@ class BeanMidiClass {
   void sustain(midiChannels channel, bool isOn);
 
   ///@}
+
+ private:
+  static int sendPacket(midiPacketBuilder *packet);
+  static int flushAutoPacket();
+  static void autoFlushTask(void *arg);
+  int loadAutoFlush(uint8_t status, uint8_t byte1, uint8_t byte2);
+  static bool parseMessage(uint8_t *status, uint8_t *byte1, uint8_t *byte2);
+  static bool watchMidi(void);
+
+  uint16_t autoFlushMs;
+  uint16_t midiDropped;
+
+ public:
+  // Both start at zero with BeanMidi's static storage, so nothing runs at
+  // startup for it.
+  BeanMidiClass() {}
 };
 
 
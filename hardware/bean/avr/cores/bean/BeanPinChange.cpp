@@ -0,0 +1,42 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "BeanPinChange.h"
+
+static uint8_t pin_change_b[BEAN_PIN_CHANGE_USERS];
+static uint8_t pin_change_d[BEAN_PIN_CHANGE_USERS];
+
+void bean_pin_change_watch(uint8_t user, uint8_t pins_b, uint8_t pins_d) {
+  pin_change_b[user] = pins_b;
+  pin_change_d[user] = pins_d;
+
+  uint8_t all_b = 0;
+  uint8_t all_d = 0;
+  for (uint8_t i = 0; i < BEAN_PIN_CHANGE_USERS; i++) {
+    all_b |= pin_change_b[i];
+    all_d |= pin_change_d[i];
+  }
+  PCMSK0 = all_b;
+  PCMSK2 = all_d;
+
+  // a port that is just being turned on may have an old change flagged;
+  // PCIFR has its flags in the same bits as PCICR
+  uint8_t enable = (all_b ? _BV(PCIE0) : 0) | (all_d ? _BV(PCIE2) : 0);
+  PCIFR = enable & ~PCICR;
+  PCICR = (PCICR & ~(_BV(PCIE0) | _BV(PCIE2))) | enable;
+}
+
+void bean_pulse_pin_change(uint8_t, uint8_t) __attribute__((weak));
+void bean_pulse_pin_change(uint8_t, uint8_t) {}
+
+void bean_encoder_pin_change(uint8_t, uint8_t) __attribute__((weak));
+void bean_encoder_pin_change(uint8_t, uint8_t) {}
+
+ISR(PCINT0_vect) {
+  uint8_t pinb = PINB;
+  uint8_t pind = PIND;
+  // the pulse timestamps first
+  bean_pulse_pin_change(pinb, pind);
+  bean_encoder_pin_change(pinb, pind);
+}
+
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
@@ -0,0 +1,31 @@
+#ifndef BEAN_PIN_CHANGE_H
+#define BEAN_PIN_CHANGE_H
+
+#include <inttypes.h>
+
+// The core's PCINT0 and PCINT2 handlers (port B and port D, the Bean's D0 to
+// D5), shared by the core modules that watch pins.  Each user says which pins
+// it wants and the handler reads both ports once and passes them on, so
+// BeanEncoder and BeanPulse work side by side.  SoftwareSerial and
+// PinChangeInt define these vectors themselves and can't be linked with
+// either.
+
+// digitalPinToPort() values; Arduino.h only defines PB and PD for
+// ARDUINO_MAIN.
+#define PORT_B (2)
+#define PORT_D (4)
+
+#define BEAN_PIN_CHANGE_ENCODER (0)
+#define BEAN_PIN_CHANGE_PULSE (1)
+#define BEAN_PIN_CHANGE_USERS (2)
+
+// Sets the pins a user watches, as masks of port B and port D bits; 0 and 0
+// stop it.  Interrupts must be off.
+void bean_pin_change_watch(uint8_t user, uint8_t pins_b, uint8_t pins_d);
+
+// Called from the handler, with interrupts off, for any change of a watched
+// pin.  A module that isn't linked in gets an empty default.
+void bean_pulse_pin_change(uint8_t pinb, uint8_t pind);
+void bean_encoder_pin_change(uint8_t pinb, uint8_t pind);
+
+#endif
@@ -0,0 +1,180 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "Arduino.h"
+#include "BeanPinChange.h"
+#include "BeanPulse.h"
+
+BeanPulseClass BeanPulse;
+
+#if (BEAN_PULSE_BUFFER & (BEAN_PULSE_BUFFER - 1))
+#error BEAN_PULSE_BUFFER must be a power of two
+#endif
+
+// Timer1 runs free at clk/8 while pulses are measured.
+#define PULSE_TICKS_PER_US (F_CPU / 8000000L)
+
+static volatile uint32_t pulse_widths[BEAN_PULSE_BUFFER];
+static volatile uint8_t pulse_head = 0;
+static volatile uint8_t pulse_tail = 0;
+static volatile uint8_t pulse_dropped = 0;
+
+static bool pulse_running = false;
+static bool pulse_capture;  // on ICP1, rather than a pin change
+static bool pulse_on_d;
+static uint8_t pulse_mask;
+static bool pulse_level;  // the level of the pulses measured
+static bool pulse_last;  // the level the pin was last seen at
+
+// The start of the pulse in progress, on Timer1 and on micros().
+static bool pulse_started = false;
+static uint16_t pulse_start_ticks;
+static unsigned long pulse_start_us;
+
+static uint8_t pulse_saved_tccr1a;
+static uint8_t pulse_saved_tccr1b;
+
+// Called with interrupts off for each edge, with Timer1 at the edge.
+static void pulse_edge(bool level, uint16_t ticks) {
+  if (level == pulse_level) {
+    pulse_start_ticks = ticks;
+    pulse_start_us = micros();
+    pulse_started = true;
+    return;
+  }
+  if (!pulse_started) {
+    return;
+  }
+  pulse_started = false;
+
+  // Timer1 wraps every 65.5 ms (32.8 on the Bean+), so micros(), which is
+  // only good to a few ticks, says how many times it did
+  uint16_t fine = ticks - pulse_start_ticks;
+  uint32_t coarse = (micros() - pulse_start_us) * PULSE_TICKS_PER_US;
+  uint32_t width = fine + ((coarse - fine + 0x8000) & 0xFFFF0000UL);
+
+  uint8_t head = pulse_head;
+  if ((uint8_t)(head - pulse_tail) >= BEAN_PULSE_BUFFER) {
+    if (pulse_dropped != 0xFF) {
+      pulse_dropped++;
+    }
+    return;
+  }
+  pulse_widths[head & (BEAN_PULSE_BUFFER - 1)] = width / PULSE_TICKS_PER_US;
+  pulse_head = head + 1;
+}
+
+void bean_pulse_pin_change(uint8_t pinb, uint8_t pind) {
+  uint16_t ticks = TCNT1;
+  if (!pulse_running || pulse_capture) {
+    return;
+  }
+  bool level = ((pulse_on_d ? pind : pinb) & pulse_mask) != 0;
+  // the interrupt is shared with other pins
+  if (level == pulse_last) {
+    return;
+  }
+  pulse_last = level;
+  pulse_edge(level, ticks);
+}
+
+ISR(TIMER1_CAPT_vect) {
+  uint16_t ticks = ICR1;
+  bool rising = bit_is_set(TCCR1B, ICES1);
+
+  // wait for the edge away from where the pin is now; changing the edge can
+  // flag a capture, so clear it after
+  bool level = (PINB & pulse_mask) != 0;
+  if (level) {
+    TCCR1B &= ~_BV(ICES1);
+  } else {
+    TCCR1B |= _BV(ICES1);
+  }
+  TIFR1 = _BV(ICF1);
+
+  if (level != rising) {
+    // the next edge came before this handler; the pulse is too short to time
+    pulse_started = false;
+    return;
+  }
+  pulse_edge(rising, ticks);
+}
+
+bool BeanPulseClass::begin(uint8_t pin, uint8_t state) {
+  uint8_t port = digitalPinToPort(pin);
+  if (port != PORT_B && port != PORT_D) {
+    return false;
+  }
+  end();
+
+  uint8_t mask = digitalPinToBitMask(pin);
+  pinMode(pin, INPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  pulse_on_d = port == PORT_D;
+  pulse_mask = mask;
+  pulse_capture = !pulse_on_d && mask == _BV(PINB0);
+  pulse_level = state != LOW;
+  pulse_last = ((pulse_on_d ? PIND : PINB) & mask) != 0;
+  pulse_started = false;
+  pulse_head = pulse_tail = 0;
+  pulse_dropped = 0;
+
+  pulse_saved_tccr1a = TCCR1A;
+  pulse_saved_tccr1b = TCCR1B;
+  TCCR1B = 0;
+  TCCR1A = 0;
+  TCNT1 = 0;
+  if (pulse_capture) {
+    // noise canceler on, first edge away from the current level
+    TCCR1B = _BV(ICNC1) | (pulse_last ? 0 : _BV(ICES1)) | _BV(CS11);
+    TIFR1 = _BV(ICF1);
+    TIMSK1 |= _BV(ICIE1);
+  } else {
+    TCCR1B = _BV(CS11);
+    bean_pin_change_watch(BEAN_PIN_CHANGE_PULSE, pulse_on_d ? 0 : mask,
+                          pulse_on_d ? mask : 0);
+  }
+  pulse_running = true;
+  SREG = oldSREG;
+  return true;
+}
+
+void BeanPulseClass::end(void) {
+  if (!pulse_running) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  if (pulse_capture) {
+    TIMSK1 &= ~_BV(ICIE1);
+  } else {
+    bean_pin_change_watch(BEAN_PIN_CHANGE_PULSE, 0, 0);
+  }
+  TCCR1B = 0;
+  TCCR1A = pulse_saved_tccr1a;
+  TCCR1B = pulse_saved_tccr1b;
+  pulse_running = false;
+  SREG = oldSREG;
+}
+
+uint8_t BeanPulseClass::available(void) {
+  return (uint8_t)(pulse_head - pulse_tail);
+}
+
+uint32_t BeanPulseClass::read(void) {
+  uint8_t tail = pulse_tail;
+  if (tail == pulse_head) {
+    return 0;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t width = pulse_widths[tail & (BEAN_PULSE_BUFFER - 1)];
+  SREG = oldSREG;
+  pulse_tail = tail + 1;
+  return width;
+}
+
+uint8_t BeanPulseClass::dropped(void) {
+  return pulse_dropped;
+}
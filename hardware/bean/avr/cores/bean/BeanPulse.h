@@ -0,0 +1,63 @@
+#ifndef BEAN_PULSE_H
+#define BEAN_PULSE_H
+
+#include <inttypes.h>
+
+// How many pulse widths wait to be read, a power of two.  It can be set from
+// compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_PULSE_BUFFER
+#define BEAN_PULSE_BUFFER (8)
+#endif
+
+class BeanPulseClass {
+ public:
+  /****************************************************************************/
+  /** @name Pulse measurement
+   *  Measure pulses on a pin in the background, e.g. the echo of an ultrasonic rangefinder, instead of waiting in `pulseIn()`. Each edge is timestamped from an interrupt with Timer1 running at 1 MHz (2 MHz on the Bean+), so widths come out to the microsecond however busy `loop()` or the serial link is, and any number wait in a buffer.
+   *
+   *  On the ATmega's input capture pin (D4 on the Bean+) the timer itself latches each edge, so interrupt latency doesn't matter. Other pins must be on port B or port D, D0 to D5 on the Bean, and use the pin change interrupts, which the core shares with `BeanEncoder`; an edge is then timed when its interrupt starts, usually within a few microseconds.
+   *
+   *  Pulse measurement owns Timer1 between `begin()` and `end()`, so in the meantime `analogWrite()` doesn't work on the Timer1 PWM pins and `BeanTone` and `BeanPwm` can't be used.
+   */
+  ///@{
+
+  /**
+   *  Starts measuring pulses. The pin is made an input.
+   *
+   *  @param pin the pin the pulses arrive on
+   *  @param state HIGH to measure high pulses, LOW for low ones
+   *  @return false if the pin can't be used
+   */
+  bool begin(uint8_t pin, uint8_t state = 1);
+
+  /**
+   *  Stops measuring and gives Timer1 back as it was before `begin()`. Widths already measured can still be read.
+   */
+  void end(void);
+
+  /**
+   *  @return how many measured pulses are waiting to be read
+   */
+  uint8_t available(void);
+
+  /**
+   *  Takes the oldest measured pulse.
+   *
+   *  @return its width in microseconds, or 0 if none is waiting
+   */
+  uint32_t read(void);
+
+  /**
+   *  Counts pulses that were dropped because BEAN_PULSE_BUFFER (8) were already waiting.
+   *
+   *  @return how many there were since `begin()`, stopping at 255
+   */
+  uint8_t dropped(void);
+  ///@}
+
+  BeanPulseClass() {}
+};
+
+extern BeanPulseClass BeanPulse;
+
+#endif
@@ -0,0 +1,212 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "Arduino.h"
+#include "wiring_private.h"
+#include "BeanPwm.h"
+
+BeanPwmClass BeanPwm;
+
+// Timer1 runs with ICR1 as TOP, in fast PWM (mode 14) or phase and frequency
+// correct PWM (mode 8).  Both load the buffered compare registers at BOTTOM,
+// so a new duty cycle always starts with a whole period.
+#define PWM_MIN_TOP (3)
+
+// The prescalers as shifts from clk/1, for clock selects 1 to 5.
+static const uint8_t PROGMEM pwm_prescaler_shifts[] = {0, 3, 6, 8, 10};
+#define PWM_PRESCALERS (sizeof(pwm_prescaler_shifts))
+
+static bool pwm_running = false;
+static bool pwm_phase_correct;
+static uint8_t pwm_clock_select;  // CS12:0, 1 to 5
+static uint16_t pwm_top;
+
+// Timer1 as it was before begin().
+static uint8_t pwm_saved_tccr1a;
+static uint8_t pwm_saved_tccr1b;
+static uint16_t pwm_saved_icr1;
+
+// Finds the smallest prescaler that fits a period of frequency into 16 bits,
+// for the finest resolution.  Returns false if none does or the period is
+// shorter than four steps.
+static bool pwm_period(uint32_t frequency, bool phase_correct,
+                       uint8_t *clock_select, uint16_t *top) {
+  if (frequency == 0) {
+    return false;
+  }
+  // fast PWM counts TOP + 1 per period, phase correct 2 * TOP
+  uint32_t counts = F_CPU / frequency;
+  if (phase_correct) {
+    counts /= 2;
+  }
+  for (uint8_t i = 0; i < PWM_PRESCALERS; i++) {
+    uint32_t t = counts >> pgm_read_byte(&pwm_prescaler_shifts[i]);
+    if (!phase_correct) {
+      t = t != 0 ? t - 1 : 0;
+    }
+    if (t <= 0xFFFF) {
+      if (t < PWM_MIN_TOP) {
+        return false;
+      }
+      *clock_select = i + 1;
+      *top = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Which compare register drives a pin, and its output mode bit.
+static volatile uint16_t *pwm_ocr(uint8_t pin, uint8_t *com) {
+  switch (digitalPinToTimer(pin)) {
+    case TIMER1A:
+      *com = _BV(COM1A1);
+      return &OCR1A;
+    case TIMER1B:
+      *com = _BV(COM1B1);
+      return &OCR1B;
+    default:
+      return NULL;
+  }
+}
+
+static uint8_t pwm_wgm_b(void) {
+  return pwm_phase_correct ? _BV(WGM13) : _BV(WGM13) | _BV(WGM12);
+}
+
+static bool pwm_start(uint8_t clock_select, uint16_t top, bool phase_correct) {
+  BeanPwm.end();
+
+  uint8_t oldSREG = SREG;
+  cli();
+  pwm_saved_tccr1a = TCCR1A;
+  pwm_saved_tccr1b = TCCR1B;
+  pwm_saved_icr1 = ICR1;
+
+  // both pins disconnected until their first write()
+  pwm_phase_correct = phase_correct;
+  pwm_clock_select = clock_select;
+  pwm_top = top;
+  TCCR1B = 0;
+  TCCR1A = phase_correct ? 0 : _BV(WGM11);
+  ICR1 = top;
+  OCR1A = 0;
+  OCR1B = 0;
+  TCNT1 = 0;
+  TCCR1B = pwm_wgm_b() | clock_select;
+  pwm_running = true;
+  SREG = oldSREG;
+  return true;
+}
+
+bool BeanPwmClass::begin(uint32_t frequency, BeanPwmMode mode) {
+  bool phase_correct = mode == BEAN_PWM_PHASE_CORRECT;
+  uint8_t clock_select;
+  uint16_t top;
+  if (!pwm_period(frequency, phase_correct, &clock_select, &top)) {
+    return false;
+  }
+  return pwm_start(clock_select, top, phase_correct);
+}
+
+bool BeanPwmClass::beginResolution(uint8_t bits, BeanPwmMode mode) {
+  if (bits < 2 || bits > 16) {
+    return false;
+  }
+  uint16_t top = (uint16_t)((1UL << bits) - 1);
+  return pwm_start(_BV(CS10), top, mode == BEAN_PWM_PHASE_CORRECT);
+}
+
+bool BeanPwmClass::setFrequency(uint32_t frequency) {
+  uint8_t clock_select;
+  uint16_t top;
+  if (!pwm_running ||
+      !pwm_period(frequency, pwm_phase_correct, &clock_select, &top)) {
+    return false;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  // ICR1 isn't buffered, so the timer stops while it and the compare values
+  // change; a counter left past the new TOP would otherwise run on to 0xFFFF
+  TCCR1B = pwm_wgm_b();
+  uint16_t old_top = pwm_top;
+  OCR1A = (uint16_t)(((uint32_t)OCR1A * top + old_top / 2) / old_top);
+  OCR1B = (uint16_t)(((uint32_t)OCR1B * top + old_top / 2) / old_top);
+  ICR1 = top;
+  if (!pwm_phase_correct) {
+    // the next count starts a period with the new compare values
+    TCNT1 = top;
+  } else if (TCNT1 > top) {
+    TCNT1 = top;
+  }
+  pwm_clock_select = clock_select;
+  pwm_top = top;
+  TCCR1B = pwm_wgm_b() | clock_select;
+  SREG = oldSREG;
+  return true;
+}
+
+void BeanPwmClass::end(void) {
+  if (!pwm_running) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  // a pin whose output is disconnected falls back to its PORT bit
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+    uint8_t timer = digitalPinToTimer(pin);
+    if ((timer == TIMER1A && bit_is_set(TCCR1A, COM1A1)) ||
+        (timer == TIMER1B && bit_is_set(TCCR1A, COM1B1))) {
+      *portOutputRegister(digitalPinToPort(pin)) &= ~digitalPinToBitMask(pin);
+    }
+  }
+  TCCR1B = 0;
+  TCCR1A = pwm_saved_tccr1a & ~(_BV(COM1A1) | _BV(COM1B1));
+  ICR1 = pwm_saved_icr1;
+  TCCR1B = pwm_saved_tccr1b;
+  pwm_running = false;
+  SREG = oldSREG;
+}
+
+bool BeanPwmClass::writeRaw(uint8_t pin, uint16_t value) {
+  uint8_t com;
+  volatile uint16_t *ocr = pwm_ocr(pin, &com);
+  if (!pwm_running || ocr == NULL) {
+    return false;
+  }
+  if (value > pwm_top) {
+    value = pwm_top;
+  }
+  pinMode(pin, OUTPUT);
+  if (value == 0 && !pwm_phase_correct) {
+    // a compare value of 0 would still leave a one count spike every period
+    digitalWrite(pin, LOW);
+    return true;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  // 16-bit writes go through the shared TEMP register, hence cli()
+  *ocr = value;
+  TCCR1A |= com;
+  SREG = oldSREG;
+  return true;
+}
+
+bool BeanPwmClass::write(uint8_t pin, uint16_t duty) {
+  return writeRaw(pin, (uint16_t)(((uint32_t)duty * pwm_top + 32767) / 65535));
+}
+
+uint16_t BeanPwmClass::top(void) {
+  return pwm_running ? pwm_top : 0;
+}
+
+uint32_t BeanPwmClass::frequency(void) {
+  if (!pwm_running) {
+    return 0;
+  }
+  uint8_t shift = pgm_read_byte(&pwm_prescaler_shifts[pwm_clock_select - 1]);
+  uint32_t counts = pwm_phase_correct ? 2UL * pwm_top : (uint32_t)pwm_top + 1;
+  return (F_CPU >> shift) / counts;
+}
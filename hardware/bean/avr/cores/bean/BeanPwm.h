@@ -0,0 +1,93 @@
+#ifndef BEAN_PWM_H
+#define BEAN_PWM_H
+
+#include <inttypes.h>
+
+/**
+ *  How Timer1 counts, see `BeanPwm.begin()`
+ */
+typedef enum BeanPwmMode {
+  BEAN_PWM_FAST = 0,       /**< counts up and starts over: twice the frequency at a given resolution */
+  BEAN_PWM_PHASE_CORRECT   /**< counts up and back down, so pulses stay centred in the period; use it for motors, and wherever a duty of 0 must be free of glitches */
+} BeanPwmMode;
+
+class BeanPwmClass {
+ public:
+  /****************************************************************************/
+  /** @name High-resolution PWM
+   *  PWM on the two Timer1 pins, 1 and 2 (D5 and D6 on the Bean+), at a frequency of your choosing and up to 16 bits of resolution, where `analogWrite()` gives 8 bits at a fixed 490 Hz (980 Hz on the Bean+). ICR1 sets the period, so the resolution is however many timer counts one period takes: the lower the frequency, the finer the steps, up to 65536 of them.
+   *
+   *  Duty cycles are double buffered by Timer1 and take effect from the start of the next period, so a PWM output never sees a runt or a doubled pulse while it changes. On a fast PWM output a duty of 0 turns the pin off and holds it low at once, as `analogWrite()` does; in phase-correct mode 0 is a steady low from the timer too.
+   *
+   *  BeanPwm owns Timer1 between `begin()` and `end()`, so in the meantime `analogWrite()` doesn't work on pins 1 and 2, and `BeanTone` and `BeanPulse` can't be used; each of them gives Timer1 back as it found it at its `end()`. `tone()` runs on Timer2 and isn't affected.
+   */
+  ///@{
+
+  /**
+   *  Takes over Timer1 and sets its frequency. Pins start to output PWM at their first `write()`.
+   *
+   *  The resolution is the highest Timer1 allows at that frequency: F_CPU / frequency counts per period in fast mode, half as many in phase-correct mode, with the prescaler raised for frequencies too low to fit 16 bits. Call `top()` for the result.
+   *
+   *  @param frequency in Hz, as low as 1 and up to F_CPU / 4 in fast mode, F_CPU / 6 in phase-correct mode
+   *  @param mode BEAN_PWM_FAST or BEAN_PWM_PHASE_CORRECT
+   *  @return false if the frequency is out of range
+   */
+  bool begin(uint32_t frequency, BeanPwmMode mode = BEAN_PWM_FAST);
+
+  /**
+   *  Takes over Timer1 with a given resolution, at the highest frequency it allows: F_CPU / 2^bits in fast mode, e.g. 122 Hz at 16 bits on the Bean and 15625 Hz at 10 bits on the Bean+.
+   *
+   *  @param bits 2 to 16
+   *  @param mode BEAN_PWM_FAST or BEAN_PWM_PHASE_CORRECT
+   *  @return false if bits is out of range
+   */
+  bool beginResolution(uint8_t bits, BeanPwmMode mode = BEAN_PWM_FAST);
+
+  /**
+   *  Changes the frequency while running, keeping each pin's duty cycle. The period in progress is cut short or stretched, never split into extra pulses.
+   *
+   *  @param frequency in Hz, as for `begin()`
+   *  @return false if `begin()` hasn't been called or the frequency is out of range
+   */
+  bool setFrequency(uint32_t frequency);
+
+  /**
+   *  Turns both pins off, leaving them low, and gives Timer1 back as it was before `begin()`.
+   */
+  void end(void);
+
+  /**
+   *  Sets a pin's duty cycle as a fraction of 65535, whatever the frequency and resolution, rounded to the nearest timer count. The pin is made an output.
+   *
+   *  @param pin 1 or 2, the Timer1 PWM pins
+   *  @param duty 0 for always low to 65535 for always high
+   *  @return false if `begin()` hasn't been called or the pin isn't a Timer1 pin
+   */
+  bool write(uint8_t pin, uint16_t duty);
+
+  /**
+   *  Sets a pin's compare value directly, when the sketch works in timer counts. The pin goes high for value counts of every top() in phase-correct mode, and for value + 1 counts of every top() + 1 in fast mode, where 0 turns the pin off.
+   *
+   *  @param pin 1 or 2, the Timer1 PWM pins
+   *  @param value 0 to `top()`; larger values are clipped to it
+   *  @return false if `begin()` hasn't been called or the pin isn't a Timer1 pin
+   */
+  bool writeRaw(uint8_t pin, uint16_t value);
+
+  /**
+   *  @return the compare value for always high, which is the number of steps between 0 and fully on, or 0 if `begin()` hasn't been called
+   */
+  uint16_t top(void);
+
+  /**
+   *  @return the frequency Timer1 actually runs at, in Hz rounded down, which may differ slightly from the one asked for; 0 if `begin()` hasn't been called
+   */
+  uint32_t frequency(void);
+  ///@}
+
+  BeanPwmClass() {}
+};
+
+extern BeanPwmClass BeanPwm;
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef BEAN_RING_BUFFER_H
+#define BEAN_RING_BUFFER_H
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Single producer, single consumer byte FIFO shared between an ISR and the
+// sketch.  head and tail are free running uint8_t counters that are masked on
+// access, so every slot is usable and no operation needs a division or a 16
+// bit compare.  The capacity is fixed at compile time by BeanRingBuffer<N>;
+// code that handles any channel takes a ring_buffer *.
+//
+// Only the producer moves head and only the consumer moves tail.  A reset
+// that touches both (head = tail = 0) must run with the producer quiet, e.g.
+// from the producing ISR itself or with interrupts disabled.
+class ring_buffer {
+ public:
+  volatile uint8_t head;
+  volatile uint8_t tail;
+
+  uint8_t capacity(void) const { return _mask + 1; }
+  uint8_t available(void) const { return (uint8_t)(head - tail); }
+  uint8_t space(void) const { return capacity() - available(); }
+
+  // Producer side.  Returns false, dropping c, if the buffer is full.
+  bool store(uint8_t c) {
+    uint8_t h = head;
+    if ((uint8_t)(h - tail) > _mask) {
+      return false;
+    }
+    _data[h & _mask] = c;
+    head = h + 1;
+    return true;
+  }
+
+  // Producer side, for a message that may still be abandoned: puts c n places
+  // after head without the consumer seeing it.  publish(n) then hands over
+  // the first n bytes put that way.
+  bool storeAt(uint8_t n, uint8_t c) {
+    uint8_t h = head;
+    if ((uint16_t)(uint8_t)(h - tail) + n > _mask) {
+      return false;
+    }
+    _data[(uint8_t)(h + n) & _mask] = c;
+    return true;
+  }
+  void publish(uint8_t n) { head += n; }
+
+  // Consumer side.
+  int read(void) {
+    uint8_t t = tail;
+    if (head == t) {
+      return -1;
+    }
+    uint8_t c = _data[t & _mask];
+    tail = t + 1;
+    return c;
+  }
+
+  // The byte n places after the next one to be read, or -1.
+  int peek(uint8_t n = 0) const {
+    if (n >= available()) {
+      return -1;
+    }
+    return _data[(uint8_t)(tail + n) & _mask];
+  }
+
+  // Copies up to n bytes out, returning how many were read.  The bytes
+  // are at most two contiguous spans of the storage, so two memcpy()s.
+  uint8_t read(uint8_t *buf, uint8_t n) {
+    uint8_t t = tail;
+    uint8_t count = (uint8_t)(head - t);
+    if (count > n) {
+      count = n;
+    }
+    uint8_t start = t & _mask;
+    uint8_t first = capacity() - start;
+    if (first > count) {
+      first = count;
+    }
+    memcpy(buf, &_data[start], first);
+    memcpy(&buf[first], _data, count - first);
+    tail = t + count;
+    return count;
+  }
+
+  // Drops the next n bytes, which must be available.
+  void skip(uint8_t n) { tail += n; }
+
+  // Drops everything currently buffered.
+  void clear(void) { tail = head; }
+
+ protected:
+  ring_buffer(uint8_t *data, uint8_t mask)
+      : head(0), tail(0), _mask(mask), _data(data) {}
+  // Leaves every member at zero, which only a buffer with static storage
+  // starts with.
+  ring_buffer() {}
+
+  uint8_t _mask;
+  uint8_t *_data;
+};
+
+template <uint8_t N>
+class BeanRingBuffer : public ring_buffer {
+  // Fails to compile unless N is a power of two between 2 and 128.
+  typedef char capacity_must_be_a_power_of_two
+      [(N >= 2 && N <= 128 && (N & (N - 1)) == 0) ? 1 : -1];
+
+ public:
+  BeanRingBuffer() : ring_buffer(_storage, N - 1) {}
+
+ private:
+  uint8_t _storage[N];
+};
+
+// Same as BeanRingBuffer<N>, but the storage is only malloc'd by begin(), the
+// first time the channel is actually used.  Until then the buffer reads as
+// empty and must not be stored into.  It must have static storage: it
+// starts out zeroed instead of running a constructor, so a channel the
+// sketch never uses adds no startup code.
+template <uint8_t N>
+class BeanLazyRingBuffer : public ring_buffer {
+  // Fails to compile unless N is a power of two between 2 and 128.
+  typedef char capacity_must_be_a_power_of_two
+      [(N >= 2 && N <= 128 && (N & (N - 1)) == 0) ? 1 : -1];
+
+ public:
+  BeanLazyRingBuffer() {}
+
+  // Returns false if the allocation failed.
+  bool begin(void) {
+    if (_data == NULL) {
+      _data = (uint8_t *)malloc(N);
+      _mask = N - 1;
+    }
+    return _data != NULL;
+  }
+  bool allocated(void) const { return _data != NULL; }
+};
+
+// A channel compiled out with a size of 0: always empty, begin() fails.
+template <>
+class BeanLazyRingBuffer<0> : public ring_buffer {
+ public:
+  BeanLazyRingBuffer() {}
+
+  bool begin(void) { return false; }
+  bool allocated(void) const { return false; }
+};
+
+#endif
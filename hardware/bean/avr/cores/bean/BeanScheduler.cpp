@@ -0,0 +1,369 @@
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "Arduino.h"
+#include "BeanScheduler.h"
+#include "BeanEnergy.h"
+
+BeanSchedulerClass BeanScheduler;
+
+#if (BEAN_MAX_DEFERRED & (BEAN_MAX_DEFERRED - 1))
+#error BEAN_MAX_DEFERRED must be a power of two
+#endif
+#if (BEAN_TIMER_WHEEL_SIZE & (BEAN_TIMER_WHEEL_SIZE - 1))
+#error BEAN_TIMER_WHEEL_SIZE must be a power of two
+#endif
+#if BEAN_MAX_TIMERS > 127
+#error BEAN_MAX_TIMERS must be 127 or less
+#endif
+
+static volatile bool idle_sleep_enabled = false;
+
+void bean_idle(void) {
+  BEAN_ENERGY_WAIT();
+  if (idle_sleep_enabled) {
+    bean_idle_sleep();
+  }
+}
+
+void bean_idle_sleep(void) {
+  // with interrupts off nothing could wake us
+  if (bit_is_clear(SREG, SREG_I)) {
+    return;
+  }
+
+  BEAN_ENERGY_WAIT();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  sleep_enable();
+  BEAN_ENERGY_IDLE(1);
+  sei();
+  sleep_cpu();
+  BEAN_ENERGY_IDLE(0);
+  sleep_disable();
+}
+
+// Deferred tasks, a FIFO filled from anywhere and drained by run().
+struct DeferredTask {
+  BeanTask task;
+  void *arg;
+};
+
+static DeferredTask deferred[BEAN_MAX_DEFERRED];
+static volatile uint8_t deferred_head = 0;
+static volatile uint8_t deferred_tail = 0;
+
+// Timers wait in a hashed timer wheel: one list per millisecond of a
+// BEAN_TIMER_WHEEL_SIZE ms turn, holding the timers whose deadline falls on
+// that millisecond of any turn.  The Timer0 overflow handler visits the lists
+// of the milliseconds that just passed and moves the timers that are due to
+// the ready list, which run() empties.  The lists are doubly linked through
+// timer index + 1, 0 ending a list, so starting or cancelling a timer doesn't
+// depend on how many are running.
+#define TIMER_READY (BEAN_TIMER_WHEEL_SIZE)
+#define TIMER_UNLINKED (0xFF)
+
+struct Timer {
+  BeanTask task;  // NULL when the timer is free
+  void *arg;
+  uint32_t interval;
+  unsigned long deadline;
+  bool repeat;
+  uint8_t list;
+  uint8_t prev;
+  uint8_t next;
+};
+
+static Timer timers[BEAN_MAX_TIMERS];
+static uint8_t timer_lists[BEAN_TIMER_WHEEL_SIZE + 1];
+
+// The last millisecond the wheel has been turned to, and how many timers are
+// on it.  Both only change with interrupts off.
+static unsigned long wheel_time = 0;
+volatile uint8_t bean_timers_armed = 0;
+
+static void timer_link(uint8_t id, uint8_t list) {
+  Timer *timer = &timers[id];
+  uint8_t head = timer_lists[list];
+  timer->list = list;
+  timer->prev = 0;
+  timer->next = head;
+  if (head != 0) {
+    timers[head - 1].prev = id + 1;
+  }
+  timer_lists[list] = id + 1;
+}
+
+static void timer_unlink(uint8_t id) {
+  Timer *timer = &timers[id];
+  if (timer->prev != 0) {
+    timers[timer->prev - 1].next = timer->next;
+  } else {
+    timer_lists[timer->list] = timer->next;
+  }
+  if (timer->next != 0) {
+    timers[timer->next - 1].prev = timer->prev;
+  }
+  timer->list = TIMER_UNLINKED;
+}
+
+// Puts a timer on the wheel at its deadline.  Interrupts must be off.
+static void timer_arm(uint8_t id) {
+  if (bean_timers_armed == 0) {
+    // the overflow handler hasn't been turning the wheel
+    wheel_time = millis();
+  }
+  unsigned long deadline = timers[id].deadline;
+  // one that is already due goes on the next millisecond visited
+  if ((long)(deadline - wheel_time) <= 0) {
+    deadline = wheel_time + 1;
+  }
+  timer_link(id, deadline & (BEAN_TIMER_WHEEL_SIZE - 1));
+  bean_timers_armed++;
+}
+
+void bean_timer_tick(unsigned long now) {
+  // after a jump, e.g. from advanceMillis(), one full turn visits them all
+  unsigned long steps = now - wheel_time;
+  if (steps > BEAN_TIMER_WHEEL_SIZE) {
+    steps = BEAN_TIMER_WHEEL_SIZE;
+  }
+  unsigned long time = now - steps;
+  while (steps-- > 0) {
+    uint8_t link = timer_lists[++time & (BEAN_TIMER_WHEEL_SIZE - 1)];
+    while (link != 0) {
+      uint8_t id = link - 1;
+      link = timers[id].next;
+      // the others on this list are due on a later turn
+      if ((long)(now - timers[id].deadline) >= 0) {
+        timer_unlink(id);
+        timer_link(id, TIMER_READY);
+        bean_timers_armed--;
+      }
+    }
+  }
+  wheel_time = now;
+}
+
+// onMessage() watches.  pending is bumped by the RX ISR; message_events_used
+// lets it skip the scan when nothing is watched.
+struct MessageEvent {
+  uint16_t messageId;
+  BeanTask task;
+  void *arg;
+  volatile uint8_t pending;
+};
+
+static MessageEvent message_events[BEAN_MAX_MESSAGE_EVENTS];
+static volatile bool message_events_used = false;
+
+bool BeanSchedulerClass::defer(BeanTask task, void *arg) {
+  bool queued = false;
+  uint8_t oldSREG = SREG;
+  cli();
+
+  uint8_t head = deferred_head;
+  if ((uint8_t)(head - deferred_tail) < BEAN_MAX_DEFERRED) {
+    deferred[head & (BEAN_MAX_DEFERRED - 1)].task = task;
+    deferred[head & (BEAN_MAX_DEFERRED - 1)].arg = arg;
+    deferred_head = head + 1;
+    queued = true;
+  }
+
+  SREG = oldSREG;
+  return queued;
+}
+
+static int8_t timer_start(uint32_t interval_ms, BeanTask task, void *arg,
+                          bool repeat) {
+  int8_t started = -1;
+  uint8_t oldSREG = SREG;
+  cli();
+
+  for (uint8_t i = 0; i < BEAN_MAX_TIMERS; i++) {
+    if (timers[i].task == NULL) {
+      timers[i].task = task;
+      timers[i].arg = arg;
+      timers[i].interval = interval_ms;
+      timers[i].deadline = millis() + interval_ms;
+      timers[i].repeat = repeat;
+      timer_arm(i);
+      started = i;
+      break;
+    }
+  }
+
+  SREG = oldSREG;
+  return started;
+}
+
+int8_t BeanSchedulerClass::setTimeout(uint32_t interval_ms, BeanTask task,
+                                      void *arg) {
+  return timer_start(interval_ms, task, arg, false);
+}
+
+int8_t BeanSchedulerClass::setInterval(uint32_t interval_ms, BeanTask task,
+                                       void *arg) {
+  return timer_start(interval_ms, task, arg, true);
+}
+
+void BeanSchedulerClass::cancel(int8_t timer) {
+  if (timer < 0 || timer >= BEAN_MAX_TIMERS) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+
+  Timer *t = &timers[timer];
+  if (t->task != NULL) {
+    if (t->list < TIMER_READY) {
+      bean_timers_armed--;
+    }
+    if (t->list != TIMER_UNLINKED) {
+      timer_unlink(timer);
+    }
+    t->task = NULL;
+  }
+
+  SREG = oldSREG;
+}
+
+uint32_t BeanSchedulerClass::nextTimeout(void) {
+  uint32_t next = 0xFFFFFFFFUL;
+  uint8_t oldSREG = SREG;
+  cli();
+
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < BEAN_MAX_TIMERS; i++) {
+    Timer *timer = &timers[i];
+    if (timer->task == NULL || timer->list == TIMER_UNLINKED) {
+      continue;
+    }
+    long left = timer->list == TIMER_READY ? 0 : (long)(timer->deadline - now);
+    if (left <= 0) {
+      next = 0;
+      break;
+    }
+    if ((uint32_t)left < next) {
+      next = left;
+    }
+  }
+
+  SREG = oldSREG;
+  return next;
+}
+
+bool BeanSchedulerClass::onMessage(uint16_t messageId, BeanTask task,
+                                   void *arg) {
+  MessageEvent *free_event = NULL;
+  bool added = false;
+  uint8_t oldSREG = SREG;
+  cli();
+
+  for (uint8_t i = 0; i < BEAN_MAX_MESSAGE_EVENTS; i++) {
+    MessageEvent *event = &message_events[i];
+    if (event->task != NULL && event->messageId == messageId) {
+      free_event = event;
+      break;
+    }
+    if (event->task == NULL && free_event == NULL) {
+      free_event = event;
+    }
+  }
+
+  if (free_event != NULL) {
+    free_event->messageId = messageId;
+    free_event->task = task;
+    free_event->arg = arg;
+    free_event->pending = 0;
+    added = true;
+  }
+
+  message_events_used = false;
+  for (uint8_t i = 0; i < BEAN_MAX_MESSAGE_EVENTS; i++) {
+    if (message_events[i].task != NULL) {
+      message_events_used = true;
+    }
+  }
+
+  SREG = oldSREG;
+  return added || task == NULL;
+}
+
+void BeanSchedulerClass::messageArrived(uint16_t messageId) {
+  if (!message_events_used) {
+    return;
+  }
+  for (uint8_t i = 0; i < BEAN_MAX_MESSAGE_EVENTS; i++) {
+    MessageEvent *event = &message_events[i];
+    if (event->task != NULL && event->messageId == messageId &&
+        event->pending != 0xFF) {
+      event->pending++;
+    }
+  }
+}
+
+void BeanSchedulerClass::enableIdleSleep(bool enable) {
+  idle_sleep_enabled = enable;
+}
+
+bool BeanSchedulerClass::run(void) {
+  bool ran = false;
+
+  // at most one run per timer, so an interval shorter than its task can't
+  // starve loop()
+  for (uint8_t n = 0; n < BEAN_MAX_TIMERS; n++) {
+    if (*(volatile uint8_t *)&timer_lists[TIMER_READY] == 0) {
+      break;
+    }
+    uint8_t oldSREG = SREG;
+    cli();
+    uint8_t id = timer_lists[TIMER_READY] - 1;
+    timer_unlink(id);
+    Timer *timer = &timers[id];
+    BeanTask task = timer->task;
+    void *arg = timer->arg;
+    if (timer->repeat) {
+      // keep the schedule, rather than drifting by how late this run is,
+      // but skip the periods missed in a long block or Bean.sleep() rather
+      // than run once per loop() to catch up
+      unsigned long now = millis();
+      timer->deadline += timer->interval;
+      if ((long)(timer->deadline - now) <= 0) {
+        timer->deadline = now + timer->interval;
+      }
+      timer_arm(id);
+    } else {
+      timer->task = NULL;
+    }
+    SREG = oldSREG;
+
+    task(arg);
+    ran = true;
+  }
+
+  if (message_events_used) {
+    for (uint8_t i = 0; i < BEAN_MAX_MESSAGE_EVENTS; i++) {
+      MessageEvent *event = &message_events[i];
+      if (event->task == NULL || event->pending == 0) {
+        continue;
+      }
+      event->pending = 0;
+      event->task(event->arg);
+      ran = true;
+    }
+  }
+
+  // only what was queued before we started, so a task that defers itself
+  // doesn't starve loop()
+  uint8_t count = (uint8_t)(deferred_head - deferred_tail);
+  while (count-- > 0) {
+    DeferredTask *next = &deferred[deferred_tail & (BEAN_MAX_DEFERRED - 1)];
+    BeanTask task = next->task;
+    void *arg = next->arg;
+    deferred_tail++;
+    task(arg);
+    ran = true;
+  }
+
+  return ran;
+}
@@ -0,0 +1,139 @@
+#ifndef BEAN_SCHEDULER_H
+#define BEAN_SCHEDULER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sleeps in SLEEP_MODE_IDLE until the next interrupt, if idle sleep is
+// enabled and interrupts are on; otherwise returns straight away.  The core's
+// wait loops (delay(), replies from the CC, a full TX queue) call it each time
+// round, so waiting costs idle current instead of full power.  Timer0 wakes
+// the CPU at least every 2 ms.
+void bean_idle(void);
+
+// The same, whether or not idle sleep is enabled.
+void bean_idle_sleep(void);
+
+// Timers in the scheduler's timer wheel.  While there are any, the Timer0
+// overflow handler calls bean_timer_tick() with the new millis().
+extern volatile uint8_t bean_timers_armed;
+void bean_timer_tick(unsigned long now);
+
+#ifdef __cplusplus
+}
+
+typedef void (*BeanTask)(void *arg);
+
+// Sizes of the scheduler's tables.  They can be set from
+// compiler.cpp.extra_flags in platform.local.txt.
+#ifndef BEAN_MAX_DEFERRED
+#define BEAN_MAX_DEFERRED (8)  // a power of two
+#endif
+// The core and its libraries take one timer each while they need it: the
+// Wire watchdog while transactions are queued, BeanEncoder while an encoder
+// is attached, each EEPROMStore while it has writes pending, BeanMidi's
+// auto-flush, BeanAncs prefetching and LED animations played by the core,
+// and BeanHid two, for mouse moves and queued keys.  That is 8 with all of
+// them at once; count the sketch's own on top.  A timer costs 16 bytes.
+#ifndef BEAN_MAX_TIMERS
+#define BEAN_MAX_TIMERS (8)
+#endif
+#ifndef BEAN_TIMER_WHEEL_SIZE
+#define BEAN_TIMER_WHEEL_SIZE (32)  // milliseconds, a power of two
+#endif
+#ifndef BEAN_MAX_MESSAGE_EVENTS
+#define BEAN_MAX_MESSAGE_EVENTS (4)
+#endif
+
+class BeanSchedulerClass {
+ public:
+  /****************************************************************************/
+  /** @name Scheduler
+   *  Run work later, on a timer, or when a message from the CC2540 arrives, without busy-waiting in `loop()`.
+   *  All tasks run between calls to `loop()`, never from an interrupt, so they can use any Bean function.
+   */
+  ///@{
+
+  /**
+   *  Runs a task once, after the current `loop()`. Safe to call from an interrupt handler.
+   *
+   *  @param task the function to run
+   *  @param arg passed to task
+   *  @return false if BEAN_MAX_DEFERRED tasks are already waiting
+   */
+  bool defer(BeanTask task, void *arg = NULL);
+
+  /**
+   *  Runs a task once, interval_ms from now.
+   *
+   *  @param interval_ms how long to wait
+   *  @param task the function to run
+   *  @param arg passed to task
+   *  @return a timer id for `cancel()`, or -1 if all BEAN_MAX_TIMERS timers are in use
+   */
+  int8_t setTimeout(uint32_t interval_ms, BeanTask task, void *arg = NULL);
+
+  /**
+   *  Runs a task every interval_ms until it is cancelled. Runs stay on schedule when one is a little late, but periods missed altogether, e.g. during `Bean.sleep()`, are skipped rather than run back to back.
+   *
+   *  @param interval_ms the time between runs
+   *  @param task the function to run
+   *  @param arg passed to task
+   *  @return a timer id for `cancel()`, or -1 if all BEAN_MAX_TIMERS timers are in use
+   */
+  int8_t setInterval(uint32_t interval_ms, BeanTask task, void *arg = NULL);
+
+  /**
+   *  Stops a timer started with `setTimeout()` or `setInterval()`.
+   *
+   *  @param timer the id returned when it was started
+   */
+  void cancel(int8_t timer);
+
+  /**
+   *  Gets how long until the next timer started with `setTimeout()` or `setInterval()` is due, e.g. to sleep until then: `Bean.sleep(BeanScheduler.nextTimeout())`.
+   *
+   *  @return the time in milliseconds, 0 if a timer is already due, or 0xFFFFFFFF if no timer is running
+   */
+  uint32_t nextTimeout(void);
+
+  /**
+   *  Runs a task each time a message with this id arrives from the CC2540 with a good CRC, e.g. MSG_ID_SERIAL_DATA for incoming Virtual Serial data. Arrivals are counted, not queued: several messages that arrive before the task runs run it once.
+   *
+   *  @param messageId the message id to watch
+   *  @param task the function to run, or NULL to stop watching messageId
+   *  @param arg passed to task
+   *  @return false if BEAN_MAX_MESSAGE_EVENTS ids are already watched
+   */
+  bool onMessage(uint16_t messageId, BeanTask task, void *arg = NULL);
+
+  /**
+   *  Lets Bean sleep in idle mode whenever there is nothing to do: after each `loop()` that leaves no task ready, and while the core waits on the CC2540 or in `delay()`. Any interrupt wakes it, including incoming serial data and the Timer0 tick that keeps `millis()`, so `loop()` still runs at least every 2 ms. Off by default.
+   *
+   *  @param enable true to sleep when idle
+   */
+  void enableIdleSleep(bool enable);
+
+  /**
+   *  Runs the tasks that are due. Called after every `loop()`.
+   *
+   *  @return true if any task ran
+   */
+  bool run(void);
+  ///@}
+
+  // Called from the RX ISR for every good frame.
+  void messageArrived(uint16_t messageId);
+
+  BeanSchedulerClass() {}
+};
+
+extern BeanSchedulerClass BeanScheduler;
+
+#endif  // __cplusplus
+
+#endif
@@ -5,6 +5,8 @@
 #include "wiring_private.h"
 
 #include "BeanSerialTransport.h"
+#include "BeanCrc32.h"
+#include "BeanScheduler.h"
 
 // There is a compiler or hardware bug(?) that causes
 // HardwareSerial::write() to lock the Serial Port unless
@@ -37,46 +39,836 @@ static const uint16_t BEAN_MAX_ADVERTISING_INT_MS = 1285;  // ms
 #endif
 #endif
 
-ring_buffer midi_buffer = {{0}, 0, 0};
-ring_buffer ancs_buffer = {{0}, 0, 0};
-ring_buffer ancs_message_buffer = {{0}, 0, 0};
-ring_buffer observer_message = {{0}, 0, 0};
-ring_buffer rx_buffer = {{0}, 0, 0};
-ring_buffer tx_buffer = {{0}, 0, 0};
-ring_buffer reply_buffer = {{0}, 0, 0};
+// Channel buffer sizes.  Each must be a power of two no larger than 128; the
+// reply and profile channels can also be 0 to compile them out.  They can be
+// set from compiler.cpp.extra_flags in platform.local.txt, e.g.
+// -DBEAN_MIDI_BUFFER_SIZE=0.
+//
+// The MIDI, ANCS and accelerometer stream buffers are allocated from the
+// heap the first time the sketch uses that feature, so a sketch that never
+// does doesn't pay for them.  The same goes for the observer queue, which
+// holds BEAN_OBSERVER_QUEUE_SIZE whole advertisements, and the queue of
+// BEAN_SCRATCH_WRITE_QUEUE_SIZE scratch writes pushed by the CC.
+#ifndef BEAN_SERIAL_RX_BUFFER_SIZE
+#define BEAN_SERIAL_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif
+#ifndef BEAN_SERIAL_TX_BUFFER_SIZE
+#define BEAN_SERIAL_TX_BUFFER_SIZE 16  // only debugWrite() bypasses the queue
+#endif
+#ifndef BEAN_REPLY_BUFFER_SIZE
+#define BEAN_REPLY_BUFFER_SIZE 0  // replies that match no request
+#endif
+#ifndef BEAN_MIDI_BUFFER_SIZE
+#define BEAN_MIDI_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif
+#ifndef BEAN_ANCS_BUFFER_SIZE
+#define BEAN_ANCS_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif
+#ifndef BEAN_ANCS_MESSAGE_BUFFER_SIZE
+#define BEAN_ANCS_MESSAGE_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif
+#ifndef BEAN_SERIAL_FRAME_QUEUE_SIZE
+#define BEAN_SERIAL_FRAME_QUEUE_SIZE 8  // frame boundaries for readFrame()
+#endif
+#ifndef BEAN_OBSERVER_QUEUE_SIZE
+#define BEAN_OBSERVER_QUEUE_SIZE 4  // a power of two
+#endif
+#ifndef BEAN_OBSERVER_DEDUPE_SIZE
+#define BEAN_OBSERVER_DEDUPE_SIZE 4  // addresses remembered for dedupe
+#endif
+#ifndef BEAN_SCRATCH_WRITE_QUEUE_SIZE
+#define BEAN_SCRATCH_WRITE_QUEUE_SIZE 4  // a power of two
+#endif
+#ifndef BEAN_ACCEL_BUFFER_SIZE
+#define BEAN_ACCEL_BUFFER_SIZE 128  // streamed accelerometer samples
+#endif
+
+BeanLazyRingBuffer<BEAN_MIDI_BUFFER_SIZE> midi_buffer;
+BeanLazyRingBuffer<BEAN_ANCS_BUFFER_SIZE> ancs_buffer;
+BeanLazyRingBuffer<BEAN_ANCS_MESSAGE_BUFFER_SIZE> ancs_message_buffer;
+BeanLazyRingBuffer<BEAN_ACCEL_BUFFER_SIZE> accel_buffer;
+BeanRingBuffer<BEAN_SERIAL_RX_BUFFER_SIZE> rx_buffer;
+BeanRingBuffer<BEAN_SERIAL_FRAME_QUEUE_SIZE> rx_frame_ends;
+BeanRingBuffer<BEAN_SERIAL_TX_BUFFER_SIZE> tx_buffer;
+#if BEAN_REPLY_BUFFER_SIZE > 0
+BeanRingBuffer<BEAN_REPLY_BUFFER_SIZE> reply_buffer;
+#define REPLY_BUFFER (&reply_buffer)
+#else
+#define REPLY_BUFFER ((ring_buffer *)NULL)
+#endif
 
 static volatile bool tx_buffer_flushed = true;
 static volatile bool serial_message_complete = false;
 
-static volatile bool observer_message_sending = false;
-static volatile int observer_msg_len = 0;
+// Outstanding call_async() requests.  The RX ISR writes a reply straight into
+// the matching request's response buffer and marks it done; pollReplies()
+// retires finished and timed out requests and runs their callbacks.  Replies
+// from the CC carry the request id, usually with BEAN_RESPONSE_BIT set (e.g.
+// MSG_ID_CC_ACCEL_READ_RSP), so both forms match.
+#ifndef BEAN_MAX_PENDING_REPLIES
+#define BEAN_MAX_PENDING_REPLIES (4)
+#endif
+
+static const uint16_t BEAN_RESPONSE_BIT = 0x0080;
+
+static BeanReply *volatile pending_replies[BEAN_MAX_PENDING_REPLIES];
+
+// The request the RX ISR is currently filling, dropped if it times out.
+static BeanReply *volatile rx_reply = NULL;
+static size_t rx_reply_length = 0;
+
+// The one request being used to grade adaptive pacing, see pacing_feedback().
+static BeanReply *pacing_probe_reply = NULL;
+
+// Called from the RX ISR.  A reply that matches no request id still goes to
+// the only outstanding request, as the CC's older replies did not always echo
+// the request id.
+static BeanReply *reply_match(uint16_t messageType) {
+  BeanReply *only = NULL;
+  uint8_t outstanding = 0;
+
+  for (uint8_t i = 0; i < BEAN_MAX_PENDING_REPLIES; i++) {
+    BeanReply *reply = pending_replies[i];
+    if (reply == NULL || reply->status != BEAN_REPLY_PENDING) {
+      continue;
+    }
+    if ((reply->messageId | BEAN_RESPONSE_BIT) ==
+        (messageType | BEAN_RESPONSE_BIT)) {
+      return reply;
+    }
+    only = reply;
+    outstanding++;
+  }
+
+  return outstanding == 1 ? only : NULL;
+}
+
+static bool reply_register(BeanReply *reply) {
+  int8_t free_slot = -1;
+  bool registered = false;
+  uint8_t oldSREG = SREG;
+  cli();
+
+  for (uint8_t i = 0; i < BEAN_MAX_PENDING_REPLIES; i++) {
+    BeanReply *other = pending_replies[i];
+    if (other == NULL) {
+      if (free_slot < 0) free_slot = i;
+    } else if ((other->messageId | BEAN_RESPONSE_BIT) ==
+               (reply->messageId | BEAN_RESPONSE_BIT)) {
+      // one request per message id, or its reply could go to either
+      free_slot = -1;
+      break;
+    }
+  }
+  if (free_slot >= 0) {
+    pending_replies[free_slot] = reply;
+    registered = true;
+  }
+
+  SREG = oldSREG;
+  return registered;
+}
+
+static void reply_release(BeanReply *reply) {
+  uint8_t oldSREG = SREG;
+  cli();
+  for (uint8_t i = 0; i < BEAN_MAX_PENDING_REPLIES; i++) {
+    if (pending_replies[i] == reply) {
+      pending_replies[i] = NULL;
+    }
+  }
+  if (rx_reply == reply) {
+    rx_reply = NULL;
+  }
+  if (pacing_probe_reply == reply) {
+    pacing_probe_reply = NULL;
+  }
+  SREG = oldSREG;
+}
+
+// Transport counters.  Only the ISRs write them, apart from the reset, so
+// reads and resets just need interrupts off.
+#if BEAN_TRANSPORT_STATS
+static BEAN_TRANSPORT_STATS_T transport_stats;
+static uint8_t rx_isr_max_ticks = 0;
+static uint8_t tx_isr_max_ticks = 0;
+
+#define STAT_INC(field)                    \
+  do {                                     \
+    if (transport_stats.field != 0xFFFF) { \
+      transport_stats.field++;             \
+    }                                      \
+  } while (0)
+
+// ISR durations in Timer0 ticks (64 cycles).  Timer0's overflow interrupt
+// can't run inside another ISR, but TCNT0 keeps counting, so the uint8_t
+// difference is right for anything under 256 ticks.
+#define ISR_TIME_BEGIN() uint8_t isr_start = TCNT0
+#define ISR_TIME_END(max_ticks)                       \
+  do {                                                \
+    uint8_t isr_ticks = (uint8_t)(TCNT0 - isr_start); \
+    if (isr_ticks > max_ticks) {                      \
+      max_ticks = isr_ticks;                          \
+    }                                                 \
+  } while (0)
+
+static void rx_count_overflow(ring_buffer *buffer) {
+  if (buffer == &rx_buffer) {
+    STAT_INC(serialOverflows);
+  } else if (buffer == &midi_buffer) {
+    STAT_INC(midiOverflows);
+  } else if (buffer == &ancs_buffer) {
+    STAT_INC(ancsOverflows);
+  } else if (buffer == &ancs_message_buffer) {
+    STAT_INC(ancsMessageOverflows);
+  } else if (buffer == &accel_buffer) {
+    STAT_INC(accelOverflows);
+  } else if (buffer == REPLY_BUFFER) {
+    STAT_INC(replyOverflows);
+  } else {
+    STAT_INC(otherOverflows);
+  }
+}
+#else
+#define STAT_INC(field) \
+  do {                  \
+  } while (0)
+#define ISR_TIME_BEGIN()
+#define ISR_TIME_END(max_ticks)
+#define rx_count_overflow(buffer)
+#endif
+
+// RX routing table, open addressed by message id.  Messages without a route
+// are replies and go to call_async() requests or reply_buffer.  The built in
+// routes are installed before the UART is enabled; libraries add their own
+// with registerRxRoute().
+#ifndef BEAN_MAX_RX_ROUTES
+#define BEAN_MAX_RX_ROUTES (16)
+#endif
+
+#if (BEAN_MAX_RX_ROUTES & (BEAN_MAX_RX_ROUTES - 1))
+#error BEAN_MAX_RX_ROUTES must be a power of two
+#endif
+
+struct BeanRxRoute {
+  uint16_t messageId;
+  bool used;
+  ring_buffer *buffer;
+  BeanRxHandler handler;
+};
+
+static BeanRxRoute rx_routes[BEAN_MAX_RX_ROUTES];
+
+// Mixes the profile (high nibble) with the low bits of the command so the
+// built in ids land in distinct slots.
+static inline uint8_t rx_route_hash(uint16_t messageId) {
+  return ((uint8_t)(messageId >> 12) ^ (uint8_t)(messageId << 2)) &
+         (BEAN_MAX_RX_ROUTES - 1);
+}
+
+static BeanRxRoute *rx_route_find(uint16_t messageId) {
+  uint8_t slot = rx_route_hash(messageId);
+
+  for (uint8_t i = 0; i < BEAN_MAX_RX_ROUTES; i++) {
+    BeanRxRoute *route = &rx_routes[slot];
+    if (!route->used) {
+      return NULL;
+    }
+    if (route->messageId == messageId) {
+      return route;
+    }
+    slot = (slot + 1) & (BEAN_MAX_RX_ROUTES - 1);
+  }
+
+  return NULL;
+}
+
+static bool rx_route_add(uint16_t messageId, ring_buffer *buffer,
+                         BeanRxHandler handler) {
+  uint8_t slot = rx_route_hash(messageId);
+
+  for (uint8_t i = 0; i < BEAN_MAX_RX_ROUTES; i++) {
+    BeanRxRoute *route = &rx_routes[slot];
+    if (!route->used || route->messageId == messageId) {
+      uint8_t oldSREG = SREG;
+      cli();
+      route->messageId = messageId;
+      route->buffer = buffer;
+      route->handler = handler;
+      route->used = true;
+      SREG = oldSREG;
+      return true;
+    }
+    slot = (slot + 1) & (BEAN_MAX_RX_ROUTES - 1);
+  }
+
+  return false;
+}
+
+// Virtual Serial data goes into rx_buffer.  Where each accepted
+// MSG_ID_SERIAL_DATA frame ends there is noted in rx_frame_ends, as the
+// rx_buffer head position after it, so readFrame() can hand frames back
+// whole.  Frames that were dropped, or published nothing, leave no boundary.
+// If rx_frame_ends is full the boundary is lost and two frames read as one.
+static uint8_t serial_rx_start;
+
+static void serial_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    serial_rx_start = rx_buffer.head;
+  } else if (event == BEAN_RX_END && arg &&
+             rx_buffer.head != serial_rx_start) {
+    rx_frame_ends.store(rx_buffer.head);
+  }
+}
+
+// BLE-MIDI packets.  Each MSG_ID_MIDI_READ body lands in midi_buffer as
+// [length][packet...], and only once its CRC checks out, so the reader
+// always finds whole packets.  One that doesn't fit is dropped whole.
+static uint8_t midi_rx_length;
+static uint8_t midi_rx_expected;
+static bool midi_rx_keep;
+
+static void midi_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    midi_rx_expected = arg;
+    midi_rx_length = 0;
+    midi_rx_keep = arg > 0 && midi_buffer.storeAt(arg, 0);
+    if (midi_rx_keep) {
+      midi_buffer.storeAt(midi_rx_length++, arg);
+    } else if (arg > 0) {
+      STAT_INC(midiOverflows);
+    }
+  } else if (event == BEAN_RX_BYTE) {
+    if (midi_rx_keep) {
+      midi_buffer.storeAt(midi_rx_length++, arg);
+    }
+  } else if (event == BEAN_RX_END) {
+    if (midi_rx_keep && arg && midi_rx_length == midi_rx_expected + 1) {
+      midi_buffer.publish(midi_rx_length);
+    }
+  }
+}
+
+// ANCS attribute replies.  The MSG_ID_ANCS_GET_NOTI stream for a request is
+// an 8 byte header, [command][notification uid, 4][attribute id][length, 2],
+// then length bytes of attribute, split over as many frames as it takes.
+// The attribute goes straight into the sketch's buffer when it gave one, so
+// a long one can't overflow a ring while the sketch is busy, and otherwise
+// into ancs_message_buffer to be read as it arrives.  A frame whose CRC
+// fails is rolled back, as if it never arrived.
+//
+// Replies carry no request id, so a stream whose header doesn't name the
+// uid and attribute asked for is the rest of an earlier request's, e.g. a
+// prefetch that was given up on.  Its frames are dropped until one starts
+// with the right header.
+#define ANCS_NOTI_HEADER_SIZE (8)
+#define ANCS_NOTI_MATCH_SIZE (6)  // [command][notification uid, 4][attribute]
+
+static uint8_t ancs_noti_header[ANCS_NOTI_HEADER_SIZE];
+static uint8_t ancs_noti_expected[ANCS_NOTI_MATCH_SIZE];
+static bool ancs_noti_match = false;  // false if the request was too short
+static bool ancs_noti_discard = false;  // the rest of this frame
+static volatile uint8_t ancs_noti_header_length = ANCS_NOTI_HEADER_SIZE;
+static volatile uint16_t ancs_noti_remaining = 0;
+static uint8_t *volatile ancs_noti_sink = NULL;
+static volatile uint16_t ancs_noti_sink_capacity = 0;
+static volatile uint16_t ancs_noti_sink_length = 0;
+
+// Where the stream stood before the current frame.
+static uint8_t ancs_noti_rx_header_length;
+static uint16_t ancs_noti_rx_remaining;
+static uint16_t ancs_noti_rx_sink_length;
+static uint8_t ancs_noti_rx_staged;
+
+static void ancs_noti_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    ancs_noti_rx_header_length = ancs_noti_header_length;
+    ancs_noti_rx_remaining = ancs_noti_remaining;
+    ancs_noti_rx_sink_length = ancs_noti_sink_length;
+    ancs_noti_rx_staged = 0;
+    ancs_noti_discard = false;
+    return;
+  }
+  if (event == BEAN_RX_END) {
+    if (arg) {
+      ancs_message_buffer.publish(ancs_noti_rx_staged);
+    } else {
+      ancs_noti_header_length = ancs_noti_rx_header_length;
+      ancs_noti_remaining = ancs_noti_rx_remaining;
+      ancs_noti_sink_length = ancs_noti_rx_sink_length;
+    }
+    return;
+  }
+
+  if (ancs_noti_discard) {
+    return;
+  }
+  if (ancs_noti_header_length < ANCS_NOTI_HEADER_SIZE) {
+    ancs_noti_header[ancs_noti_header_length++] = arg;
+    if (ancs_noti_header_length == ANCS_NOTI_HEADER_SIZE) {
+      if (ancs_noti_match && memcmp(ancs_noti_header, ancs_noti_expected,
+                                    ANCS_NOTI_MATCH_SIZE) != 0) {
+        ancs_noti_header_length = 0;
+        ancs_noti_discard = true;
+        return;
+      }
+      ancs_noti_remaining = ancs_noti_header[6] | (ancs_noti_header[7] << 8);
+    }
+    return;
+  }
+  if (ancs_noti_remaining == 0) {
+    return;  // nothing was asked for
+  }
+  ancs_noti_remaining--;
+
+  if (ancs_noti_sink) {
+    if (ancs_noti_sink_length < ancs_noti_sink_capacity) {
+      ancs_noti_sink[ancs_noti_sink_length++] = arg;
+    } else {
+      STAT_INC(ancsMessageOverflows);
+    }
+  } else if (ancs_message_buffer.storeAt(ancs_noti_rx_staged, arg)) {
+    ancs_noti_rx_staged++;
+  } else {
+    STAT_INC(ancsMessageOverflows);
+  }
+}
+
+// ANCS notifications.  Each MSG_ID_ANCS_READ body is an 8 byte
+// ANCS_SOURCE_MSG_T, [eventId][eventFlags][categoryId][categoryCount]
+// [notification uid, 4].  It is collected here and only goes into
+// ancs_buffer once its CRC checks out and it passes the filter, so
+// notifications the sketch doesn't want never take up room.  Once the CC has
+// taken a MSG_ID_ANCS_FILTER it does the filtering instead.
+#define ANCS_RECORD_SIZE (8)
+
+static BEAN_ANCS_FILTER_T ancs_filter = {0xFFFF, 0xFF, 0, 0, 0, {0}};
+static bool ancs_filter_local = true;
+static BeanCcProbe ancs_filter_probe;
+static uint8_t ancs_rx_record[ANCS_RECORD_SIZE];
+static uint8_t ancs_rx_length;
+
+static bool ancs_accept(const uint8_t *record) {
+  if (!ancs_filter_local) {
+    return true;
+  }
+  uint8_t event = record[0];
+  uint8_t flags = record[1];
+  uint8_t category = record[2];
+
+  if (event >= 8 || !(ancs_filter.events & _BV(event))) {
+    return false;
+  }
+  if ((flags & ancs_filter.flagsSet) != ancs_filter.flagsSet ||
+      (flags & ancs_filter.flagsClear) != 0) {
+    return false;
+  }
+  // any category may come from the app, which only BeanAncs can look up
+  return ancs_filter.appIdLength > 0 ||
+         (category < 16 && (ancs_filter.categories & (1 << category)));
+}
+
+static void ancs_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    ancs_rx_length = 0;
+  } else if (event == BEAN_RX_BYTE) {
+    if (ancs_rx_length < ANCS_RECORD_SIZE) {
+      ancs_rx_record[ancs_rx_length] = arg;
+    }
+    ancs_rx_length++;
+  } else if (event == BEAN_RX_END) {
+    if (!arg || ancs_rx_length != ANCS_RECORD_SIZE ||
+        !ancs_accept(ancs_rx_record)) {
+      return;
+    }
+    if (!ancs_buffer.storeAt(ANCS_RECORD_SIZE - 1, 0)) {
+      STAT_INC(ancsOverflows);
+      return;
+    }
+    for (uint8_t i = 0; i < ANCS_RECORD_SIZE; i++) {
+      ancs_buffer.storeAt(i, ancs_rx_record[i]);
+    }
+    ancs_buffer.publish(ANCS_RECORD_SIZE);
+  }
+}
+
+// Observed advertisements.  A MSG_ID_OBSERVER_READ body is an
+// OBSERVER_INFO_MESSAGE_T, assembled straight into the next free queue entry
+// and only queued once its CRC checks out and it passes the filters.  The
+// ISR only moves observer_head and the sketch only moves observer_tail.
+#if (BEAN_OBSERVER_QUEUE_SIZE & (BEAN_OBSERVER_QUEUE_SIZE - 1))
+#error BEAN_OBSERVER_QUEUE_SIZE must be a power of two
+#endif
+
+static OBSERVER_INFO_MESSAGE_T *observer_queue = NULL;
+static volatile uint8_t observer_head = 0;
+static volatile uint8_t observer_tail = 0;
+static volatile bool observer_scanning = false;
+static uint8_t observer_rx_length;
+static bool observer_rx_keep;
+
+// Filters.  Once the CC has taken a MSG_ID_OBSERVER_FILTER only matching
+// advertisements cross the UART; until then, or on a CC that doesn't answer
+// it, observer_accept() applies the same rules here.
+static BEAN_OBSERVER_FILTER_T observer_filter = {-128, 0, 0, {{0}}, 0, {0}};
+static bool observer_filter_local = true;
+static BeanCcProbe observer_filter_probe;
+
+struct ObserverSeen {
+  uint8_t addr[6];
+  uint16_t time;
+  bool used;
+};
+
+static ObserverSeen observer_seen[BEAN_OBSERVER_DEDUPE_SIZE];
+static uint8_t observer_seen_next = 0;
+
+static bool observer_dedupe(const uint8_t *addr) {
+  if (observer_filter.dedupeMs == 0) {
+    return true;
+  }
+
+  uint16_t now = (uint16_t)millis();
+  for (uint8_t i = 0; i < BEAN_OBSERVER_DEDUPE_SIZE; i++) {
+    ObserverSeen *seen = &observer_seen[i];
+    if (seen->used && memcmp(seen->addr, addr, sizeof(seen->addr)) == 0) {
+      if ((uint16_t)(now - seen->time) < observer_filter.dedupeMs) {
+        return false;
+      }
+      seen->time = now;
+      return true;
+    }
+  }
+
+  ObserverSeen *seen = &observer_seen[observer_seen_next];
+  observer_seen_next = (observer_seen_next + 1) % BEAN_OBSERVER_DEDUPE_SIZE;
+  memcpy(seen->addr, addr, sizeof(seen->addr));
+  seen->time = now;
+  seen->used = true;
+  return true;
+}
+
+// Looks through the advertisement's AD structures for manufacturer specific
+// data (type 0xFF) that starts with the prefix.
+static bool observer_prefix_match(const OBSERVER_INFO_MESSAGE_T *entry) {
+  uint8_t length = entry->dataLen < sizeof(entry->advData)
+                       ? entry->dataLen
+                       : sizeof(entry->advData);
+
+  for (uint8_t i = 0; i + 1 < length; i += entry->advData[i] + 1) {
+    uint8_t field_length = entry->advData[i];
+    if (field_length == 0 || i + 1 + field_length > length) {
+      break;
+    }
+    if (entry->advData[i + 1] == 0xFF &&
+        field_length - 1 >= observer_filter.manufacturerPrefixLength &&
+        memcmp(&entry->advData[i + 2], observer_filter.manufacturerPrefix,
+               observer_filter.manufacturerPrefixLength) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool observer_accept(const OBSERVER_INFO_MESSAGE_T *entry) {
+  if (!observer_filter_local) {
+    return true;
+  }
+  if (entry->rssi < observer_filter.minRssi) {
+    return false;
+  }
+  if (observer_filter.addressCount > 0) {
+    uint8_t i = 0;
+    while (i < observer_filter.addressCount &&
+           memcmp(observer_filter.addresses[i], entry->addr, 6) != 0) {
+      i++;
+    }
+    if (i == observer_filter.addressCount) {
+      return false;
+    }
+  }
+  if (observer_filter.manufacturerPrefixLength > 0 &&
+      !observer_prefix_match(entry)) {
+    return false;
+  }
+  return observer_dedupe(entry->addr);
+}
+
+static void observer_rx_handler(uint8_t event, uint8_t arg) {
+  OBSERVER_INFO_MESSAGE_T *entry =
+      &observer_queue[observer_head & (BEAN_OBSERVER_QUEUE_SIZE - 1)];
+
+  if (event == BEAN_RX_START) {
+    observer_rx_length = 0;
+    observer_rx_keep =
+        (uint8_t)(observer_head - observer_tail) < BEAN_OBSERVER_QUEUE_SIZE;
+    if (observer_rx_keep) {
+      memset(entry, 0, sizeof(*entry));
+    } else {
+      STAT_INC(observerOverflows);
+    }
+  } else if (event == BEAN_RX_BYTE) {
+    if (observer_rx_keep && observer_rx_length < sizeof(*entry)) {
+      ((uint8_t *)entry)[observer_rx_length++] = arg;
+    }
+  } else if (event == BEAN_RX_END && arg && observer_rx_keep) {
+    if (observer_accept(entry)) {
+      observer_head++;
+    }
+  }
+}
+
+// Streamed accelerometer data.  A MSG_ID_CC_ACCEL_STREAM_DATA body is the
+// range followed by samples of x, y and z as little endian int16_t.  Each
+// message lands in accel_buffer as
+//
+//   [arrival millis(), 4 bytes][sample count][range][samples...]
+//
+// and only once its CRC checks out; one cut short or corrupted is dropped
+// whole, so the reader never loses its place.
+#define ACCEL_STREAM_SAMPLE_SIZE (6)
+#define ACCEL_STREAM_HEADER_SIZE (6)
+
+static uint8_t accel_rx_remaining = 0;
+static uint8_t accel_rx_staged = 0;
+static uint16_t accel_stream_period_us = 0;
+
+static void accel_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    accel_rx_remaining = 0;
+    accel_rx_staged = 0;
+    if (arg < 1 + ACCEL_STREAM_SAMPLE_SIZE ||
+        (arg - 1) % ACCEL_STREAM_SAMPLE_SIZE != 0) {
+      return;
+    }
+    if (accel_buffer.space() < arg + ACCEL_STREAM_HEADER_SIZE - 1) {
+#if BEAN_TRANSPORT_STATS
+      for (uint8_t i = 0; i < arg; i++) {
+        rx_count_overflow(&accel_buffer);
+      }
+#endif
+      return;
+    }
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < 4; i++) {
+      accel_buffer.storeAt(accel_rx_staged++, (uint8_t)(now >> (8 * i)));
+    }
+    accel_buffer.storeAt(accel_rx_staged++,
+                         (arg - 1) / ACCEL_STREAM_SAMPLE_SIZE);
+    accel_rx_remaining = arg;
+  } else if (event == BEAN_RX_BYTE) {
+    if (accel_rx_remaining > 0) {
+      accel_buffer.storeAt(accel_rx_staged++, arg);
+      accel_rx_remaining--;
+    }
+  } else if (event == BEAN_RX_END) {
+    if (arg && accel_rx_staged > 0 && accel_rx_remaining == 0) {
+      accel_buffer.publish(accel_rx_staged);
+    }
+    accel_rx_remaining = 0;
+  }
+}
+
+// Scratch writes pushed by the CC.  A MSG_ID_BT_SCRATCH_WRITTEN body is laid
+// out like a BT_SCRATCH_T, [bank][data...], and is assembled straight into
+// the next free queue entry, which is only queued once its CRC checks out.
+// A write that finds the queue full is dropped and noted in
+// scratch_writes_lost, so the sketch knows to read the banks again.
+#if (BEAN_SCRATCH_WRITE_QUEUE_SIZE & (BEAN_SCRATCH_WRITE_QUEUE_SIZE - 1))
+#error BEAN_SCRATCH_WRITE_QUEUE_SIZE must be a power of two
+#endif
+
+struct ScratchWrite {
+  uint8_t bank;
+  ScratchData data;
+};
+
+static ScratchWrite *scratch_write_queue = NULL;
+static volatile uint8_t scratch_write_head = 0;
+static volatile uint8_t scratch_write_tail = 0;
+static volatile bool scratch_writes_lost = false;
+static uint8_t scratch_write_rx_length;
+static bool scratch_write_rx_keep;
+
+static void scratch_write_rx_handler(uint8_t event, uint8_t arg) {
+  ScratchWrite *entry = &scratch_write_queue[scratch_write_head &
+                                             (BEAN_SCRATCH_WRITE_QUEUE_SIZE - 1)];
+
+  if (event == BEAN_RX_START) {
+    scratch_write_rx_length = 0;
+    scratch_write_rx_keep = (uint8_t)(scratch_write_head - scratch_write_tail) <
+                            BEAN_SCRATCH_WRITE_QUEUE_SIZE;
+    if (!scratch_write_rx_keep) {
+      scratch_writes_lost = true;
+    }
+  } else if (event == BEAN_RX_BYTE) {
+    if (!scratch_write_rx_keep) {
+      return;
+    }
+    if (scratch_write_rx_length == 0) {
+      entry->bank = arg;
+    } else if (scratch_write_rx_length <= sizeof(entry->data.data)) {
+      entry->data.data[scratch_write_rx_length - 1] = arg;
+    }
+    if (scratch_write_rx_length < 0xFF) {
+      scratch_write_rx_length++;
+    }
+  } else if (event == BEAN_RX_END && arg && scratch_write_rx_keep &&
+             scratch_write_rx_length > 0) {
+    uint8_t length = scratch_write_rx_length - 1;
+    entry->data.length = length < sizeof(entry->data.data)
+                             ? length
+                             : sizeof(entry->data.data);
+    memset(&entry->data.data[entry->data.length], 0,
+           sizeof(entry->data.data) - entry->data.length);
+    scratch_write_head++;
+  }
+}
+
+// Connection and advertising states pushed by the CC.  A
+// MSG_ID_BT_STATES_CHANGED body is a BT_STATES_T; it only replaces bt_states
+// once its CRC checks out, and connection changes are noted in
+// bt_state_events for BTStateEventsTake().
+static uint8_t bt_states_rx[sizeof(BT_STATES_T)];
+static uint8_t bt_states_rx_length;
+static BT_STATES_T bt_states;
+static volatile uint8_t bt_state_events = 0;
+
+static void bt_states_store(const BT_STATES_T *states) {
+  if (states->conn_state && !bt_states.conn_state) {
+    bt_state_events |= BEAN_BT_CONNECTED;
+  } else if (!states->conn_state && bt_states.conn_state) {
+    bt_state_events |= BEAN_BT_DISCONNECTED;
+  }
+  bt_states = *states;
+}
 
-static inline void store_char(unsigned char c, ring_buffer *buffer) {
-  unsigned int i = (buffer->head + 1) % SERIAL_BUFFER_SIZE;
+static void bt_states_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    bt_states_rx_length = 0;
+  } else if (event == BEAN_RX_BYTE) {
+    if (bt_states_rx_length < sizeof(bt_states_rx)) {
+      bt_states_rx[bt_states_rx_length++] = arg;
+    }
+  } else if (event == BEAN_RX_END && arg &&
+             bt_states_rx_length == sizeof(bt_states_rx)) {
+    bt_states_store((const BT_STATES_T *)bt_states_rx);
+  }
+}
+
+// Accelerometer interrupts pushed by the CC.  A MSG_ID_CC_ACCEL_EVENT body
+// is the BMA250 interrupt status (REG_INT_STATUS_X09), which the CC has read
+// and cleared.  Its bits only count once the CRC checks out.
+static uint8_t accel_event_rx;
+static volatile uint8_t accel_events = 0;
 
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  if (i != buffer->tail) {
-    buffer->buffer[buffer->head] = c;
-    buffer->head = i;
+static void accel_event_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    accel_event_rx = 0;
+  } else if (event == BEAN_RX_BYTE) {
+    accel_event_rx |= arg;
+  } else if (event == BEAN_RX_END && arg) {
+    accel_events |= accel_event_rx;
   }
 }
 
-static uint32_t calc_crc32(uint32_t crc, uint8_t *buf, uint16_t len) {
-  uint16_t k;
+// Sent by the CC right after it wakes the ATmega from Bean.sleep(): [wake
+// reason][time asleep in ms, uint32_t little endian].  The reason codes are
+// Bean.h's WakeReasons.
+#define WAKE_INFO_SIZE (5)
+
+static uint8_t wake_info_rx[WAKE_INFO_SIZE];
+static uint8_t wake_info_rx_length;
+static uint8_t wake_info[WAKE_INFO_SIZE];
+static volatile bool wake_info_ready = false;
+
+static void wake_info_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    wake_info_rx_length = 0;
+  } else if (event == BEAN_RX_BYTE) {
+    if (wake_info_rx_length < WAKE_INFO_SIZE) {
+      wake_info_rx[wake_info_rx_length++] = arg;
+    }
+  } else if (event == BEAN_RX_END && arg &&
+             wake_info_rx_length == WAKE_INFO_SIZE) {
+    memcpy(wake_info, wake_info_rx, WAKE_INFO_SIZE);
+    wake_info_ready = true;
+  }
+}
 
-  crc = ~crc;
-  while (len--) {
-    crc ^= *buf++;
-    for (k = 0; k < 8; k++) {
-      // If CRC LSB is 1, right shift CRC, then XOR CRC with 0xEDB88320
-      // Otherwise, just right shift CRC
-      crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+// RX acknowledgements, see setRxAcks().  The RX ISR takes numbered frames in
+// order and notes what to answer; the pacing tick queues the answer, as it
+// does write combined data, once the last one it queued has gone out.  An
+// answer waiting to be queued is brought up to date by later frames, so a
+// burst of frames gets one ACK.
+#define RX_ACK_NONE (0)
+#define RX_ACK (1)
+#define RX_NAK (2)
+
+static volatile bool rx_acks = false;
+static volatile uint8_t rx_ack_next = 0;  // the sequence number expected next
+static volatile uint8_t rx_ack_pending = RX_ACK_NONE;
+static uint16_t rx_ack_frame;  // the frame that carried the last answer
+static uint8_t rx_acks_rx;
+static uint8_t rx_acks_rx_length;
+static volatile bool rx_acks_answered = false;
+
+// Called from the RX ISR at the end of each numbered frame, or when one is
+// cut short.
+static void rx_ack_frame_end(bool crc_ok, uint8_t seq) {
+  if (crc_ok && seq == rx_ack_next) {
+    rx_ack_next = seq + 1;
+    rx_ack_pending = RX_ACK;
+  } else if (crc_ok && (int8_t)(seq - rx_ack_next) < 0) {
+    // a frame already taken, sent again as our ACK didn't get through
+    STAT_INC(sequenceErrors);
+    if (rx_ack_pending == RX_ACK_NONE) {
+      rx_ack_pending = RX_ACK;
+    }
+  } else {
+    if (crc_ok) {
+      STAT_INC(sequenceErrors);  // the frame we expected went missing
     }
+    rx_ack_pending = RX_NAK;
+  }
+  sbi(TIMSK0, OCIE0B);
+}
+
+// The CC's answer to MSG_ID_AR_SET_RX_ACKS, after which its frames are
+// numbered or not.
+static void rx_acks_rx_handler(uint8_t event, uint8_t arg) {
+  if (event == BEAN_RX_START) {
+    rx_acks_rx_length = 0;
+  } else if (event == BEAN_RX_BYTE) {
+    rx_acks_rx = arg;
+    rx_acks_rx_length++;
+  } else if (event == BEAN_RX_END && arg && rx_acks_rx_length == 1) {
+    rx_acks = rx_acks_rx != 0;
+    rx_ack_next = 0;
+    rx_ack_pending = RX_ACK_NONE;
+    rx_acks_answered = true;
+  }
+}
+
+// The profile channels start out routed nowhere, so their messages are
+// dropped rather than taken for replies until the sketch first uses them.
+static void rx_routes_init(void) {
+  static bool routes_initialized = false;
+
+  if (!routes_initialized) {
+    routes_initialized = true;
+    rx_route_add(MSG_ID_SERIAL_DATA, &rx_buffer, serial_rx_handler);
+    rx_route_add(MSG_ID_MIDI_READ, NULL, NULL);
+    rx_route_add(MSG_ID_ANCS_READ, NULL, NULL);
+    rx_route_add(MSG_ID_ANCS_GET_NOTI, NULL, NULL);
+    rx_route_add(MSG_ID_OBSERVER_READ, NULL, NULL);
+    rx_route_add(MSG_ID_CC_ACCEL_STREAM_DATA, NULL, NULL);
+    rx_route_add(MSG_ID_CC_ACCEL_EVENT, NULL, accel_event_rx_handler);
+    rx_route_add(MSG_ID_AR_WAKE_INFO, NULL, wake_info_rx_handler);
+    rx_route_add(MSG_ID_BT_SCRATCH_WRITTEN, NULL, NULL);
+    rx_route_add(MSG_ID_BT_STATES_CHANGED, NULL, bt_states_rx_handler);
+    rx_route_add(MSG_ID_AR_SET_RX_ACKS, NULL, rx_acks_rx_handler);
   }
-  return ~crc;
 }
 
 void toUint8Array(uint32_t value, uint8_t *target, uint8_t target_bytes) {
@@ -110,30 +902,39 @@ static bool rx_char(uint8_t *c) {
 #endif
 }
 
-#if !defined(USART0_RX_vect) && defined(USART1_RX_vect)
-// do nothing - on the 32u4 the first USART is USART1
-#else
-#if !defined(USART_RX_vect) && !defined(USART0_RX_vect) && \
-    !defined(USART_RXC_vect)
-#error "Don't know what the Data Received vector is called for the first UART"
-#else
-void serialEvent() __attribute__((weak));
-void serialEvent() {}
-#define serialEvent_implemented
-#if defined(USART_RX_vect)
-ISR(USART_RX_vect)
-#elif defined(USART0_RX_vect)
-ISR(USART0_RX_vect)
-#elif defined(USART_RXC_vect)
-ISR(USART_RXC_vect)  // ATmega8
-#endif
-{
+// Picks where a frame's body goes once its message id, and with RX
+// acknowledgements on its sequence number, are in.  Routed bodies go to the
+// route's buffer or handler, anything else is a reply.
+static BeanRxRoute *rx_frame_begin(uint16_t messageType, uint8_t length,
+                                   ring_buffer **buffer) {
+  BeanRxRoute *route = rx_route_find(messageType);
+  if (route) {
+    *buffer = route->buffer;
+    if (route->handler) {
+      route->handler(BEAN_RX_START, length);
+    }
+  } else {
+    rx_reply = reply_match(messageType);
+    rx_reply_length = 0;
+    *buffer = rx_reply ? NULL : REPLY_BUFFER;
+  }
+  return route;
+}
+
+// The receive state machine, run once per received byte.  Kept out of the
+// ISR body so that its early returns still pass through the ISR timing.  A
+// body going to a buffer is staged past the buffer's head and only published
+// once the CRC checks out, so readers never see a corrupted or abandoned
+// frame.
+static inline void rx_handle_char(void) __attribute__((always_inline));
+static inline void rx_handle_char(void) {
   // DECLARATIONS
   static enum {
     WAITING_FOR_SOF,
     GETTING_LENGTH,
     GETTING_MESSAGE_ID_1,
     GETTING_MESSAGE_ID_2,
+    GETTING_SEQUENCE,
     GETTING_MESSAGE_BODY,
     GETTING_CRC32,
     GETTING_EOF
@@ -146,13 +947,20 @@ ISR(USART_RXC_vect)  // ATmega8
   static uint8_t temp_var[4];
   static uint8_t rx_crc32[4];
   static uint32_t calculated_crc32;
+  static uint8_t staged = 0;
+  static bool overflowed = false;  // the body didn't fit its buffer
+  static bool sequenced = false;
+  static uint8_t sequence;
   uint8_t bytes_ok;
+  bool accepted;
 
   // buffer
   static ring_buffer *buffer = NULL;
+  static BeanRxRoute *route = NULL;
 
   uint8_t next;
   if (!rx_char(&next)) {
+    STAT_INC(parityErrors);
     return;
   }
 
@@ -171,11 +979,27 @@ ISR(USART_RXC_vect)  // ATmega8
         (next == BEAN_EOF && bean_transport_state != GETTING_EOF) ||
         next == BEAN_ESCAPE) {
       // RESET STATE
+      if (bean_transport_state != WAITING_FOR_SOF) {
+        STAT_INC(framingResets);
+        if (route && route->handler) {
+          route->handler(BEAN_RX_END, false);
+        }
+        if (rx_acks) {
+          rx_ack_frame_end(false, 0);
+        }
+      }
+      // an SOF starts the next frame straight away
+      bean_transport_state = next == BEAN_SOF ? GETTING_LENGTH : WAITING_FOR_SOF;
       escaping = false;
-      messageType = WAITING_FOR_SOF;
+      messageType = MSG_ID_SERIAL_DATA;
       messageRemaining = 0;
       messageCur = 0;
+      staged = 0;
+      overflowed = false;
+      sequenced = false;
       buffer = NULL;
+      route = NULL;
+      rx_reply = NULL;
       serial_message_complete = false;
       return;
     }
@@ -195,36 +1019,47 @@ ISR(USART_RXC_vect)  // ATmega8
     case GETTING_LENGTH:
       messageRemaining = next;
       bean_transport_state = GETTING_MESSAGE_ID_1;
-      observer_msg_len = next;  // we don't have message type yet, but save the
-                                // length for later
-      calculated_crc32 = calc_crc32(0, &next, 1);
+      calculated_crc32 = bean_crc32_update_byte(bean_crc32_begin(), next);
       break;
 
     case GETTING_MESSAGE_ID_1:
       messageType = ((unsigned int)next) << 8;
       messageRemaining--;
       bean_transport_state = GETTING_MESSAGE_ID_2;
-      calculated_crc32 = calc_crc32(calculated_crc32, &next, 1);
+      calculated_crc32 = bean_crc32_update_byte(calculated_crc32, next);
       break;
 
     case GETTING_MESSAGE_ID_2:
       messageType |= next;
       messageRemaining--;
+      calculated_crc32 = bean_crc32_update_byte(calculated_crc32, next);
+
+      sequenced = rx_acks;
+      if (sequenced) {
+        // a numbered frame without its sequence number is refused at EOF
+        sequence = rx_ack_next - 1;
+      } else {
+        route = rx_frame_begin(messageType, messageRemaining, &buffer);
+      }
 
-      if (messageType == MSG_ID_MIDI_READ) {
-        buffer = &midi_buffer;
-      } else if (messageType == MSG_ID_ANCS_READ) {
-        buffer = &ancs_buffer;
-      } else if (messageType == MSG_ID_ANCS_GET_NOTI) {
-        buffer = &ancs_message_buffer;
-      } else if (messageType == MSG_ID_OBSERVER_READ) {
-        buffer = &observer_message;
-        observer_message_sending = true;
-        observer_message.head = observer_message.tail =
-            0;  // if the user missed a previous message drop it
+      if (messageRemaining == 0) {
+        bean_transport_state = GETTING_CRC32;
+        messageRemaining = 4;
+      } else if (sequenced) {
+        bean_transport_state = GETTING_SEQUENCE;
       } else {
-        buffer =
-            (messageType == MSG_ID_SERIAL_DATA) ? &rx_buffer : &reply_buffer;
+        bean_transport_state = GETTING_MESSAGE_BODY;
+      }
+      break;
+
+    case GETTING_SEQUENCE:
+      sequence = next;
+      messageRemaining--;
+      calculated_crc32 = bean_crc32_update_byte(calculated_crc32, next);
+
+      // frames out of order are read to their end and dropped
+      if (sequence == rx_ack_next) {
+        route = rx_frame_begin(messageType, messageRemaining, &buffer);
       }
 
       if (messageRemaining > 0) {
@@ -233,16 +1068,29 @@ ISR(USART_RXC_vect)  // ATmega8
         bean_transport_state = GETTING_CRC32;
         messageRemaining = 4;
       }
-      calculated_crc32 = calc_crc32(calculated_crc32, &next, 1);
-
       break;
 
     case GETTING_MESSAGE_BODY:
-      if (buffer) {
-        store_char(next, buffer);
-        messageRemaining--;
-        calculated_crc32 = calc_crc32(calculated_crc32, &next, 1);
+      if (rx_reply) {
+        if (rx_reply_length < rx_reply->capacity) {
+          rx_reply->response[rx_reply_length] = next;
+        } else {
+          STAT_INC(replyOverflows);
+        }
+        rx_reply_length++;
+      } else if (buffer) {
+        if (buffer->storeAt(staged, next)) {
+          staged++;
+        } else {
+          // the frame is dropped whole at EOF rather than published cut short
+          overflowed = true;
+          rx_count_overflow(buffer);
+        }
+      } else if (route && route->handler) {
+        route->handler(BEAN_RX_BYTE, next);
       }
+      messageRemaining--;
+      calculated_crc32 = bean_crc32_update_byte(calculated_crc32, next);
 
       if (messageRemaining == 0) {
         bean_transport_state = GETTING_CRC32;
@@ -253,78 +1101,713 @@ ISR(USART_RXC_vect)  // ATmega8
       messageRemaining--;
       rx_crc32[3 - messageRemaining] = next;
       if (messageRemaining == 0) {
-        toUint8Array(calculated_crc32, temp_var, 4);
+        toUint8Array(bean_crc32_finish(calculated_crc32), temp_var, 4);
         bean_transport_state = GETTING_EOF;
       }
       break;
     case GETTING_EOF:
       // RESET STATE
-      if (messageType == MSG_ID_MIDI_READ) {
-        for (int i = 0; i < 3; i++)
-          // null message to specify the end of a BLE packet
-          store_char(0, buffer);
-      }
-      if (messageType == MSG_ID_OBSERVER_READ) {
-        observer_message_sending = false;
-      }
       bytes_ok = 0;
       for (int i = 0; i < 4; i++) {
         if (temp_var[i] == rx_crc32[i]) {
           bytes_ok += 1;
         }
       }
-      if (bytes_ok == 4) {
+      // a frame that didn't fit is refused, and with RX acknowledgements
+      // NAKed, so the CC sends it again once the sketch has read some
+      accepted = bytes_ok == 4 && !overflowed;
+      if (sequenced) {
+        accepted = accepted && sequence == rx_ack_next;
+        rx_ack_frame_end(bytes_ok == 4 && !overflowed, sequence);
+      }
+      if (buffer && accepted) {
+        buffer->publish(staged);
+      }
+      if (route && route->handler) {
+        route->handler(BEAN_RX_END, accepted);
+      }
+      if (accepted) {
+        STAT_INC(framesReceived);
+        BEAN_ENERGY_FRAME_RECEIVED();
+        BeanScheduler.messageArrived(messageType);
         serial_message_complete = true;
+        if (rx_reply) {
+          rx_reply->length = rx_reply_length;
+          rx_reply->status = BEAN_REPLY_DONE;
+        }
+      } else if (bytes_ok != 4) {
+        STAT_INC(crcErrors);
       }
       bean_transport_state = WAITING_FOR_SOF;
       messageType = MSG_ID_SERIAL_DATA;
       messageRemaining = 0;
       messageCur = 0;
+      staged = 0;
+      overflowed = false;
+      sequenced = false;
       buffer = NULL;
+      route = NULL;
+      rx_reply = NULL;
       break;
   }
 }
-#endif
-#endif
-
-// The Original HWSerial version of this function
-// relies on the TX Vector flag to tell when tx_buffer_flushed.
-// we need that flag to fire the interrupt (auto-clears, and cannot be manually
-// set) pin for the CC, so for BeanSerial we use 'tx_buffer_flushed' bool
-// instead.
-void BeanSerialTransport::flush() {
-  // logic is handled in writes and interrupts
-  while (tx_buffer_flushed == false) {}
-
-  // this is a holdover from HWSerial.
-  transmitting = false;
-}
 
-// This interrupt fires after the send has completed
-ISR(USART_TX_vect) {
-  // lower interrupt line that wakes The CC
-  if (tx_buffer.head == tx_buffer.tail) {
-    digitalWrite(CC_INTERRUPT_PIN, m_ccSleepPinVal);
-    cbi(UCSR0B, TXCIE0);
+#if !defined(USART0_RX_vect) && defined(USART1_RX_vect)
+// do nothing - on the 32u4 the first USART is USART1
+#else
+#if !defined(USART_RX_vect) && !defined(USART0_RX_vect) && \
+    !defined(USART_RXC_vect)
+#error "Don't know what the Data Received vector is called for the first UART"
+#else
+void serialEvent() __attribute__((weak));
+void serialEvent() {}
+#define serialEvent_implemented
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect)
+#elif defined(USART0_RX_vect)
+ISR(USART0_RX_vect)
+#elif defined(USART_RXC_vect)
+ISR(USART_RXC_vect)  // ATmega8
+#endif
+{
+  ISR_TIME_BEGIN();
+  rx_handle_char();
+  ISR_TIME_END(rx_isr_max_ticks);
+}
+#endif
+#endif
+
+// TX frame scheduler.
+//
+// write_message() only queues a message and returns; it never waits out the
+// CC pacing delays.  Messages are stored un-escaped in tx_frame_queue as
+// [body length][msg id hi][msg id lo][body...] and the UDRE interrupt builds
+// the wire frame (SOF, escaping, CRC32, EOF) one byte at a time straight out
+// of the queue.  The CC wake wait and the minimum spacing between frame
+// starts are timed by the Timer0 compare B interrupt, which is only enabled
+// while a frame is waiting for its slot.  Timer0 keeps its normal millis() and
+// PWM duties, so pacing has the resolution of one Timer0 overflow (2 ms on
+// an 8 MHz Bean).
+//
+// write_message() only blocks when the queue has no room for the message.
+// The size must be a power of two no larger than 128 so the uint8_t head and
+// tail can wrap freely.
+#ifndef BEAN_TX_QUEUE_SIZE
+#define BEAN_TX_QUEUE_SIZE 128
+#endif
+
+#if (BEAN_TX_QUEUE_SIZE & (BEAN_TX_QUEUE_SIZE - 1)) || BEAN_TX_QUEUE_SIZE > 128
+#error BEAN_TX_QUEUE_SIZE must be a power of two no larger than 128
+#endif
+#if BEAN_TX_QUEUE_SIZE < MAX_BODY_LENGTH + 3
+#error BEAN_TX_QUEUE_SIZE must hold at least one maximum length message
+#endif
+
+#define TX_QUEUE_MASK (BEAN_TX_QUEUE_SIZE - 1)
+
+static uint8_t tx_frame_queue[BEAN_TX_QUEUE_SIZE];
+static volatile uint8_t tx_queue_head = 0;  // advanced by write_message()
+static volatile uint8_t tx_queue_tail = 0;  // advanced by the UDRE ISR
+static volatile uint16_t tx_frames_queued = 0;
+static volatile uint16_t tx_frames_sent = 0;
+
+static volatile enum {
+  TX_IDLE,     // queue empty
+  TX_WAITING,  // waiting for the CC to wake or for the pacing slot
+  TX_SOF,      // slot granted, SOF goes out next
+  TX_FRAME,    // sending length, message id, body and CRC32
+  TX_EOF       // EOF goes out next
+} tx_state = TX_IDLE;
+
+// Used for waking the CC out of deep sleep mode, see BTConfigUartSleep().
+static uint16_t m_wakeDelay = UART_DEFAULT_WAKE_WAIT;
+static uint16_t m_enforcedDelay = UART_DEFAULT_SEND_WAIT;
+static volatile bool cc_awake = false;
+
+static unsigned long tx_slot_start;
+static uint16_t tx_slot_wait;
+static unsigned long tx_frame_start;
+
+// Adaptive pacing, see setAdaptivePacing().  Each frame is tagged with the
+// delay that decided when it went out.  When a call_async() request carries
+// a tag, its reply shortens that delay by 1 ms, down to a floor, and a
+// timeout restores the default and raises the floor above the delay that
+// failed.  A frame queued within cc_wake_hold ms of the interrupt line
+// dropping skips the wake delay, as the CC can't be deeply asleep yet; a
+// timeout there turns the hold off.  Frames that were not held up carry no
+// tag and teach nothing.
+#ifndef BEAN_CC_WAKE_HOLD
+#define BEAN_CC_WAKE_HOLD (2)
+#endif
+
+#define PACED_WAKE (1)     // waited for the CC to wake
+#define PACED_SPACING (2)  // waited out m_enforcedDelay
+#define PACED_HOLD (4)     // skipped the wake delay, the CC was just let go
+
+static bool pacing_adaptive = false;
+static uint16_t pacing_wake_floor = 0;
+static uint16_t pacing_send_floor = 0;
+static uint8_t cc_wake_hold = BEAN_CC_WAKE_HOLD;
+static unsigned long cc_sleep_start;
+static uint8_t tx_pacing;  // the tag of the frame at the tail of the queue
+
+// The tag of the frame carrying pacing_probe_reply's request.
+static uint16_t pacing_probe_frame;
+static volatile uint8_t pacing_probe_flags;
+
+static void pacing_reset(void) {
+  pacing_wake_floor = 0;
+  pacing_send_floor = 0;
+  cc_wake_hold = BEAN_CC_WAKE_HOLD;
+}
+
+static uint16_t pacing_adjust(uint16_t delay, uint16_t *floor, uint16_t def,
+                              bool ok) {
+  if (ok) {
+    return delay > *floor ? delay - 1 : delay;
+  }
+  if (delay + 1 > *floor) {
+    *floor = delay + 1 < def ? delay + 1 : def;
+  }
+  return def;
+}
+
+// Called from pollReplies() when the probe request finishes.
+static void pacing_feedback(bool ok) {
+  uint8_t flags = pacing_probe_flags;
+
+  if (flags & PACED_WAKE) {
+    m_wakeDelay = pacing_adjust(m_wakeDelay, &pacing_wake_floor,
+                                UART_DEFAULT_WAKE_WAIT, ok);
+  }
+  if (flags & PACED_SPACING) {
+    m_enforcedDelay = pacing_adjust(m_enforcedDelay, &pacing_send_floor,
+                                    UART_DEFAULT_SEND_WAIT, ok);
+  }
+  if ((flags & PACED_HOLD) && !ok) {
+    cc_wake_hold = 0;
+  }
+}
+
+// Write combining.  Serial data bytes collect in tx_combine and go out as one
+// MSG_ID_SERIAL_DATA message once MAX_BODY_LENGTH bytes are waiting, when
+// flush() or any other message is sent, or when nothing has been written for
+// tx_combine_timeout ms (checked by the pacing tick).  tx_queue_locked keeps
+// the tick from touching the queue or tx_combine while the sketch is.  Off
+// until setWriteCombining(true), since it changes when and in what pieces a
+// sketch's writes reach the app.
+#ifndef BEAN_SERIAL_COMBINE_TIMEOUT
+#define BEAN_SERIAL_COMBINE_TIMEOUT (10)
+#endif
+
+static uint8_t tx_combine[MAX_BODY_LENGTH];
+static volatile uint8_t tx_combine_len = 0;
+static unsigned long tx_combine_last;
+static uint16_t tx_combine_timeout = BEAN_SERIAL_COMBINE_TIMEOUT;
+static bool tx_combine_enabled = false;
+static volatile bool tx_queue_locked = false;
+
+static uint8_t tx_frame_pos;
+static uint8_t tx_frame_len;
+static bool tx_escaping = false;
+static uint8_t tx_escaped;
+static uint32_t tx_crc32;
+static uint8_t tx_crc_bytes[4];
+
+static void tx_start_frame(unsigned long now) {
+  tx_frame_start = now;
+  if ((uint16_t)(tx_frames_sent + 1) == pacing_probe_frame) {
+    pacing_probe_flags = tx_pacing;
+  }
+  tx_state = TX_SOF;
+  sbi(UCSR0B, UDRIE0);
+}
+
+// Grants the frame at the tail of the queue its send slot, either right away
+// or by arming the pacing tick.  Called with interrupts disabled.
+static void tx_schedule_next(void) {
+  if (tx_queue_head == tx_queue_tail) {
+    tx_state = TX_IDLE;
+    return;
+  }
+
+  unsigned long now = millis();
+  unsigned long since_last = now - tx_frame_start;
+  uint16_t wait = 0;
+  uint8_t pacing = 0;
+
+  // throttle the transfer speed
+  if (since_last < m_enforcedDelay) {
+    wait = m_enforcedDelay - since_last;
+    pacing = PACED_SPACING;
+  }
+
+  // if the CC may be asleep, raise the ccinterrupt and wait for the cc to
+  // wake before starting the transmit. testing has shown this to take up
+  // to 4ms.  adding 1 ms padding.
+  if (!cc_awake) {
+    digitalWriteFast(CC_INTERRUPT_PIN, HIGH);
+    cc_awake = true;
+    if (pacing_adaptive && now - cc_sleep_start < cc_wake_hold) {
+      pacing |= PACED_HOLD;
+    } else if (wait < m_wakeDelay) {
+      wait = m_wakeDelay;
+      pacing = PACED_WAKE;
+    }
+  }
+  tx_pacing = pacing;
+
+  if (wait == 0) {
+    tx_start_frame(now);
+  } else {
+    tx_slot_start = now;
+    tx_slot_wait = wait;
+    tx_state = TX_WAITING;
+    TIFR0 = _BV(OCF0B);  // drop a stale match, the flag clears on write
+    sbi(TIMSK0, OCIE0B);
+  }
+}
+
+static uint8_t tx_queue_free(void) {
+  return BEAN_TX_QUEUE_SIZE - (uint8_t)(tx_queue_head - tx_queue_tail);
+}
+
+// Copies a message into the queue and kicks the scheduler.  The caller must
+// hold tx_queue_locked (or be the pacing tick) and have checked for room.
+static uint8_t tx_queue_put_header(uint16_t messageId, uint8_t body_length) {
+  uint8_t head = tx_queue_head;
+  tx_frame_queue[head++ & TX_QUEUE_MASK] = body_length;
+  tx_frame_queue[head++ & TX_QUEUE_MASK] = (uint8_t)(messageId >> 8);
+  tx_frame_queue[head++ & TX_QUEUE_MASK] = (uint8_t)(messageId & 0xFF);
+  return head;
+}
+
+static uint8_t tx_queue_put(uint8_t head, const uint8_t *data, uint8_t length,
+                            bool progmem) {
+  if (progmem) {
+    for (uint8_t i = 0; i < length; i++) {
+      tx_frame_queue[head++ & TX_QUEUE_MASK] = pgm_read_byte(data + i);
+    }
+  } else {
+    for (uint8_t i = 0; i < length; i++) {
+      tx_frame_queue[head++ & TX_QUEUE_MASK] = data[i];
+    }
+  }
+  return head;
+}
+
+// Publishes everything written up to head as one message.
+static void tx_queue_commit(uint8_t head) {
+  uint8_t oldSREG = SREG;
+  cli();
+  tx_queue_head = head;
+  tx_frames_queued++;
+  tx_buffer_flushed = false;
+  if (tx_state == TX_IDLE) {
+    tx_schedule_next();
+  }
+  SREG = oldSREG;
+}
+
+static void tx_enqueue(uint16_t messageId, const uint8_t *body,
+                       uint8_t body_length) {
+  uint8_t head = tx_queue_put_header(messageId, body_length);
+  tx_queue_commit(tx_queue_put(head, body, body_length, false));
+}
+
+// Virtual Serial compression, see setCompression().  With it on, write
+// combined bytes collect in lz->window instead of tx_combine, right after the
+// history the encoder matches them against, and go out as
+// MSG_ID_SERIAL_DATA_LZ messages of up to MAX_BODY_LENGTH bytes once
+// LZ_MAX_PENDING are waiting or on a flush.  A message that wouldn't come
+// out smaller goes uncompressed instead.  Encoding only happens in the
+// sketch: the pacing tick's idle timeout sends what's waiting uncompressed,
+// which keeps the tick short.
+//
+// The window is indexed by uint8_t, so positions wrap freely.  The hash table
+// remembers where each 3 byte prefix was last seen; a stale entry just fails
+// to match.  The encoder is only reached through lz_send_hook, so it isn't
+// linked into sketches that never call setCompression().
+#ifndef BEAN_SERIAL_LZ_RESET
+#define BEAN_SERIAL_LZ_RESET (16)  // compressed messages between resets
+#endif
+
+#define LZ_HASH_SIZE (64)
+#define LZ_MAX_PENDING (128)
+#define LZ_MIN_MATCH (3)
+#define LZ_RESET_BIT (0x80)
+
+struct BeanLz {
+  uint8_t window[256];
+  uint8_t hash[LZ_HASH_SIZE];
+};
+
+static BeanLz *lz = NULL;
+static bool lz_enabled = false;
+static uint8_t lz_pos = 0;                  // the next byte to send
+static volatile uint8_t lz_pending = 0;     // written, but not sent yet
+static uint8_t lz_history = 0;              // sent bytes a match may use
+static uint8_t lz_stream = 0;               // bytes since the last reset
+static uint8_t lz_messages = 0;             // compressed since then
+static bool lz_reset = true;
+static void (*lz_send_hook)(void) = NULL;
+
+static inline uint8_t lz_hash_at(uint8_t pos) {
+  const uint8_t *w = lz->window;
+  return ((w[pos] << 3) ^ (w[(uint8_t)(pos + 1)] << 1) ^
+          w[(uint8_t)(pos + 2)]) &
+         (LZ_HASH_SIZE - 1);
+}
+
+// Moves length pending bytes into the history, remembering where each one
+// starts in the hash table if index is set.
+static void lz_advance(uint8_t length, bool index) {
+  for (uint8_t i = 0; i < length; i++) {
+    if (index && lz_pending >= LZ_MIN_MATCH) {
+      lz->hash[lz_hash_at(lz_pos)] = lz_pos;
+    }
+    lz_pos++;
+    lz_pending--;
+    if (lz_history < 255) {
+      lz_history++;
+    }
+  }
+  lz_stream += length;
+}
+
+// Queues length pending bytes as MSG_ID_SERIAL_DATA, from start.  Called by
+// the sketch with tx_queue_locked held, or by the pacing tick, after
+// checking for room.
+static void lz_put_raw(uint8_t start, uint8_t length) {
+  uint8_t head = tx_queue_put_header(MSG_ID_SERIAL_DATA, length);
+  uint8_t first = (uint8_t)(0 - start);  // up to the end of the window
+  if (first == 0 || first > length) {
+    first = length;
+  }
+  head = tx_queue_put(head, &lz->window[start], first, false);
+  head = tx_queue_put(head, lz->window, length - first, false);
+  tx_queue_commit(head);
+}
+
+// The longest match for the pending bytes at lz_pos, or 0.
+static uint8_t lz_match(uint8_t *distance) {
+  const uint8_t *w = lz->window;
+  uint8_t candidate = lz->hash[lz_hash_at(lz_pos)];
+  uint8_t d = lz_pos - candidate;
+  if (d == 0 || d > lz_history) {
+    return 0;
+  }
+
+  uint8_t length = 0;
+  while (length < lz_pending &&
+         w[(uint8_t)(candidate + length)] == w[(uint8_t)(lz_pos + length)]) {
+    length++;
+  }
+  *distance = d;
+  return length;
+}
+
+// Encodes as many pending bytes as fit in one message and queues it.  Called
+// by the sketch with tx_queue_locked held.
+static void lz_send(void) {
+  uint8_t out[MAX_BODY_LENGTH];
+  uint8_t start = lz_pos;
+  uint8_t used = 0;
+  uint8_t n = 1;
+  bool full = false;
+
+  if (lz_reset) {
+    lz_history = 0;
+    lz_stream = 0;
+  }
+  out[0] = (lz_reset ? LZ_RESET_BIT : 0) | (lz_stream & ~LZ_RESET_BIT);
+
+  // groups of eight tokens, each led by a byte flagging its matches
+  while (!full && lz_pending > 0 && n + 2 <= MAX_BODY_LENGTH) {
+    uint8_t control_at = n++;
+    uint8_t control = 0;
+    for (uint8_t bit = 0; bit < 8 && lz_pending > 0; bit++) {
+      uint8_t distance;
+      uint8_t length = lz_pending >= LZ_MIN_MATCH ? lz_match(&distance) : 0;
+      if (length >= LZ_MIN_MATCH && n + 2 <= MAX_BODY_LENGTH) {
+        control |= 1 << bit;
+        out[n++] = distance - 1;
+        out[n++] = length - LZ_MIN_MATCH;
+      } else if (n + 1 <= MAX_BODY_LENGTH) {
+        length = 1;
+        out[n++] = lz->window[lz_pos];
+      } else {
+        full = true;
+        break;
+      }
+      lz_advance(length, true);
+      used += length;
+    }
+    out[control_at] = control;
+  }
+
+  while (tx_queue_free() < n + 3) {
+    bean_idle();
+  }
+  if (n >= used) {
+    // a raw message costs no more, and raw bytes are history all the same
+    lz_put_raw(start, used);
+    return;
+  }
+  tx_enqueue(MSG_ID_SERIAL_DATA_LZ, out, n);
+  lz_reset = ++lz_messages == BEAN_SERIAL_LZ_RESET;
+  if (lz_reset) {
+    lz_messages = 0;
+  }
+}
+
+// Adds a written byte, sending a message first if the window is full.  The
+// caller must hold tx_queue_locked.
+static inline void lz_write(uint8_t c) {
+  if (lz_pending == LZ_MAX_PENDING) {
+    lz_send_hook();
+  }
+  lz->window[(uint8_t)(lz_pos + lz_pending)] = c;
+  lz_pending++;
+  // the new byte overwrites the oldest one in the history
+  if ((uint16_t)lz_history + lz_pending > 256) {
+    lz_history--;
+  }
+}
+
+// Moves any write combined serial data into the queue, waiting for room if
+// the queue is full.  The caller must hold tx_queue_locked.
+static void tx_combine_flush(void) {
+  while (lz_pending > 0) {
+    lz_send_hook();
+  }
+  if (tx_combine_len == 0) {
+    return;
+  }
+
+  while (tx_queue_free() < tx_combine_len + 3) {
+    bean_idle();
+  }
+  tx_enqueue(MSG_ID_SERIAL_DATA, tx_combine, tx_combine_len);
+  tx_combine_len = 0;
+}
+
+// Pacing tick, fires once per Timer0 overflow while a frame is TX_WAITING,
+// write combined data is waiting for its idle timeout or an RX
+// acknowledgement is waiting to be queued.
+ISR(TIMER0_COMPB_vect) {
+  ISR_TIME_BEGIN();
+  unsigned long now = millis();
+
+  if (rx_ack_pending != RX_ACK_NONE && !tx_queue_locked &&
+      (int16_t)(tx_frames_sent - rx_ack_frame) >= 0 && tx_queue_free() >= 4) {
+    uint8_t next = rx_ack_next;
+    if (rx_ack_pending == RX_NAK) {
+      STAT_INC(naksSent);
+      tx_enqueue(MSG_ID_AR_RX_NAK, &next, 1);
+    } else {
+      tx_enqueue(MSG_ID_AR_RX_ACK, &next, 1);
+    }
+    rx_ack_pending = RX_ACK_NONE;
+    rx_ack_frame = tx_frames_queued;
+  }
+
+  if (tx_combine_len > 0 && !tx_queue_locked &&
+      now - tx_combine_last >= tx_combine_timeout &&
+      tx_queue_free() >= tx_combine_len + 3) {
+    tx_enqueue(MSG_ID_SERIAL_DATA, tx_combine, tx_combine_len);
+    tx_combine_len = 0;
+  }
+
+  if (lz_pending > 0 && !tx_queue_locked &&
+      now - tx_combine_last >= tx_combine_timeout) {
+    uint8_t length = lz_pending > MAX_BODY_LENGTH ? MAX_BODY_LENGTH : lz_pending;
+    if (tx_queue_free() >= length + 3) {
+      lz_put_raw(lz_pos, length);
+      lz_advance(length, false);
+    }
+  }
+
+  if (tx_state == TX_WAITING && now - tx_slot_start >= tx_slot_wait) {
+    tx_start_frame(now);
+  }
+
+  if (tx_state != TX_WAITING && tx_combine_len == 0 && lz_pending == 0 &&
+      rx_ack_pending == RX_ACK_NONE) {
+    cbi(TIMSK0, OCIE0B);
+  }
+
+  ISR_TIME_END(tx_isr_max_ticks);
+}
+
+// Produces the next wire byte of the frame at the tail of the queue.
+// Returns false if no frame is being sent.
+static bool tx_next_frame_byte(uint8_t *c) {
+  uint8_t next;
+  uint8_t crc_pos;
+
+  if (tx_escaping) {
+    tx_escaping = false;
+    *c = tx_escaped;
+    return true;
+  }
+
+  switch (tx_state) {
+    case TX_SOF:
+      // body length + 2 for message type + 4 for the CRC32
+      tx_frame_len = tx_frame_queue[tx_queue_tail & TX_QUEUE_MASK] + 7;
+      tx_frame_pos = 0;
+      tx_crc32 = bean_crc32_begin();
+      tx_state = TX_FRAME;
+      *c = BEAN_SOF;
+      return true;
+
+    case TX_FRAME:
+      crc_pos = tx_frame_len - 4;
+      if (tx_frame_pos == 0) {
+        next = tx_frame_queue[tx_queue_tail & TX_QUEUE_MASK] + 2;
+      } else if (tx_frame_pos < crc_pos) {
+        next = tx_frame_queue[(uint8_t)(tx_queue_tail + tx_frame_pos) &
+                              TX_QUEUE_MASK];
+      } else {
+        if (tx_frame_pos == crc_pos) {
+          toUint8Array(bean_crc32_finish(tx_crc32), tx_crc_bytes, 4);
+        }
+        next = tx_crc_bytes[tx_frame_pos - crc_pos];
+      }
+
+      if (tx_frame_pos < crc_pos) {
+        tx_crc32 = bean_crc32_update_byte(tx_crc32, next);
+      }
+      if (++tx_frame_pos == tx_frame_len) {
+        tx_state = TX_EOF;
+      }
+
+      if (next == BEAN_SOF || next == BEAN_EOF || next == BEAN_ESCAPE) {
+        tx_escaped = next ^ BEAN_ESCAPE_XOR;
+        tx_escaping = true;
+        next = BEAN_ESCAPE;
+      }
+      *c = next;
+      return true;
+
+    case TX_EOF:
+      *c = BEAN_EOF;
+      // the queued record is the frame minus its CRC32
+      tx_queue_tail += tx_frame_len - 4;
+      tx_frames_sent++;
+      STAT_INC(framesSent);
+      BEAN_ENERGY_FRAME_SENT();
+      tx_schedule_next();
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// The Original HWSerial version of this function
+// relies on the TX Vector flag to tell when tx_buffer_flushed.
+// we need that flag to fire the interrupt (auto-clears, and cannot be manually
+// set) pin for the CC, so for BeanSerial we use 'tx_buffer_flushed' bool
+// instead.
+void BeanSerialTransport::flush() {
+  tx_queue_locked = true;
+  tx_combine_flush();
+  tx_queue_locked = false;
+
+  // logic is handled in writes and interrupts
+  while (tx_buffer_flushed == false) {
+    bean_idle();
+  }
+
+  // this is a holdover from HWSerial.
+  transmitting = false;
+}
+
+uint8_t BeanSerialTransport::txFramesPending(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t pending = (uint8_t)(tx_frames_queued - tx_frames_sent);
+  SREG = oldSREG;
+
+  return pending;
+}
+
+size_t BeanSerialTransport::txQueueAvailable(void) { return tx_queue_free(); }
+
+uint16_t BeanSerialTransport::txLastFrame(void) { return tx_frames_queued; }
+
+bool BeanSerialTransport::txFrameSent(uint16_t frame) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t sent = tx_frames_sent;
+  SREG = oldSREG;
+
+  return (int16_t)(sent - frame) >= 0;
+}
+
+bool BeanSerialTransport::getTransportStats(BEAN_TRANSPORT_STATS_T *stats) {
+#if BEAN_TRANSPORT_STATS
+  uint8_t oldSREG = SREG;
+  cli();
+  *stats = transport_stats;
+  uint8_t rx_ticks = rx_isr_max_ticks;
+  uint8_t tx_ticks = tx_isr_max_ticks;
+  SREG = oldSREG;
+
+  stats->maxRxIsrMicros = clockCyclesToMicroseconds(64UL * rx_ticks);
+  stats->maxTxIsrMicros = clockCyclesToMicroseconds(64UL * tx_ticks);
+  return true;
+#else
+  memset(stats, 0, sizeof(*stats));
+  return false;
+#endif
+}
+
+void BeanSerialTransport::resetTransportStats(void) {
+#if BEAN_TRANSPORT_STATS
+  uint8_t oldSREG = SREG;
+  cli();
+  memset(&transport_stats, 0, sizeof(transport_stats));
+  rx_isr_max_ticks = 0;
+  tx_isr_max_ticks = 0;
+  SREG = oldSREG;
+#endif
+}
+
+// This interrupt fires after the send has completed
+ISR(USART_TX_vect) {
+  // lower interrupt line that wakes The CC, unless more frames are queued
+  if (tx_buffer.head == tx_buffer.tail && tx_state == TX_IDLE) {
+    digitalWriteFast(CC_INTERRUPT_PIN, m_ccSleepPinVal);
+    cc_awake = (m_ccSleepPinVal == HIGH);
+    cc_sleep_start = millis();
     tx_buffer_flushed = true;
   }
+  cbi(UCSR0B, TXCIE0);
 }
 
 // This interrupt fires after the send register as offloaded the data
 // to the send hardware.
 ISR(USART_UDRE_vect) {
-  if (tx_buffer.head == tx_buffer.tail) {
-    // Buffer empty, so disable interrupts
+  ISR_TIME_BEGIN();
+  uint8_t c;
+
+  if (tx_buffer.head != tx_buffer.tail &&
+      (tx_state == TX_IDLE || tx_state == TX_WAITING)) {
+    // raw bytes from debugWrite() only go out between frames
+    c = tx_buffer.read();
+  } else if (!tx_next_frame_byte(&c)) {
+    // Nothing to send until the next slot, so disable interrupts
     cbi(UCSR0B, UDRIE0);
 
-    // enable the tx sent interrupt so we can disable the
-    // CC interrupt pin
-    sbi(UCSR0B, TXCIE0);
+    // once everything is out, enable the tx sent interrupt so we can
+    // disable the CC interrupt pin
+    if (tx_state == TX_IDLE) {
+      sbi(UCSR0B, TXCIE0);
+    }
   } else {
-    // There is more data in the output buffer. Send the next byte
-    unsigned char c = tx_buffer.buffer[tx_buffer.tail];
-    tx_buffer.tail = (tx_buffer.tail + 1) % SERIAL_BUFFER_SIZE;
-
 #if defined(UDR0)
     UDR0 = c;
 #elif defined(UDR)
@@ -333,140 +1816,554 @@ ISR(USART_UDRE_vect) {
 #error UDR not defined
 #endif
   }
+
+  ISR_TIME_END(tx_isr_max_ticks);
 }
 
+// Baud negotiation, see MSG_ID_AR_SET_BAUD.  The rates divide 8 and 16 MHz
+// exactly with U2X, unlike 57600 or 115200.
+#define BAUD_DEFAULT (38400UL)
+#define BAUD_CONFIRM_MS (100)  // the CC's wait for a good frame, as above
+#define BAUD_PING_MS (30)
+#define BAUD_RESUME_CHECK(baud) \
+  ((uint16_t)((baud) ^ ((baud) >> 16) ^ 0xB4D5))
+
+// Worst case cycles the RX ISR spends on one byte, e.g. its rx_isr figure in
+// resources/benchmark_sketches/transport.ino.  A rate is only used if a byte
+// takes at least twice this, so the UART's two byte receive buffer covers
+// another ISR of the same length.
+#ifndef BEAN_SERIAL_RX_ISR_CYCLES
+#define BEAN_SERIAL_RX_ISR_CYCLES (150)
+#endif
+
+static const uint32_t baud_rates[] PROGMEM = {1000000UL, 500000UL, 250000UL};
+static uint32_t uart_baud = BAUD_DEFAULT;
+
+// The rate in use survives a reset the CC didn't cause, e.g. by the
+// watchdog, so the ATmega can find the CC again.
+static struct {
+  uint32_t baud;
+  uint16_t check;
+} baud_resume __attribute__((section(".noinit")));
+
 // Called in main, before setup, to enable things such as setting the LED
 // color during setup.
 void BeanSerialTransport::begin(void) {
-  HardwareSerial::begin(38400);
-  pinMode(CC_INTERRUPT_PIN, OUTPUT);
-  digitalWrite(CC_INTERRUPT_PIN, LOW);
+  static bool resumed = false;
+
+  rx_routes_init();
+  HardwareSerial::begin(uart_baud);
+  pinModeFast(CC_INTERRUPT_PIN, OUTPUT);
+  digitalWriteFast(CC_INTERRUPT_PIN, LOW);
+  cc_awake = false;
 
-  if (tx_buffer.head == tx_buffer.tail) {
+  if (tx_buffer.head == tx_buffer.tail && tx_state == TX_IDLE) {
     tx_buffer_flushed = true;
-    digitalWrite(CC_INTERRUPT_PIN, m_ccSleepPinVal);
-  }
-}
-
-inline void BeanSerialTransport::insert_escaped_char(uint8_t input) {
-  // It's crucial that HardwareSerial::write is only called
-  // with excplicit uint8_t types otherwise weird overloading
-  // happens, and things you don't expect result
-  switch (input) {
-    case BEAN_SOF:  // fallthrough
-    case BEAN_EOF:  // fallthrough
-    case BEAN_ESCAPE:
-      HardwareSerial::write(BEAN_ESCAPE);
-      // without the cast, the XOR is getting promoted
-      // to another type, probably an int, and causing unexpected
-      // results in the messages.
-      HardwareSerial::write(uint8_t(input ^ BEAN_ESCAPE_XOR));
-      break;
-    default:
-      HardwareSerial::write(input);
+    digitalWriteFast(CC_INTERRUPT_PIN, m_ccSleepPinVal);
+    cc_awake = (m_ccSleepPinVal == HIGH);
+  }
+
+  if (!resumed) {
+    resumed = true;
+    baudResume();
   }
 }
 
+bool BeanSerialTransport::registerRxRoute(uint16_t messageId,
+                                          ring_buffer *buffer,
+                                          BeanRxHandler handler) {
+  rx_routes_init();
+  return rx_route_add(messageId, buffer, handler);
+}
+
 void BeanSerialTransport::BTConfigUartSleep(UART_SLEEP_MODE_T mode) {
   if (UART_SLEEP_NORMAL == mode) {
     m_wakeDelay = UART_DEFAULT_WAKE_WAIT;
     m_enforcedDelay = UART_DEFAULT_SEND_WAIT;
     m_ccSleepPinVal = LOW;
+    pacing_reset();
   } else if (UART_SLEEP_NEVER == mode) {
     m_wakeDelay = 0;
     m_enforcedDelay = 0;
     m_ccSleepPinVal = HIGH;
-    digitalWrite(CC_INTERRUPT_PIN, HIGH);
+    digitalWriteFast(CC_INTERRUPT_PIN, HIGH);
+    cc_awake = true;
   }
 }
 
-size_t BeanSerialTransport::write_message(uint16_t messageId,
-                                          const uint8_t *body,
-                                          size_t body_length) {
+void BeanSerialTransport::setWriteCombining(bool enable) {
+  if (!enable) {
+    tx_queue_locked = true;
+    tx_combine_flush();
+    // what's written now bypasses the compression history
+    lz_reset = true;
+    tx_queue_locked = false;
+  }
+  tx_combine_enabled = enable;
+}
+
+void BeanSerialTransport::setWriteCombiningTimeout(uint16_t idle_ms) {
+  tx_combine_timeout = idle_ms;
+}
+
+bool BeanSerialTransport::setCompression(bool enable) {
+  tx_queue_locked = true;
+  tx_combine_flush();
+
+  if (enable && lz == NULL) {
+    lz = (BeanLz *)malloc(sizeof(BeanLz));
+    lz_send_hook = lz_send;
+  }
+  lz_enabled = enable && lz != NULL;
+  // the receiver may not have seen the stream so far
+  lz_reset = true;
+  lz_messages = 0;
+
+  tx_queue_locked = false;
+  return lz_enabled == enable;
+}
+
+void BeanSerialTransport::setAdaptivePacing(bool enable) {
+  uint8_t oldSREG = SREG;
+  cli();
+  pacing_adaptive = enable;
+  pacing_probe_reply = NULL;
+  if (m_ccSleepPinVal == LOW) {
+    m_wakeDelay = UART_DEFAULT_WAKE_WAIT;
+    m_enforcedDelay = UART_DEFAULT_SEND_WAIT;
+  }
+  pacing_reset();
+  SREG = oldSREG;
+}
+
+// Set before begin() runs, as it may already send messages.
+static void serial_begin_once(void) {
   static bool serial_initialized = false;
-  uint32_t crc32 = 0;
-  uint8_t temp_var[4];
 
   if (!serial_initialized) {
-    Serial.begin();
     serial_initialized = true;
+    Serial.begin();
+  }
+}
+
+void BeanSerialTransport::getPacing(uint16_t *wake_ms, uint16_t *send_ms) {
+  *wake_ms = m_wakeDelay;
+  *send_ms = m_enforcedDelay;
+}
+
+static bool baud_supported(uint32_t baud) {
+  for (uint8_t i = 0; i < sizeof(baud_rates) / sizeof(baud_rates[0]); i++) {
+    if (pgm_read_dword(&baud_rates[i]) == baud) {
+      return true;
+    }
   }
+  return false;
+}
+
+static bool baud_fits(uint32_t baud) {
+  uint16_t byte_cycles = F_CPU * 10 / baud;  // 10 bits a byte
+  if (byte_cycles < 2 * BEAN_SERIAL_RX_ISR_CYCLES) {
+    return false;
+  }
+#if BEAN_TRANSPORT_STATS
+  // nor may the longest RX ISR seen, e.g. one finishing a reply, outlast
+  // the buffer
+  if ((uint16_t)rx_isr_max_ticks * 64 >= 2 * byte_cycles) {
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool BeanSerialTransport::baudPing(void) {
+  // includes bytes that are escaped on the wire
+  static const uint8_t ping[] = {0x55, UT_CHAR_START, 0xAA, UT_CHAR_ESC};
+  uint8_t echo[sizeof(ping)];
+  size_t length = sizeof(echo);
+  return call_and_response(MSG_ID_DB_LOOPBACK, ping, sizeof(ping), echo,
+                           &length, BAUD_PING_MS) == 0 &&
+         length == sizeof(ping) && memcmp(echo, ping, sizeof(ping)) == 0;
+}
+
+void BeanSerialTransport::baudSwitch(uint32_t baud) {
+  tx_queue_locked = true;
+  while (tx_queue_tail != tx_queue_head || tx_state != TX_IDLE) {
+    bean_idle();
+  }
+  // the UART still shifts out the last byte, and may hold one more
+  delayMicroseconds(2 * 10000000UL / uart_baud + 1);
+
+  uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+  uint8_t oldSREG = SREG;
+  cli();
+  UCSR0A = _BV(U2X0);
+  UBRR0H = setting >> 8;
+  UBRR0L = setting;
+  uart_baud = baud;
+  SREG = oldSREG;
+  tx_queue_locked = false;
+
+  baud_resume.baud = baud;
+  baud_resume.check = BAUD_RESUME_CHECK(baud);
+}
+
+void BeanSerialTransport::baudResume(void) {
+  uint32_t baud = baud_resume.baud;
+  if (baud_resume.check != BAUD_RESUME_CHECK(baud) || !baud_supported(baud)) {
+    baud_resume.baud = BAUD_DEFAULT;
+    baud_resume.check = BAUD_RESUME_CHECK(BAUD_DEFAULT);
+    return;
+  }
+  // if the CC reset the ATmega it went back to 38400 as well
+  baudSwitch(baud);
+  if (!baudPing()) {
+    baudSwitch(BAUD_DEFAULT);
+  }
+}
+
+uint32_t BeanSerialTransport::negotiateBaud(uint32_t max_baud) {
+  serial_begin_once();
+
+  uint32_t baud = BAUD_DEFAULT;
+  for (uint8_t i = 0; i < sizeof(baud_rates) / sizeof(baud_rates[0]); i++) {
+    uint32_t rate = pgm_read_dword(&baud_rates[i]);
+    if (rate <= max_baud && baud_fits(rate)) {
+      baud = rate;
+      break;
+    }
+  }
+  if (baud == uart_baud) {
+    return uart_baud;
+  }
+
+  // CC firmware without baud negotiation doesn't answer
+  uint32_t accepted = 0;
+  size_t length = sizeof(accepted);
+  if (call_and_response(MSG_ID_AR_SET_BAUD, (const uint8_t *)&baud,
+                        sizeof(baud), (uint8_t *)&accepted, &length) != 0 ||
+      length != sizeof(accepted) || accepted != baud) {
+    return uart_baud;
+  }
+  baudSwitch(baud);
+  if (baudPing()) {
+    return uart_baud;
+  }
+
+  // Either the CC didn't get the ping, and goes back to 38400 by itself, or
+  // its answer didn't get through.  Ask it to go back in case it did, then
+  // confirm 38400 once it has.
+  uint32_t fallback = BAUD_DEFAULT;
+  write_message(MSG_ID_AR_SET_BAUD, (const uint8_t *)&fallback,
+                sizeof(fallback));
+  baudSwitch(BAUD_DEFAULT);
+  delay(BAUD_CONFIRM_MS);
+  baudPing();
+  return uart_baud;
+}
+
+uint32_t BeanSerialTransport::baud(void) { return uart_baud; }
+
+// The CC answers within a reply timeout, as for call_and_response().
+#define RX_ACKS_TIMEOUT_MS (100)
+
+bool BeanSerialTransport::setRxAcks(bool enable) {
+  serial_begin_once();
+  if (enable == rx_acks) {
+    return true;
+  }
+
+  uint8_t body = enable ? 1 : 0;
+  rx_acks_answered = false;
+  write_message(MSG_ID_AR_SET_RX_ACKS, &body, sizeof(body));
+
+  uint16_t frame = txLastFrame();
+  while (!txFrameSent(frame)) {
+    bean_idle();
+  }
+  unsigned long start = millis();
+  while (!rx_acks_answered) {
+    if (millis() - start >= RX_ACKS_TIMEOUT_MS) {
+      return false;
+    }
+    bean_idle();
+  }
+  return rx_acks == enable;
+}
+
+bool BeanSerialTransport::rxAcks(void) { return rx_acks; }
+
+
+size_t BeanSerialTransport::write_message(uint16_t messageId,
+                                          const uint8_t *body,
+                                          size_t body_length) {
+  serial_begin_once();
 
   if (body_length > MAX_BODY_LENGTH) {
     return -1;
   }
 
-  // if the buffer is empty, raise the ccinterrupt
-  // and wait for the cc to wake before starting the transmit
-  // testing has shown this to take up to 4ms.  adding 1 ms padding.
-  tx_buffer_flushed = false;
-  digitalWrite(CC_INTERRUPT_PIN, HIGH);
-  if (tx_buffer.head == tx_buffer.tail && m_wakeDelay > 0) {
-    delay(m_wakeDelay);
+  tx_queue_locked = true;
+
+  // keep write combined serial data ahead of this message
+  tx_combine_flush();
+
+  // wait for the scheduler to make room if the queue is full
+  while (tx_queue_free() < body_length + 3) {
+    bean_idle();
   }
+  tx_enqueue(messageId, body, (uint8_t)body_length);
+
+  tx_queue_locked = false;
 
-  HardwareSerial::write(BEAN_SOF);
-  // body_length + "2" for message type.
-  temp_var[0] = body_length + 2;
-  temp_var[1] = (uint8_t)(messageId >> 8);
-  temp_var[2] = (uint8_t)(messageId & 0xFF);
-  crc32 = calc_crc32(crc32, temp_var, 3);
-  for (int i = 0; i < 3; i++) {
-    insert_escaped_char(temp_var[i]);
+  return body_length;
+}
+
+size_t BeanSerialTransport::write_message_v(uint16_t messageId,
+                                            const BeanTxSegment *segments,
+                                            uint8_t count) {
+  size_t body_length = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    body_length += segments[i].length;
   }
 
-  crc32 = calc_crc32(crc32, (uint8_t *)body, body_length);
-  for (uint8_t i = 0; i < body_length; i++) {
-    insert_escaped_char(body[i]);
+  serial_begin_once();
+
+  if (body_length > MAX_BODY_LENGTH) {
+    return -1;
   }
 
-  toUint8Array(crc32, temp_var, sizeof(uint32_t));
-  for (uint8_t i = 0; i < sizeof(uint32_t); i++) {
-    insert_escaped_char(temp_var[i]);
+  tx_queue_locked = true;
+
+  // keep write combined serial data ahead of this message
+  tx_combine_flush();
+
+  // wait for the scheduler to make room if the queue is full
+  while (tx_queue_free() < body_length + 3) {
+    bean_idle();
   }
-  HardwareSerial::write(BEAN_EOF);
-  // throttle the transfer speed
-  if (m_enforcedDelay > 0) {
-    delay(m_enforcedDelay);
+  uint8_t head = tx_queue_put_header(messageId, (uint8_t)body_length);
+  for (uint8_t i = 0; i < count; i++) {
+    head = tx_queue_put(head, (const uint8_t *)segments[i].data,
+                        segments[i].length, segments[i].progmem);
   }
+  tx_queue_commit(head);
+
+  tx_queue_locked = false;
 
   return body_length;
 }
 
+int BeanSerialTransport::call_async(MSG_ID_T messageId, const uint8_t *body,
+                                    size_t body_length, BeanReply *reply,
+                                    unsigned long timeout_ms) {
+  if (body_length > MAX_BODY_LENGTH) {
+    return -1;
+  }
+
+  reply->messageId = messageId;
+  reply->length = 0;
+  reply->status = BEAN_REPLY_PENDING;
+  reply->sentMillis = millis();
+  reply->timeout_ms = timeout_ms;
+
+  if (!reply_register(reply)) {
+    return -1;
+  }
+
+  write_message(messageId, body, body_length);
+
+  if (pacing_adaptive && pacing_probe_reply == NULL) {
+    uint8_t oldSREG = SREG;
+    cli();
+    pacing_probe_reply = reply;
+    pacing_probe_frame = tx_frames_queued;
+    // the frame may already be on its way
+    bool started = tx_state != TX_IDLE && tx_state != TX_WAITING &&
+                   (uint16_t)(tx_frames_sent + 1) == pacing_probe_frame;
+    pacing_probe_flags = started ? tx_pacing : 0;
+    SREG = oldSREG;
+  }
+  return 0;
+}
+
+void BeanSerialTransport::pollReplies(void) {
+  for (uint8_t i = 0; i < BEAN_MAX_PENDING_REPLIES; i++) {
+    BeanReply *reply = pending_replies[i];
+    if (reply == NULL) {
+      continue;
+    }
+
+    uint8_t oldSREG = SREG;
+    cli();
+    if (reply->status == BEAN_REPLY_PENDING &&
+        millis() - reply->sentMillis >= reply->timeout_ms) {
+      reply->status = BEAN_REPLY_TIMEOUT;
+    }
+    bool finished = reply->status != BEAN_REPLY_PENDING;
+    if (finished) {
+      pending_replies[i] = NULL;
+      if (rx_reply == reply) {
+        rx_reply = NULL;
+      }
+    }
+    SREG = oldSREG;
+
+    if (finished && reply == pacing_probe_reply) {
+      pacing_probe_reply = NULL;
+      pacing_feedback(reply->status == BEAN_REPLY_DONE);
+    }
+    if (finished && reply->callback) {
+      reply->callback(reply);
+    }
+  }
+}
+
 int BeanSerialTransport::call_and_response(
     MSG_ID_T messageId, const uint8_t *body, size_t body_length,
     uint8_t *response, size_t *response_length, unsigned long timeout_ms) {
-  noInterrupts();
-  // clear our rx buffer to ensure that we don't read some old message out of it
-  _reply_buffer->head = _reply_buffer->tail = 0;
-  *_message_complete = false;
-  interrupts();
-
-  // send our message
-  write_message(messageId, body, body_length);
-  // wait for RX to hold an EOF, and then return the data
+  BeanReply reply;
+  reply.response = response;
+  reply.capacity = *response_length;
+  reply.callback = NULL;
+  reply.context = NULL;
 
+  // wait our turn if an async request for the same id is still outstanding
   _startMillis = millis();
-  do {
-  } while (*_message_complete == false &&
-           (millis() - _startMillis < timeout_ms));
+  while (call_async(messageId, body, body_length, &reply, timeout_ms) != 0) {
+    if (millis() - _startMillis >= timeout_ms) {
+      return -1;
+    }
+    pollReplies();
+    bean_idle();
+  }
 
-  if (*_message_complete) {
-    // copy the message body into out
-    memcpy(response, _reply_buffer->buffer,
-           min(_reply_buffer->head, *response_length));
-    *response_length = _reply_buffer->head;
+  // start the timeout once our message has left the queue
+  uint16_t frame = txLastFrame();
+  while (!txFrameSent(frame)) {
+    bean_idle();
+  }
+  reply.sentMillis = millis();
+
+  // wait for RX to hold the reply, and then return the data
+  while (reply.status == BEAN_REPLY_PENDING) {
+    pollReplies();
+    bean_idle();
+  }
+  reply_release(&reply);
 
+  if (reply.status == BEAN_REPLY_DONE) {
+    *response_length = reply.length;
     return 0;
   }
 
   return -1;
 }
 
+static uint8_t cc_probe_epoch = 0;
+
+bool bean_cc_probe_open(BeanCcProbe *probe) {
+  if (probe->epoch != cc_probe_epoch) {
+    probe->epoch = cc_probe_epoch;
+    probe->misses = 0;
+  }
+  return probe->misses < BEAN_CC_PROBE_ATTEMPTS;
+}
+
+void bean_cc_probe_result(BeanCcProbe *probe, bool answered) {
+  if (answered) {
+    probe->misses = 0;
+  } else if (probe->misses < BEAN_CC_PROBE_ATTEMPTS) {
+    probe->misses++;
+  }
+}
+
+void bean_cc_probes_reset(void) {
+  cc_probe_epoch++;
+}
+
+void bean_cc_push_enable(BeanCcPush *push,
+                         int (BeanSerialTransport::*enable)(uint8_t),
+                         uint8_t mask) {
+  if (!bean_cc_probe_open(&push->probe)) {
+    return;
+  }
+  bool answered = (Serial.*enable)(mask) == 0;
+  // a CC already pushing takes the message, so its timeouts prove nothing
+  if (answered || !push->on) {
+    bean_cc_probe_result(&push->probe, answered);
+  }
+  if (answered) {
+    push->on = mask != 0;
+  }
+}
+
 /////////
 /// Radio
 /////////
 
+// The radio config setters below change a shadow copy of the CC's
+// BT_RADIOCONFIG_T.  Outside a radioConfigBegin()/radioConfigCommit()
+// transaction each one fetches the config and writes it back, only if it
+// changed; inside one the config is fetched by the first setter and written
+// once, by the commit, so a batch of changes costs one round trip and at most
+// one save to the CC's flash.
+static BT_RADIOCONFIG_T radio_config;
+static size_t radio_config_size;
+static bool radio_config_valid = false;
+static uint8_t radio_config_depth = 0;
+static bool radio_config_dirty = false;
+static bool radio_config_lost = false;
+// A setter that changed nothing still writes if config save is on and an
+// earlier write left the config unsaved, so the save isn't skipped.
+static bool radio_config_unsaved = false;
+
+BT_RADIOCONFIG_T *BeanSerialTransport::radioConfigFetch(void) {
+  if (radio_config_depth == 0 || !radio_config_valid) {
+    radio_config_size = sizeof(radio_config);
+    radio_config_valid =
+        call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0,
+                          (uint8_t *)&radio_config, &radio_config_size) == 0;
+  }
+  if (!radio_config_valid) {
+    radio_config_lost = true;
+    return NULL;
+  }
+  return &radio_config;
+}
+
+void BeanSerialTransport::radioConfigChanged(bool changed) {
+  if (!changed && !(m_enableSave && radio_config_unsaved)) {
+    return;
+  }
+  if (radio_config_depth > 0) {
+    radio_config_dirty = true;
+    return;
+  }
+  uint16_t msgId =
+      (m_enableSave ? MSG_ID_BT_SET_CONFIG : MSG_ID_BT_SET_CONFIG_NOSAVE);
+  write_message(msgId, (const uint8_t *)&radio_config, radio_config_size);
+  radio_config_unsaved = !m_enableSave;
+}
+
+void BeanSerialTransport::radioConfigBegin(void) {
+  if (radio_config_depth++ == 0) {
+    radio_config_valid = false;
+    radio_config_dirty = false;
+    radio_config_lost = false;
+  }
+}
+
+bool BeanSerialTransport::radioConfigCommit(void) {
+  if (radio_config_depth == 0 || --radio_config_depth > 0) {
+    return true;
+  }
+  if (radio_config_dirty) {
+    radio_config_dirty = false;
+    radioConfigChanged(true);
+  }
+  return !radio_config_lost;
+}
+
 void BeanSerialTransport::BTSetAdvertisingOnOff(const bool setting,
                                                 uint32_t timer) {
   BT_ADV_ONOFF_T advOnOff;
@@ -478,26 +2375,30 @@ void BeanSerialTransport::BTSetAdvertisingOnOff(const bool setting,
 
 void BeanSerialTransport::BTSetLocalName(const char *name) {
   if (name == NULL) name = "";
+  BTSetLocalName(name, strlen(name), false);
+}
 
-  size_t length = strlen(name);
+void BeanSerialTransport::BTSetLocalName(const char *name, size_t length,
+                                         bool progmem) {
   if (length > 20) {
     length = 20;
   }
 
-  BT_RADIOCONFIG_T radioConfig;
-  size_t size = sizeof(BT_RADIOCONFIG_T);
-  int response = call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0,
-                                   (uint8_t *)&radioConfig, &size);
-
-  if (0 == response) {
-    memcpy((void *)radioConfig.local_name, (void *)name, length);
-    radioConfig.local_name_size = length;
-
-    uint16_t msgId =
-        (m_enableSave ? MSG_ID_BT_SET_CONFIG : MSG_ID_BT_SET_CONFIG_NOSAVE);
+  BT_RADIOCONFIG_T *config = radioConfigFetch();
+  if (config == NULL) {
+    return;
+  }
 
-    write_message(msgId, (const uint8_t *)&radioConfig, size);
+  int differs = progmem ? memcmp_P(config->local_name, name, length)
+                        : memcmp(config->local_name, name, length);
+  bool changed = differs != 0 || config->local_name_size != length;
+  if (progmem) {
+    memcpy_P((void *)config->local_name, name, length);
+  } else {
+    memcpy((void *)config->local_name, (void *)name, length);
   }
+  config->local_name_size = length;
+  radioConfigChanged(changed);
 }
 
 int BeanSerialTransport::BTGetStates(BT_STATES_T *btStates) {
@@ -506,12 +2407,55 @@ int BeanSerialTransport::BTGetStates(BT_STATES_T *btStates) {
                            (uint8_t *)btStates, &length);
 }
 
+// MSG_ID_BT_STATES_NOTIFY body: 1 to push state changes, 0 to stop.  The CC
+// acks it with the current BT_STATES_T, so the pushed states start out right.
+int BeanSerialTransport::BTStatesNotifyEnable(bool enable) {
+  uint8_t body = enable ? 1 : 0;
+  BT_STATES_T current;
+  size_t size = sizeof(current);
+
+  rx_routes_init();
+  if (call_and_response(MSG_ID_BT_STATES_NOTIFY, &body, sizeof(body),
+                        (uint8_t *)&current, &size) != 0) {
+    return -1;
+  }
+  if (enable && size != sizeof(current) && BTGetStates(&current) != 0) {
+    return -1;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  bt_states_store(&current);
+  bt_state_events = 0;
+  SREG = oldSREG;
+  return 0;
+}
+
+void BeanSerialTransport::BTPushedStates(BT_STATES_T *btStates) {
+  uint8_t oldSREG = SREG;
+  cli();
+  *btStates = bt_states;
+  SREG = oldSREG;
+}
+
+uint8_t BeanSerialTransport::BTStateEventsTake(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t events = bt_state_events;
+  bt_state_events = 0;
+  SREG = oldSREG;
+  return events;
+}
+
 void BeanSerialTransport::BTSetPairingPin(const uint32_t pin) {
-  uint8_t msg[6] = {0};
-  memcpy(msg, (void *)&pin, sizeof(pin));
-  msg[4] = 0x01;    // 4th byte is the enable/disable for the pairing pin
-  msg[5] = m_enableSave ? 1 : 0;  // 5th byte is for persistent memory
-  write_message(MSG_ID_BT_SET_PIN, (const uint8_t *)msg, sizeof(msg));
+  uint8_t enable = 0x01;  // 4th byte is the enable/disable for the pairing pin
+  uint8_t save = m_enableSave ? 1 : 0;  // 5th byte is for persistent memory
+  BeanTxSegment msg[] = {
+      {&pin, sizeof(pin), false},
+      {&enable, 1, false},
+      {&save, 1, false},
+  };
+  write_message_v(MSG_ID_BT_SET_PIN, msg, 3);
 }
 
 void BeanSerialTransport::BTEnablePairingPin(bool enable) {
@@ -528,18 +2472,11 @@ void BeanSerialTransport::BTSetAdvertisingInterval(uint16_t interval_ms) {
     interval_ms = BEAN_MAX_ADVERTISING_INT_MS;
   }
 
-  BT_RADIOCONFIG_T radioConfig;
-  size_t size = sizeof(BT_RADIOCONFIG_T);
-  int response = call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0,
-                                   (uint8_t *)&radioConfig, &size);
-
-  if (0 == response) {
-    radioConfig.adv_int = (uint16_t)interval_ms;
-
-    uint16_t msgId =
-        (m_enableSave ? MSG_ID_BT_SET_CONFIG : MSG_ID_BT_SET_CONFIG_NOSAVE);
-
-    write_message(msgId, (const uint8_t *)&radioConfig, size);
+  BT_RADIOCONFIG_T *config = radioConfigFetch();
+  if (config != NULL) {
+    bool changed = config->adv_int != interval_ms;
+    config->adv_int = interval_ms;
+    radioConfigChanged(changed);
   }
 }
 
@@ -571,43 +2508,203 @@ int BeanSerialTransport::BTGetScratchChar(uint8_t scratchNum,
   return rtnVal;
 }
 
+// MSG_ID_BT_SET_SCRATCH_MULTI carries [bank][length][data] for each bank, as
+// many as fit in one body, and is acked with an empty reply.  For
+// MSG_ID_BT_GET_SCRATCH_MULTI the body is the bank mask and the reply is
+// [bank][length][data] for each bank asked for.  A call that isn't answered
+// falls back to one bank per message, and a CC that misses either
+// BEAN_CC_PROBE_ATTEMPTS times in a row isn't asked again until it restarts.
+#define SCRATCH_ENTRY_MAX (2 + 20)
+
+static BeanCcProbe scratch_set_multi_probe;
+static BeanCcProbe scratch_get_multi_probe;
+
+uint8_t BeanSerialTransport::BTSetScratchChars(const ScratchData *banks,
+                                               uint8_t mask) {
+  uint8_t written = 0;
+  uint8_t bank = 0;
+  bool multi = bean_cc_probe_open(&scratch_set_multi_probe);
+
+  while (multi && bank < BEAN_SCRATCH_BANKS) {
+    uint8_t payload[MAX_BODY_LENGTH];
+    size_t length = 0;
+    uint8_t packed = 0;
+
+    for (; bank < BEAN_SCRATCH_BANKS; bank++) {
+      const ScratchData *entry = &banks[bank];
+      if (!(mask & (1 << bank)) || entry->length > sizeof(entry->data)) {
+        continue;
+      }
+      if (length + 2 + entry->length > sizeof(payload)) {
+        break;
+      }
+      payload[length++] = bank + 1;
+      payload[length++] = entry->length;
+      memcpy(&payload[length], entry->data, entry->length);
+      length += entry->length;
+      packed |= 1 << bank;
+    }
+
+    if (packed == 0) {
+      break;
+    }
+    size_t size = 0;
+    multi = call_and_response(MSG_ID_BT_SET_SCRATCH_MULTI, payload, length,
+                              NULL, &size) == 0;
+    bean_cc_probe_result(&scratch_set_multi_probe, multi);
+    if (!multi) {
+      // nothing from this message is known to have landed; resend it below
+      break;
+    }
+    written |= packed;
+  }
+
+  for (bank = 0; bank < BEAN_SCRATCH_BANKS; bank++) {
+    const ScratchData *entry = &banks[bank];
+    if (!(mask & (1 << bank)) || (written & (1 << bank)) ||
+        entry->length > sizeof(entry->data)) {
+      continue;
+    }
+    BT_SCRATCH_T scratch;
+    scratch.number = bank + 1;
+    memcpy(scratch.scratch, entry->data, entry->length);
+    BTSetScratchChar(&scratch, entry->length + 1);
+    written |= 1 << bank;
+  }
+
+  return written;
+}
+
+uint8_t BeanSerialTransport::BTGetScratchChars(ScratchData *banks,
+                                               uint8_t mask) {
+  uint8_t read = 0;
+  mask &= (1 << BEAN_SCRATCH_BANKS) - 1;
+  bool multi = bean_cc_probe_open(&scratch_get_multi_probe);
+
+  while (multi && (mask & ~read)) {
+    // ask for as many banks as a full reply has room for
+    uint8_t request = 0;
+    uint8_t count = 0;
+    for (uint8_t bank = 0; bank < BEAN_SCRATCH_BANKS; bank++) {
+      if ((mask & ~read & (1 << bank)) &&
+          (count + 1) * SCRATCH_ENTRY_MAX <= MAX_BODY_LENGTH) {
+        request |= 1 << bank;
+        count++;
+      }
+    }
+
+    uint8_t response[MAX_BODY_LENGTH];
+    size_t size = sizeof(response);
+    multi = call_and_response(MSG_ID_BT_GET_SCRATCH_MULTI, &request, 1,
+                              response, &size) == 0;
+    bean_cc_probe_result(&scratch_get_multi_probe, multi);
+    if (!multi) {
+      break;
+    }
+
+    size_t i = 0;
+    while (i + 2 <= size) {
+      uint8_t bank = response[i] - 1;
+      uint8_t length = response[i + 1];
+      if (bank >= BEAN_SCRATCH_BANKS || length > sizeof(banks->data) ||
+          i + 2 + length > size) {
+        break;
+      }
+      banks[bank].length = length;
+      memcpy(banks[bank].data, &response[i + 2], length);
+      read |= (1 << bank) & request;
+      i += 2 + length;
+    }
+    if ((read & request) != request) {
+      // a short reply; don't ask again for banks it left out
+      mask &= ~(request & ~read);
+    }
+  }
+
+  if (!multi) {
+    for (uint8_t bank = 0; bank < BEAN_SCRATCH_BANKS; bank++) {
+      if ((mask & ~read & (1 << bank)) &&
+          BTGetScratchChar(bank + 1, &banks[bank]) == 0) {
+        read |= 1 << bank;
+      }
+    }
+  }
+
+  return read;
+}
+
+// MSG_ID_BT_SCRATCH_NOTIFY body: the mask of banks to push writes for.  The
+// CC acks it with an empty reply; no reply means it can't push them.
+int BeanSerialTransport::scratchNotifyEnable(uint8_t mask) {
+  if (mask != 0 && scratch_write_queue == NULL) {
+    scratch_write_queue = (ScratchWrite *)malloc(
+        BEAN_SCRATCH_WRITE_QUEUE_SIZE * sizeof(ScratchWrite));
+    if (scratch_write_queue == NULL) {
+      return -1;
+    }
+    rx_routes_init();
+    if (!rx_route_add(MSG_ID_BT_SCRATCH_WRITTEN, NULL,
+                      scratch_write_rx_handler)) {
+      return -1;
+    }
+  }
+
+  size_t size = 0;
+  return call_and_response(MSG_ID_BT_SCRATCH_NOTIFY, &mask, sizeof(mask),
+                           NULL, &size);
+}
+
+bool BeanSerialTransport::readScratchWrite(uint8_t *bank, ScratchData *data) {
+  uint8_t tail = scratch_write_tail;
+  if (scratch_write_head == tail) {
+    return false;
+  }
+  ScratchWrite *entry =
+      &scratch_write_queue[tail & (BEAN_SCRATCH_WRITE_QUEUE_SIZE - 1)];
+  *bank = entry->bank;
+  *data = entry->data;
+  scratch_write_tail = tail + 1;
+  return true;
+}
+
+bool BeanSerialTransport::scratchWritesLost(void) {
+  bool lost = scratch_writes_lost;
+  scratch_writes_lost = false;
+  return lost;
+}
+
 int BeanSerialTransport::BTGetConfig(BT_RADIOCONFIG_T *config) {
+  // inside a transaction, what it will write
+  if (radio_config_depth > 0 && radio_config_valid) {
+    *config = radio_config;
+    return 0;
+  }
   size_t size = sizeof(BT_RADIOCONFIG_T);
   return call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0, (uint8_t *)config,
                            &size);
 }
 
 void BeanSerialTransport::BTBeaconModeEnable(bool beaconEnable) {
-  BT_RADIOCONFIG_T radioConfig;
-  size_t size = sizeof(BT_RADIOCONFIG_T);
-  int response = call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0,
-                                   (uint8_t *)&radioConfig, &size);
-
-  if (0 == response) {
-    radioConfig.adv_mode = (beaconEnable ? ADV_IBEACON : ADV_STANDARD);
-    uint16_t msgId =
-        (m_enableSave ? MSG_ID_BT_SET_CONFIG : MSG_ID_BT_SET_CONFIG_NOSAVE);
-
-    write_message(msgId, (const uint8_t *)&radioConfig, size);
+  uint8_t mode = beaconEnable ? ADV_IBEACON : ADV_STANDARD;
+  BT_RADIOCONFIG_T *config = radioConfigFetch();
+  if (config != NULL) {
+    bool changed = config->adv_mode != mode;
+    config->adv_mode = mode;
+    radioConfigChanged(changed);
   }
 }
 
 void BeanSerialTransport::BTSetBeaconParams(uint16_t uuid, uint16_t majorid,
                                             uint16_t minorid) {
-  BT_RADIOCONFIG_T radioConfig;
-  size_t size = sizeof(BT_RADIOCONFIG_T);
-  int response = call_and_response(MSG_ID_BT_GET_CONFIG, NULL, 0,
-                                   (uint8_t *)&radioConfig, &size);
-
-  if (0 == response) {
-    radioConfig.ibeacon_uuid = uuid;
-    radioConfig.ibeacon_major = majorid;
-    radioConfig.ibeacon_minor = minorid;
-
-    uint16_t msgId =
-        (m_enableSave ? MSG_ID_BT_SET_CONFIG : MSG_ID_BT_SET_CONFIG_NOSAVE);
-
-    write_message(msgId, (const uint8_t *)&radioConfig, size);
+  BT_RADIOCONFIG_T *config = radioConfigFetch();
+  if (config != NULL) {
+    bool changed = config->ibeacon_uuid != uuid ||
+                   config->ibeacon_major != majorid ||
+                   config->ibeacon_minor != minorid;
+    config->ibeacon_uuid = uuid;
+    config->ibeacon_major = majorid;
+    config->ibeacon_minor = minorid;
+    radioConfigChanged(changed);
   }
 }
 
@@ -630,6 +2727,11 @@ int BeanSerialTransport::ledRead(LED_SETTING_T *reading) {
                            &size);
 }
 
+int BeanSerialTransport::ledAnimate(const uint8_t *body, size_t length) {
+  size_t size = 0;
+  return call_and_response(MSG_ID_CC_LED_ANIMATE, body, length, NULL, &size);
+}
+
 //////
 /// GATT manager
 //////
@@ -649,10 +2751,12 @@ int BeanSerialTransport::setCustomAdvertisement(uint8_t *buf, int len) {
   if (len > 31) {
     return -1;
   }
-  uint8_t sendBuf[32];
-  sendBuf[0] = len;
-  memcpy((void *)&sendBuf[1], buf, len);
-  write_message(MSG_ID_GATT_SET_CUSTOM, sendBuf, len + 1);
+  uint8_t length = len;
+  BeanTxSegment msg[] = {
+      {&length, 1, false},
+      {buf, length, false},
+  };
+  write_message_v(MSG_ID_GATT_SET_CUSTOM, msg, 2);
   return 0;
 }
 
@@ -660,26 +2764,31 @@ int BeanSerialTransport::setCustomAdvertisement(uint8_t *buf, int len) {
 /// MIDI
 ////////
 
-char BeanSerialTransport::peekMidi() {
-  return midi_buffer.buffer[midi_buffer.tail];
+bool BeanSerialTransport::midiRxBegin() {
+  if (midi_buffer.allocated()) {
+    return true;
+  }
+  if (!midi_buffer.begin()) {
+    return false;
+  }
+
+  rx_routes_init();
+  return rx_route_add(MSG_ID_MIDI_READ, NULL, midi_rx_handler);
+}
+int BeanSerialTransport::peekMidi(uint8_t n) {
+  midiRxBegin();
+  return midi_buffer.peek(n);
+}
+void BeanSerialTransport::skipMidi(uint8_t n) {
+  midi_buffer.skip(min(n, midi_buffer.available()));
 }
 size_t BeanSerialTransport::midiAvailable() {
-  if (midi_buffer.head == midi_buffer.tail) return 0;
-  if (midi_buffer.head > midi_buffer.tail)
-    return midi_buffer.head - midi_buffer.tail;
-  else
-    return midi_buffer.head + (SERIAL_BUFFER_SIZE - midi_buffer.tail);
+  midiRxBegin();
+  return midi_buffer.available();
 }
 size_t BeanSerialTransport::readMidi(uint8_t *buffer, size_t max_length) {
-  size_t bytes_written = 0;
-  while (midi_buffer.tail != midi_buffer.head) {
-    if (bytes_written >= max_length) break;
-    buffer[bytes_written] = midi_buffer.buffer[midi_buffer.tail];
-    midi_buffer.tail++;
-    midi_buffer.tail %= SERIAL_BUFFER_SIZE;
-    bytes_written++;
-  }
-  return bytes_written;
+  midiRxBegin();
+  return midi_buffer.read(buffer, min(max_length, 255));
 }
 
 void BeanSerialTransport::midiSend(uint8_t status, uint8_t byte1,
@@ -695,106 +2804,293 @@ void BeanSerialTransport::midiSend(uint8_t status, uint8_t byte1,
 // ANCS
 ////////
 
+bool BeanSerialTransport::ancsRxBegin() {
+  if (ancs_buffer.allocated()) {
+    return true;
+  }
+  if (!ancs_buffer.begin()) {
+    return false;
+  }
+
+  rx_routes_init();
+  return rx_route_add(MSG_ID_ANCS_READ, NULL, ancs_rx_handler);
+}
+
 int BeanSerialTransport::ancsAvailable() {
-  if (ancs_buffer.head == ancs_buffer.tail) return 0;
-  if (ancs_buffer.head > ancs_buffer.tail)
-    return (ancs_buffer.head - ancs_buffer.tail) / 8;
-  else
-    return (ancs_buffer.head + (SERIAL_BUFFER_SIZE - ancs_buffer.tail)) / 8;
+  ancsRxBegin();
+  return ancs_buffer.available() / ANCS_RECORD_SIZE;
 }
 
 int BeanSerialTransport::readAncs(uint8_t *buffer, size_t max_length) {
-  size_t bytes_written = 0;
-  while (ancs_buffer.tail != ancs_buffer.head) {
-    if (bytes_written >= max_length) break;
-    buffer[bytes_written] = ancs_buffer.buffer[ancs_buffer.tail];
-    ancs_buffer.tail++;
-    ancs_buffer.tail %= SERIAL_BUFFER_SIZE;
-    bytes_written++;
-  }
-  return bytes_written;
+  ancsRxBegin();
+  return ancs_buffer.read(buffer, min(max_length, 255));
 }
 
 int BeanSerialTransport::getAncsNotiDetails(uint8_t *buffer, size_t length,
                                                   uint8_t *data, uint32_t timeout) {
-  ancs_message_buffer.head = ancs_message_buffer.tail;  //  clear buffer
-  write_message(MSG_ID_ANCS_GET_NOTI, (const uint8_t *)buffer, length);
-  uint32_t startMillis = millis();
+  BeanTxSegment request = {buffer, (uint8_t)length, false};
+  return getAncsNotiDetails(&request, 1, data, timeout);
+}
+
+bool BeanSerialTransport::ancsNotiBegin(const BeanTxSegment *request,
+                                        uint8_t count, uint8_t *data,
+                                        uint16_t capacity) {
+  if (!ancs_message_buffer.allocated()) {
+    if (!ancs_message_buffer.begin()) {
+      return false;
+    }
+    rx_routes_init();
+    if (!rx_route_add(MSG_ID_ANCS_GET_NOTI, NULL, ancs_noti_rx_handler)) {
+      return false;
+    }
+  }
+
+  // the header the answer must start with, from the request's first bytes
+  uint8_t expected[ANCS_NOTI_MATCH_SIZE];
+  uint8_t matched = 0;
+  for (uint8_t i = 0; i < count && matched < ANCS_NOTI_MATCH_SIZE; i++) {
+    const uint8_t *bytes = (const uint8_t *)request[i].data;
+    for (uint8_t j = 0;
+         j < request[i].length && matched < ANCS_NOTI_MATCH_SIZE; j++) {
+      expected[matched++] =
+          request[i].progmem ? pgm_read_byte(bytes + j) : bytes[j];
+    }
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  memcpy(ancs_noti_expected, expected, matched);
+  ancs_noti_match = matched == ANCS_NOTI_MATCH_SIZE;
+  ancs_noti_discard = false;
+  ancs_noti_header_length = 0;
+  ancs_noti_remaining = 0;
+  ancs_noti_sink = data;
+  ancs_noti_sink_capacity = data ? capacity : 0;
+  ancs_noti_sink_length = 0;
+  ancs_message_buffer.clear();
+  // a frame arriving now belongs to the old request
+  ancs_noti_rx_header_length = 0;
+  ancs_noti_rx_remaining = 0;
+  ancs_noti_rx_sink_length = 0;
+  ancs_noti_rx_staged = 0;
+  SREG = oldSREG;
+
+  write_message_v(MSG_ID_ANCS_GET_NOTI, request, count);
+  return true;
+}
+
+int32_t BeanSerialTransport::ancsNotiRemaining() {
+  uint8_t oldSREG = SREG;
+  cli();
+  int32_t remaining = ancs_noti_header_length < ANCS_NOTI_HEADER_SIZE
+                      ? -1
+                      : (int32_t)ancs_noti_remaining;
+  SREG = oldSREG;
+  return remaining;
+}
+
+uint16_t BeanSerialTransport::ancsNotiSinkLength() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t length = ancs_noti_sink_length;
+  SREG = oldSREG;
+  return length;
+}
+
+int BeanSerialTransport::getAncsNotiDetails(const BeanTxSegment *request,
+                                            uint8_t count, uint8_t *data,
+                                            uint32_t timeout,
+                                            uint16_t capacity) {
+  if (!ancsNotiBegin(request, count, data, capacity)) {
+    return 0;
+  }
 
-  do {
-    if ((millis() - startMillis > timeout)) return 0;
-  } while (ancsNotiDetailsAvailable() < 8);  //  block until we have length bytes
-  uint8_t buf[8];
-  readAncsMessage(buf, 8);
-  uint16_t incomingMsgLen = buf[6] | (buf[7] << 8);
+  uint32_t startMillis = millis();
+  while (ancsNotiRemaining() != 0) {
+    if ((millis() - startMillis > timeout)) {
+      break;
+    }
+    bean_idle();
+  }
 
-  uint16_t bytesRead = 0;
-  do {
-    //  add bytes to buffer as they come in, this allows very large data arrays
-    bytesRead += readAncsMessage((uint8_t *)&data[bytesRead], incomingMsgLen);
-    if ((millis() - startMillis > timeout)) return bytesRead;
-  } while (bytesRead < incomingMsgLen);
+  // stop filling data, which may go out of scope once we return
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t bytesRead = ancs_noti_sink_length;
+  ancs_noti_sink = NULL;
+  ancs_noti_remaining = 0;
+  ancs_noti_rx_remaining = 0;
+  SREG = oldSREG;
 
   return bytesRead;
 }
 
 int BeanSerialTransport::ancsNotiDetailsAvailable() {
-  if (ancs_message_buffer.head == ancs_message_buffer.tail) return 0;
-  if (ancs_message_buffer.head > ancs_message_buffer.tail)
-    return (ancs_message_buffer.head - ancs_message_buffer.tail);
-  else
-    return (ancs_message_buffer.head +
-            (SERIAL_BUFFER_SIZE - ancs_message_buffer.tail));
+  return ancs_message_buffer.available();
 }
 
 int BeanSerialTransport::readAncsMessage(uint8_t *buffer, size_t max_length) {
-  size_t bytes_written = 0;
-  while (ancs_message_buffer.tail != ancs_message_buffer.head) {
-    if (bytes_written >= max_length) break;
-    buffer[bytes_written] =
-        ancs_message_buffer.buffer[ancs_message_buffer.tail];
-    ancs_message_buffer.tail++;
-    ancs_message_buffer.tail %= SERIAL_BUFFER_SIZE;
-    bytes_written++;
+  return ancs_message_buffer.read(buffer, min(max_length, 255));
+}
+
+// MSG_ID_ANCS_FILTER body: [categories lo][categories hi][events][flagsSet]
+// [flagsClear][appId length][appId].  The CC acks it with an empty reply.
+int BeanSerialTransport::ancsFilter(const BEAN_ANCS_FILTER_T *filter) {
+  BEAN_ANCS_FILTER_T checked = *filter;
+  if (checked.appIdLength > BEAN_ANCS_MAX_APP_ID) {
+    checked.appIdLength = BEAN_ANCS_MAX_APP_ID;
+  }
+
+  bool cc_filters = false;
+  if (bean_cc_probe_open(&ancs_filter_probe)) {
+    uint8_t payload[6 + BEAN_ANCS_MAX_APP_ID];
+    size_t length = 0;
+    payload[length++] = (uint8_t)(checked.categories & 0xFF);
+    payload[length++] = (uint8_t)(checked.categories >> 8);
+    payload[length++] = checked.events;
+    payload[length++] = checked.flagsSet;
+    payload[length++] = checked.flagsClear;
+    payload[length++] = checked.appIdLength;
+    memcpy(&payload[length], checked.appId, checked.appIdLength);
+    length += checked.appIdLength;
+
+    size_t size = 0;
+    cc_filters = call_and_response(MSG_ID_ANCS_FILTER, payload, length, NULL,
+                                   &size) == 0;
+    bean_cc_probe_result(&ancs_filter_probe, cc_filters);
   }
-  return bytes_written;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  ancs_filter = checked;
+  ancs_filter_local = !cc_filters;
+  SREG = oldSREG;
+
+  return cc_filters ? 0 : 1;
 }
 
 ///////
 // Observer
 ///////
+static bool observer_begin(void) {
+  if (observer_queue != NULL) {
+    return true;
+  }
+  observer_queue = (OBSERVER_INFO_MESSAGE_T *)malloc(
+      BEAN_OBSERVER_QUEUE_SIZE * sizeof(OBSERVER_INFO_MESSAGE_T));
+  if (observer_queue == NULL) {
+    return false;
+  }
+
+  rx_routes_init();
+  return rx_route_add(MSG_ID_OBSERVER_READ, NULL, observer_rx_handler);
+}
+
 int BeanSerialTransport::getObserverMessage(OBSERVER_INFO_MESSAGE_T *message,
                                             unsigned long timeout) {
-  // Begin observing
-  write_message(MSG_ID_OBSERVER_START, NULL, 0);
-
-  // Wait for Observed ADV if Any
   memset(message, 0, sizeof(OBSERVER_INFO_MESSAGE_T));
 
+  if (!observer_begin()) {
+    return -1;
+  }
+
+  // Outside a scan, observe just long enough for one advertisement, and
+  // drop any the user missed last time.
+  bool one_shot = !observer_scanning;
+  if (one_shot) {
+    observer_tail = observer_head;
+    write_message(MSG_ID_OBSERVER_START, NULL, 0);
+  }
+
   unsigned long startMillis = millis();
-  do {
-    if ((millis() - startMillis > timeout)) {
-      write_message(MSG_ID_OBSERVER_STOP, NULL, 0);
-      return -1;
-    }
-  } while (observer_message_sending == false &&
-           abs(observer_message.head - observer_message.tail) ==
-               0);  // block until advertisement is observed
-  do {
+  while (observer_head == observer_tail) {
     if ((millis() - startMillis > timeout)) {
-      write_message(MSG_ID_OBSERVER_STOP, NULL, 0);
-      return -1;
+      break;
     }
-  } while (observer_message_sending == true);  // block until data is sent
+    bean_idle();
+  }
 
-  observer_message.head = observer_message.tail = 0;
+  if (one_shot) {
+    write_message(MSG_ID_OBSERVER_STOP, NULL, 0);
+  }
+  return readObserverMessage(message) ? 1 : -1;
+}
 
-  // copy the message body into out
-  memcpy(message, observer_message.buffer,
-         min(observer_msg_len, sizeof(OBSERVER_INFO_MESSAGE_T)));
-  // Stop Observing
-  write_message(MSG_ID_OBSERVER_STOP, NULL, 0);
-  return 1;
+bool BeanSerialTransport::observerStart(void) {
+  if (!observer_begin()) {
+    return false;
+  }
+  if (!observer_scanning) {
+    observer_scanning = true;
+    write_message(MSG_ID_OBSERVER_START, NULL, 0);
+  }
+  return true;
+}
+
+void BeanSerialTransport::observerStop(void) {
+  if (observer_scanning) {
+    observer_scanning = false;
+    write_message(MSG_ID_OBSERVER_STOP, NULL, 0);
+  }
+}
+
+uint8_t BeanSerialTransport::observerAvailable(void) {
+  return (uint8_t)(observer_head - observer_tail);
+}
+
+bool BeanSerialTransport::readObserverMessage(
+    OBSERVER_INFO_MESSAGE_T *message) {
+  uint8_t tail = observer_tail;
+  if (observer_head == tail) {
+    return false;
+  }
+  memcpy(message, &observer_queue[tail & (BEAN_OBSERVER_QUEUE_SIZE - 1)],
+         sizeof(OBSERVER_INFO_MESSAGE_T));
+  observer_tail = tail + 1;
+  return true;
+}
+
+// MSG_ID_OBSERVER_FILTER body: [minRssi][dedupeMs lo][dedupeMs hi]
+// [addressCount][addresses, 6 bytes each][prefix length][prefix].  The CC
+// acks it with an empty reply.
+int BeanSerialTransport::observerFilter(const BEAN_OBSERVER_FILTER_T *filter) {
+  BEAN_OBSERVER_FILTER_T checked = *filter;
+  if (checked.addressCount > BEAN_OBSERVER_MAX_ADDRESSES) {
+    checked.addressCount = BEAN_OBSERVER_MAX_ADDRESSES;
+  }
+  if (checked.manufacturerPrefixLength > BEAN_OBSERVER_MAX_PREFIX) {
+    checked.manufacturerPrefixLength = BEAN_OBSERVER_MAX_PREFIX;
+  }
+
+  bool cc_filters = false;
+  if (bean_cc_probe_open(&observer_filter_probe)) {
+    uint8_t payload[5 + sizeof(checked.addresses) + BEAN_OBSERVER_MAX_PREFIX];
+    size_t length = 0;
+    payload[length++] = (uint8_t)checked.minRssi;
+    payload[length++] = (uint8_t)(checked.dedupeMs & 0xFF);
+    payload[length++] = (uint8_t)(checked.dedupeMs >> 8);
+    payload[length++] = checked.addressCount;
+    memcpy(&payload[length], checked.addresses, 6 * checked.addressCount);
+    length += 6 * checked.addressCount;
+    payload[length++] = checked.manufacturerPrefixLength;
+    memcpy(&payload[length], checked.manufacturerPrefix,
+           checked.manufacturerPrefixLength);
+    length += checked.manufacturerPrefixLength;
+
+    size_t size = 0;
+    cc_filters = call_and_response(MSG_ID_OBSERVER_FILTER, payload, length,
+                                   NULL, &size) == 0;
+    bean_cc_probe_result(&observer_filter_probe, cc_filters);
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  observer_filter = checked;
+  observer_filter_local = !cc_filters;
+  memset(observer_seen, 0, sizeof(observer_seen));
+  SREG = oldSREG;
+
+  return cc_filters ? 0 : 1;
 }
 
 ////////
@@ -820,7 +3116,7 @@ void BeanSerialTransport::accelRangeSet(uint8_t range) {
 
 int BeanSerialTransport::accelRegisterRead(uint8_t reg, uint8_t length,
                                            uint8_t *value) {
-  size_t size = sizeof(uint8_t);
+  size_t size = length;
   uint8_t payload[2];
   payload[0] = reg;
   payload[1] = length;
@@ -836,6 +3132,194 @@ void BeanSerialTransport::accelRegisterWrite(uint8_t reg, uint8_t value) {
                 sizeof(payload));
 }
 
+// MSG_ID_CC_ACCEL_TRANSACTION carries two bytes per op, [reg][value] for a
+// write and [reg | ACCEL_OP_READ][length] for a read; the BMA250 has no
+// registers above 0x3F.  The reply is the bytes read, in op order.  A CC that
+// doesn't answer it gets the ops one message at a time, see BeanCcProbe.
+#define ACCEL_OP_READ (0x80)
+
+static BeanCcProbe accel_transaction_probe;
+
+int BeanSerialTransport::accelTransaction(const BeanAccelOp *ops,
+                                          uint8_t count) {
+  uint8_t payload[MAX_BODY_LENGTH];
+  uint8_t response[MAX_BODY_LENGTH];
+  size_t payload_length = 0;
+  size_t read_length = 0;
+
+  if (count > MAX_BODY_LENGTH / 2) {
+    return -1;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (ops[i].length > 0) {
+      payload[payload_length++] = ops[i].reg | ACCEL_OP_READ;
+      payload[payload_length++] = ops[i].length;
+      read_length += ops[i].length;
+    } else {
+      payload[payload_length++] = ops[i].reg;
+      payload[payload_length++] = ops[i].value;
+    }
+  }
+
+  if (read_length > sizeof(response)) {
+    return -1;
+  }
+
+  if (bean_cc_probe_open(&accel_transaction_probe)) {
+    size_t response_length = sizeof(response);
+    bool answered =
+        call_and_response(MSG_ID_CC_ACCEL_TRANSACTION, payload, payload_length,
+                          response, &response_length) == 0;
+    bean_cc_probe_result(&accel_transaction_probe, answered);
+    if (answered && response_length == read_length) {
+      const uint8_t *next = response;
+      for (uint8_t i = 0; i < count; i++) {
+        if (ops[i].length > 0) {
+          memcpy(ops[i].data, next, ops[i].length);
+          next += ops[i].length;
+        }
+      }
+      return 0;
+    }
+  }
+
+  int rc = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (ops[i].length > 0) {
+      if (accelRegisterRead(ops[i].reg, ops[i].length, ops[i].data) != 0) {
+        rc = -1;
+      }
+    } else {
+      accelRegisterWrite(ops[i].reg, ops[i].value);
+    }
+  }
+  return rc;
+}
+
+// MSG_ID_CC_ACCEL_EVENT_ENABLE asks the CC to send MSG_ID_CC_ACCEL_EVENT
+// whenever one of the events (a REG_INT_STATUS_X09 mask) fires, or to stop if
+// events is 0.  The CC acknowledges it with an empty reply; no reply means it
+// doesn't push events and the caller has to poll the BMA250.
+int BeanSerialTransport::accelEventsEnable(uint8_t events) {
+  size_t size = 0;
+  return call_and_response(MSG_ID_CC_ACCEL_EVENT_ENABLE, &events,
+                           sizeof(events), NULL, &size);
+}
+
+// Returns and clears the events pushed since the last call.
+uint8_t BeanSerialTransport::accelEventsTake(void) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t events = accel_events;
+  accel_events = 0;
+  SREG = oldSREG;
+  return events;
+}
+
+// MSG_ID_CC_ACCEL_STREAM asks the CC to push samples at rate_hz, batched
+// samples_per_message to a message (0 for as many as fit), or to stop when
+// rate_hz is 0.  Body: [rate_hz lo][rate_hz hi][samples_per_message].
+bool BeanSerialTransport::accelStreamBegin(uint16_t rate_hz,
+                                           uint8_t samples_per_message) {
+  if (rate_hz == 0) {
+    return false;
+  }
+  if (!accel_buffer.allocated()) {
+    if (!accel_buffer.begin()) {
+      return false;
+    }
+    rx_routes_init();
+    if (!rx_route_add(MSG_ID_CC_ACCEL_STREAM_DATA, NULL, accel_rx_handler)) {
+      return false;
+    }
+  }
+
+  accel_stream_period_us = 1000000UL / rate_hz > 0xFFFF
+                               ? 0xFFFF
+                               : (uint16_t)(1000000UL / rate_hz);
+  uint8_t payload[3];
+  payload[0] = (uint8_t)(rate_hz & 0xFF);
+  payload[1] = (uint8_t)(rate_hz >> 8);
+  payload[2] = samples_per_message;
+  write_message(MSG_ID_CC_ACCEL_STREAM, payload, sizeof(payload));
+  return true;
+}
+
+void BeanSerialTransport::accelStreamEnd(void) {
+  uint8_t payload[3] = {0, 0, 0};
+  write_message(MSG_ID_CC_ACCEL_STREAM, payload, sizeof(payload));
+}
+
+// Reader state for the batch being drained.
+static uint8_t accel_batch_left = 0;
+static uint8_t accel_batch_range;
+static uint32_t accel_batch_millis;
+
+// Counts the samples that have fully arrived.
+uint8_t BeanSerialTransport::accelSamplesAvailable(void) {
+  uint8_t buffered = accel_buffer.available();
+  uint16_t offset = accel_batch_left * ACCEL_STREAM_SAMPLE_SIZE;
+
+  if (offset >= buffered) {
+    return buffered / ACCEL_STREAM_SAMPLE_SIZE;
+  }
+
+  uint8_t count = accel_batch_left;
+  while (offset + ACCEL_STREAM_HEADER_SIZE <= buffered) {
+    uint8_t batch = accel_buffer.peek(offset + 4);
+    uint16_t batch_end = offset + ACCEL_STREAM_HEADER_SIZE +
+                         batch * ACCEL_STREAM_SAMPLE_SIZE;
+    if (batch_end > buffered) {
+      count += (buffered - offset - ACCEL_STREAM_HEADER_SIZE) /
+               ACCEL_STREAM_SAMPLE_SIZE;
+      break;
+    }
+    count += batch;
+    offset = batch_end;
+  }
+  return count;
+}
+
+uint8_t BeanSerialTransport::readAccelSamples(BEAN_ACCEL_SAMPLE_T *samples,
+                                              uint8_t max_count) {
+  uint8_t count = 0;
+
+  while (count < max_count) {
+    if (accel_batch_left == 0) {
+      uint8_t header[ACCEL_STREAM_HEADER_SIZE];
+      if (accel_buffer.available() < ACCEL_STREAM_HEADER_SIZE) {
+        break;
+      }
+      accel_buffer.read(header, sizeof(header));
+      accel_batch_millis = (uint32_t)header[0] | (uint32_t)header[1] << 8 |
+                           (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+      accel_batch_left = header[4];
+      accel_batch_range = header[5];
+    }
+
+    // the rest of the batch may still be arriving
+    uint8_t raw[ACCEL_STREAM_SAMPLE_SIZE];
+    if (accel_buffer.available() < sizeof(raw)) {
+      break;
+    }
+    accel_buffer.read(raw, sizeof(raw));
+    accel_batch_left--;
+
+    BEAN_ACCEL_SAMPLE_T *sample = &samples[count++];
+    sample->xAxis = (int16_t)(raw[0] | raw[1] << 8);
+    sample->yAxis = (int16_t)(raw[2] | raw[3] << 8);
+    sample->zAxis = (int16_t)(raw[4] | raw[5] << 8);
+    sample->sensitivity = accel_batch_range;
+    // the last sample of a batch was taken just before it was sent
+    sample->timestamp =
+        accel_batch_millis -
+        ((uint32_t)accel_batch_left * accel_stream_period_us) / 1000;
+  }
+
+  return count;
+}
+
 // Bit zero is INT1 pin from Accelerometer, Bit one is INT2 pin from
 // Accelerometer (if available)
 void BeanSerialTransport::wakeOnAccel(uint8_t int_enable) {
@@ -872,6 +3356,24 @@ void BeanSerialTransport::sleep(uint32_t duration_ms) {
                 sizeof(duration_ms));
 }
 
+void BeanSerialTransport::wakeInfoClear(void) { wake_info_ready = false; }
+
+bool BeanSerialTransport::wakeInfoTake(uint8_t *reason, uint32_t *slept_ms) {
+  uint8_t oldSREG = SREG;
+  cli();
+  bool ready = wake_info_ready;
+  wake_info_ready = false;
+  *reason = wake_info[0];
+  *slept_ms = (uint32_t)wake_info[1] | (uint32_t)wake_info[2] << 8 |
+              (uint32_t)wake_info[3] << 16 | (uint32_t)wake_info[4] << 24;
+  SREG = oldSREG;
+  if (ready) {
+    // the CC may have restarted, e.g. with new firmware, while we slept
+    bean_cc_probes_reset();
+  }
+  return ready;
+}
+
 void BeanSerialTransport::enableWakeOnConnect(bool enable) {
   uint8_t enableBuff = (enable == true) ? 1 : 0;
 
@@ -930,6 +3432,10 @@ void BeanSerialTransport::debugWritePtm(const uint8_t *message,
 /////////////////////
 // This is the public write function that is used all the time
 size_t BeanSerialTransport::write(uint8_t c) {
+  if (tx_combine_enabled) {
+    return write(&c, 1);
+  }
+
   write_message(MSG_ID_SERIAL_DATA, &c, 1);
   return 1;
 }
@@ -937,6 +3443,31 @@ size_t BeanSerialTransport::write(uint8_t c) {
 size_t BeanSerialTransport::write(const uint8_t *buffer, size_t size) {
   if (buffer == NULL || size == 0) return 0;
 
+  if (tx_combine_enabled) {
+    serial_begin_once();
+    tx_queue_locked = true;
+    if (lz_enabled) {
+      for (size_t i = 0; i < size; i++) {
+        lz_write(buffer[i]);
+      }
+    } else {
+      for (size_t i = 0; i < size; i++) {
+        tx_combine[tx_combine_len++] = buffer[i];
+        if (tx_combine_len == MAX_BODY_LENGTH) {
+          tx_combine_flush();
+        }
+      }
+    }
+
+    if (tx_combine_len > 0 || lz_pending > 0) {
+      // arm the pacing tick for the idle timeout
+      tx_combine_last = millis();
+      sbi(TIMSK0, OCIE0B);
+    }
+    tx_queue_locked = false;
+    return size;
+  }
+
   if (size > MAX_BODY_LENGTH) {
     size_t end = MAX_BODY_LENGTH - 1;
     size_t start = 0;
@@ -957,26 +3488,76 @@ size_t BeanSerialTransport::print(const String &s) {
 }
 
 size_t BeanSerialTransport::print(const __FlashStringHelper *ifsh) {
-  uint8_t buffer[MAX_BODY_LENGTH];
-  const char PROGMEM *p = (const char PROGMEM *)ifsh;
-  size_t n = 0;
-
   if (ifsh == NULL) return 0;
 
-  while (1) {
-    unsigned char c = pgm_read_byte(p++);
-    if (c == 0) break;
-    buffer[n++] = c;
+  const char PROGMEM *p = (const char PROGMEM *)ifsh;
+  size_t n = strlen_P(p);
 
-    if (n == MAX_BODY_LENGTH) {
-      write_message(MSG_ID_SERIAL_DATA, buffer, n);
-      n = 0;
+  if (tx_combine_enabled) {
+    for (size_t i = 0; i < n; i++) {
+      write((uint8_t)pgm_read_byte(p + i));
     }
+    return n;
+  }
+
+  // straight from flash into the queue, one message per MAX_BODY_LENGTH
+  for (size_t sent = 0; sent < n; sent += MAX_BODY_LENGTH) {
+    BeanTxSegment segment = {p + sent, (uint8_t)min(n - sent, MAX_BODY_LENGTH),
+                             true};
+    write_message_v(MSG_ID_SERIAL_DATA, &segment, 1);
   }
-  write_message(MSG_ID_SERIAL_DATA, buffer, n);
   return n;
 }
 
+size_t BeanSerialTransport::readBytes(uint8_t *buffer, size_t length) {
+  size_t count = 0;
+  _startMillis = millis();
+  while (count < length) {
+    size_t want = length - count;
+    uint8_t got = _rx_buffer->read(&buffer[count], want > 255 ? 255 : want);
+    if (got > 0) {
+      count += got;
+      _startMillis = millis();
+    } else if (millis() - _startMillis >= _timeout) {
+      break;
+    } else {
+      bean_idle();
+    }
+  }
+  return count;
+}
+
+// Drops boundaries that the reader has already passed, e.g. by read().
+// Positions are uint8_t and rx_buffer holds at most 128 bytes, so a boundary
+// is ahead of tail exactly when its distance is within what's available.
+static int rx_frame_next_end(void) {
+  int end;
+  while ((end = rx_frame_ends.peek()) >= 0) {
+    uint8_t distance = (uint8_t)(end - rx_buffer.tail);
+    if (distance != 0 && distance <= rx_buffer.available()) {
+      return distance;
+    }
+    rx_frame_ends.skip(1);
+  }
+  return -1;
+}
+
+uint8_t BeanSerialTransport::framesAvailable(void) {
+  rx_frame_next_end();
+  return rx_frame_ends.available();
+}
+
+size_t BeanSerialTransport::readFrame(uint8_t *buffer, size_t length) {
+  int frame = rx_frame_next_end();
+  if (frame < 0) {
+    return 0;
+  }
+  if ((size_t)frame > length) {
+    frame = length;
+  }
+  return rx_buffer.read(buffer, frame);
+}
+
 void BeanSerialTransport::debugLoopBackFullSerialMessages() {
   setTimeout(0);
 
@@ -1005,17 +3586,19 @@ void BeanSerialTransport::BTDisconnect(void) {
 
 void BeanSerialTransport::BTRestart(void) {
   write_message(MSG_ID_BT_RESTART, NULL, 0);
+  radio_config_valid = false;
+  bean_cc_probes_reset();
 }
 
 // Preinstantiate Objects //////////////////////////////////////////////////////
 #if defined(UBRRH) && defined(UBRRL)
 BeanSerialTransport Serial(&rx_buffer, &tx_buffer, &UBRRH, &UBRRL, &UCSRA,
                            &UCSRB, &UCSRC, &UDR, RXEN, TXEN, RXCIE, UDRIE, U2X,
-                           &reply_buffer, &serial_message_complete);
+                           REPLY_BUFFER, &serial_message_complete);
 #elif defined(UBRR0H) && defined(UBRR0L)
 BeanSerialTransport Serial(&rx_buffer, &tx_buffer, &UBRR0H, &UBRR0L, &UCSR0A,
                            &UCSR0B, &UCSR0C, &UDR0, RXEN0, TXEN0, RXCIE0,
-                           UDRIE0, U2X0, &reply_buffer,
+                           UDRIE0, U2X0, REPLY_BUFFER,
                            &serial_message_complete);
 #elif defined(USBCON)
 // do nothing - Serial object and buffers are initialized in CDC code
@@ -13,6 +13,231 @@ struct ScratchData {
 
 typedef enum { UART_SLEEP_NORMAL, UART_SLEEP_NEVER } UART_SLEEP_MODE_T;
 
+// Messages this core sends that applicationMessageHeaders doesn't define yet.
+// They need matching CC firmware; where a CC doesn't answer one, the core
+// falls back to the older messages.
+#define MSG_ID_CC_ACCEL_TRANSACTION ((MSG_ID_T)0x2042)
+#define MSG_ID_CC_ACCEL_STREAM ((MSG_ID_T)0x2043)
+#define MSG_ID_CC_ACCEL_STREAM_DATA ((MSG_ID_T)0x2044)
+#define MSG_ID_CC_ACCEL_EVENT_ENABLE ((MSG_ID_T)0x2045)
+#define MSG_ID_CC_ACCEL_EVENT ((MSG_ID_T)0x2046)
+#define MSG_ID_AR_WAKE_INFO ((MSG_ID_T)0x3011)
+#define MSG_ID_OBSERVER_FILTER ((MSG_ID_T)0xB003)
+#define MSG_ID_ANCS_FILTER ((MSG_ID_T)0x9002)
+// LED animations, see Bean.playLedAnimation().  Body: [repeats, 0 for
+// forever][keyframe count], then for each keyframe [red][green][blue][easing]
+// [duration ms lo][duration ms hi].  The CC acks it with an empty reply and
+// plays it from the color showing; a count of 0, or any LED write, stops it
+// where it is.
+#define MSG_ID_CC_LED_ANIMATE ((MSG_ID_T)0x2003)
+#define BEAN_LED_CC_MAX_KEYFRAMES (10)
+#define MSG_ID_BT_SET_SCRATCH_MULTI ((MSG_ID_T)0x0516)
+#define MSG_ID_BT_GET_SCRATCH_MULTI ((MSG_ID_T)0x0517)
+#define MSG_ID_BT_SCRATCH_NOTIFY ((MSG_ID_T)0x0518)
+#define MSG_ID_BT_SCRATCH_WRITTEN ((MSG_ID_T)0x0519)
+#define MSG_ID_BT_STATES_NOTIFY ((MSG_ID_T)0x0532)
+#define MSG_ID_BT_STATES_CHANGED ((MSG_ID_T)0x0533)
+// Body: the uint32_t baud rate the ATmega asks for.  Reply: the same rate if
+// the CC switches to it once the reply has gone out, or 0.  Having switched,
+// the CC goes back to 38400 unless a frame with a good CRC arrives within
+// 100 ms, and it always starts at 38400 after resetting the ATmega.
+#define MSG_ID_AR_SET_BAUD ((MSG_ID_T)0x3030)
+// Frame acknowledgements, see setRxAcks().  MSG_ID_AR_SET_RX_ACKS: body [1 to
+// number frames, 0 to stop].  The CC answers with the same message and body,
+// sent the old way, and numbers every frame after it: the body starts with a
+// sequence number counting up from 0.  MSG_ID_AR_RX_ACK and MSG_ID_AR_RX_NAK:
+// body [the sequence number the ATmega expects next].  Both acknowledge every
+// frame before it; a NAK also asks for that frame again.  The CC sends again
+// what isn't acknowledged within 100 ms, and always starts with frames
+// unnumbered after resetting the ATmega.
+#define MSG_ID_AR_SET_RX_ACKS ((MSG_ID_T)0x3031)
+// Compressed Virtual Serial data, see setCompression().  Body: a header, then
+// LZ77 tokens in groups of up to eight, each group led by a byte whose bits,
+// lowest first, flag its matches.  A literal is one byte of data; a match is
+// [distance - 1][length - 3] and repeats length bytes from distance back in
+// the stream.  Header bit 7 clears the stream's history; bits 0-6 count the
+// bytes since then, mod 128, so a receiver that missed a message can tell
+// and wait for the next clear.  Uncompressed MSG_ID_SERIAL_DATA bytes count
+// as part of the stream too.
+#define MSG_ID_SERIAL_DATA_LZ ((MSG_ID_T)0x0001)
+#define MSG_ID_AR_RX_ACK ((MSG_ID_T)0x3032)
+#define MSG_ID_AR_RX_NAK ((MSG_ID_T)0x3033)
+
+// Connection transitions reported by BTStateEventsTake().
+#define BEAN_BT_CONNECTED (0x01)
+#define BEAN_BT_DISCONNECTED (0x02)
+
+// Bean and Bean+ have scratch banks 1 to 5.  The multi-bank calls take an
+// array of BEAN_SCRATCH_BANKS entries, bank 1 first, and a mask with bit
+// (bank - 1) set for each entry to use.
+#define BEAN_SCRATCH_BANKS (5)
+
+// Which observed advertisements to pass on.  An advertisement must meet every
+// rule that is set: an address in addresses (if addressCount > 0),
+// manufacturer specific data starting with manufacturerPrefix (if
+// manufacturerPrefixLength > 0), and an RSSI of at least minRssi.  Repeats
+// from an address within dedupeMs of the last one passed are dropped.
+#ifndef BEAN_OBSERVER_MAX_ADDRESSES
+#define BEAN_OBSERVER_MAX_ADDRESSES (4)
+#endif
+#define BEAN_OBSERVER_MAX_PREFIX (8)
+
+typedef struct {
+  int8_t minRssi;
+  uint16_t dedupeMs;
+  uint8_t addressCount;
+  uint8_t addresses[BEAN_OBSERVER_MAX_ADDRESSES][6];
+  uint8_t manufacturerPrefixLength;
+  uint8_t manufacturerPrefix[BEAN_OBSERVER_MAX_PREFIX];
+} BEAN_OBSERVER_FILTER_T;
+
+// Which ANCS notifications to pass on.  A notification must have its EventID's
+// bit set in events, every EventFlags bit in flagsSet and none in flagsClear,
+// and then either its CategoryID's bit set in categories or, if appIdLength >
+// 0, come from the app appId.  The app identifier is an attribute, not part
+// of the notification, so only the CC can check it as it arrives; here only a
+// notification that fails the other rules is dropped.
+#define BEAN_ANCS_MAX_APP_ID (32)
+
+typedef struct {
+  uint16_t categories;
+  uint8_t events;
+  uint8_t flagsSet;
+  uint8_t flagsClear;
+  uint8_t appIdLength;
+  char appId[BEAN_ANCS_MAX_APP_ID];
+} BEAN_ANCS_FILTER_T;
+
+// One streamed accelerometer sample.  timestamp is the millis() time it was
+// taken, worked out from the arrival of its batch and the stream rate.
+typedef struct {
+  int16_t xAxis;
+  int16_t yAxis;
+  int16_t zAxis;
+  uint8_t sensitivity;
+  uint32_t timestamp;
+} BEAN_ACCEL_SAMPLE_T;
+
+// One BMA250 register access in accelTransaction().  A read (length > 0)
+// fills data with length bytes starting at reg; a write (length 0) stores
+// value in reg.
+struct BeanAccelOp {
+  uint8_t reg;
+  uint8_t length;
+  uint8_t value;
+  uint8_t *data;
+};
+
+typedef enum {
+  BEAN_REPLY_PENDING,
+  BEAN_REPLY_DONE,
+  BEAN_REPLY_TIMEOUT
+} BEAN_REPLY_STATUS_T;
+
+typedef enum { BEAN_RX_START, BEAN_RX_BYTE, BEAN_RX_END } BEAN_RX_EVENT_T;
+
+// Called from the RX ISR for a registered message id, so keep it short.
+// BEAN_RX_START: arg is the body length.  BEAN_RX_BYTE: arg is a body byte,
+// only sent when the route has no buffer.  BEAN_RX_END: arg is 1 if the frame
+// was accepted (its CRC checked out, it was in sequence and its body fit the
+// route's buffer), 0 if it was dropped.
+typedef void (*BeanRxHandler)(uint8_t event, uint8_t arg);
+
+// One piece of a message body for write_message_v().  progmem marks data
+// that lives in flash (PROGMEM, PSTR()).
+struct BeanTxSegment {
+  const void *data;
+  uint8_t length;
+  bool progmem;
+};
+
+// Features of newer CC firmware are probed for by using them: older firmware
+// ignores the message and the request times out.  A timeout may only mean
+// the CC was busy or asleep, so a feature is given up on after
+// BEAN_CC_PROBE_ATTEMPTS of them in a row, and probed for again once the CC
+// restarts, on restartBluetooth() or when it next reports a wake.  Zeroed, a
+// probe is untried.
+#ifndef BEAN_CC_PROBE_ATTEMPTS
+#define BEAN_CC_PROBE_ATTEMPTS (3)
+#endif
+
+struct BeanCcProbe {
+  uint8_t misses;  // timeouts in a row
+  uint8_t epoch;   // of the CC they were counted against
+};
+
+// False once the feature has been given up on.
+bool bean_cc_probe_open(BeanCcProbe *probe);
+// Notes whether the CC answered.
+void bean_cc_probe_result(BeanCcProbe *probe, bool answered);
+// Starts every probe over, after the CC restarted.
+void bean_cc_probes_reset(void);
+
+class BeanSerialTransport;
+
+// Something the CC can push instead of being polled for, probed for by
+// asking it to: on once it has taken a non-zero mask.
+struct BeanCcPush {
+  BeanCcProbe probe;
+  bool on;
+};
+
+// Asks the CC to push mask, or to stop if it's 0, through enable, unless the
+// push has been given up on.  on only changes when the CC answers.
+void bean_cc_push_enable(BeanCcPush *push,
+                         int (BeanSerialTransport::*enable)(uint8_t),
+                         uint8_t mask);
+
+struct BeanReply;
+typedef void (*BeanReplyCallback)(BeanReply *reply);
+
+// A CC request started with call_async().  The caller owns it and must keep
+// it alive until status leaves BEAN_REPLY_PENDING; set response, capacity,
+// callback and context before the call.  length is the full reply length,
+// of which at most capacity bytes are stored.
+struct BeanReply {
+  uint16_t messageId;
+  uint8_t *response;
+  size_t capacity;
+  volatile size_t length;
+  volatile uint8_t status;  // BEAN_REPLY_STATUS_T
+  unsigned long sentMillis;
+  unsigned long timeout_ms;
+  BeanReplyCallback callback;
+  void *context;
+};
+
+// Transport counters, see getTransportStats().  Compiled out by building with
+// -DBEAN_TRANSPORT_STATS=0.
+#ifndef BEAN_TRANSPORT_STATS
+#define BEAN_TRANSPORT_STATS 1
+#endif
+
+// All counters saturate at 65535.  An overflow count is the number of
+// received bytes dropped because that channel's buffer was full; for replies
+// it also counts bytes that did not fit a call_async() response buffer.  ISR
+// durations are measured on Timer0, so they have its resolution (8 us on an
+// 8 MHz Bean).
+typedef struct {
+  uint16_t framesSent;
+  uint16_t framesReceived;  // frames with a good CRC
+  uint16_t crcErrors;
+  uint16_t framingResets;   // frames cut short by an out of place SOF/EOF/ESC
+  uint16_t parityErrors;
+  uint16_t sequenceErrors;  // numbered frames repeated or out of order
+  uint16_t naksSent;
+  uint16_t serialOverflows;
+  uint16_t midiOverflows;
+  uint16_t ancsOverflows;
+  uint16_t ancsMessageOverflows;
+  uint16_t observerOverflows;
+  uint16_t accelOverflows;
+  uint16_t replyOverflows;
+  uint16_t otherOverflows;  // routes added with registerRxRoute()
+  uint16_t maxRxIsrMicros;
+  uint16_t maxTxIsrMicros;  // the UDRE interrupt and the pacing tick
+} BEAN_TRANSPORT_STATS_T;
+
 // Used for waking the CC out of deep sleep mode.
 #define UART_DEFAULT_WAKE_WAIT (7)
 #define UART_DEFAULT_SEND_WAIT (13)
@@ -23,23 +248,28 @@ class BeanSerialTransport : public HardwareSerial {
   friend class BeanAncsClass;
   friend class BeanHidClass;
 
- private:
-  uint32_t m_wakeDelay;
-  uint32_t m_enforcedDelay;
-
  protected:
   ring_buffer *_reply_buffer;
-  void insert_escaped_char(uint8_t input);
   volatile bool *_message_complete;
 
   size_t write_message(uint16_t messageId, const uint8_t *body,
                        size_t body_length);
 
+  // Sends the concatenation of count segments as one message, gathering them
+  // straight into the TX queue instead of through a staging buffer.
+  size_t write_message_v(uint16_t messageId, const BeanTxSegment *segments,
+                         uint8_t count);
+
   int call_and_response(MSG_ID_T messageId, const uint8_t *body,
                         size_t body_length, uint8_t *response,
                         size_t *response_length,
                         unsigned long timeout_ms = 100);
 
+  // Sends a request and returns straight away; the reply lands in *reply.
+  // Returns -1 if too many requests, or one with the same id, are outstanding.
+  int call_async(MSG_ID_T messageId, const uint8_t *body, size_t body_length,
+                 BeanReply *reply, unsigned long timeout_ms = 100);
+
   // API Control
   // BT
   void BTSetAdvertisingOnOff(const bool setting, uint32_t timer);
@@ -47,13 +277,38 @@ class BeanSerialTransport : public HardwareSerial {
   void BTSetAdvertisingInterval(uint16_t interval_ms);
   void BTSetConnectionInterval(const int interval_ms);
   void BTSetLocalName(const char *name);
+  // name needn't be terminated, and with progmem set is read from flash
+  void BTSetLocalName(const char *name, size_t length, bool progmem);
   void BTSetPairingPin(const uint32_t pin);
   void BTEnablePairingPin(bool enable);
   void BTSetTxPower(const BT_TXPOWER_DB_T &power);
   void BTSetScratchChar(BT_SCRATCH_T *setting, uint8_t length);
   int BTGetScratchChar(uint8_t scratchNum, ScratchData *scratchData);
+  // Return the mask of banks written or read.
+  uint8_t BTSetScratchChars(const ScratchData *banks, uint8_t mask);
+  uint8_t BTGetScratchChars(ScratchData *banks, uint8_t mask);
+  // Asks the CC to push MSG_ID_BT_SCRATCH_WRITTEN when a client writes one
+  // of the banks in mask, or to stop if mask is 0.  Returns 0 if it agreed.
+  int scratchNotifyEnable(uint8_t mask);
+  // The next pushed write, bank 1 to 5 with what the client wrote.
+  bool readScratchWrite(uint8_t *bank, ScratchData *data);
+  // True, once, if pushed writes were dropped because the queue was full.
+  bool scratchWritesLost(void);
   int BTGetConfig(BT_RADIOCONFIG_T *config);
+  // The config setters between these share one MSG_ID_BT_GET_CONFIG and one
+  // MSG_ID_BT_SET_CONFIG.  They nest; the outermost commit writes, and
+  // returns false if a setter was dropped because the fetch failed.
+  void radioConfigBegin(void);
+  bool radioConfigCommit(void);
   int BTGetStates(BT_STATES_T *btStates);
+  // Asks the CC to push MSG_ID_BT_STATES_CHANGED whenever its states change,
+  // or to stop.  Returns 0 if it agreed, after which BTPushedStates() is
+  // current.
+  int BTStatesNotifyEnable(bool enable);
+  void BTPushedStates(BT_STATES_T *btStates);
+  // Returns and clears the BEAN_BT_CONNECTED and BEAN_BT_DISCONNECTED
+  // transitions pushed since the last call.
+  uint8_t BTStateEventsTake(void);
   void BTSetBeaconParams(uint16_t uuid, uint16_t majorid, uint16_t minorid);
   void BTBeaconModeEnable(bool beaconEnable);
   void BTConfigUartSleep(UART_SLEEP_MODE_T mode);
@@ -64,6 +319,8 @@ class BeanSerialTransport : public HardwareSerial {
   void ledSet(const LED_SETTING_T &setting);
   void ledSetSingle(const LED_IND_SETTING_T &setting);
   int ledRead(LED_SETTING_T *reading);
+  // Returns 0 if the CC took the MSG_ID_CC_LED_ANIMATE body.
+  int ledAnimate(const uint8_t *body, size_t length);
 
   // GATT Control
   int readGATT(ADV_SWITCH_ENABLED_T *reading);
@@ -71,21 +328,46 @@ class BeanSerialTransport : public HardwareSerial {
   int setCustomAdvertisement(uint8_t *buf, int len);
 
   // Midi
-  char peekMidi();
+  bool midiRxBegin();
+  // midi_buffer holds whole BLE-MIDI packets, each as [length][packet...].
+  int peekMidi(uint8_t n = 0);
+  void skipMidi(uint8_t n);
   size_t midiAvailable();
   size_t readMidi(uint8_t *buffer, size_t max_length);
   void midiSend(uint8_t status, uint8_t byte1, uint8_t byte2);
 
   // ANCS
+  bool ancsRxBegin();
   int ancsAvailable();
   int readAncs(uint8_t *buffer, size_t max_length);
   int getAncsNotiDetails(uint8_t *buffer, size_t length, uint8_t *data, uint32_t timeout);
+  int getAncsNotiDetails(const BeanTxSegment *request, uint8_t count,
+                         uint8_t *data, uint32_t timeout,
+                         uint16_t capacity = 0xFFFF);
+  // Starts an attribute request without waiting for it.  The attribute goes
+  // into data, up to capacity bytes, or if data is NULL into the buffer read
+  // by readAncsMessage().  ancsNotiRemaining() is -1 until its header
+  // arrives, then the bytes still to come.
+  bool ancsNotiBegin(const BeanTxSegment *request, uint8_t count,
+                     uint8_t *data, uint16_t capacity);
+  int32_t ancsNotiRemaining();
+  uint16_t ancsNotiSinkLength();
   int ancsNotiDetailsAvailable();
   int readAncsMessage(uint8_t *buffer, size_t max_length);
+  // Pushed to the CC, or applied in the RX ISR if the CC doesn't take it.
+  // Returns 0 if the CC filters, app identifier included.
+  int ancsFilter(const BEAN_ANCS_FILTER_T *filter);
 
   // Observer
   int getObserverMessage(OBSERVER_INFO_MESSAGE_T *message,
                          unsigned long timeout);
+  bool observerStart(void);
+  void observerStop(void);
+  uint8_t observerAvailable(void);
+  bool readObserverMessage(OBSERVER_INFO_MESSAGE_T *message);
+  // Pushed to the CC, or applied in the RX ISR if the CC doesn't take it.
+  // Returns 0 if the CC filters.
+  int observerFilter(const BEAN_OBSERVER_FILTER_T *filter);
 
   // Accelerometer
   int accelRead(ACC_READING_T *reading);
@@ -93,7 +375,15 @@ class BeanSerialTransport : public HardwareSerial {
   void accelRangeSet(uint8_t range);
   int accelRegisterRead(uint8_t reg, uint8_t length, uint8_t *value);
   void accelRegisterWrite(uint8_t reg, uint8_t value);
+  // Runs the ops in order as one CC message and one reply.
+  int accelTransaction(const BeanAccelOp *ops, uint8_t count);
   void wakeOnAccel(uint8_t int_enable);
+  int accelEventsEnable(uint8_t events);
+  uint8_t accelEventsTake(void);
+  bool accelStreamBegin(uint16_t rate_hz, uint8_t samples_per_message);
+  void accelStreamEnd(void);
+  uint8_t accelSamplesAvailable(void);
+  uint8_t readAccelSamples(BEAN_ACCEL_SAMPLE_T *samples, uint8_t max_count);
 
   // temperature
   int temperatureRead(int8_t *tempRead);
@@ -104,12 +394,21 @@ class BeanSerialTransport : public HardwareSerial {
   // Arduino Sleep
   void sleep(uint32_t duration_ms);
   void enableWakeOnConnect(bool enable);
+  void wakeInfoClear(void);
+  bool wakeInfoTake(uint8_t *reason, uint32_t *slept_ms);
 
   bool m_enableSave = true;
 
+  BT_RADIOCONFIG_T *radioConfigFetch(void);
+  void radioConfigChanged(bool changed);
+
+  bool baudPing(void);
+  void baudSwitch(uint32_t baud);
+  void baudResume(void);
+
  public:
   // To work on bean, the serial must be initialized
-  // at 57600 with standard settings, and cannot be disabled
+  // at 38400 with standard settings, and cannot be disabled
   // or all control messaging will break.  We've overidden begin() and end()
   // functions to not do a whole heck of a lot as a result.
   void begin(void);
@@ -128,6 +427,89 @@ class BeanSerialTransport : public HardwareSerial {
 
   virtual void flush(void);
 
+  // Stream::readBytes() without a virtual read() and millis() check per
+  // byte: whatever has arrived is copied out in one go.  The timeout applies
+  // between arrivals, as in Stream.
+  size_t readBytes(uint8_t *buffer, size_t length);
+  size_t readBytes(char *buffer, size_t length) {
+    return readBytes((uint8_t *)buffer, length);
+  }
+
+  // Reads the next whole Virtual Serial message as it arrived from the CC,
+  // or up to length bytes of it, leaving the rest for the next call.
+  // Returns 0 until a message has fully arrived.  Bytes taken with read()
+  // are simply no longer part of their message.
+  size_t readFrame(uint8_t *buffer, size_t length);
+  // Messages readFrame() can return now.
+  uint8_t framesAvailable(void);
+
+  // Routes incoming messages with this id into buffer and/or handler instead
+  // of treating them as replies.  Registering an id again replaces its route.
+  // Returns false if the routing table (BEAN_MAX_RX_ROUTES) is full.
+  bool registerRxRoute(uint16_t messageId, ring_buffer *buffer,
+                       BeanRxHandler handler = NULL);
+
+  // Retires finished and timed out async requests and runs their callbacks.
+  // Called after every loop(), and while a blocking request waits.
+  void pollReplies(void);
+
+  // Messages are queued and sent in the background, paced for the CC.
+  // txFramesPending() is the number of queued messages not yet sent and
+  // txQueueAvailable() the free queue space in bytes (a message takes its
+  // length + 3).  txLastFrame() identifies the most recently queued message;
+  // pass it to txFrameSent() to find out whether it has gone out.
+  uint8_t txFramesPending(void);
+  size_t txQueueAvailable(void);
+  uint16_t txLastFrame(void);
+  bool txFrameSent(uint16_t frame);
+
+  // Write combining collects the bytes from write() and print() into full
+  // messages, which are sent when full, on flush(), before any other message,
+  // or after idle_ms (default 10) without a write.  Off by default, so each
+  // write() goes out as its own MSG_ID_SERIAL_DATA as soon as it's made.
+  void setWriteCombining(bool enable);
+  void setWriteCombiningTimeout(uint16_t idle_ms);
+
+  // Compression packs write combined serial data, typically repetitive text,
+  // into fewer and shorter messages.  The receiving app must decode
+  // MSG_ID_SERIAL_DATA_LZ.  The window and match table take 320 bytes of heap
+  // the first time it's turned on; returns false if that fails.  Data written
+  // with write combining off isn't compressed, so turn that on too.  Off by
+  // default.
+  bool setCompression(bool enable);
+
+  // Adaptive pacing learns how short the CC wake wait and the frame spacing
+  // can be.  The replies to requests sent after a wait shorten it a step at a
+  // time; a request that times out puts the default back and stops the wait
+  // from going that low again.  Frames sent right after the CC interrupt line
+  // dropped also skip the wake wait.  Off by default.  getPacing() reports
+  // the waits currently in use.
+  void setAdaptivePacing(bool enable);
+  void getPacing(uint16_t *wake_ms, uint16_t *send_ms);
+
+  // The link to the CC starts at 38400 baud.  negotiateBaud() moves it to the
+  // fastest of 1000000, 500000 and 250000 up to max_baud that leaves the RX
+  // ISR enough time per byte (see BEAN_SERIAL_RX_ISR_CYCLES), if the CC
+  // supports it, and checks the new rate with a loopback; anything that
+  // doesn't check out leaves the link at 38400.  A max_baud of 38400 moves
+  // it back.  Returns the rate in use, which baud() also reports.
+  uint32_t negotiateBaud(uint32_t max_baud);
+  uint32_t baud(void);
+
+  // With RX acknowledgements on, the CC numbers its frames and the ATmega
+  // acknowledges them, so one cut short or with a bad CRC is sent again on
+  // its own instead of the request it answered timing out.  Frames are only
+  // taken in order, and a repeat of one already taken is dropped.  Needs CC
+  // firmware that supports it; returns false, changing nothing, if the CC
+  // doesn't answer.  Off by default.
+  bool setRxAcks(bool enable);
+  bool rxAcks(void);
+
+  // Copies out the transport counters.  Returns false, with *stats zeroed,
+  // if they were compiled out.
+  bool getTransportStats(BEAN_TRANSPORT_STATS_T *stats);
+  void resetTransportStats(void);
+
   virtual size_t write(uint8_t);
   size_t write(const uint8_t *buffer, size_t size);
 
@@ -158,8 +540,6 @@ class BeanSerialTransport : public HardwareSerial {
     _reply_buffer = reply_buffer;
     _message_complete = message_complete;
     *message_complete = false;
-    m_wakeDelay = UART_DEFAULT_WAKE_WAIT;
-    m_enforcedDelay = UART_DEFAULT_SEND_WAIT;
   }  // End constructor
 };   // End BeanSerialTransport
 
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "Bean.h"
+#include "BeanTelemetry.h"
+
+#define SCRATCH_SIZE (20)
+
+// Appends the low bits of value at bit pos of the stream spread over banks.
+static void telemetry_put(ScratchData *banks, uint16_t *pos, uint32_t value,
+                          uint8_t bits) {
+  while (bits > 0) {
+    uint8_t byte = *pos >> 3;
+    uint8_t shift = *pos & 7;
+    uint8_t take = 8 - shift;
+    if (take > bits) {
+      take = bits;
+    }
+    banks[byte / SCRATCH_SIZE].data[byte % SCRATCH_SIZE] |=
+        (uint8_t)((value & ((1 << take) - 1)) << shift);
+    value >>= take;
+    *pos += take;
+    bits -= take;
+  }
+}
+
+static uint32_t telemetry_load(const uint8_t *record,
+                               const BeanTelemetryField *field) {
+  uint32_t value = 0;
+  memcpy(&value, &record[field->offset], field->size);
+  if ((field->flags & BEAN_FIELD_SIGNED) && field->size < 4 &&
+      (record[field->offset + field->size - 1] & 0x80)) {
+    value |= 0xFFFFFFFFUL << (8 * field->size);
+  }
+  return value;
+}
+
+BeanTelemetryBase::BeanTelemetryBase(const BeanTelemetryField *layout,
+                                     uint8_t fields, uint8_t keyInterval,
+                                     uint8_t firstBank, uint8_t banks)
+    : _layout(layout),
+      _fields(fields),
+      _keyInterval(keyInterval),
+      _sinceKey(0),
+      _firstBank(firstBank),
+      _banks(banks),
+      _hasDelta(false),
+      _havePrevious(false) {
+  for (uint8_t i = 0; i < fields; i++) {
+    if (pgm_read_byte(&layout[i].deltaBits) != 0) {
+      _hasDelta = true;
+    }
+  }
+}
+
+// Returns the frame's length in bits, or 0 if it doesn't fit in the banks or,
+// for a delta frame, a difference doesn't fit its delta bits.
+uint16_t BeanTelemetryBase::encode(ScratchData *banks, const uint8_t *record,
+                                   const uint8_t *previous, bool key) {
+  uint16_t capacity = (uint16_t)_banks * SCRATCH_SIZE * 8;
+  uint16_t pos = 0;
+
+  for (uint8_t i = 0; i < _banks; i++) {
+    memset(banks[i].data, 0, SCRATCH_SIZE);
+  }
+  if (_hasDelta) {
+    telemetry_put(banks, &pos, key ? 1 : 0, 1);
+  }
+
+  for (uint8_t i = 0; i < _fields; i++) {
+    BeanTelemetryField field;
+    memcpy_P(&field, &_layout[i], sizeof(field));
+
+    uint32_t value = telemetry_load(record, &field);
+    uint8_t bits = field.bits;
+    if (!key && field.deltaBits > 0) {
+      int32_t delta = (int32_t)(value - telemetry_load(previous, &field));
+      if (field.deltaBits < 32) {
+        int32_t limit = (int32_t)1 << (field.deltaBits - 1);
+        if (delta < -limit || delta >= limit) {
+          return 0;
+        }
+      }
+      value = (uint32_t)delta;
+      bits = field.deltaBits;
+    }
+    if (pos + bits > capacity) {
+      return 0;
+    }
+    telemetry_put(banks, &pos, value, bits);
+  }
+  return pos;
+}
+
+uint8_t BeanTelemetryBase::publish(const uint8_t *record, uint8_t *previous,
+                                   uint8_t size) {
+  ScratchData banks[BEAN_SCRATCH_BANKS];
+  ScratchData *mine = &banks[_firstBank - 1];
+
+  bool key = !_hasDelta || !_havePrevious ||
+             (_keyInterval > 0 && _sinceKey >= _keyInterval);
+  uint16_t bits = encode(mine, record, previous, key);
+  if (bits == 0 && !key) {
+    key = true;
+    bits = encode(mine, record, previous, key);
+  }
+  if (bits == 0) {
+    return 0;
+  }
+
+  uint8_t bytes = (bits + 7) / 8;
+  uint8_t mask = 0;
+  for (uint8_t i = 0; i < _banks && bytes > 0; i++) {
+    mine[i].length = bytes < SCRATCH_SIZE ? bytes : SCRATCH_SIZE;
+    bytes -= mine[i].length;
+    mask |= 1 << (_firstBank - 1 + i);
+  }
+
+  memcpy(previous, record, size);
+  _havePrevious = true;
+  if (key) {
+    _sinceKey = 1;
+  } else if (_sinceKey < 0xFF) {
+    _sinceKey++;
+  }
+
+  return Bean.setScratchBanks(banks, mask);
+}
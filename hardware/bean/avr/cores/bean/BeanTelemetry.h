@@ -0,0 +1,108 @@
+#ifndef BEAN_TELEMETRY_H
+#define BEAN_TELEMETRY_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "BeanSerialTransport.h"
+
+// Packs a struct into scratch banks with a fixed bit layout, so a client can
+// decode it without any framing, and sends only the banks that changed.
+//
+// The layout is a PROGMEM table with one entry per field to send, in order:
+//
+//   struct Reading { int16_t temperature; uint8_t battery; uint32_t count; };
+//
+//   static const BeanTelemetryField layout[] PROGMEM = {
+//     BEAN_TELEMETRY_FIELD(Reading, temperature, 10, BEAN_FIELD_SIGNED, 4),
+//     BEAN_TELEMETRY_FIELD(Reading, battery, 7, 0, 0),
+//     BEAN_TELEMETRY_FIELD(Reading, count, 32, 0, 8),
+//   };
+//
+//   BeanTelemetry<Reading> telemetry(layout, 3);
+//   ...
+//   telemetry.publish(reading);
+//
+// The bank contents are one little endian bit stream, least significant bit
+// first, starting at bit 0 of the first bank and running on into the next
+// bank after 20 bytes.  If any field has delta bits, the stream starts with a
+// one bit flag: 1 for a key frame, where every field is sent whole in its
+// bits, and 0 for a delta frame, where fields with delta bits are sent as the
+// signed difference from the previous frame.  A delta frame is sent only if
+// every difference fits; otherwise, every keyInterval frames, and for the
+// first frame, a key frame is sent.  Values must fit in their bits; signed
+// ones are sent in two's complement and should be sign extended by the
+// client.
+//
+// Banks the frame doesn't reach are left alone.  Clients are notified of each
+// bank separately, so they may briefly see banks from different frames.
+
+#define BEAN_FIELD_SIGNED (0x01)
+
+struct BeanTelemetryField {
+  uint8_t offset;     // offsetof() the member
+  uint8_t size;       // 1, 2 or 4 bytes in the struct
+  uint8_t bits;       // sent in a key frame, 1 to 32
+  uint8_t deltaBits;  // sent in a delta frame, 0 to always send it whole
+  uint8_t flags;
+};
+
+#define BEAN_TELEMETRY_FIELD(type, member, bits, flags, deltaBits) \
+  {offsetof(type, member), sizeof(((type *)0)->member), bits, deltaBits, flags}
+
+class BeanTelemetryBase {
+ public:
+  // Sends the next frame as a key frame.
+  void forceKeyframe(void) { _havePrevious = false; }
+
+ protected:
+  BeanTelemetryBase(const BeanTelemetryField *layout, uint8_t fields,
+                    uint8_t keyInterval, uint8_t firstBank, uint8_t banks);
+
+  uint8_t publish(const uint8_t *record, uint8_t *previous, uint8_t size);
+
+ private:
+  uint16_t encode(ScratchData *banks, const uint8_t *record,
+                  const uint8_t *previous, bool key);
+
+  const BeanTelemetryField *_layout;
+  uint8_t _fields;
+  uint8_t _keyInterval;
+  uint8_t _sinceKey;
+  uint8_t _firstBank;
+  uint8_t _banks;
+  bool _hasDelta;
+  bool _havePrevious;
+};
+
+// Record is sent in banks FirstBank to FirstBank + Banks - 1.  The last
+// frame sent is kept in the object, so nothing is allocated.
+template <typename Record, uint8_t FirstBank = 1,
+          uint8_t Banks = BEAN_SCRATCH_BANKS>
+class BeanTelemetry : public BeanTelemetryBase {
+  // Fails to compile unless the banks exist and Record is under 256 bytes.
+  typedef char banks_must_exist
+      [(FirstBank >= 1 && Banks >= 1 &&
+        FirstBank + Banks - 1 <= BEAN_SCRATCH_BANKS && sizeof(Record) < 256)
+           ? 1
+           : -1];
+
+ public:
+  // layout is a PROGMEM table of fields entries.  With keyInterval 0 key
+  // frames are only sent when a delta doesn't fit or after forceKeyframe().
+  BeanTelemetry(const BeanTelemetryField *layout, uint8_t fields,
+                uint8_t keyInterval = 16)
+      : BeanTelemetryBase(layout, fields, keyInterval, FirstBank, Banks) {}
+
+  // Returns the mask of banks written, bit 0 for bank 1; 0 if nothing
+  // changed or the frame doesn't fit in Banks banks.
+  uint8_t publish(const Record &record) {
+    return BeanTelemetryBase::publish((const uint8_t *)&record,
+                                      (uint8_t *)&_previous, sizeof(Record));
+  }
+
+ private:
+  Record _previous;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "Arduino.h"
+#include "wiring_private.h"
+#include "BeanTone.h"
+
+BeanToneClass BeanTone;
+
+// Timer1 runs in fast PWM with ICR1 as TOP and no prescaler, one sample per
+// PWM period.  The duty cycle is centred on TONE_MID, and TONE_SHIFT scales
+// the mix of four full voices, +-508, to the range either side of it.
+#define TONE_TOP (F_CPU / BEAN_TONE_SAMPLE_RATE - 1)
+#define TONE_MID ((TONE_TOP + 1) / 2)
+#if F_CPU == 16000000L
+#define TONE_SHIFT (0)
+#elif F_CPU == 8000000L
+#define TONE_SHIFT (1)
+#else
+#error BeanTone needs an 8 or 16 MHz clock
+#endif
+
+// A sample lasts exactly 64 us, and the phase steps 2^16 per cycle, so a
+// frequency's phase increment is f * 2^16 / 15625, here in 16.16 fixed point.
+#define TONE_US_PER_SAMPLE (1000000L / BEAN_TONE_SAMPLE_RATE)
+#define TONE_INCREMENT(f) ((uint16_t)(((uint32_t)(f) * 274878UL) >> 16))
+
+#define TONE_TABLE_BITS (6)  // 64 samples per table
+
+static const int8_t PROGMEM tone_sine[1 << TONE_TABLE_BITS] = {
+    0, 12, 25, 37, 49, 60, 71, 81, 90, 98, 106, 112, 117, 122, 125, 126,
+    127, 126, 125, 122, 117, 112, 106, 98, 90, 81, 71, 60, 49, 37, 25, 12,
+    0, -12, -25, -37, -49, -60, -71, -81, -90, -98, -106, -112, -117, -122, -125, -126,
+    -127, -126, -125, -122, -117, -112, -106, -98, -90, -81, -71, -60, -49, -37, -25, -12,
+};
+
+static const int8_t PROGMEM tone_triangle[1 << TONE_TABLE_BITS] = {
+    0, 8, 16, 24, 32, 40, 48, 56, 64, 71, 79, 87, 95, 103, 111, 119,
+    127, 119, 111, 103, 95, 87, 79, 71, 64, 56, 48, 40, 32, 24, 16, 8,
+    0, -8, -16, -24, -32, -40, -48, -56, -64, -71, -79, -87, -95, -103, -111, -119,
+    -127, -119, -111, -103, -95, -87, -79, -71, -64, -56, -48, -40, -32, -24, -16, -8,
+};
+
+static const int8_t PROGMEM tone_square[1 << TONE_TABLE_BITS] = {
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+    -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127, -127,
+};
+
+static const int8_t PROGMEM tone_sawtooth[1 << TONE_TABLE_BITS] = {
+    -127, -123, -119, -115, -111, -107, -103, -99, -95, -91, -87, -83, -79, -75, -71, -67,
+    -62, -58, -54, -50, -46, -42, -38, -34, -30, -26, -22, -18, -14, -10, -6, -2,
+    2, 6, 10, 14, 18, 22, 26, 30, 34, 38, 42, 46, 50, 54, 58, 62,
+    67, 71, 75, 79, 83, 87, 91, 95, 99, 103, 107, 111, 115, 119, 123, 127,
+};
+
+static const int8_t *const PROGMEM tone_waves[] = {
+    tone_sine, tone_triangle, tone_square, tone_sawtooth,
+};
+
+struct ToneVoice {
+  uint16_t phase;
+  uint16_t increment;
+  uint8_t level;  // 0 while silent or resting
+  const int8_t *wave;
+  uint8_t volume;
+  uint8_t decay;
+  bool active;
+  uint16_t remaining_ms;  // of the note; 0 plays it until stop()
+  const BeanToneNote *notes;  // the rest of the sequence
+  uint8_t count;
+  bool progmem;
+};
+
+// The ISR owns the voices while any is active; everything else changes them
+// with interrupts off.
+static ToneVoice tone_voices[BEAN_TONE_VOICES];
+static volatile uint16_t *tone_ocr = NULL;
+static uint16_t tone_us = 0;
+
+// Timer1 as it was before begin().
+static uint8_t tone_saved_tccr1a;
+static uint8_t tone_saved_tccr1b;
+static uint16_t tone_saved_icr1;
+
+static void tone_start_note(ToneVoice *v, uint16_t frequency,
+                            uint16_t duration_ms) {
+  v->increment = TONE_INCREMENT(frequency);
+  v->level = frequency != 0 ? v->volume : 0;
+  v->remaining_ms = duration_ms;
+  v->active = true;
+}
+
+// Starts the next note of the sequence, or silences the voice at its end.
+static void tone_next_note(ToneVoice *v) {
+  if (v->count == 0) {
+    v->level = 0;
+    v->active = false;
+    return;
+  }
+  uint16_t frequency, duration_ms;
+  if (v->progmem) {
+    frequency = pgm_read_word(&v->notes->frequency);
+    duration_ms = pgm_read_word(&v->notes->duration_ms);
+  } else {
+    frequency = v->notes->frequency;
+    duration_ms = v->notes->duration_ms;
+  }
+  v->notes++;
+  v->count--;
+  // 0 would mean forever
+  tone_start_note(v, frequency, duration_ms != 0 ? duration_ms : 1);
+}
+
+// Runs from the ISR once a millisecond: envelopes and note lengths.
+static void tone_tick(void) {
+  bool active = false;
+  for (uint8_t i = 0; i < BEAN_TONE_VOICES; i++) {
+    ToneVoice *v = &tone_voices[i];
+    if (!v->active) {
+      continue;
+    }
+    if (v->decay != 0 && v->level != 0) {
+      v->level = v->level > v->decay ? v->level - v->decay : 0;
+    }
+    if (v->remaining_ms != 0 && --v->remaining_ms == 0) {
+      tone_next_note(v);
+    }
+    active |= v->active;
+  }
+  if (!active) {
+    // nothing left to play; stay at the midpoint until the next note
+    TIMSK1 &= ~_BV(TOIE1);
+    *tone_ocr = TONE_MID;
+  }
+}
+
+ISR(TIMER1_OVF_vect) {
+  int16_t sum = 0;
+  for (uint8_t i = 0; i < BEAN_TONE_VOICES; i++) {
+    ToneVoice *v = &tone_voices[i];
+    if (v->level == 0) {
+      continue;
+    }
+    uint16_t phase = v->phase + v->increment;
+    v->phase = phase;
+    int8_t sample =
+        pgm_read_byte(v->wave + (phase >> (16 - TONE_TABLE_BITS)));
+    sum += ((int16_t)sample * v->level) >> 8;
+  }
+
+  // the duty cycle is double buffered and takes effect from the next period
+  int16_t out = TONE_MID + (sum >> TONE_SHIFT);
+  if (out < 0) {
+    out = 0;
+  } else if (out > TONE_TOP) {
+    out = TONE_TOP;
+  }
+  *tone_ocr = out;
+
+  tone_us += TONE_US_PER_SAMPLE;
+  if (tone_us >= 1000) {
+    tone_us -= 1000;
+    tone_tick();
+  }
+}
+
+bool BeanToneClass::begin(uint8_t pin) {
+  uint8_t timer = digitalPinToTimer(pin);
+  if (timer != TIMER1A && timer != TIMER1B) {
+    return false;
+  }
+  end();
+
+  uint8_t oldSREG = SREG;
+  cli();
+  for (uint8_t i = 0; i < BEAN_TONE_VOICES; i++) {
+    ToneVoice *v = &tone_voices[i];
+    v->level = 0;
+    v->active = false;
+    v->wave = tone_sine;
+    v->volume = 255;
+    v->decay = 0;
+  }
+  tone_saved_tccr1a = TCCR1A;
+  tone_saved_tccr1b = TCCR1B;
+  tone_saved_icr1 = ICR1;
+
+  // fast PWM, TOP = ICR1 (mode 14), clk/1, non-inverting on the one pin
+  TCCR1B = 0;
+  ICR1 = TONE_TOP;
+  TCNT1 = 0;
+  if (timer == TIMER1A) {
+    tone_ocr = &OCR1A;
+    TCCR1A = _BV(COM1A1) | _BV(WGM11);
+  } else {
+    tone_ocr = &OCR1B;
+    TCCR1A = _BV(COM1B1) | _BV(WGM11);
+  }
+  *tone_ocr = TONE_MID;
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+  SREG = oldSREG;
+
+  pinMode(pin, OUTPUT);
+  return true;
+}
+
+void BeanToneClass::end(void) {
+  if (tone_ocr == NULL) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK1 &= ~_BV(TOIE1);
+  for (uint8_t i = 0; i < BEAN_TONE_VOICES; i++) {
+    tone_voices[i].level = 0;
+    tone_voices[i].active = false;
+  }
+  TCCR1B = 0;
+  TCCR1A = tone_saved_tccr1a;
+  ICR1 = tone_saved_icr1;
+  TCCR1B = tone_saved_tccr1b;
+  tone_ocr = NULL;
+  SREG = oldSREG;
+}
+
+void BeanToneClass::setVoice(uint8_t voice, BeanToneWave wave, uint8_t volume,
+                             uint8_t decay) {
+  if (voice >= BEAN_TONE_VOICES || wave > BEAN_TONE_SAWTOOTH) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  ToneVoice *v = &tone_voices[voice];
+  v->wave = (const int8_t *)pgm_read_word(&tone_waves[wave]);
+  v->volume = volume;
+  v->decay = decay;
+  SREG = oldSREG;
+}
+
+void BeanToneClass::setWavetable(uint8_t voice, const int8_t *table) {
+  if (voice >= BEAN_TONE_VOICES) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  tone_voices[voice].wave = table;
+  SREG = oldSREG;
+}
+
+bool BeanToneClass::play(uint8_t voice, uint16_t frequency,
+                         uint16_t duration_ms) {
+  if (tone_ocr == NULL || voice >= BEAN_TONE_VOICES) {
+    return false;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  ToneVoice *v = &tone_voices[voice];
+  v->count = 0;
+  tone_start_note(v, frequency, duration_ms);
+  TIMSK1 |= _BV(TOIE1);
+  SREG = oldSREG;
+  return true;
+}
+
+bool BeanToneClass::playSequence(uint8_t voice, const BeanToneNote *notes,
+                                 uint8_t count, bool progmem) {
+  if (tone_ocr == NULL || voice >= BEAN_TONE_VOICES) {
+    return false;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  ToneVoice *v = &tone_voices[voice];
+  v->notes = notes;
+  v->count = count;
+  v->progmem = progmem;
+  tone_next_note(v);
+  if (v->active) {
+    TIMSK1 |= _BV(TOIE1);
+  }
+  SREG = oldSREG;
+  return true;
+}
+
+void BeanToneClass::stop(uint8_t voice) {
+  if (voice >= BEAN_TONE_VOICES) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  tone_voices[voice].count = 0;
+  tone_voices[voice].level = 0;
+  tone_voices[voice].active = false;
+  SREG = oldSREG;
+}
+
+bool BeanToneClass::playing(uint8_t voice) {
+  if (voice >= BEAN_TONE_VOICES) {
+    return false;
+  }
+  return *(volatile bool *)&tone_voices[voice].active;
+}
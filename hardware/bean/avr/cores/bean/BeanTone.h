@@ -0,0 +1,122 @@
+#ifndef BEAN_TONE_H
+#define BEAN_TONE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// How many voices are mixed.  It can be set from compiler.cpp.extra_flags in
+// platform.local.txt; each voice costs about 30 cycles per sample while it
+// sounds.
+#ifndef BEAN_TONE_VOICES
+#define BEAN_TONE_VOICES (4)
+#endif
+
+// Samples per second, on both the 8 MHz Bean and the 16 MHz Bean+.  This is
+// also the PWM frequency, and the highest frequency a voice can play is half
+// of it.
+#define BEAN_TONE_SAMPLE_RATE (15625)
+
+/**
+ *  The waveforms the voices can play
+ */
+typedef enum BeanToneWave {
+  BEAN_TONE_SINE = 0,
+  BEAN_TONE_TRIANGLE,
+  BEAN_TONE_SQUARE,
+  BEAN_TONE_SAWTOOTH
+} BeanToneWave;
+
+/**
+ *  One note of a sequence for `BeanTone.playSequence()`
+ */
+typedef struct BeanToneNote {
+  uint16_t frequency;    /**< in Hz, or 0 for a rest */
+  uint16_t duration_ms;  /**< how long the note lasts, including its decay */
+} BeanToneNote;
+
+class BeanToneClass {
+ public:
+  /****************************************************************************/
+  /** @name Tone generator
+   *  Play several notes at once on one PWM pin. Each voice steps through a wavetable at the note's frequency and the voices are mixed into the PWM duty cycle from one Timer1 interrupt, BEAN_TONE_SAMPLE_RATE (15625) times a second. Notes and whole sequences play from that interrupt too, so `loop()` doesn't have to time them.
+   *
+   *  The output is a PWM signal, not a voltage: it drives a piezo or a small speaker through a transistor directly, and an amplifier through an RC low-pass filter.
+   *
+   *  The tone generator owns Timer1 between `begin()` and `end()`, so in the meantime `analogWrite()` doesn't work on pins 1 and 2 and `BeanPwm` can't be used. While any voice is playing, the interrupt takes about a third of the CPU on the 8 MHz Bean with all four voices sounding.
+   */
+  ///@{
+
+  /**
+   *  Takes over Timer1 and starts the output, silent.
+   *
+   *  @param pin 1 or 2, the Timer1 PWM pins
+   *  @return false for any other pin
+   */
+  bool begin(uint8_t pin);
+
+  /**
+   *  Stops every voice and gives Timer1 back as it was before `begin()`.
+   */
+  void end(void);
+
+  /**
+   *  Sets how a voice sounds, from its next note on.
+   *
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   *  @param wave the waveform
+   *  @param volume the level notes start at, 0 to 255
+   *  @param decay how much the level drops every millisecond, for a plucked or bell-like sound; 0 to hold it
+   */
+  void setVoice(uint8_t voice, BeanToneWave wave, uint8_t volume = 255,
+                uint8_t decay = 0);
+
+  /**
+   *  Uses a wavetable of your own for a voice.
+   *
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   *  @param table 64 signed samples, one cycle of the wave, in PROGMEM
+   */
+  void setWavetable(uint8_t voice, const int8_t *table);
+
+  /**
+   *  Plays one note on a voice, replacing whatever it was playing.
+   *
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   *  @param frequency in Hz, up to half of BEAN_TONE_SAMPLE_RATE
+   *  @param duration_ms how long to play it, or 0 to play it until `stop()`
+   *  @return false if `begin()` hasn't been called or voice is out of range
+   */
+  bool play(uint8_t voice, uint16_t frequency, uint16_t duration_ms = 0);
+
+  /**
+   *  Plays a sequence of notes on a voice, one after another, replacing whatever it was playing. The notes are read as they are played, so the array has to stay until `playing()` is false.
+   *
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   *  @param notes the sequence
+   *  @param count how many notes it has
+   *  @param progmem true if notes is in PROGMEM
+   *  @return false if `begin()` hasn't been called or voice is out of range
+   */
+  bool playSequence(uint8_t voice, const BeanToneNote *notes, uint8_t count,
+                    bool progmem = false);
+
+  /**
+   *  Silences a voice.
+   *
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   */
+  void stop(uint8_t voice);
+
+  /**
+   *  @param voice 0 to BEAN_TONE_VOICES - 1
+   *  @return true while the voice has a note or sequence to play
+   */
+  bool playing(uint8_t voice);
+  ///@}
+
+  BeanToneClass() {}
+};
+
+extern BeanToneClass BeanTone;
+
+#endif
@@ -36,29 +36,22 @@
 
 
 #if defined(UBRR1H)
-  ring_buffer rx_buffer1  =  { { 0 }, 0, 0 };
-  ring_buffer tx_buffer1  =  { { 0 }, 0, 0 };
+  serial_ring_buffer rx_buffer1;
+  serial_ring_buffer tx_buffer1;
 #endif
 #if defined(UBRR2H)
-  ring_buffer rx_buffer2  =  { { 0 }, 0, 0 };
-  ring_buffer tx_buffer2  =  { { 0 }, 0, 0 };
+  serial_ring_buffer rx_buffer2;
+  serial_ring_buffer tx_buffer2;
 #endif
 #if defined(UBRR3H)
-  ring_buffer rx_buffer3  =  { { 0 }, 0, 0 };
-  ring_buffer tx_buffer3  =  { { 0 }, 0, 0 };
+  serial_ring_buffer rx_buffer3;
+  serial_ring_buffer tx_buffer3;
 #endif
 
 inline void store_char(unsigned char c, ring_buffer *buffer){
-  unsigned int i = (buffer->head + 1) % SERIAL_BUFFER_SIZE;
-
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  if (i != buffer->tail) {
-    buffer->buffer[buffer->head] = c;
-    buffer->head = i;
-  }
+  // if the buffer is full we're about to overflow it, so we don't write the
+  // character.
+  buffer->store(c);
 }
 
 
@@ -135,8 +128,7 @@ ISR(USART1_UDRE_vect)
   }
   else {
     // There is more data in the output buffer. Send the next byte
-    unsigned char c = tx_buffer1.buffer[tx_buffer1.tail];
-    tx_buffer1.tail = (tx_buffer1.tail + 1) % SERIAL_BUFFER_SIZE;
+    unsigned char c = tx_buffer1.read();
 	
     UDR1 = c;
   }
@@ -152,8 +144,7 @@ ISR(USART2_UDRE_vect)
   }
   else {
     // There is more data in the output buffer. Send the next byte
-    unsigned char c = tx_buffer2.buffer[tx_buffer2.tail];
-    tx_buffer2.tail = (tx_buffer2.tail + 1) % SERIAL_BUFFER_SIZE;
+    unsigned char c = tx_buffer2.read();
 	
     UDR2 = c;
   }
@@ -169,8 +160,7 @@ ISR(USART3_UDRE_vect)
   }
   else {
     // There is more data in the output buffer. Send the next byte
-    unsigned char c = tx_buffer3.buffer[tx_buffer3.tail];
-    tx_buffer3.tail = (tx_buffer3.tail + 1) % SERIAL_BUFFER_SIZE;
+    unsigned char c = tx_buffer3.read();
 	
     UDR3 = c;
   }
@@ -304,33 +294,23 @@ void HardwareSerial::end()
   cbi(*_ucsrb, _udrie);
   
   // clear any received data
-  _rx_buffer->head = _rx_buffer->tail;
+  _rx_buffer->clear();
 }
 
 int HardwareSerial::available(void)
 {
-  return (unsigned int)(SERIAL_BUFFER_SIZE + _rx_buffer->head - _rx_buffer->tail) % SERIAL_BUFFER_SIZE;
+  return _rx_buffer->available();
 }
 
 int HardwareSerial::peek(void)
 {
-  if (_rx_buffer->head == _rx_buffer->tail) {
-    return -1;
-  } else {
-    return _rx_buffer->buffer[_rx_buffer->tail];
-  }
+  return _rx_buffer->peek();
 }
 
 int HardwareSerial::read(void)
 {
-  // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer->head == _rx_buffer->tail) {
-    return -1;
-  } else {
-    unsigned char c = _rx_buffer->buffer[_rx_buffer->tail];
-    _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % SERIAL_BUFFER_SIZE;
-    return c;
-  }
+  // returns -1 if we don't have any characters
+  return _rx_buffer->read();
 }
 
 void HardwareSerial::flush()
@@ -342,17 +322,12 @@ void HardwareSerial::flush()
 
 size_t HardwareSerial::write(uint8_t c)
 {
-  unsigned int i = (_tx_buffer->head + 1) % SERIAL_BUFFER_SIZE;
-	
   // If the output buffer is full, there's nothing for it other than to 
   // wait for the interrupt handler to empty it a bit
   // ???: return 0 here instead?
-  while (i == _tx_buffer->tail)
+  while (!_tx_buffer->store(c))
     ;
 	
-  _tx_buffer->buffer[_tx_buffer->head] = c;
-  _tx_buffer->head = i;
-	
   sbi(*_ucsrb, _udrie);
   // clear the TXC bit -- "can be cleared by writing a one to its bit location"
   transmitting = true;
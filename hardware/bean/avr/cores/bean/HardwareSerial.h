@@ -27,28 +27,21 @@
 #include <inttypes.h>
 
 #include "Stream.h"
+#include "BeanRingBuffer.h"
 #include "applicationMessageHeaders/AppMessages.h"
 
 
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which head is the index of the location
-// to which to write the next incoming character and tail is the index of the
-// location from which to read.
+// Define constants and variables for buffering incoming serial data, see
+// BeanRingBuffer.h.  The size must be a power of two.
 #if (RAMEND < 1000)
   #define SERIAL_BUFFER_SIZE 16
 #else
-  // Probably overkill here, but just ensureing that there is room
-  // for a max message + length, + SOF and EOF
-  #define SERIAL_BUFFER_SIZE (APP_MSG_MAX_LENGTH + 3)
+  // Room for one full message body (APP_MSG_MAX_LENGTH - 2 bytes)
+  #define SERIAL_BUFFER_SIZE 64
 #endif
 
-struct ring_buffer
-{
-  unsigned char buffer[SERIAL_BUFFER_SIZE];
-  volatile unsigned int head;
-  volatile unsigned int tail;
-};
+typedef BeanRingBuffer<SERIAL_BUFFER_SIZE> serial_ring_buffer;
 
 
 class HardwareSerial : public Stream
@@ -89,13 +89,11 @@ size_t Print::print(long n, int base)
 {
   if (base == 0) {
     return write(n);
-  } else if (base == 10) {
-    if (n < 0) {
-      int t = print('-');
-      n = -n;
-      return printNumber(n, 10) + t;
-    }
-    return printNumber(n, 10);
+  } else if (base == 10 && n < 0) {
+    char buf[12];
+    char *str = formatNumber(&buf[sizeof(buf)], -(unsigned long)n, 10);
+    *--str = '-';
+    return write((const uint8_t *)str, &buf[sizeof(buf)] - str);
   } else {
     return printNumber(n, base);
   }
@@ -203,39 +201,82 @@ size_t Print::println(const Printable& x)
 
 // Private Methods /////////////////////////////////////////////////////////////
 
-size_t Print::printNumber(unsigned long n, uint8_t base) {
-  char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-  char *str = &buf[sizeof(buf) - 1];
+// n / 10 with shifts and adds, since AVR has no divide instruction and a 32
+// bit software division per digit is slow.  The estimate is at most one low.
+static inline unsigned long divu10(unsigned long n, uint8_t *rem)
+{
+  unsigned long q = (n >> 1) + (n >> 2);
+  q += q >> 4;
+  q += q >> 8;
+  q += q >> 16;
+  q >>= 3;
+  uint8_t r = (uint8_t)(n - ((q << 3) + (q << 1)));
+  if (r > 9) {
+    q++;
+    r -= 10;
+  }
+  *rem = r;
+  return q;
+}
 
-  *str = '\0';
+// Writes the digits of n backwards from end, returning the first one.  Bases
+// 10 and powers of two don't divide.
+char *Print::formatNumber(char *end, unsigned long n, uint8_t base)
+{
+  char *str = end;
 
   // prevent crash if called with base == 1
   if (base < 2) base = 10;
 
-  do {
-    unsigned long m = n;
-    n /= base;
-    char c = m - base * n;
-    *--str = c < 10 ? c + '0' : c + 'A' - 10;
-  } while(n);
+  if (base == 10) {
+    do {
+      uint8_t c;
+      n = divu10(n, &c);
+      *--str = c + '0';
+    } while (n);
+  } else if ((base & (base - 1)) == 0) {
+    uint8_t shift = 0;
+    while ((1 << shift) < base) shift++;
+    do {
+      uint8_t c = n & (base - 1);
+      n >>= shift;
+      *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+  } else {
+    do {
+      unsigned long m = n;
+      n /= base;
+      char c = m - base * n;
+      *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+  }
 
-  return write(str);
+  return str;
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+  char buf[8 * sizeof(long)]; // Assumes 8-bit chars.
+  char *str = formatNumber(&buf[sizeof(buf)], n, base);
+  return write((const uint8_t *)str, &buf[sizeof(buf)] - str);
 }
 
 size_t Print::printFloat(double number, uint8_t digits) 
 { 
-  size_t n = 0;
-  
   if (isnan(number)) return print("nan");
   if (isinf(number)) return print("inf");
   if (number > 4294967040.0) return print ("ovf");  // constant determined empirically
   if (number <-4294967040.0) return print ("ovf");  // constant determined empirically
-  
-  // Handle negative numbers
-  if (number < 0.0)
-  {
-     n += print('-');
-     number = -number;
+
+  // The whole number goes into one buffer and out in one write.  Up to 9
+  // digits after the point fit an unsigned long and are formatted with one
+  // multiplication; more are done a digit at a time, as they always were.
+  char buf[1 + 10 + 1 + 9];
+  char *end = &buf[sizeof(buf)];
+  uint8_t fast = digits <= 9 ? digits : 0;
+  bool negative = number < 0.0;
+
+  if (negative) {
+    number = -number;
   }
 
   // Round correctly so that print(1.999, 2) prints as "2.00"
@@ -245,10 +286,31 @@ size_t Print::printFloat(double number, uint8_t digits)
   
   number += rounding;
 
-  // Extract the integer part of the number and print it
+  // Extract the integer part of the number
   unsigned long int_part = (unsigned long)number;
   double remainder = number - (double)int_part;
-  n += print(int_part);
+
+  char *str = end;
+  if (fast > 0) {
+    unsigned long scale = 1;
+    for (uint8_t i = 0; i < fast; i++) scale *= 10;
+    unsigned long fraction = (unsigned long)(remainder * scale);
+    if (fraction >= scale) {  // remainder * scale rounded up
+      fraction -= scale;
+      int_part++;
+    }
+    char *digit = formatNumber(end, fraction, 10);
+    while (digit > end - fast) *--digit = '0';
+    str = digit;
+    *--str = '.';
+  }
+  str = formatNumber(str, int_part, 10);
+  if (negative) *--str = '-';
+
+  size_t n = write((const uint8_t *)str, end - str);
+  if (fast == digits) {
+    return n;
+  }
 
   // Print the decimal point, but only if there are digits beyond
   if (digits > 0) {
@@ -37,6 +37,7 @@ class Print
     int write_error;
     size_t printNumber(unsigned long, uint8_t);
     size_t printFloat(double, uint8_t);
+    static char *formatNumber(char *end, unsigned long n, uint8_t base);
   protected:
     void setWriteError(int err = 1) { write_error = err; }
   public:
@@ -230,6 +230,52 @@ void detachInterrupt(uint8_t interruptNum) {
   }
 }
 
+#if defined(EICRA) && defined(EIMSK) && !defined(EICRB)
+// sleep() borrows an interrupt to be woken by a low level on its pin.  What
+// attachInterrupt() set up for it is kept here and put back once awake, so a
+// handler attached to the same interrupt keeps working.
+static uint8_t wakeNum = EXTERNAL_NUM_INTERRUPTS;  // none borrowed
+static uint8_t wakeMode;
+static uint8_t wakeEnabled;
+static voidFuncPtr wakeFunc;
+
+void bean_wake_interrupt_arm(uint8_t interruptNum) {
+  uint8_t shift = interruptNum * 2;
+  uint8_t oldSREG = SREG;
+  cli();
+  wakeNum = interruptNum;
+  wakeMode = (EICRA >> shift) & 3;
+  wakeEnabled = EIMSK & _BV(interruptNum);
+  wakeFunc = intFunc[interruptNum];
+
+  // The pin reaches the low level with a falling edge, so a handler waiting
+  // for one is run for the wake.  Any other is left for its own trigger.
+  if (!wakeEnabled || (wakeMode != FALLING && wakeMode != CHANGE)) {
+    intFunc[interruptNum] = 0;
+  }
+  EICRA &= ~(3 << shift);  // LOW
+  EIMSK |= _BV(interruptNum);
+  SREG = oldSREG;
+}
+
+void bean_wake_interrupt_disarm(void) {
+  if (wakeNum >= EXTERNAL_NUM_INTERRUPTS) {
+    return;
+  }
+  uint8_t shift = wakeNum * 2;
+  uint8_t oldSREG = SREG;
+  cli();
+  EIMSK &= ~_BV(wakeNum);
+  EICRA = (EICRA & ~(3 << shift)) | (wakeMode << shift);
+  // changing the sense bits can raise the flag by itself
+  EIFR = _BV(wakeNum);
+  intFunc[wakeNum] = wakeFunc;
+  EIMSK |= wakeEnabled;
+  wakeNum = EXTERNAL_NUM_INTERRUPTS;
+  SREG = oldSREG;
+}
+#endif
+
 /*
 void attachInterruptTwi(void (*userFunc)(void) ) {
   twiIntFunc = userFunc;
@@ -306,12 +352,14 @@ ISR(INT7_vect) {
 
 #else
 
-ISR(INT0_vect) {
+// Weak, so that a sketch defining ISR(INT0_vect) or ISR(INT1_vect) itself
+// replaces the dispatch through intFunc[] and its full register save.
+ISR(INT0_vect, __attribute__((weak))) {
   if(intFunc[EXTERNAL_INT_0])
     intFunc[EXTERNAL_INT_0]();
 }
 
-ISR(INT1_vect) {
+ISR(INT1_vect, __attribute__((weak))) {
   if(intFunc[EXTERNAL_INT_1])
     intFunc[EXTERNAL_INT_1]();
 }
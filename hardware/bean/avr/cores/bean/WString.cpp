@@ -100,9 +100,18 @@ String::String(unsigned long value, unsigned char base)
 	*this = buf;
 }
 
+String::String(char *fixed, unsigned int size)
+{
+	buffer = fixed;
+	buffer[0] = 0;
+	capacity = size;
+	len = 0;
+	flags = STRING_FIXED;
+}
+
 String::~String()
 {
-	free(buffer);
+	if (!(flags & STRING_FIXED)) free(buffer);
 }
 
 /*********************************************/
@@ -119,6 +128,12 @@ inline void String::init(void)
 
 void String::invalidate(void)
 {
+	if (flags & STRING_FIXED) {
+		// keep the storage, there's nothing to get back
+		buffer[0] = 0;
+		len = 0;
+		return;
+	}
 	if (buffer) free(buffer);
 	buffer = NULL;
 	capacity = len = 0;
@@ -136,6 +151,7 @@ unsigned char String::reserve(unsigned int size)
 
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
+	if (flags & STRING_FIXED) return maxStrLen <= capacity;
 	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
 	if (newbuffer) {
 		buffer = newbuffer;
@@ -163,6 +179,12 @@ String & String::copy(const char *cstr, unsigned int length)
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
 void String::move(String &rhs)
 {
+	// a fixed buffer can neither be given away nor replaced
+	if ((flags | rhs.flags) & STRING_FIXED) {
+		if (rhs.buffer) copy(rhs.buffer, rhs.len);
+		else invalidate();
+		return;
+	}
 	if (buffer) {
 		if (capacity >= rhs.len) {
 			strcpy(buffer, rhs.buffer);
@@ -175,8 +175,12 @@ protected:
 	char *buffer;	        // the actual char array
 	unsigned int capacity;  // the array length minus one (for the '\0')
 	unsigned int len;       // the String length (not counting the '\0')
-	unsigned char flags;    // unused, for future features
+	unsigned char flags;    // STRING_FIXED if buffer isn't ours to realloc
+	enum { STRING_FIXED = 0x01 };
 protected:
+	// uses size + 1 bytes at fixed for the string, and never reallocates
+	// them, for StaticString
+	String(char *fixed, unsigned int size);
 	void init(void);
 	void invalidate(void);
 	unsigned char changeBuffer(unsigned int maxStrLen);
@@ -202,5 +206,48 @@ public:
 	StringSumHelper(unsigned long num) : String(num) {}
 };
 
+// A String that keeps up to N characters inside the object, so it never
+// touches the heap and can't fragment it.  It has the whole String API and
+// can be passed anywhere a String & is taken.  What doesn't fit fails the
+// same way an allocation failure does with String: concat() and += leave it
+// unchanged and return false, while an assignment leaves it empty (a
+// StaticString is never invalid).
+//
+// Only what makes new Strings allocates: substring(), the temporaries of
+// a + b (build with += or concat() instead), and a "literal" passed where a
+// String is taken, as in replace("a", "b").
+template <unsigned int N>
+class StaticString : public String
+{
+public:
+	StaticString(const char *cstr = "") : String(storage, N) {*this = cstr;}
+	StaticString(const String &str) : String(storage, N) {*this = str;}
+	StaticString(const StaticString &str) : String(storage, N) {*this = str;}
+	explicit StaticString(char c) : String(storage, N) {concat(c);}
+	explicit StaticString(unsigned char value, unsigned char base=10) : String(storage, N)
+		{char buf[9]; utoa(value, buf, base); *this = buf;}
+	explicit StaticString(int value, unsigned char base=10) : String(storage, N)
+		{char buf[18]; itoa(value, buf, base); *this = buf;}
+	explicit StaticString(unsigned int value, unsigned char base=10) : String(storage, N)
+		{char buf[17]; utoa(value, buf, base); *this = buf;}
+	explicit StaticString(long value, unsigned char base=10) : String(storage, N)
+		{char buf[34]; ltoa(value, buf, base); *this = buf;}
+	explicit StaticString(unsigned long value, unsigned char base=10) : String(storage, N)
+		{char buf[33]; ultoa(value, buf, base); *this = buf;}
+
+	StaticString & operator = (const StaticString &rhs)
+		{String::operator = (rhs); return *this;}
+	StaticString & operator = (const String &rhs)
+		{String::operator = (rhs); return *this;}
+	StaticString & operator = (const char *cstr)
+		{String::operator = (cstr); return *this;}
+
+	// the most characters it can hold
+	static unsigned int maxLength(void) {return N;}
+
+private:
+	char storage[N + 1];
+};
+
 #endif  // __cplusplus
 #endif  // String_class_h
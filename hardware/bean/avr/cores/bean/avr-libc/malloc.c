@@ -59,6 +59,10 @@ char *__malloc_heap_end = &__heap_end;
 char *__brkval;
 struct __freelist *__flp;
 
+/* Memory health, read by Bean.getMemoryStats(). */
+char *__malloc_brkval_max;
+uint16_t __malloc_failures;
+
 ATTRIBUTE_CLIB_SECTION
 void *
 malloc(size_t len)
@@ -67,6 +71,11 @@ malloc(size_t len)
 	char *cp;
 	size_t s, avail;
 
+#if BEAN_POOL_ALLOC
+	if ((cp = __pool_malloc(len)) != 0)
+		return cp;
+#endif
+
 	/*
 	 * Our minimum chunk size is the size of a pointer (plus the
 	 * size of the "sz" field, but we don't need to account for
@@ -159,11 +168,13 @@ malloc(size_t len)
 	cp = __malloc_heap_end;
 	if (cp == 0)
 		cp = STACK_POINTER() - __malloc_margin;
-	if (cp <= __brkval)
+	if (cp <= __brkval) {
 	  /*
 	   * Memory exhausted.
 	   */
+	  __malloc_note_failure();
 	  return 0;
+	}
 	avail = cp - __brkval;
 	/*
 	 * Both tests below are needed to catch the case len >= 0xfffe.
@@ -171,12 +182,14 @@ malloc(size_t len)
 	if (avail >= len && avail >= len + sizeof(size_t)) {
 		fp1 = (struct __freelist *)__brkval;
 		__brkval += len + sizeof(size_t);
+		__malloc_note_brkval();
 		fp1->sz = len;
 		return &(fp1->nx);
 	}
 	/*
 	 * Step 4: There's no help, just fail. :-/
 	 */
+	__malloc_note_failure();
 	return 0;
 }
 
@@ -192,6 +205,13 @@ free(void *p)
 	if (p == 0)
 		return;
 
+#if BEAN_POOL_ALLOC
+	if (__pool_block_size(p)) {
+		__pool_free(p);
+		return;
+	}
+#endif
+
 	cpnew = p;
 	cpnew -= sizeof(size_t);
 	fpnew = (struct __freelist *)cpnew;
@@ -0,0 +1,115 @@
+/*
+ * Segregated fixed-block pools for malloc(), see BEAN_POOL_ALLOC in
+ * stdlib_private.h.
+ *
+ * One static arena holds the 8, 16, 32 and 64 byte classes one after the
+ * other, so the class of a block is found from its address alone and a
+ * block needs no header.  Each class keeps its free blocks on a list
+ * threaded through the blocks themselves.
+ */
+
+#include <stdlib.h>
+#include "sectionname.h"
+#include "stdlib_private.h"
+
+#if BEAN_POOL_ALLOC
+
+#define POOL_CLASSES 4
+
+#define POOL_ARENA_SIZE (BEAN_POOL_8_BLOCKS * 8 + BEAN_POOL_16_BLOCKS * 16 + \
+			 BEAN_POOL_32_BLOCKS * 32 + BEAN_POOL_64_BLOCKS * 64)
+
+#if POOL_ARENA_SIZE == 0
+#error BEAN_POOL_ALLOC needs at least one BEAN_POOL_*_BLOCKS above 0
+#endif
+
+struct __pool_block {
+	struct __pool_block *nx;
+};
+
+static char pool_arena[POOL_ARENA_SIZE];
+static struct __pool_block *pool_free[POOL_CLASSES];
+static char pool_ready;
+
+static const uint8_t pool_sizes[POOL_CLASSES] = {8, 16, 32, 64};
+static const uint8_t pool_blocks[POOL_CLASSES] = {
+	BEAN_POOL_8_BLOCKS, BEAN_POOL_16_BLOCKS,
+	BEAN_POOL_32_BLOCKS, BEAN_POOL_64_BLOCKS
+};
+
+/* Threads every block onto its class's list, lowest address first. */
+static void
+pool_init(void)
+{
+	char *cp = pool_arena + POOL_ARENA_SIZE;
+	uint8_t c, i;
+
+	for (c = POOL_CLASSES; c-- > 0;) {
+		for (i = 0; i < pool_blocks[c]; i++) {
+			cp -= pool_sizes[c];
+			((struct __pool_block *)cp)->nx = pool_free[c];
+			pool_free[c] = (struct __pool_block *)cp;
+		}
+	}
+	pool_ready = 1;
+}
+
+ATTRIBUTE_CLIB_SECTION
+void *
+__pool_malloc(size_t len)
+{
+	struct __pool_block *bp;
+	uint8_t c;
+
+	if (!pool_ready)
+		pool_init();
+
+	for (c = 0; c < POOL_CLASSES; c++) {
+		if (len > pool_sizes[c] || pool_free[c] == 0)
+			continue;
+		bp = pool_free[c];
+		pool_free[c] = bp->nx;
+		return bp;
+	}
+	return 0;
+}
+
+/* The class p is a block of, or POOL_CLASSES if it's outside the arena. */
+static uint8_t
+pool_class(void *p)
+{
+	char *cp = (char *)p;
+	char *end = pool_arena;
+	uint8_t c;
+
+	if (cp < pool_arena)
+		return POOL_CLASSES;
+	for (c = 0; c < POOL_CLASSES; c++) {
+		end += (size_t)pool_blocks[c] * pool_sizes[c];
+		if (cp < end)
+			break;
+	}
+	return c;
+}
+
+ATTRIBUTE_CLIB_SECTION
+size_t
+__pool_block_size(void *p)
+{
+	uint8_t c = pool_class(p);
+
+	return c < POOL_CLASSES ? pool_sizes[c] : 0;
+}
+
+ATTRIBUTE_CLIB_SECTION
+void
+__pool_free(void *p)
+{
+	struct __pool_block *bp = (struct __pool_block *)p;
+	uint8_t c = pool_class(p);
+
+	bp->nx = pool_free[c];
+	pool_free[c] = bp;
+}
+
+#endif /* BEAN_POOL_ALLOC */
@@ -50,14 +50,29 @@ realloc(void *ptr, size_t len)
 	if (ptr == 0)
 		return malloc(len);
 
+#if BEAN_POOL_ALLOC
+	/* A pool block can't grow, so move it once it's outgrown. */
+	if ((s = __pool_block_size(ptr)) != 0) {
+		if (len <= s)
+			return ptr;
+		if ((memp = malloc(len)) == 0)
+			return 0;
+		memcpy(memp, ptr, s);
+		free(ptr);
+		return memp;
+	}
+#endif
+
 	cp1 = (char *)ptr;
 	cp1 -= sizeof(size_t);
 	fp1 = (struct __freelist *)cp1;
 
 	cp = (char *)ptr + len; /* new next pointer */
-	if (cp < cp1)
+	if (cp < cp1) {
 		/* Pointer wrapped across top of RAM, fail. */
+		__malloc_note_failure();
 		return 0;
+	}
 
 	/*
 	 * See whether we are growing or shrinking.  When shrinking,
@@ -130,10 +145,12 @@ realloc(void *ptr, size_t len)
 			cp1 = STACK_POINTER() - __malloc_margin;
 		if (cp < cp1) {
 			__brkval = cp;
+			__malloc_note_brkval();
 			fp1->sz = len;
 			return ptr;
 		}
 		/* If that failed, we are out of luck. */
+		__malloc_note_failure();
 		return 0;
 	}
 
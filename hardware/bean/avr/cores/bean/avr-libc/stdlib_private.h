@@ -47,12 +47,55 @@ extern struct __freelist *__flp; /* freelist pointer (head of freelist) */
 extern size_t __malloc_margin;	/* user-changeable before the first malloc() */
 extern char *__malloc_heap_start;
 extern char *__malloc_heap_end;
+extern char *__malloc_brkval_max; /* highest __brkval so far */
+extern uint16_t __malloc_failures; /* requests that couldn't be satisfied */
 
 extern char __heap_start;
 extern char __heap_end;
 
+/*
+ * Fixed-block pools in front of the heap, built with -DBEAN_POOL_ALLOC=1.
+ * Requests of up to 64 bytes take a block from the smallest class that
+ * fits and has one free, in constant time, and fall back to the heap when
+ * none does.  The blocks live in a static array, so they count as .bss
+ * rather than heap.
+ */
+#ifndef BEAN_POOL_ALLOC
+#define BEAN_POOL_ALLOC 0
+#endif
+#ifndef BEAN_POOL_8_BLOCKS
+#define BEAN_POOL_8_BLOCKS 8
+#endif
+#ifndef BEAN_POOL_16_BLOCKS
+#define BEAN_POOL_16_BLOCKS 8
+#endif
+#ifndef BEAN_POOL_32_BLOCKS
+#define BEAN_POOL_32_BLOCKS 4
+#endif
+#ifndef BEAN_POOL_64_BLOCKS
+#define BEAN_POOL_64_BLOCKS 2
+#endif
+
+#if BEAN_POOL_ALLOC
+extern void *__pool_malloc(size_t len);	/* 0 if no block fits */
+extern size_t __pool_block_size(void *p); /* 0 if p isn't a pool block */
+extern void __pool_free(void *p);
+#endif
+
 /* Needed for definition of AVR_STACK_POINTER_REG. */
 #include <avr/io.h>
 
 #define STACK_POINTER() ((char *)AVR_STACK_POINTER_REG)
 
+static inline void __malloc_note_brkval(void)
+{
+	if (__brkval > __malloc_brkval_max)
+		__malloc_brkval_max = __brkval;
+}
+
+static inline void __malloc_note_failure(void)
+{
+	if (__malloc_failures != 0xffff)
+		__malloc_failures++;
+}
+
@@ -18,7 +18,12 @@ int main(void)
 
   for (;;) {
     loop();
+    Serial.pollReplies();
+    Bean.pollEvents();
     if (serialEventRun) serialEventRun();
+    if (!BeanScheduler.run()) {
+      bean_idle();
+    }
   }
 
   return 0;
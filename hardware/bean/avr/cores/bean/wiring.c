@@ -23,6 +23,8 @@
 */
 
 #include "wiring_private.h"
+#include "BeanScheduler.h"
+#include "BeanEnergy.h"
 
 // the prescaler is set so that timer0 ticks every 64 clock cycles, and the
 // the overflow handler is called every 256 ticks.
@@ -40,6 +42,8 @@
 volatile unsigned long timer0_overflow_count = 0;
 volatile unsigned long timer0_millis = 0;
 static unsigned char timer0_fract = 0;
+// microseconds left over from advancing timer0_overflow_count by whole overflows
+static unsigned int timer0_advance_us = 0;
 
 #if defined(__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
 ISR(TIM0_OVF_vect)
@@ -62,59 +66,104 @@ ISR(TIMER0_OVF_vect)
 	timer0_fract = f;
 	timer0_millis = m;
 	timer0_overflow_count++;
+
+#if BEAN_ENERGY_STATS
+	bean_energy_tick();
+#endif
+
+	// the scheduler's timer wheel follows millis() while it has timers
+	if (bean_timers_armed)
+		bean_timer_tick(m);
 }
 
 unsigned long millis()
 {
-	unsigned long m;
-	uint8_t oldSREG = SREG;
+	unsigned long m = timer0_millis;
 
-	// disable interrupts while we read timer0_millis or we might get an
-	// inconsistent value (e.g. in the middle of a write to timer0_millis)
-	cli();
-	m = timer0_millis;
-	SREG = oldSREG;
+	// only the overflow handler writes timer0_millis while interrupts are
+	// on, so a read it didn't interrupt reads the same value again; this
+	// saves masking interrupts, which would hold off the serial RX handler
+	unsigned long again;
+	while ((again = timer0_millis) != m)
+		m = again;
 
 	return m;
 }
 
-unsigned long micros() {
-	unsigned long m;
-	uint8_t oldSREG = SREG, t;
-	
+void advanceMillis(unsigned long ms)
+{
+	// split ms so that ms * 1000 can't overflow
+	unsigned long whole = ms / MICROSECONDS_PER_TIMER0_OVERFLOW;
+	unsigned long part = (ms % MICROSECONDS_PER_TIMER0_OVERFLOW) * 1000 + timer0_advance_us;
+	unsigned long overflows = whole * 1000 + part / MICROSECONDS_PER_TIMER0_OVERFLOW;
+	uint8_t oldSREG = SREG;
+
 	cli();
-	m = timer0_overflow_count;
-#if defined(TCNT0)
-	t = TCNT0;
-#elif defined(TCNT0L)
-	t = TCNT0L;
-#else
-	#error TIMER 0 not defined
-#endif
+	timer0_millis += ms;
+	timer0_overflow_count += overflows;
+	timer0_advance_us = part % MICROSECONDS_PER_TIMER0_OVERFLOW;
+	SREG = oldSREG;
+}
+
+// microseconds per Timer0 tick: 8 on the 8 MHz Bean, 4 on the 16 MHz Bean+.
+// A power of two for both, so the scaling below folds into shifts.
+#define MICROSECONDS_PER_TIMER0_TICK (64 / clockCyclesPerMicrosecond())
 
-  
 #ifdef TIFR0
-	if ((TIFR0 & _BV(TOV0)) && (t < 255))
-		m++;
+#define TIMER0_OVERFLOW_PENDING() (TIFR0 & _BV(TOV0))
 #else
-	if ((TIFR & _BV(TOV0)) && (t < 255))
-		m++;
+#define TIMER0_OVERFLOW_PENDING() (TIFR & _BV(TOV0))
 #endif
 
-	SREG = oldSREG;
-	
-	return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond());
+unsigned long micros() {
+	unsigned long m, first;
+	uint8_t t;
+
+	// read the overflow count and TCNT0 as one value without masking
+	// interrupts: if the overflow handler ran in between, the count reads
+	// differently the second time and we go round again.  With interrupts
+	// off the handler can't run and a pending overflow is counted from TOV0;
+	// TCNT0 of 255 means it came after TCNT0 was read.
+	do {
+		first = timer0_overflow_count;
+		m = first;
+		t = TCNT0;
+		if (TIMER0_OVERFLOW_PENDING() && (t < 255))
+			m++;
+	} while (timer0_overflow_count != first);
+
+	return ((m << 8) + t) * MICROSECONDS_PER_TIMER0_TICK;
+}
+
+unsigned int micros16() {
+	uint8_t m, first, t;
+
+	// the low 16 bits of micros() only depend on the low byte of the count
+	do {
+		first = *(volatile uint8_t *)&timer0_overflow_count;
+		m = first;
+		t = TCNT0;
+		if (TIMER0_OVERFLOW_PENDING() && (t < 255))
+			m++;
+	} while (*(volatile uint8_t *)&timer0_overflow_count != first);
+
+	return (((unsigned int)m << 8) | t) * MICROSECONDS_PER_TIMER0_TICK;
 }
 
 void delay(unsigned long ms)
 {
-	uint16_t start = (uint16_t)micros();
+	uint16_t start = micros16();
 
 	while (ms > 0) {
-		if (((uint16_t)micros() - start) >= 1000) {
+		if ((uint16_t)(micros16() - start) >= 1000) {
 			ms--;
 			start += 1000;
 		}
+		// an idle sleep lasts up to one Timer0 overflow, so spin the
+		// last couple of ms to stay accurate
+		if (ms > 2) {
+			bean_idle();
+		}
 	}
 }
 
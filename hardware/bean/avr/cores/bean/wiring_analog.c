@@ -37,10 +37,8 @@ void analogReference(uint8_t mode)
 	analog_reference = mode;
 }
 
-int analogRead(uint8_t pin)
+uint8_t analog_pin_to_channel(uint8_t pin)
 {
-	uint8_t low, high;
-
 #if defined(IS_BEAN)
 	if ( 0 == pin )
 		pin = 18;
@@ -60,6 +58,15 @@ int analogRead(uint8_t pin)
 	if (pin >= NUM_DIGITAL_PINS) pin -= NUM_DIGITAL_PINS; // allow for channel or pin numbers
 #endif
 
+	return pin;
+}
+
+int analogRead(uint8_t pin)
+{
+	uint8_t low, high;
+
+	pin = analog_pin_to_channel(pin);
+
 #if defined(__AVR_ATmega32U4__)
 	pin = analogPinToChannel(pin);
 	ADCSRB = (ADCSRB & ~(1 << MUX5)) | (((pin >> 3) & 0x01) << MUX5);
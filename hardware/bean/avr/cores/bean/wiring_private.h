@@ -64,6 +64,16 @@ extern "C"{
 
 typedef void (*voidFuncPtr)(void);
 
+// Has external interrupt interruptNum wake the ATmega from power-down on a
+// low level, keeping what attachInterrupt() set up for it until
+// bean_wake_interrupt_disarm() puts it back.
+void bean_wake_interrupt_arm(uint8_t interruptNum);
+void bean_wake_interrupt_disarm(void);
+
+// The ADC channel analogRead(pin) converts, before the ATmega32U4's
+// analogPinToChannel() remapping.
+uint8_t analog_pin_to_channel(uint8_t pin);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -24,32 +24,150 @@
 
 #include "wiring_private.h"
 
-uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
-	uint8_t value = 0;
-	uint8_t i;
-
-	for (i = 0; i < 8; ++i) {
-		digitalWrite(clockPin, HIGH);
-		if (bitOrder == LSBFIRST)
-			value |= digitalRead(dataPin) << i;
-		else
-			value |= digitalRead(dataPin) << (7 - i);
-		digitalWrite(clockPin, LOW);
+// shiftOutSPI() and shiftInSPI() shift through the SPI hardware on MOSI or
+// MISO and SCK, at F_CPU / 4, mode 0 out and mode 1 in: shiftIn() reads each
+// bit after the rising clock edge, so after the device has shifted, and mode
+// 1 samples on the falling edge to match.  While the SPI is on it owns both
+// data pins, so the one not shifting must be an input the sketch can spare:
+// with MISO an output (a 595's latch, say) or MOSI one (a 165's load), the
+// bytes are bit-banged instead.  So are they while the SPI is busy, or while
+// its SS pin is an input held low, which would drop a master to slave mode.
+static uint8_t shift_spi_begin(uint8_t dataPin, uint8_t otherPin,
+                               uint8_t bitOrder, uint8_t mode)
+{
+	// an interrupt driven transfer owns the SPI
+	if (SPCR & _BV(SPIE))
+		return 0;
+	if (*portModeRegister(digitalPinToPort(otherPin)) &
+	    digitalPinToBitMask(otherPin))
+		return 0;
+	uint8_t ss_port = digitalPinToPort(SS);
+	uint8_t ss_mask = digitalPinToBitMask(SS);
+	if (!(*portModeRegister(ss_port) & ss_mask) &&
+	    !(*portInputRegister(ss_port) & ss_mask))
+		return 0;
+
+	// the clock idles low, also once the SPI lets go of the pin
+	digitalWrite(SCK, LOW);
+	pinMode(SCK, OUTPUT);
+	if (dataPin == MOSI)
+		pinMode(dataPin, OUTPUT);
+	SPCR = _BV(SPE) | _BV(MSTR) | mode |
+	       (bitOrder == LSBFIRST ? _BV(DORD) : 0);
+	SPSR &= ~_BV(SPI2X);
+	// clear an old SPIF
+	(void)SPSR;
+	(void)SPDR;
+	return 1;
+}
+
+static inline uint8_t shift_spi_transfer(uint8_t value)
+{
+	SPDR = value;
+	while (!(SPSR & _BV(SPIF)))
+		;
+	return SPDR;
+}
+
+void shiftOutSPI(uint8_t bitOrder, const uint8_t *buf, size_t n)
+{
+	uint8_t spcr = SPCR, spsr = SPSR;
+	if (!shift_spi_begin(MOSI, MISO, bitOrder, 0)) {
+		shiftOutBuffer(MOSI, SCK, bitOrder, buf, n);
+		return;
 	}
+	while (n--)
+		shift_spi_transfer(*buf++);
+	SPCR = spcr;
+	SPSR = spsr;
+}
+
+void shiftInSPI(uint8_t bitOrder, uint8_t *buf, size_t n)
+{
+	uint8_t spcr = SPCR, spsr = SPSR;
+	if (!shift_spi_begin(MISO, MOSI, bitOrder, _BV(CPHA))) {
+		shiftInBuffer(MISO, SCK, bitOrder, buf, n);
+		return;
+	}
+	while (n--)
+		*buf++ = shift_spi_transfer(0);
+	SPCR = spcr;
+	SPSR = spsr;
+}
+
+void shiftInBuffer(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder,
+                   uint8_t *buf, size_t n)
+{
+	// look the pins up once rather than for every bit
+	volatile uint8_t *data_in = portInputRegister(digitalPinToPort(dataPin));
+	uint8_t data_mask = digitalPinToBitMask(dataPin);
+	volatile uint8_t *clock_out = portOutputRegister(digitalPinToPort(clockPin));
+	uint8_t clock_mask = digitalPinToBitMask(clockPin);
+	// and turn PWM off the clock pin, as digitalWrite() would
+	digitalWrite(clockPin, LOW);
+
+	while (n--) {
+		uint8_t value = 0;
+		uint8_t i;
+		// interrupts that write the same port mustn't come in between the
+		// read and the write of each clock edge
+		uint8_t oldSREG = SREG;
+		cli();
+		for (i = 0; i < 8; ++i) {
+			*clock_out |= clock_mask;
+			if (bitOrder == LSBFIRST)
+				value = (value >> 1) | ((*data_in & data_mask) ? 0x80 : 0);
+			else
+				value = (value << 1) | ((*data_in & data_mask) ? 1 : 0);
+			*clock_out &= ~clock_mask;
+		}
+		SREG = oldSREG;
+		*buf++ = value;
+	}
+}
+
+void shiftOutBuffer(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder,
+                    const uint8_t *buf, size_t n)
+{
+	volatile uint8_t *data_out = portOutputRegister(digitalPinToPort(dataPin));
+	uint8_t data_mask = digitalPinToBitMask(dataPin);
+	volatile uint8_t *clock_out = portOutputRegister(digitalPinToPort(clockPin));
+	uint8_t clock_mask = digitalPinToBitMask(clockPin);
+	digitalWrite(dataPin, LOW);
+	digitalWrite(clockPin, LOW);
+
+	while (n--) {
+		uint8_t value = *buf++;
+		uint8_t i;
+		uint8_t oldSREG = SREG;
+		cli();
+		for (i = 0; i < 8; i++) {
+			uint8_t bit;
+			if (bitOrder == LSBFIRST) {
+				bit = value & 1;
+				value >>= 1;
+			} else {
+				bit = value & 0x80;
+				value <<= 1;
+			}
+			if (bit)
+				*data_out |= data_mask;
+			else
+				*data_out &= ~data_mask;
+			*clock_out |= clock_mask;
+			*clock_out &= ~clock_mask;
+		}
+		SREG = oldSREG;
+	}
+}
+
+uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
+	uint8_t value;
+	shiftInBuffer(dataPin, clockPin, bitOrder, &value, 1);
 	return value;
 }
 
 void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val)
 {
-	uint8_t i;
-
-	for (i = 0; i < 8; i++)  {
-		if (bitOrder == LSBFIRST)
-			digitalWrite(dataPin, !!(val & (1 << i)));
-		else	
-			digitalWrite(dataPin, !!(val & (1 << (7 - i))));
-			
-		digitalWrite(clockPin, HIGH);
-		digitalWrite(clockPin, LOW);		
-	}
+	shiftOutBuffer(dataPin, clockPin, bitOrder, &val, 1);
 }
@@ -0,0 +1,104 @@
+/*
+  EEPROM.cpp - EEPROM library, interrupt driven writes
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <avr/interrupt.h>
+#include "EEPROM.h"
+
+#if EEPROM_ASYNC_QUEUE & ( EEPROM_ASYNC_QUEUE - 1 )
+#error "EEPROM_ASYNC_QUEUE must be a power of two"
+#endif
+
+struct EEAsyncWrite{
+    int index;
+    const uint8_t *data;
+    uint16_t length;    //bytes left
+    volatile bool *done;
+};
+
+//The ISR owns the writes from asyncTail up to asyncHead.
+static EEAsyncWrite asyncJobs[ EEPROM_ASYNC_QUEUE ];
+static volatile uint8_t asyncHead = 0;
+static volatile uint8_t asyncTail = 0;
+
+//Starts the next byte that differs from the EEPROM, or turns the interrupt
+//off once the queue is empty.  Called with interrupts off and EEPE clear.
+static void eeprom_service(){
+    while( asyncTail != asyncHead ){
+        EEAsyncWrite *job = &asyncJobs[ asyncTail & ( EEPROM_ASYNC_QUEUE - 1 ) ];
+        if( job->length == 0 ){
+            //its last byte, if it wrote one, has just finished
+            if( job->done ){
+                *job->done = true;
+            }
+            asyncTail = asyncTail + 1;
+            continue;
+        }
+        uint8_t value = *job->data++;
+        EEAR = job->index++;
+        --job->length;
+        EECR |= _BV( EERE );
+        if( EEDR != value ){
+            EEDR = value;
+            //erase and write; EEPE has to follow EEMPE within four cycles
+            EECR = _BV( EERIE ) | _BV( EEMPE );
+            EECR |= _BV( EEPE );
+            return;
+        }
+    }
+    EECR &= ~_BV( EERIE );
+}
+
+ISR( EE_READY_vect ){
+    eeprom_service();
+}
+
+bool EEPROMClass::writeAsync( int idx, const void *data, uint16_t length, volatile bool *done ){
+    uint8_t oldSREG = SREG;
+    cli();
+    uint8_t h = asyncHead;
+    if( (uint8_t)( h - asyncTail ) >= EEPROM_ASYNC_QUEUE ){
+        SREG = oldSREG;
+        return false;
+    }
+    EEAsyncWrite *job = &asyncJobs[ h & ( EEPROM_ASYNC_QUEUE - 1 ) ];
+    job->index = idx;
+    job->data = (const uint8_t*) data;
+    job->length = length;
+    job->done = done;
+    if( done ){
+        *done = false;
+    }
+    asyncHead = h + 1;
+    //fires as soon as any write in progress is done
+    EECR |= _BV( EERIE );
+    SREG = oldSREG;
+    return true;
+}
+
+bool EEPROMClass::asyncBusy(){
+    return asyncHead != asyncTail;
+}
+
+void EEPROMClass::flushAsync(){
+    while( asyncHead != asyncTail ){
+        //with interrupts off nothing else will run the queue
+        if( !( SREG & _BV( SREG_I ) ) && !( EECR & _BV( EEPE ) ) ){
+            eeprom_service();
+        }
+    }
+}
@@ -24,6 +24,7 @@
 #include <inttypes.h>
 #include <avr/eeprom.h>
 #include <avr/io.h>
+#include <stddef.h>
 
 /***
     EERef class.
@@ -105,6 +106,11 @@ struct EEPtr{
     int index; //Index of current EEPROM cell.
 };
 
+//Number of putAsync() writes that can wait at once, a power of two.
+#ifndef EEPROM_ASYNC_QUEUE
+#define EEPROM_ASYNC_QUEUE 4
+#endif
+
 /***
     EEPROMClass class.
     
@@ -140,6 +146,28 @@ struct EEPROMClass{
         for( int count = sizeof(T) ; count ; --count, ++e )  (*e).update( *ptr++ );
         return t;
     }
+
+    /***
+        Non-blocking writes.
+
+        putAsync() queues the object and returns straight away; the EE_READY
+        interrupt then writes it one byte at a time, skipping bytes that
+        already hold the right value, just like put().  The object is read as
+        it is written, so it has to stay alive and unchanged until done is set
+        (or asyncBusy() is false).  Returns false if EEPROM_ASYNC_QUEUE writes
+        are already waiting.
+
+        The EEPROM can't be read or written any other way while an async
+        write is going, so the blocking methods above must not be used until
+        flushAsync() returns.
+    ***/
+    template< typename T > bool putAsync( int idx, const T &t, volatile bool *done = NULL ){
+        return writeAsync( idx, &t, sizeof(T), done );
+    }
+
+    bool writeAsync( int idx, const void *data, uint16_t length, volatile bool *done = NULL );
+    bool asyncBusy();
+    void flushAsync();  //waits for every queued write to finish
 };
 
 static EEPROMClass EEPROM;
@@ -0,0 +1,302 @@
+/*
+  EEPROMStore.cpp - wear-leveled key/value storage on top of the EEPROM library
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+#include "Arduino.h"
+#include "BeanCrc32.h"
+#include "EEPROM.h"
+#include "EEPROMStore.h"
+
+//Record layout.  The CRC covers everything before it and is written last, so
+//a record cut short by a reset never checks out.
+#define RECORD_SEQUENCE 0
+#define RECORD_KEY      4
+#define RECORD_LENGTH   5
+#define RECORD_VALUE    6
+#define RECORD_CRC      ( EEPROM_STORE_RECORD_SIZE - 2 )
+
+#define NO_KEY 0xFF     //an erased cell
+
+//Entry flags.
+#define LIVE  0x01      //slot holds the value's latest record
+#define DIRTY 0x02      //changed since the last batch
+#define BATCH 0x04      //to be written by the current batch
+
+EEPROMStore::EEPROMStore()
+    : count( 0 ), staged( 0 ), stagedAt( 0 ), start( 0 ), slots( 0 ),
+      head( 0 ), sequence( 0 ), writing( NULL ), queued( false ),
+      written( false ), writeSlot( 0 ), timer( -1 ) {}
+
+bool EEPROMStore::begin( uint16_t start, uint16_t length ){
+    if( timer >= 0 ){
+        BeanScheduler.cancel( timer );
+        timer = -1;
+    }
+    //a record of ours may still be going out of this buffer
+    EEPROM.flushAsync();
+    this->start = start;
+    count = 0;
+    staged = 0;
+    writing = NULL;
+    head = 0;
+    sequence = 0;
+
+    uint16_t records = length / EEPROM_STORE_RECORD_SIZE;
+    if( records < EEPROM_STORE_MAX_KEYS + 2 ){
+        slots = 0;
+        return false;
+    }
+    slots = records > 255 ? 255 : records;
+
+    bool ok = true;
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t latest[ EEPROM_STORE_MAX_KEYS ];
+
+    for( uint8_t s = 0 ; s < slots ; ++s ){
+        readRecord( s );
+        uint8_t key = record[ RECORD_KEY ];
+        uint8_t valueLength = record[ RECORD_LENGTH ];
+        if( key == NO_KEY || valueLength > EEPROM_STORE_VALUE_MAX ||
+            recordCrc() != ( record[ RECORD_CRC ] | ( record[ RECORD_CRC + 1 ] << 8 ) ) ){
+            continue;
+        }
+        uint32_t seq;
+        memcpy( &seq, &record[ RECORD_SEQUENCE ], sizeof(seq) );
+
+        if( !found || seq > newest ){
+            found = true;
+            newest = seq;
+            head = s + 1 == slots ? 0 : s + 1;
+        }
+
+        Entry *e = find( key );
+        if( e == NULL ){
+            if( count == EEPROM_STORE_MAX_KEYS ){
+                ok = false;
+                continue;
+            }
+            e = &entries[ count++ ];
+            e->key = key;
+        }else if( seq <= latest[ e - entries ] ){
+            continue;
+        }
+        latest[ e - entries ] = seq;
+        e->length = valueLength;
+        e->slot = s;
+        e->flags = LIVE;
+        memcpy( e->value, &record[ RECORD_VALUE ], valueLength );
+    }
+    sequence = found ? newest + 1 : 0;
+    return ok;
+}
+
+int8_t EEPROMStore::get( uint8_t key, void *data, uint8_t size ){
+    Entry *e = find( key );
+    if( e == NULL ){
+        return -1;
+    }
+    memcpy( data, e->value, size < e->length ? size : e->length );
+    return e->length;
+}
+
+bool EEPROMStore::put( uint8_t key, const void *data, uint8_t length ){
+    if( slots == 0 || key == NO_KEY || length > EEPROM_STORE_VALUE_MAX ){
+        return false;
+    }
+    Entry *e = find( key );
+    if( e == NULL ){
+        if( count == EEPROM_STORE_MAX_KEYS ){
+            return false;
+        }
+        e = &entries[ count++ ];
+        e->key = key;
+        e->length = NO_KEY;     //never matches below
+        e->flags = 0;
+    }
+    if( e->length == length && !memcmp( e->value, data, length ) ){
+        return true;
+    }
+    memcpy( e->value, data, length );
+    e->length = length;
+
+    //an entry already in the batch is snapshotted when its record starts, so
+    //it picks up this value without another record
+    if( !( e->flags & ( DIRTY | BATCH ) ) ){
+        e->flags |= DIRTY;
+        if( staged++ == 0 ){
+            stagedAt = millis();
+        }
+    }
+    //if every scheduler timer is taken the next put() or commit() retries
+    if( timer < 0 ){
+        timer = BeanScheduler.setInterval( EEPROM_STORE_POLL_MS, poll, this );
+    }
+    return true;
+}
+
+bool EEPROMStore::pending(){
+    if( staged || writing != NULL ){
+        return true;
+    }
+    for( uint8_t i = 0 ; i < count ; ++i ){
+        if( entries[ i ].flags & BATCH ){
+            return true;
+        }
+    }
+    return false;
+}
+
+void EEPROMStore::commit(){
+    startBatch();
+    while( writing != NULL || startRecord() ){
+        writeRecord();
+    }
+}
+
+void EEPROMStore::clear(){
+    if( timer >= 0 ){
+        BeanScheduler.cancel( timer );
+        timer = -1;
+    }
+    EEPROM.flushAsync();
+    for( uint8_t s = 0 ; s < slots ; ++s ){
+        EEPROM.update( slotAddress( s ) + RECORD_KEY, NO_KEY );
+    }
+    count = 0;
+    staged = 0;
+    writing = NULL;
+    head = 0;
+}
+
+//Private Methods /////////////////////////////////////////////////////////////
+
+void EEPROMStore::poll( void *store ){
+    EEPROMStore *s = (EEPROMStore*) store;
+    if( s->writing == NULL ){
+        if( s->staged && millis() - s->stagedAt >= EEPROM_STORE_COMMIT_MS ){
+            s->startBatch();
+        }
+        if( !s->startRecord() ){
+            if( !s->staged ){
+                BeanScheduler.cancel( s->timer );
+                s->timer = -1;
+            }
+            return;
+        }
+    }
+    s->writeRecord();
+}
+
+EEPROMStore::Entry *EEPROMStore::find( uint8_t key ){
+    for( uint8_t i = 0 ; i < count ; ++i ){
+        if( entries[ i ].key == key ){
+            return &entries[ i ];
+        }
+    }
+    return NULL;
+}
+
+bool EEPROMStore::slotLive( uint8_t slot ){
+    for( uint8_t i = 0 ; i < count ; ++i ){
+        if( ( entries[ i ].flags & LIVE ) && entries[ i ].slot == slot ){
+            return true;
+        }
+    }
+    return false;
+}
+
+//Values changed from here on wait for the next batch, so a value put()
+//faster than its record can be written doesn't keep a batch going forever.
+void EEPROMStore::startBatch(){
+    for( uint8_t i = 0 ; i < count ; ++i ){
+        if( entries[ i ].flags & DIRTY ){
+            entries[ i ].flags = ( entries[ i ].flags & ~DIRTY ) | BATCH;
+        }
+    }
+    staged = 0;
+}
+
+bool EEPROMStore::startRecord(){
+    Entry *e = NULL;
+    for( uint8_t i = 0 ; i < count ; ++i ){
+        if( entries[ i ].flags & BATCH ){
+            e = &entries[ i ];
+            break;
+        }
+    }
+    if( e == NULL ){
+        return false;
+    }
+    e->flags &= ~BATCH;
+
+    memcpy( &record[ RECORD_SEQUENCE ], &sequence, sizeof(sequence) );
+    record[ RECORD_KEY ] = e->key;
+    record[ RECORD_LENGTH ] = e->length;
+    memcpy( &record[ RECORD_VALUE ], e->value, e->length );
+    memset( &record[ RECORD_VALUE + e->length ], 0xFF,
+            EEPROM_STORE_VALUE_MAX - e->length );
+    uint16_t crc = recordCrc();
+    record[ RECORD_CRC ] = crc;
+    record[ RECORD_CRC + 1 ] = crc >> 8;
+
+    //there are more slots than keys, so this ends
+    while( slotLive( head ) ){
+        head = head + 1 == slots ? 0 : head + 1;
+    }
+    writeSlot = head;
+    queued = false;
+    writing = e;
+    return true;
+}
+
+//Queues the record without waiting, returning true once it is written.  The
+//bytes go out in order, so the CRC is the last of them.
+bool EEPROMStore::writeRecord(){
+    if( !queued ){
+        if( !EEPROM.writeAsync( slotAddress( writeSlot ), record,
+                                EEPROM_STORE_RECORD_SIZE, &written ) ){
+            return false;
+        }
+        queued = true;
+    }
+    if( !written ){
+        return false;
+    }
+    writing->slot = writeSlot;
+    writing->flags |= LIVE;
+    writing = NULL;
+    head = writeSlot + 1 == slots ? 0 : writeSlot + 1;
+    ++sequence;
+    return true;
+}
+
+void EEPROMStore::readRecord( uint8_t slot ){
+    uint16_t address = slotAddress( slot );
+    for( uint8_t i = 0 ; i < EEPROM_STORE_RECORD_SIZE ; ++i ){
+        record[ i ] = EEPROM.read( address + i );
+    }
+}
+
+uint16_t EEPROMStore::recordCrc(){
+    return (uint16_t) bean_crc32( record, RECORD_CRC );
+}
+
+uint16_t EEPROMStore::slotAddress( uint8_t slot ){
+    return start + (uint16_t) slot * EEPROM_STORE_RECORD_SIZE;
+}
@@ -0,0 +1,165 @@
+/*
+  EEPROMStore.h - wear-leveled key/value storage on top of the EEPROM library
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef EEPROMStore_h
+#define EEPROMStore_h
+
+#include <inttypes.h>
+
+/***
+    Configuration.
+
+    These can be set from compiler.cpp.extra_flags in platform.local.txt.
+    Every store keeps EEPROM_STORE_MAX_KEYS * (EEPROM_STORE_VALUE_MAX + 4)
+    bytes of RAM for its index and staged values.
+***/
+
+//Largest value, in bytes, one key can hold.
+#ifndef EEPROM_STORE_VALUE_MAX
+#define EEPROM_STORE_VALUE_MAX 8
+#endif
+
+//Number of keys one store can hold.
+#ifndef EEPROM_STORE_MAX_KEYS
+#define EEPROM_STORE_MAX_KEYS 8
+#endif
+
+//How long a changed value stays in RAM before it is written, so a value
+//put() every loop costs one record per interval rather than one per call.
+#ifndef EEPROM_STORE_COMMIT_MS
+#define EEPROM_STORE_COMMIT_MS 1000
+#endif
+
+//How often the background task checks whether a batch is due or the record
+//it queued is written.  A byte takes 3.3 ms to program.
+#ifndef EEPROM_STORE_POLL_MS
+#define EEPROM_STORE_POLL_MS 4
+#endif
+
+//Sequence number, key, length, value and CRC.
+#define EEPROM_STORE_RECORD_SIZE ( EEPROM_STORE_VALUE_MAX + 8 )
+
+#if EEPROM_STORE_MAX_KEYS > 16
+#error "EEPROM_STORE_MAX_KEYS must be 16 or less"
+#endif
+#if EEPROM_STORE_VALUE_MAX > 64
+#error "EEPROM_STORE_VALUE_MAX must be 64 or less"
+#endif
+
+/***
+    EEPROMStore class.
+
+    Keeps up to EEPROM_STORE_MAX_KEYS small values, each under a key from 0 to
+    254, in a region of the EEPROM.  The region is a ring of fixed size
+    records; every change is appended as a new record with a sequence number
+    and a CRC rather than rewriting the value in place, so the writes, and the
+    wear, are spread over the whole region.  A record that is still the latest
+    one for its key is never overwritten, so a reset or a brown out during a
+    write leaves the previous value in place.
+
+    Values live in RAM.  get() never touches the EEPROM and put() only stages
+    the change; a background task started from BeanScheduler hands staged
+    values to EEPROM.writeAsync() EEPROM_STORE_COMMIT_MS later, so loop()
+    never waits 3.3 ms on a byte write.  Values put again while they wait are
+    coalesced into one record.
+
+    The region needs room for at least EEPROM_STORE_MAX_KEYS + 2 records, and
+    each record cell is written roughly once every (records - keys) changes,
+    so a bigger region lasts proportionally longer.  Up to 255 records are
+    used.
+
+    All methods are for loop context, not interrupt handlers.
+***/
+
+class EEPROMStore{
+    public:
+        EEPROMStore();
+
+        //Scans the region [ start, start + length ) and rebuilds the index
+        //from the latest valid record of each key.  Returns false if the
+        //region is too small or holds more keys than the index can track;
+        //those extra keys are dropped.
+        bool begin( uint16_t start, uint16_t length );
+
+        //Copies up to size bytes of the value of key into data.  Returns the
+        //length of the value, or -1 if the key was never put().
+        int8_t get( uint8_t key, void *data, uint8_t size );
+
+        //Stages a new value for key.  Returns false if the value is longer
+        //than EEPROM_STORE_VALUE_MAX or the index is full.
+        bool put( uint8_t key, const void *data, uint8_t length );
+
+        template< typename T > bool get( uint8_t key, T &t ){
+            return get( key, &t, sizeof(T) ) == (int8_t) sizeof(T);
+        }
+
+        template< typename T > bool put( uint8_t key, const T &t ){
+            return put( key, &t, sizeof(T) );
+        }
+
+        //True while any staged value has not been written yet.
+        bool pending();
+
+        //Writes every staged value now, waiting for the EEPROM.
+        void commit();
+
+        //Invalidates every record in the region and empties the index.
+        //Blocks for about 3.3 ms per record.
+        void clear();
+
+    private:
+        struct Entry{
+            uint8_t key;
+            uint8_t length;
+            uint8_t slot;   //record holding the committed value, if LIVE
+            uint8_t flags;
+            uint8_t value[ EEPROM_STORE_VALUE_MAX ];
+        };
+
+        static void poll( void *store );
+
+        Entry *find( uint8_t key );
+        bool slotLive( uint8_t slot );
+        void startBatch();
+        bool startRecord();
+        bool writeRecord();
+        void readRecord( uint8_t slot );
+        uint16_t recordCrc();
+        uint16_t slotAddress( uint8_t slot );
+
+        Entry entries[ EEPROM_STORE_MAX_KEYS ];
+        uint8_t count;        //entries in use
+        uint8_t staged;       //entries changed since the last batch
+        uint32_t stagedAt;
+
+        uint16_t start;
+        uint8_t slots;
+        uint8_t head;         //where the next record goes
+        uint32_t sequence;    //of the next record
+
+        //The record being written, from a snapshot of its entry.
+        uint8_t record[ EEPROM_STORE_RECORD_SIZE ];
+        Entry *writing;
+        bool queued;          //record handed to writeAsync()
+        volatile bool written;
+        uint8_t writeSlot;
+
+        int8_t timer;
+};
+
+#endif
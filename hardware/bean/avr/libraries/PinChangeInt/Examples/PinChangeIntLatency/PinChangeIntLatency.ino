@@ -0,0 +1,80 @@
+// PinChangeIntLatency sketch
+// Measures how long the pin change handler takes to reach your function, in CPU cycles, with several
+// pins attached on one port.  PinChangeIntSpeedTest times a long run of interrupts with millis(); this
+// times each one with Timer1, so it shows the spread as well as the average.
+
+// for vim editing: :set et ts=2 sts=2 sw=2 et
+
+// Interrupts are attached to Bean pins 1 to 5, which are all on port B, and the sketch toggles pin 5
+// itself, so nothing needs to be wired up.  Pin 5 is the last one attached, the worst case for the
+// default handler, which walks the attached pins in order.  Leave the pins unconnected while it runs.
+// Timer1 is taken over for timing, so PWM on pins 1 and 2 stops.
+
+// Uncomment to measure the table dispatch instead of the linked list.  Results go to Serial, which
+// is the Bean's virtual serial port.
+//#define PCINT_FAST_DISPATCH
+
+#define NO_PORTC_PINCHANGES
+#define NO_PORTD_PINCHANGES
+#include <PinChangeInt.h>
+
+#define FIRST_PIN 1
+#define LAST_PIN 5
+#define RUNS 256
+
+volatile uint16_t called;
+volatile bool wasCalled;
+
+void handler() {
+  called = TCNT1;
+  wasCalled = true;
+}
+
+void setup() {
+  Serial.begin(57600);
+  for (uint8_t pin = FIRST_PIN; pin <= LAST_PIN; pin++) {
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+    attachPinChangeInterrupt(pin, handler, CHANGE);
+  }
+  // Timer1 in normal mode, counting every CPU cycle
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+}
+
+void loop() {
+  volatile uint8_t *toggle = portInputRegister(digitalPinToPort(LAST_PIN)); // writing PINx toggles
+  uint8_t mask = digitalPinToBitMask(LAST_PIN);
+  uint16_t least = 0xFFFF, most = 0;
+  uint32_t total = 0;
+
+  for (uint16_t run = 0; run < RUNS; run++) {
+    wasCalled = false;
+    cli();
+    uint16_t start = TCNT1;
+    *toggle = mask;
+    sei();
+    while (!wasCalled) ;
+    uint16_t cycles = called - start;
+    if (cycles < least) least = cycles;
+    if (cycles > most) most = cycles;
+    total += cycles;
+  }
+
+#ifdef PCINT_FAST_DISPATCH
+  Serial.print("table dispatch, ");
+#else
+  Serial.print("list dispatch, ");
+#endif
+  Serial.print(LAST_PIN - FIRST_PIN + 1);
+  Serial.print(" pins: cycles min ");
+  Serial.print(least);
+  Serial.print(" avg ");
+  Serial.print(total / RUNS);
+  Serial.print(" max ");
+  Serial.print(most);
+  Serial.print(" (");
+  Serial.print((total / RUNS) * 1000000UL / F_CPU);
+  Serial.println(" us avg)");
+  delay(2000);
+}
@@ -106,6 +106,15 @@ Copyright 2010-2014 Michael Schwager (aka, "GreyGnome")
 // #define NO_PIN_NUMBER       // to indicate that you don't need the arduinoPin
 // #define DISABLE_PCINT_MULTI_SERVICE // to limit the handler to servicing a single interrupt per invocation.
 // #define GET_PCINT_VERSION   // to enable the uint16_t getPCIintVersion () function.
+// The handler normally walks a list of every attached pin on the port, so its latency grows with the
+// number of pins.  With PCINT_FAST_DISPATCH each port keeps a table of user functions indexed by bit
+// position instead, and the handler visits only the bits that actually changed, lowest first.  It takes
+// no heap, but 16 bytes of RAM per port (24 with the pin number).  PINMODE's variables aren't kept.
+// #define PCINT_FAST_DISPATCH
+// With PCINT_FAST_DISPATCH, an edge on a pin less than PCINT_DEBOUNCE_MS milliseconds after the last one
+// that called its function is ignored, so a bouncing switch calls it once.  A real change that quick is
+// lost too.  0, the default, turns debouncing off.
+// #define PCINT_DEBOUNCE_MS 20
 // The following is intended for testing purposes.  If defined, then a whole host of static variables can be read
 // in your interrupt subroutine.  It is not defined by default, and you DO NOT want to define this in
 // Production code!:
@@ -186,6 +195,21 @@ Copyright 2010-2014 Michael Schwager (aka, "GreyGnome")
 
 typedef void (*PCIntvoidFuncPtr)(void);
 
+#ifdef PCINT_FAST_DISPATCH
+#ifndef PCINT_DEBOUNCE_MS
+#define PCINT_DEBOUNCE_MS 0
+#endif
+// Position of the lowest set bit of a nonzero byte, in three tests; AVR has no
+// instruction for it and __builtin_ctz() would call a 16 bit libgcc routine.
+static inline uint8_t PCintLowestBit(uint8_t bits) {
+	uint8_t bit = 0;
+	if (!(bits & 0x0F)) { bit += 4; bits >>= 4; }
+	if (!(bits & 0x03)) { bit += 2; bits >>= 2; }
+	if (!(bits & 0x01)) { bit += 1; }
+	return bit;
+}
+#endif
+
 class PCintPort {
 public:
 	// portB=PCintPort(2, 1,PCMSK1);
@@ -197,8 +221,10 @@ public:
 	portPCMask(maskReg),
 	PCICRbit(1 << pcindex),
 	portRisingPins(0),
-	portFallingPins(0),
-	firstPin(NULL)
+	portFallingPins(0)
+#ifndef PCINT_FAST_DISPATCH
+	,firstPin(NULL)
+#endif
 #ifdef PINMODE
 	,intrCount(0)
 #endif
@@ -257,7 +283,18 @@ protected:
 	volatile	uint8_t			portRisingPins;
 	volatile	uint8_t			portFallingPins;
 	volatile uint8_t		lastPinView;
+#ifdef PCINT_FAST_DISPATCH
+	// Indexed by bit position.  The ports are globals, so these start out zeroed.
+	PCIntvoidFuncPtr	pinFunc[8];
+	#ifndef NO_PIN_NUMBER
+	uint8_t		pinNumber[8];
+	#endif
+	#if PCINT_DEBOUNCE_MS > 0
+	uint16_t	pinLastCall[8]; // low 16 bits of millis()
+	#endif
+#else
 	PCintPin*	firstPin;
+#endif
 };
 
 #ifndef LIBCALL_PINCHANGEINT // LIBCALL_PINCHANGEINT ***********************************************
@@ -408,6 +445,36 @@ void PCintPort::enable(PCintPin* p, PCIntvoidFuncPtr userFunc, uint8_t mode) {
 	PCICR |= PCICRbit;
 }
 
+#ifdef PCINT_FAST_DISPATCH
+int8_t PCintPort::addPin(uint8_t arduinoPin, PCIntvoidFuncPtr userFunc, uint8_t mode)
+{
+	uint8_t mask = digitalPinToBitMask(arduinoPin);
+	uint8_t bit = PCintLowestBit(mask);
+	int8_t added = (pinFunc[bit] == NULL);
+	uint8_t oldSREG = SREG;
+	cli(); // the handler may be reading the entry
+	pinFunc[bit] = userFunc;
+	#ifndef NO_PIN_NUMBER
+	pinNumber[bit] = arduinoPin;
+	#endif
+	portRisingPins &= ~mask; portFallingPins &= ~mask;
+	if ((mode == RISING) || (mode == CHANGE)) portRisingPins |= mask;
+	if ((mode == FALLING) || (mode == CHANGE)) portFallingPins |= mask;
+#ifndef NO_PORTJ_PINCHANGES
+	if ((arduinoPin == 14) || (arduinoPin == 15)) {
+		portPCMask |= (mask << 1); // PORTJ's PCMSK1 is a little odd...
+	}
+	else {
+		portPCMask |= mask;
+	}
+#else
+	portPCMask |= mask;
+#endif
+	PCICR |= PCICRbit;
+	SREG = oldSREG;
+	return(added);
+}
+#else
 int8_t PCintPort::addPin(uint8_t arduinoPin, PCIntvoidFuncPtr userFunc, uint8_t mode)
 {
 	PCintPin* tmp;
@@ -448,6 +515,7 @@ int8_t PCintPort::addPin(uint8_t arduinoPin, PCIntvoidFuncPtr userFunc, uint8_t
 #endif
 	return(1);
 }
+#endif // PCINT_FAST_DISPATCH
 
 /*
  * attach an interrupt to a specific pin using pin change interrupts.
@@ -469,6 +537,33 @@ int8_t PCintPort::attachInterrupt(uint8_t arduinoPin, PCIntvoidFuncPtr userFunc,
 	return(port->addPin(arduinoPin,userFunc,mode));
 }
 
+#ifdef PCINT_FAST_DISPATCH
+void PCintPort::detachInterrupt(uint8_t arduinoPin)
+{
+	PCintPort *port;
+	uint8_t mask;
+	uint8_t portNum = digitalPinToPort(arduinoPin);
+	if (portNum == NOT_A_PORT) return;
+	port=lookupPortNumToPort(portNum);
+	mask=digitalPinToBitMask(arduinoPin);
+	uint8_t oldSREG = SREG;
+	cli(); // disable interrupts
+#ifndef NO_PORTJ_PINCHANGES
+	if ((arduinoPin == 14) || (arduinoPin == 15)) {
+		port->portPCMask &= ~(mask << 1); // PORTJ's PCMSK1 is a little odd...
+	}
+	else {
+		port->portPCMask &= ~mask; // disable the mask entry.
+	}
+#else
+	port->portPCMask &= ~mask; // disable the mask entry.
+#endif
+	if (port->portPCMask == 0) PCICR &= ~(port->PCICRbit);
+	port->portRisingPins &= ~mask; port->portFallingPins &= ~mask;
+	port->pinFunc[PCintLowestBit(mask)] = NULL;
+	SREG = oldSREG; // Restore register; reenables interrupts
+}
+#else
 void PCintPort::detachInterrupt(uint8_t arduinoPin)
 {
 	PCintPort *port;
@@ -509,6 +604,7 @@ void PCintPort::detachInterrupt(uint8_t arduinoPin)
 		current=current->next;
 	}
 }
+#endif // PCINT_FAST_DISPATCH
 
 // common code for isr handler. "port" is the PCINT number.
 // there isn't really a good way to back-map ports and masks to pins.
@@ -538,6 +634,24 @@ void PCintPort::PCint() {
 		#endif
 		lastPinView = PCintPort::curr;
 
+		#ifdef PCINT_FAST_DISPATCH
+		while (changedPins) {
+			uint8_t bit = PCintLowestBit(changedPins);
+			changedPins &= changedPins - 1; // clear the lowest set bit
+			#if PCINT_DEBOUNCE_MS > 0
+			uint16_t now = millis();
+			if ((uint16_t)(now - pinLastCall[bit]) < PCINT_DEBOUNCE_MS) continue;
+			pinLastCall[bit] = now;
+			#endif
+			#ifndef NO_PIN_STATE
+			PCintPort::pinState=PCintPort::curr & _BV(bit) ? HIGH : LOW;
+			#endif
+			#ifndef NO_PIN_NUMBER
+			PCintPort::arduinoPin=pinNumber[bit];
+			#endif
+			pinFunc[bit]();
+		}
+		#else
 		PCintPin* p = firstPin;
 		while (p) {
 			// Trigger interrupt if the bit is high and it's set to trigger on mode RISING or CHANGE
@@ -560,6 +674,7 @@ void PCintPort::PCint() {
 			}
 			p=p->next;
 		}
+		#endif // PCINT_FAST_DISPATCH
 	#ifndef DISABLE_PCINT_MULTI_SERVICE
 		pcifr = PCIFR & PCICRbit;
 		if (pcifr == 0) break;
@@ -22,6 +22,10 @@ uint8_t SPIClass::interruptSave = 0;
 #ifdef SPI_TRANSACTION_MISMATCH_LED
 uint8_t SPIClass::inTransactionFlag = 0;
 #endif
+#if SPI_ASYNC
+SPIAsyncTransfer * volatile SPIClass::asyncCurrent = NULL;
+SPIAsyncTransfer *SPIClass::asyncTail = NULL;
+#endif
 
 void SPIClass::begin()
 {
@@ -199,3 +203,89 @@ void SPIClass::notUsingInterrupt(uint8_t interruptNumber)
     interruptMode = 0;
   SREG = sreg;
 }
+
+#if SPI_ASYNC
+// Puts asyncCurrent on the bus; called with interrupts off.
+void SPIClass::asyncStart()
+{
+  SPIAsyncTransfer *t = asyncCurrent;
+  SPCR = t->settings.spcr | _BV(SPIE);
+  SPSR = t->settings.spsr;
+  if (t->csPin != SPI_NO_CS)
+    digitalWrite(t->csPin, LOW);
+  SPDR = t->tx ? t->tx[0] : 0xFF;
+}
+
+bool SPIClass::transferAsync(SPIAsyncTransfer *t, SPISettings settings,
+                             const void *tx, void *rx, uint16_t count,
+                             SPIAsyncCallback callback, void *arg,
+                             uint8_t csPin)
+{
+  if (count == 0 || t->pending)
+    return false;
+  t->settings = settings;
+  t->tx = (const uint8_t *)tx;
+  t->rx = (uint8_t *)rx;
+  t->count = count;
+  t->csPin = csPin;
+  t->callback = callback;
+  t->arg = arg;
+  t->done = 0;
+  t->next = NULL;
+  t->pending = true;
+
+  uint8_t sreg = SREG;
+  noInterrupts();
+  if (asyncCurrent) {
+    asyncTail->next = t;
+    asyncTail = t;
+  } else {
+    asyncCurrent = asyncTail = t;
+    asyncStart();
+  }
+  SREG = sreg;
+  return true;
+}
+
+void SPIClass::flushAsync()
+{
+  while (asyncCurrent) {
+    // reading SPSR, then SPDR in asyncService(), clears SPIF
+    if (!(SREG & _BV(SREG_I)) && (SPSR & _BV(SPIF)))
+      asyncService();
+  }
+}
+
+void SPIClass::asyncService()
+{
+  SPIAsyncTransfer *t = asyncCurrent;
+  uint16_t i = t->done;
+  uint8_t in = SPDR;
+  if (t->rx)
+    t->rx[i] = in;
+  t->done = ++i;
+  if (i < t->count) {
+    SPDR = t->tx ? t->tx[i] : 0xFF;
+    return;
+  }
+
+  if (t->csPin != SPI_NO_CS)
+    digitalWrite(t->csPin, HIGH);
+  SPIAsyncTransfer *next = t->next;
+  asyncCurrent = next;
+  if (next) {
+    asyncStart();
+  } else {
+    asyncTail = NULL;
+    SPCR &= ~_BV(SPIE);
+  }
+  t->pending = false;
+  if (t->callback)
+    t->callback(t);
+}
+
+ISR(SPI_STC_vect)
+{
+  SPIClass::asyncService();
+}
+#endif
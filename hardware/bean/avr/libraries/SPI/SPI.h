@@ -60,6 +60,17 @@
 #define SPI_CLOCK_MASK 0x03  // SPR1 = bit 1, SPR0 = bit 0 on SPCR
 #define SPI_2XCLOCK_MASK 0x01  // SPI2X = bit 0 on SPSR
 
+// SPI_ASYNC 1 builds transferAsync(), which takes over ISR(SPI_STC_vect).
+// It is off so that sketches and libraries with their own SPI interrupt
+// still link; set it from compiler.cpp.extra_flags in platform.local.txt,
+// as SPI.cpp is compiled on its own and doesn't see the sketch's #defines.
+#ifndef SPI_ASYNC
+#define SPI_ASYNC 0
+#endif
+
+// No chip select pin for transferAsync() to drive.
+#define SPI_NO_CS 0xFF
+
 // define SPI_AVR_EIMSK for AVR boards with external interrupt pins
 #if defined(EIMSK)
   #define SPI_AVR_EIMSK  EIMSK
@@ -153,6 +164,29 @@ private:
 };
 
 
+#if SPI_ASYNC
+// A transfer queued with SPI.transferAsync(), which fills it in.  It belongs
+// to the queue, and must not be changed or go out of scope, while pending is
+// true.
+struct SPIAsyncTransfer;
+typedef void (*SPIAsyncCallback)(SPIAsyncTransfer *);
+
+struct SPIAsyncTransfer {
+  SPISettings settings;
+  const uint8_t *tx;
+  uint8_t *rx;
+  uint16_t count;
+  uint8_t csPin;
+  SPIAsyncCallback callback;
+  void *arg;
+  volatile uint16_t done;   // bytes shifted so far
+  volatile bool pending;
+  SPIAsyncTransfer *next;
+
+  SPIAsyncTransfer() : pending(false) {}
+};
+#endif
+
 class SPIClass {
 public:
   // Initialize the SPI library
@@ -176,6 +210,9 @@ public:
   // this function is used to gain exclusive access to the SPI bus
   // and configure the correct settings.
   inline static void beginTransaction(SPISettings settings) {
+    #if SPI_ASYNC
+    if (asyncCurrent) flushAsync();
+    #endif
     if (interruptMode > 0) {
       uint8_t sreg = SREG;
       noInterrupts();
@@ -286,6 +323,35 @@ public:
   // Disable the SPI bus
   static void end();
 
+  #if SPI_ASYNC
+  // Queues count bytes to shift out of tx while shifting the replies into
+  // rx, from the SPI interrupt, so loop() can get the next buffer ready
+  // meanwhile.  tx NULL sends 0xFF, rx NULL drops the replies and rx may be
+  // tx.  Transfers run in turn, each with its own settings and, unless
+  // csPin is SPI_NO_CS, with csPin driven LOW while it runs; callback runs
+  // from the interrupt when it is done and may queue another.  Nothing is
+  // copied, so t, tx and rx must stay valid while t->pending is true.
+  //
+  // beginTransaction() waits for queued transfers to finish, so they never
+  // clash with other SPI users; don't call transferAsync() between
+  // beginTransaction() and endTransaction().  Each byte costs an interrupt
+  // of about 4 us, so at SPI clocks above 2 MHz the transfer takes longer
+  // than transfer() would and leaves loop() little time.
+  //
+  // Returns false if count is 0 or t is already pending.
+  static bool transferAsync(SPIAsyncTransfer *t, SPISettings settings,
+                            const void *tx, void *rx, uint16_t count,
+                            SPIAsyncCallback callback = NULL,
+                            void *arg = NULL, uint8_t csPin = SPI_NO_CS);
+  // True while queued transfers are waiting or running.
+  inline static bool asyncBusy() { return asyncCurrent != NULL; }
+  // Waits for every queued transfer to finish.  With interrupts off, e.g.
+  // from another interrupt, it drives the transfers itself.
+  static void flushAsync();
+  // Called from the SPI interrupt.
+  static void asyncService();
+  #endif
+
   // This function is deprecated.  New applications should use
   // beginTransaction() to configure SPI settings.
   inline static void setBitOrder(uint8_t bitOrder) {
@@ -317,6 +383,11 @@ private:
   #ifdef SPI_TRANSACTION_MISMATCH_LED
   static uint8_t inTransactionFlag;
   #endif
+  #if SPI_ASYNC
+  static SPIAsyncTransfer * volatile asyncCurrent;
+  static SPIAsyncTransfer *asyncTail;
+  static void asyncStart();
+  #endif
 };
 
 extern SPIClass SPI;
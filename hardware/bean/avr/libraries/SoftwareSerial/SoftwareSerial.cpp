@@ -51,6 +51,33 @@ SoftwareSerial *SoftwareSerial::active_object = 0;
 char SoftwareSerial::_receive_buffer[_SS_MAX_RX_BUFF]; 
 volatile uint8_t SoftwareSerial::_receive_buffer_tail = 0;
 volatile uint8_t SoftwareSerial::_receive_buffer_head = 0;
+volatile uint8_t SoftwareSerial::_rx_timer_state = 0xFF;
+uint8_t SoftwareSerial::_rx_timer_byte;
+uint16_t SoftwareSerial::_rx_timer_when;
+uint8_t SoftwareSerial::_timer_saved_tccr2a;
+uint8_t SoftwareSerial::_timer_saved_tccr2b;
+uint8_t SoftwareSerial::_timer_users = 0;
+#if _SS_MAX_TX_BUFF > 0
+uint8_t SoftwareSerial::_transmit_buffer[_SS_MAX_TX_BUFF];
+volatile uint8_t SoftwareSerial::_transmit_buffer_tail = 0;
+volatile uint8_t SoftwareSerial::_transmit_buffer_head = 0;
+SoftwareSerial * volatile SoftwareSerial::tx_object = 0;
+uint8_t SoftwareSerial::_tx_timer_state;
+uint8_t SoftwareSerial::_tx_timer_byte;
+uint16_t SoftwareSerial::_tx_timer_when;
+#endif
+
+// _timer_users bits
+#define _SS_TIMER_RX 0x01
+#define _SS_TIMER_TX 0x02
+
+// Timer2 prescalers, in order of their CS22:0 values from 1
+static const uint16_t timer2_prescalers[] PROGMEM = { 1, 8, 32, 64, 128, 256, 1024 };
+
+// Cycles from the start bit's edge to reading TCNT2 in the pin change
+// interrupt, plus from a compare match to reading the pin in the timer
+// interrupt; the first sample is moved that much earlier
+#define _SS_TIMER_LATENCY 110
 
 //
 // Debugging
@@ -96,6 +123,21 @@ bool SoftwareSerial::listen()
     _receive_buffer_head = _receive_buffer_tail = 0;
     active_object = this;
 
+    if (_timer_receive)
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      // Timer2 may be sending for another object at another speed
+      while (!timer2Acquire(_SS_TIMER_RX, _timer_prescaler))
+      {
+        SREG = oldSREG;
+        flushTransmit(NULL);
+        cli();
+      }
+      _rx_timer_state = 0xFF;
+      SREG = oldSREG;
+    }
+
     setRxIntMsk(true);
     return true;
   }
@@ -109,12 +151,78 @@ bool SoftwareSerial::stopListening()
   if (active_object == this)
   {
     setRxIntMsk(false);
+    if (_timer_receive)
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      TIMSK2 &= ~_BV(OCIE2B);
+      timer2Release(_SS_TIMER_RX);
+      SREG = oldSREG;
+    }
     active_object = NULL;
     return true;
   }
   return false;
 }
 
+//
+// Takes Timer2 for user, in normal mode, so compare values take effect as
+// soon as they are written, with OC2A and OC2B disconnected from their pins.
+// Fails if the other user has it at another prescaler.  Called with
+// interrupts off.
+//
+/* static */
+bool SoftwareSerial::timer2Acquire(uint8_t user, uint8_t prescaler)
+{
+  if (!_timer_users)
+  {
+    _timer_saved_tccr2a = TCCR2A;
+    _timer_saved_tccr2b = TCCR2B;
+    TCCR2A = 0;
+    TCCR2B = prescaler;
+  }
+  else if ((TCCR2B & 0x07) != prescaler)
+  {
+    return false;
+  }
+  _timer_users |= user;
+  return true;
+}
+
+//
+// Hands Timer2 back once neither user needs it.  Called with interrupts off.
+//
+/* static */
+void SoftwareSerial::timer2Release(uint8_t user)
+{
+  _timer_users &= ~user;
+  if (!_timer_users)
+  {
+    TCCR2A = _timer_saved_tccr2a;
+    TCCR2B = _timer_saved_tccr2b;
+  }
+}
+
+//
+// Puts a received byte in the buffer
+//
+void SoftwareSerial::store(uint8_t d)
+{
+  // if buffer full, set the overflow flag and return
+  uint8_t next = (_receive_buffer_tail + 1) % _SS_MAX_RX_BUFF;
+  if (next != _receive_buffer_head)
+  {
+    // save new data in buffer: tail points to where byte goes
+    _receive_buffer[_receive_buffer_tail] = d; // save new byte
+    _receive_buffer_tail = next;
+  } 
+  else 
+  {
+    DebugPulse(_DEBUG_PIN1, 1);
+    _buffer_overflow = true;
+  }
+}
+
 //
 // The receive routine called by the interrupt handler
 //
@@ -139,9 +247,26 @@ void SoftwareSerial::recv()
 
   uint8_t d = 0;
 
+  if (_timer_receive)
+  {
+    // Only a start bit between bytes; the interrupt may also be for
+    // another pin on the port
+    if (_rx_timer_state == 0xFF &&
+        (_inverse_logic ? rx_pin_read() : !rx_pin_read()))
+    {
+      setRxIntMsk(false);
+
+      // Sample the middle of the start bit, then of each bit after it
+      _rx_timer_when = ((uint16_t)TCNT2 << 8) + _rx_timer_first;
+      OCR2B = _rx_timer_when >> 8;
+      _rx_timer_state = 0;
+      TIFR2 = _BV(OCF2B);
+      TIMSK2 |= _BV(OCIE2B);
+    }
+  }
   // If RX line is high, then we don't see any start bit
   // so interrupt is probably not for us
-  if (_inverse_logic ? rx_pin_read() : !rx_pin_read())
+  else if (_inverse_logic ? rx_pin_read() : !rx_pin_read())
   {
     // Disable further interrupts during reception, this prevents
     // triggering another interrupt directly after we return, which can
@@ -165,19 +290,7 @@ void SoftwareSerial::recv()
     if (_inverse_logic)
       d = ~d;
 
-    // if buffer full, set the overflow flag and return
-    uint8_t next = (_receive_buffer_tail + 1) % _SS_MAX_RX_BUFF;
-    if (next != _receive_buffer_head)
-    {
-      // save new data in buffer: tail points to where byte goes
-      _receive_buffer[_receive_buffer_tail] = d; // save new byte
-      _receive_buffer_tail = next;
-    } 
-    else 
-    {
-      DebugPulse(_DEBUG_PIN1, 1);
-      _buffer_overflow = true;
-    }
+    store(d);
 
     // skip the stop bit
     tunedDelay(_rx_delay_stopbit);
@@ -204,6 +317,149 @@ void SoftwareSerial::recv()
 #endif
 }
 
+//
+// The timerReceive routine, called from the Timer2 compare interrupt in the
+// middle of each bit
+//
+void SoftwareSerial::recvBit()
+{
+  uint8_t state = _rx_timer_state;
+  bool mark = rx_pin_read() != 0;
+  if (_inverse_logic)
+    mark = !mark;
+  DebugPulse(_DEBUG_PIN2, 1);
+
+  if (state == 0 ? !mark : state < 9)
+  {
+    if (state > 0)
+    {
+      _rx_timer_byte >>= 1;
+      if (mark)
+        _rx_timer_byte |= 0x80;
+    }
+    _rx_timer_state = state + 1;
+    _rx_timer_when += _timer_bit;
+    OCR2B = _rx_timer_when >> 8;
+    return;
+  }
+
+  // In the stop bit, or a start bit that didn't last was a glitch
+  if (state == 9)
+    store(_rx_timer_byte);
+  TIMSK2 &= ~_BV(OCIE2B);
+  _rx_timer_state = 0xFF;
+  setRxIntMsk(true);
+}
+
+#if _SS_MAX_TX_BUFF > 0
+//
+// The buffered transmit routine, called from the Timer2 compare interrupt at
+// the end of each bit
+//
+void SoftwareSerial::sendBit()
+{
+  uint8_t state = _tx_timer_state;
+  uint8_t mark;
+
+  if (state < 8)
+  {
+    mark = _tx_timer_byte & 1;
+    _tx_timer_byte >>= 1;
+  }
+  else if (state == 8)
+  {
+    mark = 1;  // stop bit
+  }
+  else if (_transmit_buffer_head != _transmit_buffer_tail)
+  {
+    _tx_timer_byte = _transmit_buffer[_transmit_buffer_head];
+    _transmit_buffer_head = (_transmit_buffer_head + 1) % _SS_MAX_TX_BUFF;
+    mark = 0;  // start bit
+    state = 0xFF;
+  }
+  else
+  {
+    // the stop bit of the last byte is out
+    TIMSK2 &= ~_BV(OCIE2A);
+    tx_object = NULL;
+    timer2Release(_SS_TIMER_TX);
+    return;
+  }
+
+  if (mark != _inverse_logic)
+    *_transmitPortRegister |= _transmitBitMask;
+  else
+    *_transmitPortRegister &= ~_transmitBitMask;
+
+  _tx_timer_state = state + 1;
+  _tx_timer_when += _timer_bit;
+  OCR2A = _tx_timer_when >> 8;
+}
+
+//
+// Queues b to be sent from the Timer2 interrupt, waiting for room, or for
+// another object's bytes to go first.  Returns false if Timer2 is busy
+// receiving at another speed, for the caller to send b itself.
+//
+bool SoftwareSerial::queue(uint8_t b)
+{
+  uint8_t next = (_transmit_buffer_tail + 1) % _SS_MAX_TX_BUFF;
+  uint8_t oldSREG = SREG;
+  for (;;)
+  {
+    cli();
+    SoftwareSerial *sending = tx_object;
+    if (!sending || (sending == this && next != _transmit_buffer_head))
+      break;
+    SREG = oldSREG;
+    pollTransmit(oldSREG);
+  }
+
+  if (tx_object)
+  {
+    _transmit_buffer[_transmit_buffer_tail] = b;
+    _transmit_buffer_tail = next;
+  }
+  else
+  {
+    if (!timer2Acquire(_SS_TIMER_TX, _timer_prescaler))
+    {
+      SREG = oldSREG;
+      return false;
+    }
+    tx_object = this;
+
+    // the start bit goes out now, then sendBit() takes over
+    if (_inverse_logic)
+      *_transmitPortRegister |= _transmitBitMask;
+    else
+      *_transmitPortRegister &= ~_transmitBitMask;
+    _tx_timer_byte = b;
+    _tx_timer_state = 0;
+    _tx_timer_when = ((uint16_t)TCNT2 << 8) + _timer_bit;
+    OCR2A = _tx_timer_when >> 8;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+  }
+  SREG = oldSREG;
+  return true;
+}
+
+//
+// With interrupts off, as they were at oldSREG, nothing else will run
+// sendBit(), so run it here when the compare comes
+//
+/* static */
+void SoftwareSerial::pollTransmit(uint8_t oldSREG)
+{
+  if (!(oldSREG & _BV(SREG_I)) && (TIFR2 & _BV(OCF2A)))
+  {
+    TIFR2 = _BV(OCF2A);
+    tx_object->sendBit();
+  }
+}
+#endif
+
 uint8_t SoftwareSerial::rx_pin_read()
 {
   return *_receivePortRegister & _receiveBitMask;
@@ -229,6 +485,36 @@ ISR(PCINT0_vect)
 }
 #endif
 
+/* static */
+inline void SoftwareSerial::handle_timer_interrupt()
+{
+  if (active_object)
+  {
+    active_object->recvBit();
+  }
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+  SoftwareSerial::handle_timer_interrupt();
+}
+
+#if _SS_MAX_TX_BUFF > 0
+/* static */
+inline void SoftwareSerial::handle_tx_interrupt()
+{
+  if (tx_object)
+  {
+    tx_object->sendBit();
+  }
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  SoftwareSerial::handle_tx_interrupt();
+}
+#endif
+
 #if defined(PCINT1_vect)
 ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
 #endif
@@ -250,7 +536,9 @@ SoftwareSerial::SoftwareSerial(uint8_t receivePin, uint8_t transmitPin, bool inv
   _rx_delay_stopbit(0),
   _tx_delay(0),
   _buffer_overflow(false),
-  _inverse_logic(inverse_logic)
+  _inverse_logic(inverse_logic),
+  _timer_receive(false),
+  _timer_transmit(false)
 {
   setTX(transmitPin);
   setRX(receivePin);
@@ -299,9 +587,38 @@ uint16_t SoftwareSerial::subtract_cap(uint16_t num, uint16_t sub) {
 // Public methods
 //
 
-void SoftwareSerial::begin(long speed)
+void SoftwareSerial::begin(long speed, bool timerReceive /* = false */)
 {
+  end();
   _rx_delay_centering = _rx_delay_intrabit = _rx_delay_stopbit = _tx_delay = 0;
+  _timer_receive = _timer_transmit = false;
+
+  // For the Timer2 modes, the finest prescaler that makes a bit less than
+  // 256 ticks, since each compare is a step of one bit
+  bool timer = false;
+  if (speed <= _SS_TIMER_MAX_SPEED)
+  {
+    for (uint8_t i = 0; i < sizeof(timer2_prescalers) / sizeof(timer2_prescalers[0]); ++i)
+    {
+      uint16_t prescaler = pgm_read_word(&timer2_prescalers[i]);
+      uint32_t bit = ((uint32_t)(F_CPU / prescaler) << 8) / speed;
+      if (bit < 0xFF00)
+      {
+        uint16_t latency = ((uint32_t)_SS_TIMER_LATENCY << 8) / prescaler;
+        _timer_bit = bit;
+        // at least 2 ticks, so the compare can't be set behind TCNT2
+        _rx_timer_first = subtract_cap(bit / 2, latency);
+        if (_rx_timer_first < 0x200)
+          _rx_timer_first = 0x200;
+        _timer_prescaler = i + 1;
+        timer = true;
+        break;
+      }
+    }
+  }
+#if _SS_MAX_TX_BUFF > 0
+  _timer_transmit = timer;
+#endif
 
   // Precalculate the various delays, in number of 4-cycle delays
   uint16_t bit_delay = (F_CPU / speed) / 4;
@@ -361,6 +678,8 @@ void SoftwareSerial::begin(long speed)
     _pcint_maskreg = digitalPinToPCMSK(_receivePin);
     _pcint_maskvalue = _BV(digitalPinToPCMSKbit(_receivePin));
 
+    _timer_receive = timerReceive && timer;
+
     tunedDelay(_tx_delay); // if we were low this establishes the end
   }
 
@@ -383,6 +702,7 @@ void SoftwareSerial::setRxIntMsk(bool enable)
 void SoftwareSerial::end()
 {
   stopListening();
+  flushTransmit();
 }
 
 
@@ -417,6 +737,11 @@ size_t SoftwareSerial::write(uint8_t b)
     return 0;
   }
 
+#if _SS_MAX_TX_BUFF > 0
+  if (_timer_transmit && queue(b))
+    return 1;
+#endif
+
   // By declaring these as local variables, the compiler will put them
   // in registers _before_ disabling interrupts and entering the
   // critical timing sections below, which makes it a lot easier to
@@ -465,6 +790,36 @@ size_t SoftwareSerial::write(uint8_t b)
   return 1;
 }
 
+size_t SoftwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+// Wait until the bytes queued for sending by object, or by any object if it
+// is NULL, are out
+/* static */
+void SoftwareSerial::flushTransmit(SoftwareSerial *object)
+{
+#if _SS_MAX_TX_BUFF > 0
+  uint8_t oldSREG = SREG;
+  for (;;)
+  {
+    SoftwareSerial *sending = tx_object;
+    if (!sending || (object && sending != object))
+      break;
+    pollTransmit(oldSREG);
+  }
+#endif
+}
+
+void SoftwareSerial::flushTransmit()
+{
+  flushTransmit(this);
+}
+
 void SoftwareSerial::flush()
 {
   if (!isListening())
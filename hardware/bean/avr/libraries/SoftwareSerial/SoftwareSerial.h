@@ -39,7 +39,25 @@ http://arduiniana.org.
 * Definitions
 ******************************************************************************/
 
-#define _SS_MAX_RX_BUFF 64 // RX buffer size
+#ifndef _SS_MAX_RX_BUFF
+#define _SS_MAX_RX_BUFF 64 // RX buffer size, settable from platform.local.txt
+#endif
+#if _SS_MAX_RX_BUFF < 2 || _SS_MAX_RX_BUFF > 256
+#error "_SS_MAX_RX_BUFF must be between 2 and 256"
+#endif
+// Bytes write() can queue to be sent from the Timer2 interrupt; 0 sends them
+// the old way, with interrupts off for each byte, and leaves
+// ISR(TIMER2_COMPA_vect), which tone() also uses, alone.  Settable from
+// platform.local.txt.
+#ifndef _SS_MAX_TX_BUFF
+#define _SS_MAX_TX_BUFF 0
+#endif
+#if _SS_MAX_TX_BUFF == 1 || _SS_MAX_TX_BUFF > 256
+#error "_SS_MAX_TX_BUFF must be 0 or between 2 and 256"
+#endif
+// Fastest speed begin() will receive at with timerReceive; faster ones fall
+// back to receiving the whole byte in the pin change interrupt
+#define _SS_TIMER_MAX_SPEED 38400
 #ifndef GCC_VERSION
 #define GCC_VERSION (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__)
 #endif
@@ -62,8 +80,16 @@ private:
   uint16_t _rx_delay_stopbit;
   uint16_t _tx_delay;
 
+  // Timer2 compare steps, in 1/256 ticks, for timerReceive and buffered
+  // transmit
+  uint16_t _rx_timer_first;
+  uint16_t _timer_bit;
+  uint8_t _timer_prescaler;
+
   uint16_t _buffer_overflow:1;
   uint16_t _inverse_logic:1;
+  uint16_t _timer_receive:1;
+  uint16_t _timer_transmit:1;
 
   // static data
   static char _receive_buffer[_SS_MAX_RX_BUFF]; 
@@ -71,8 +97,38 @@ private:
   static volatile uint8_t _receive_buffer_head;
   static SoftwareSerial *active_object;
 
+  // timerReceive state: the bit being sampled next, 0 for the start bit and
+  // 9 for the stop bit, or 0xFF between bytes
+  static volatile uint8_t _rx_timer_state;
+  static uint8_t _rx_timer_byte;
+  static uint16_t _rx_timer_when;
+  static uint8_t _timer_saved_tccr2a;
+  static uint8_t _timer_saved_tccr2b;
+  static uint8_t _timer_users;
+
+#if _SS_MAX_TX_BUFF > 0
+  // Buffered transmit: tx_object is sending _tx_timer_byte and then the
+  // buffer; _tx_timer_state is how many bits of the byte are out, 8 for
+  // all of them and 9 once the stop bit is too
+  static uint8_t _transmit_buffer[_SS_MAX_TX_BUFF];
+  static volatile uint8_t _transmit_buffer_tail;
+  static volatile uint8_t _transmit_buffer_head;
+  static SoftwareSerial * volatile tx_object;
+  static uint8_t _tx_timer_state;
+  static uint8_t _tx_timer_byte;
+  static uint16_t _tx_timer_when;
+#endif
+
   // private methods
   void recv() __attribute__((__always_inline__));
+  void recvBit() __attribute__((__always_inline__));
+  void store(uint8_t d) __attribute__((__always_inline__));
+  void sendBit() __attribute__((__always_inline__));
+  bool queue(uint8_t b);
+  static void pollTransmit(uint8_t oldSREG);
+  static void flushTransmit(SoftwareSerial *object);
+  static bool timer2Acquire(uint8_t user, uint8_t prescaler);
+  static void timer2Release(uint8_t user);
   uint8_t rx_pin_read();
   void tx_pin_write(uint8_t pin_state) __attribute__((__always_inline__));
   void setTX(uint8_t transmitPin);
@@ -89,7 +145,21 @@ public:
   // public methods
   SoftwareSerial(uint8_t receivePin, uint8_t transmitPin, bool inverse_logic = false);
   ~SoftwareSerial();
-  void begin(long speed);
+  // With timerReceive each bit is sampled by its own Timer2 compare
+  // interrupt instead of the pin change interrupt waiting out the whole
+  // byte, so other interrupts, like the Bean's serial link to the CC2540,
+  // are only held off for a few microseconds at a time.  Timer2 is taken
+  // over while listening, so tone() and analogWrite() on its pins can't be
+  // used meanwhile.  Speeds above _SS_TIMER_MAX_SPEED (38400) receive the
+  // old way; 19200 and below leave the most margin.
+  //
+  // Built with _SS_MAX_TX_BUFF, write() at those speeds just queues the
+  // byte, and the Timer2 compare A interrupt sends one bit at a time, with
+  // Timer2 taken only while there is something to send.  Otherwise write()
+  // holds interrupts off for each byte it sends.  Receiving the old way
+  // holds off the bits being sent, so send and receive at the same time
+  // only with timerReceive.
+  void begin(long speed, bool timerReceive = false);
   bool listen();
   void end();
   bool isListening() { return this == active_object; }
@@ -98,6 +168,10 @@ public:
   int peek();
 
   virtual size_t write(uint8_t byte);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  // Waits until the bytes queued by write() are sent.  flush() only empties
+  // the receive buffer.
+  void flushTransmit();
   virtual int read();
   virtual int available();
   virtual void flush();
@@ -107,6 +181,8 @@ public:
 
   // public only for easy access by interrupt handlers
   static inline void handle_interrupt() __attribute__((__always_inline__));
+  static inline void handle_timer_interrupt() __attribute__((__always_inline__));
+  static inline void handle_tx_interrupt() __attribute__((__always_inline__));
 };
 
 // Arduino 0012 workaround
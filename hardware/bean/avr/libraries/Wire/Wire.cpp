@@ -26,6 +26,7 @@ extern "C" {
   #include "twi.h"
 }
 
+#include "Arduino.h"
 #include "Wire.h"
 
 // Initialize Class Variables //////////////////////////////////////////////////
@@ -297,6 +298,96 @@ void TwoWire::onRequest( void (*function)(void) )
   user_onRequest = function;
 }
 
+// checks queued transactions for timeouts while any are waiting
+static int8_t wire_watchdog = -1;
+
+static void wire_watch(void *)
+{
+  twi_checkTimeout();
+  if(!twi_busy()){
+    BeanScheduler.cancel(wire_watchdog);
+    wire_watchdog = -1;
+  }
+}
+
+// Starts the watchdog.  With every scheduler timer taken it checks the bus
+// itself and tries again from the next loop() until one is free.
+static bool wire_arm_deferred = false;
+
+static void wire_arm_retry(void *);
+
+static void wire_arm(void)
+{
+  if(wire_watchdog >= 0 || wire_arm_deferred || !twi_busy()){
+    return;
+  }
+  wire_watchdog = BeanScheduler.setInterval(5, wire_watch);
+  if(wire_watchdog < 0){
+    twi_checkTimeout();
+    wire_arm_deferred = BeanScheduler.defer(wire_arm_retry);
+  }
+}
+
+static void wire_arm_retry(void *)
+{
+  wire_arm_deferred = false;
+  wire_arm();
+}
+
+bool TwoWire::queue(WireTransaction *t, uint8_t address,
+                    const uint8_t *tx, uint8_t txLength,
+                    uint8_t *rx, uint8_t rxLength,
+                    WireCallback callback, void *arg, bool sendStop)
+{
+  if(twi_queued(t)){
+    return false;
+  }
+  t->address = address;
+  t->txData = tx;
+  t->txLength = txLength;
+  t->rxData = rx;
+  t->rxLength = rxLength;
+  t->sendStop = sendStop;
+  t->callback = callback;
+  t->arg = arg;
+  if(!twi_queue(t)){
+    return false;
+  }
+  // a callback queueing the next transaction runs while the watchdog is
+  // already going, so this is never reached from the interrupt
+  wire_arm();
+  return true;
+}
+
+uint8_t TwoWire::readRegisters(uint8_t address, uint8_t reg,
+                               uint8_t *data, uint8_t length)
+{
+  WireTransaction t;
+  t.address = address;
+  t.txData = &reg;
+  t.txLength = 1;
+  t.rxData = data;
+  t.rxLength = length;
+  t.sendStop = true;
+  t.callback = NULL;
+  t.arg = NULL;
+  twi_queue(&t);
+  while(TWI_STATUS_PENDING == t.status){
+    twi_checkTimeout();
+  }
+  return TWI_STATUS_OK == t.status ? t.rxCount : 0;
+}
+
+bool TwoWire::busy(void)
+{
+  return twi_busy();
+}
+
+void TwoWire::setBusTimeout(uint16_t ms)
+{
+  twi_setTimeout(ms);
+}
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 TwoWire Wire = TwoWire();
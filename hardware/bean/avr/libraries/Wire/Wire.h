@@ -25,7 +25,27 @@
 #include <inttypes.h>
 #include "Stream.h"
 
-#define BUFFER_LENGTH 32
+extern "C" {
+  #include "utility/twi.h"
+}
+
+// The most bytes one requestFrom() or beginTransmission() can carry.  Both
+// can be raised together from build.extra_flags in platform.local.txt, e.g.
+// -DTWI_BUFFER_LENGTH=64, at the cost of five buffers of that size in RAM.
+// readRegisters() and queue() aren't limited by them.
+#ifndef BUFFER_LENGTH
+#define BUFFER_LENGTH TWI_BUFFER_LENGTH
+#endif
+
+#if BUFFER_LENGTH > TWI_BUFFER_LENGTH || BUFFER_LENGTH > 255
+#error "BUFFER_LENGTH must be at most TWI_BUFFER_LENGTH and 255"
+#endif
+
+// A queued transaction, see TwoWire::queue().  status is
+// TWI_STATUS_PENDING until it is done, then one of the endTransmission()
+// codes, or TWI_STATUS_TIMEOUT (5).
+typedef twi_transaction WireTransaction;
+typedef void (*WireCallback)(WireTransaction *);
 
 class TwoWire : public Stream
 {
@@ -67,6 +87,35 @@ class TwoWire : public Stream
     void onReceive( void (*)(int) );
     void onRequest( void (*)(void) );
 
+    // Queues a master transaction that runs from the TWI interrupt while
+    // loop() carries on: txLength bytes written from tx, then, after a
+    // repeated start, rxLength bytes read into rx, so writing a register
+    // address and reading the registers is one transaction.  Nothing is
+    // copied; t, tx and rx must stay valid until t->status is no longer
+    // TWI_STATUS_PENDING.  With sendStop false the next queued transaction
+    // follows with a repeated start, keeping the bus.  callback runs from
+    // the interrupt when t is done and may queue another transaction.
+    // Returns false if t is already queued.
+    bool queue(WireTransaction *t, uint8_t address,
+               const uint8_t *tx, uint8_t txLength,
+               uint8_t *rx, uint8_t rxLength,
+               WireCallback callback = NULL, void *arg = NULL,
+               bool sendStop = true);
+    // Writes reg to the slave at address and, after a repeated start,
+    // reads length bytes straight into data; the usual way to read a
+    // block of registers or a sensor's FIFO in one transaction, up to
+    // 255 bytes whatever BUFFER_LENGTH is.  Blocks until it is done, after
+    // any queued transactions.  Returns how many bytes were read, 0 if
+    // the slave didn't answer or the bus timed out.
+    uint8_t readRegisters(uint8_t address, uint8_t reg,
+                          uint8_t *data, uint8_t length);
+    // True while queued transactions are waiting or running.
+    bool busy(void);
+    // How long a transaction, queued or not, may take before it fails
+    // with TWI_STATUS_TIMEOUT and the bus is reset, clocking out a slave
+    // stuck holding SDA; 0 for no limit.  TWI_TIMEOUT_MS (25) by default.
+    void setBusTimeout(uint16_t ms);
+
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
     inline size_t write(unsigned int n) { return write((uint8_t)n); }
@@ -47,6 +47,7 @@ static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
 
 static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+static uint8_t *twi_masterData = twi_masterBuffer;	// twi_masterBuffer or a queued transaction's buffer
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
 
@@ -59,6 +60,20 @@ static volatile uint8_t twi_rxBufferIndex;
 
 static volatile uint8_t twi_error;
 
+// not a TW_STATUS value, all of which are multiples of 8
+#define TWI_ERROR_TIMEOUT 0x01
+
+// queued transactions, twi_current first; twi_active once it's on the bus
+static twi_transaction * volatile twi_current;
+static twi_transaction *twi_queueTail;
+static volatile uint8_t twi_active;
+
+static uint16_t twi_timeout = TWI_TIMEOUT_MS;
+static volatile unsigned long twi_started;
+
+static void twi_startTransaction(void);
+static void twi_kick(void);
+
 /* 
  * Function twi_init
  * Desc     readys twi pins and sets twi bitrate
@@ -102,6 +117,47 @@ void twi_setAddress(uint8_t address)
   TWAR = address << 1;
 }
 
+/* 
+ * Function twi_waitReady
+ * Desc     waits for the twi to be free for a blocking master
+ *          operation, including of queued transactions
+ * Input    none
+ * Output   SREG as it was on entry, for the caller to restore; returns
+ *          with interrupts disabled
+ */
+static uint8_t twi_waitReady(void)
+{
+  uint8_t oldSREG = SREG;
+  for(;;){
+    cli();
+    if(TWI_READY == twi_state && !twi_active){
+      return oldSREG;
+    }
+    SREG = oldSREG;
+    twi_checkTimeout();
+  }
+}
+
+/* 
+ * Function twi_status
+ * Desc     maps twi_error to a TWI_STATUS_ code
+ * Input    error: twi_error value
+ * Output   TWI_STATUS_OK .. TWI_STATUS_TIMEOUT
+ */
+static uint8_t twi_status(uint8_t error)
+{
+  if (error == 0xFF)
+    return TWI_STATUS_OK;	// success
+  else if (error == TW_MT_SLA_NACK || error == TW_MR_SLA_NACK)
+    return TWI_STATUS_ADDRESS_NACK;	// error: address send, nack received
+  else if (error == TW_MT_DATA_NACK)
+    return TWI_STATUS_DATA_NACK;	// error: data send, nack received
+  else if (error == TWI_ERROR_TIMEOUT)
+    return TWI_STATUS_TIMEOUT;	// error: transfer took too long
+  else
+    return TWI_STATUS_ERROR;	// other twi error
+}
+
 /* 
  * Function twi_readFrom
  * Desc     attempts to become twi bus master and read a
@@ -122,15 +178,15 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   }
 
   // wait until twi is ready, become master receiver
-  while(TWI_READY != twi_state){
-    continue;
-  }
+  uint8_t oldSREG = twi_waitReady();
   twi_state = TWI_MRX;
+  SREG = oldSREG;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = twi_masterBuffer;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length-1;  // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
@@ -143,6 +199,7 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   twi_slarw = TW_READ;
   twi_slarw |= address << 1;
 
+  twi_started = millis();
   if (true == twi_inRepStart) {
     // if we're in the repeated start state, then we've already sent the start,
     // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
@@ -160,8 +217,9 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
 
   // wait for read operation to complete
   while(TWI_MRX == twi_state){
-    continue;
+    twi_checkTimeout();
   }
+  twi_kick();
 
   if (twi_masterBufferIndex < length)
     length = twi_masterBufferIndex;
@@ -199,15 +257,15 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   }
 
   // wait until twi is ready, become master transmitter
-  while(TWI_READY != twi_state){
-    continue;
-  }
+  uint8_t oldSREG = twi_waitReady();
   twi_state = TWI_MTX;
+  SREG = oldSREG;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = twi_masterBuffer;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length;
   
@@ -223,6 +281,7 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   // if we're in a repeated start, then we've already sent the START
   // in the ISR. Don't do it again.
   //
+  twi_started = millis();
   if (true == twi_inRepStart) {
     // if we're in the repeated start state, then we've already sent the start,
     // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
@@ -240,17 +299,12 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 
   // wait for write operation to complete
   while(wait && (TWI_MTX == twi_state)){
-    continue;
+    twi_checkTimeout();
   }
+  if (wait)
+    twi_kick();
   
-  if (twi_error == 0xFF)
-    return 0;	// success
-  else if (twi_error == TW_MT_SLA_NACK)
-    return 2;	// error: address send, nack received
-  else if (twi_error == TW_MT_DATA_NACK)
-    return 3;	// error: data send, nack received
-  else
-    return 4;	// other twi error
+  return twi_status(twi_error);
 }
 
 /* 
@@ -360,6 +414,234 @@ void twi_releaseBus(void)
   twi_state = TWI_READY;
 }
 
+/* 
+ * Function twi_startTransaction
+ * Desc     puts twi_current on the bus, with a start condition, or a
+ *          repeated start if we still hold the bus
+ * Input    none, called with interrupts disabled
+ * Output   none
+ */
+static void twi_startTransaction(void)
+{
+  twi_transaction *t = twi_current;
+
+  twi_error = 0xFF;
+  twi_inRepStart = false;
+  twi_masterBufferIndex = 0;
+  if (t->txLength || !t->rxLength) {
+    twi_state = TWI_MTX;
+    twi_masterData = (uint8_t *)t->txData;
+    twi_masterBufferLength = t->txLength;
+    twi_slarw = TW_WRITE | (t->address << 1);
+  } else {
+    twi_state = TWI_MRX;
+    twi_masterData = t->rxData;
+    twi_masterBufferLength = t->rxLength - 1;	// see twi_readFrom
+    twi_slarw = TW_READ | (t->address << 1);
+  }
+  twi_started = millis();
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+}
+
+/* 
+ * Function twi_kick
+ * Desc     starts the first queued transaction if the bus is free
+ * Input    none
+ * Output   none
+ */
+static void twi_kick(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if (twi_current && !twi_active && TWI_READY == twi_state && !twi_inRepStart) {
+    twi_active = true;
+    twi_startTransaction();
+  }
+  SREG = oldSREG;
+}
+
+/* 
+ * Function twi_masterDone
+ * Desc     ends twi_current, tells its owner and starts the next one
+ * Input    error: twi_error value
+ * Output   none, called with interrupts disabled
+ */
+static void twi_masterDone(uint8_t error)
+{
+  twi_transaction *t = twi_current;
+  twi_transaction *next = t->next;
+  uint8_t read = TWI_MRX == twi_state ? twi_masterBufferIndex : 0;
+
+  if (error == TW_MT_ARB_LOST) {
+    // somebody else has the bus, so just let go of it
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT);
+  } else if (error != 0xFF || t->sendStop || !next) {
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO);
+    while(TWCR & _BV(TWSTO)){
+      continue;
+    }
+  }
+  // otherwise the bus is still ours and next begins with a repeated start
+  twi_state = TWI_READY;
+
+  twi_current = next;
+  if (!next) {
+    twi_queueTail = 0;
+    twi_active = false;
+  }
+  t->rxCount = read;
+  t->status = twi_status(error);
+  if (t->callback) {
+    t->callback(t);
+  }
+
+  if (next) {
+    twi_startTransaction();
+  }
+}
+
+/* 
+ * Function twi_queued
+ * Desc     tells whether a transaction is waiting or running
+ * Input    t: the transaction
+ * Output   1 queued, 0 not
+ */
+uint8_t twi_queued(twi_transaction *t)
+{
+  twi_transaction *q;
+  uint8_t found = 0;
+  uint8_t oldSREG = SREG;
+  cli();
+  for (q = twi_current; q; q = q->next) {
+    if (q == t) {
+      found = 1;
+      break;
+    }
+  }
+  SREG = oldSREG;
+  return found;
+}
+
+/* 
+ * Function twi_queue
+ * Desc     queues a master transaction, to run from the interrupt
+ *          once the transactions ahead of it are done
+ * Input    t: the transaction, which must stay valid until its
+ *          status is no longer TWI_STATUS_PENDING
+ * Output   1 queued, 0 t is already queued
+ */
+uint8_t twi_queue(twi_transaction *t)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if (twi_queued(t)) {
+    SREG = oldSREG;
+    return 0;
+  }
+  t->status = TWI_STATUS_PENDING;
+  t->rxCount = 0;
+  t->next = 0;
+  if (twi_queueTail) {
+    twi_queueTail->next = t;
+  } else {
+    twi_current = t;
+  }
+  twi_queueTail = t;
+  SREG = oldSREG;
+
+  twi_kick();
+  return 1;
+}
+
+/* 
+ * Function twi_busy
+ * Desc     tells whether any master transaction is queued or running
+ * Input    none
+ * Output   1 busy, 0 idle
+ */
+uint8_t twi_busy(void)
+{
+  return twi_current != 0 || TWI_MTX == twi_state || TWI_MRX == twi_state;
+}
+
+/* 
+ * Function twi_setTimeout
+ * Desc     sets how long a master operation may take before
+ *          twi_checkTimeout() gives up on it and resets the bus
+ * Input    ms: the limit, 0 for none
+ * Output   none
+ */
+void twi_setTimeout(uint16_t ms)
+{
+  twi_timeout = ms;
+}
+
+/* 
+ * Function twi_recoverBus
+ * Desc     frees a bus held by a slave that is stuck mid-byte: clocks
+ *          SCL until the slave lets go of SDA, then sends a stop, and
+ *          reenables the twi
+ * Input    none
+ * Output   none
+ */
+static void twi_recoverBus(void)
+{
+  uint8_t i;
+
+  TWCR = 0;	// hand the pins back to the port
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, INPUT_PULLUP);
+  // drive a line low as an output, release it as a pulled up input
+  for(i = 0; i < 9 && !digitalRead(SDA); i++){
+    pinMode(SCL, OUTPUT);
+    digitalWrite(SCL, LOW);
+    delayMicroseconds(5);
+    pinMode(SCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+  }
+  // stop: SDA rising while SCL is high
+  pinMode(SCL, OUTPUT);
+  digitalWrite(SCL, LOW);
+  pinMode(SDA, OUTPUT);
+  digitalWrite(SDA, LOW);
+  delayMicroseconds(5);
+  pinMode(SCL, INPUT_PULLUP);
+  delayMicroseconds(5);
+  pinMode(SDA, INPUT_PULLUP);
+  delayMicroseconds(5);
+
+  twi_inRepStart = false;
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
+
+/* 
+ * Function twi_checkTimeout
+ * Desc     fails a master operation that has run longer than the
+ *          timeout and recovers the bus, then starts any queued
+ *          transaction that is waiting.  The blocking functions call
+ *          it while they wait; with queued transactions it has to be
+ *          called regularly, as TwoWire does from the scheduler.
+ * Input    none
+ * Output   none
+ */
+void twi_checkTimeout(void)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if ((TWI_MTX == twi_state || TWI_MRX == twi_state) && twi_timeout &&
+      millis() - twi_started > twi_timeout) {
+    twi_recoverBus();
+    if (twi_active) {
+      twi_masterDone(TWI_ERROR_TIMEOUT);
+    } else {
+      twi_error = TWI_ERROR_TIMEOUT;
+      twi_state = TWI_READY;
+    }
+  }
+  SREG = oldSREG;
+  twi_kick();
+}
+
 ISR(TWI_vect)
 {
   switch(TW_STATUS){
@@ -377,8 +659,18 @@ ISR(TWI_vect)
       // if there is data to send, send it, otherwise stop 
       if(twi_masterBufferIndex < twi_masterBufferLength){
         // copy data to output register and ack
-        TWDR = twi_masterBuffer[twi_masterBufferIndex++];
+        TWDR = twi_masterData[twi_masterBufferIndex++];
         twi_reply(1);
+      }else if(twi_active && twi_current->rxLength){
+        // go on to the read, after a repeated start
+        twi_state = TWI_MRX;
+        twi_masterData = twi_current->rxData;
+        twi_masterBufferIndex = 0;
+        twi_masterBufferLength = twi_current->rxLength - 1;
+        twi_slarw = TW_READ | (twi_current->address << 1);
+        TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+      }else if(twi_active){
+        twi_masterDone(0xFF);
       }else{
 	if (twi_sendStop)
           twi_stop();
@@ -394,21 +686,24 @@ ISR(TWI_vect)
       break;
     case TW_MT_SLA_NACK:  // address sent, nack received
       twi_error = TW_MT_SLA_NACK;
-      twi_stop();
+      if (twi_active) twi_masterDone(twi_error);
+      else twi_stop();
       break;
     case TW_MT_DATA_NACK: // data sent, nack received
       twi_error = TW_MT_DATA_NACK;
-      twi_stop();
+      if (twi_active) twi_masterDone(twi_error);
+      else twi_stop();
       break;
     case TW_MT_ARB_LOST: // lost bus arbitration
       twi_error = TW_MT_ARB_LOST;
-      twi_releaseBus();
+      if (twi_active) twi_masterDone(twi_error);
+      else twi_releaseBus();
       break;
 
     // Master Receiver
     case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
     case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(twi_masterBufferIndex < twi_masterBufferLength){
@@ -419,8 +714,10 @@ ISR(TWI_vect)
       break;
     case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
-	if (twi_sendStop)
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
+	if (twi_active)
+	  twi_masterDone(0xFF);
+	else if (twi_sendStop)
           twi_stop();
 	else {
 	  twi_inRepStart = true;	// we're gonna send the START
@@ -432,7 +729,9 @@ ISR(TWI_vect)
 	}    
 	break;
     case TW_MR_SLA_NACK: // address sent, nack received
-      twi_stop();
+      twi_error = TW_MR_SLA_NACK;
+      if (twi_active) twi_masterDone(twi_error);
+      else twi_stop();
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
@@ -520,7 +819,8 @@ ISR(TWI_vect)
       break;
     case TW_BUS_ERROR: // bus error, illegal stop/start
       twi_error = TW_BUS_ERROR;
-      twi_stop();
+      if (twi_active) twi_masterDone(twi_error);
+      else twi_stop();
       break;
   }
 }
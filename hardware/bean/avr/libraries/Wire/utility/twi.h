@@ -32,12 +32,45 @@
   #define TWI_BUFFER_LENGTH 32
   #endif
 
+  #ifndef TWI_TIMEOUT_MS
+  #define TWI_TIMEOUT_MS 25
+  #endif
+
   #define TWI_READY 0
   #define TWI_MRX   1
   #define TWI_MTX   2
   #define TWI_SRX   3
   #define TWI_STX   4
-  
+
+  // status of a master transaction, the same codes twi_writeTo() returns
+  #define TWI_STATUS_OK           0
+  #define TWI_STATUS_ADDRESS_NACK 2
+  #define TWI_STATUS_DATA_NACK    3
+  #define TWI_STATUS_ERROR        4
+  #define TWI_STATUS_TIMEOUT      5
+  #define TWI_STATUS_PENDING      0xFF
+
+  // A master transaction run from the TWI interrupt: txLength bytes written,
+  // then, after a repeated start, rxLength bytes read, straight from and into
+  // the caller's buffers.  Either length may be 0.  With sendStop false the
+  // bus is kept for the next queued transaction, which starts with a
+  // repeated start.  The struct belongs to the queue until status stops
+  // being TWI_STATUS_PENDING, just before callback runs, from the
+  // interrupt.
+  typedef struct twi_transaction {
+    uint8_t address;
+    const uint8_t *txData;
+    uint8_t txLength;
+    uint8_t *rxData;
+    uint8_t rxLength;
+    uint8_t sendStop;
+    void (*callback)(struct twi_transaction *);
+    void *arg;
+    volatile uint8_t status;
+    volatile uint8_t rxCount;  // bytes actually read
+    struct twi_transaction *next;
+  } twi_transaction;
+
   void twi_init(void);
   void twi_setAddress(uint8_t);
   uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
@@ -48,6 +81,11 @@
   void twi_reply(uint8_t);
   void twi_stop(void);
   void twi_releaseBus(void);
+  uint8_t twi_queue(twi_transaction *);
+  uint8_t twi_queued(twi_transaction *);
+  uint8_t twi_busy(void);
+  void twi_setTimeout(uint16_t);
+  void twi_checkTimeout(void);
 
 #endif
 
@@ -53,6 +53,18 @@ static const uint8_t A5 = 15;
 
 static const uint8_t CC_INTERRUPT_PIN = 16;
 
+// The port ('B', 'C' or 'D', or 0 if there's none) and bit of each pin, the
+// same as digital_pin_to_port_PGM and digital_pin_to_bit_mask_PGM below but
+// usable at compile time, for digitalWriteFast() and friends.  Keep them in
+// step with the tables.
+#define digitalPinToPortFast(p) \
+	(((p) >= 10 && (p) <= 15) ? 'C' : \
+	 ((p) >= 4 && (p) <= 9) ? 'B' : \
+	 (((p) >= 0 && (p) <= 3) || (p) == 16) ? 'D' : 0)
+#define digitalPinToBitFast(p) \
+	(((p) == 0) ? 2 : ((p) == 1) ? 4 : ((p) == 2) ? 6 : ((p) == 3) ? 7 : \
+	 ((p) == 16) ? 5 : ((p) >= 10) ? (p) - 10 : (p) - 4)
+
 // TODO - I don't know what this stuff is
 #define digitalPinToPCICR(p)    (((p) >= 0 && (p) <= 21) ? (&PCICR) : ((uint8_t *)0))
 #define digitalPinToPCICRbit(p) (((p) <= 7) ? 2 : (((p) <= 13) ? 0 : 1))
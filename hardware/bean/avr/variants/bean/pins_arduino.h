@@ -59,6 +59,18 @@ static const uint8_t A7 = 21;
 
 static const uint8_t CC_INTERRUPT_PIN = 13;
 
+// The port ('B', 'C' or 'D', or 0 if there's none) and bit of each pin, the
+// same as digital_pin_to_port_PGM and digital_pin_to_bit_mask_PGM below but
+// usable at compile time, for digitalWriteFast() and friends.  Keep them in
+// step with the tables.
+#define digitalPinToPortFast(p) \
+	(((p) >= 14 && (p) <= 19) ? 'C' : \
+	 (((p) >= 1 && (p) <= 5) || (p) == 8) ? 'B' : \
+	 ((p) >= 0 && (p) <= 13) ? 'D' : 0)
+#define digitalPinToBitFast(p) \
+	(((p) == 0) ? 6 : ((p) == 6) ? 0 : ((p) >= 14) ? (p) - 14 : \
+	 ((p) >= 8) ? (p) - 8 : (p))
+
 #define digitalPinToPCICR(p)    (((p) >= 0 && (p) <= 21) ? (&PCICR) : ((uint8_t *)0))
 #define digitalPinToPCICRbit(p) (((p) <= 7) ? 2 : (((p) <= 13) ? 0 : 1))
 #define digitalPinToPCMSK(p)    (((p) <= 7) ? (&PCMSK2) : (((p) <= 13) ? (&PCMSK0) : (((p) <= 21) ? (&PCMSK1) : ((uint8_t *)0))))
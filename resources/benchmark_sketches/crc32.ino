@@ -0,0 +1,60 @@
+// Compares the three CRC32 implementations in BeanCrc32.h.
+//
+// Timer1 is borrowed as a free-running cycle counter (prescaler 1), so PWM on
+// pins driven by Timer1 is unavailable while this sketch runs. Results are
+// printed to Virtual Serial as CSV lines:
+//
+//   crc32,<variant>,<cycles per byte>,<crc of "123456789">
+//
+// Every variant must report the standard check value CBF43926.
+
+#include <BeanCrc32.h>
+
+#define BENCH_BUFFER_SIZE 64
+
+typedef uint32_t (*crcUpdateFn)(uint32_t, const uint8_t *, uint16_t);
+
+static uint8_t benchBuffer[BENCH_BUFFER_SIZE];
+
+static uint16_t measureCycles(crcUpdateFn fn) {
+  uint8_t oldTccr1a = TCCR1A;
+  uint8_t oldTccr1b = TCCR1B;
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TCNT1 = 0;
+  fn(bean_crc32_begin(), benchBuffer, BENCH_BUFFER_SIZE);
+  uint16_t cycles = TCNT1;
+  TCCR1A = oldTccr1a;
+  TCCR1B = oldTccr1b;
+  interrupts();
+
+  return cycles;
+}
+
+static void report(const char *name, crcUpdateFn fn) {
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  uint32_t crc = bean_crc32_finish(fn(bean_crc32_begin(), check, sizeof(check)));
+  uint16_t cycles = measureCycles(fn);
+
+  Serial.print("crc32,");
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(cycles / BENCH_BUFFER_SIZE);
+  Serial.print(',');
+  Serial.println(crc, HEX);
+}
+
+void setup() {
+  for (int i = 0; i < BENCH_BUFFER_SIZE; i++) {
+    benchBuffer[i] = (uint8_t)(i * 7 + 3);
+  }
+}
+
+void loop() {
+  report("bitwise", bean_crc32_update_bitwise);
+  report("nibble", bean_crc32_update_nibble);
+  report("table", bean_crc32_update_table);
+  Bean.sleep(5000);
+}
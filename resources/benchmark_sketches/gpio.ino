@@ -0,0 +1,91 @@
+// Measures the cost of the core's pin functions.
+//
+// Timer1 is borrowed as a free-running cycle counter (prescaler 1), so PWM on
+// pins driven by Timer1 is unavailable while this sketch runs. Results are
+// printed to Virtual Serial as CSV lines:
+//
+//   gpio,<function>,<cycles per call>
+//
+// The cost of the measuring loop itself is subtracted. Pin 0 is driven as an
+// output and pin A0 is read, so leave nothing connected to them.
+
+#define BENCH_CALLS 16
+#define BENCH_PIN 0
+
+typedef void (*benchFn)(void);
+
+static volatile uint8_t sink;
+
+static void benchEmpty(void) {}
+
+static void benchDigitalWrite(void) {
+  digitalWrite(BENCH_PIN, HIGH);
+  digitalWrite(BENCH_PIN, LOW);
+}
+
+static void benchDigitalRead(void) {
+  sink = digitalRead(BENCH_PIN);
+  sink = digitalRead(BENCH_PIN);
+}
+
+static void benchDigitalWriteFast(void) {
+  digitalWriteFast(BENCH_PIN, HIGH);
+  digitalWriteFast(BENCH_PIN, LOW);
+}
+
+static void benchPinMode(void) {
+  pinMode(BENCH_PIN, OUTPUT);
+  pinMode(BENCH_PIN, OUTPUT);
+}
+
+static void benchAnalogRead(void) {
+  sink = analogRead(A0);
+  sink = analogRead(A0);
+}
+
+// Cycles taken by BENCH_CALLS calls of fn, each making two calls of the
+// function under test.  analogRead() is the slowest at 13 ADC clocks of 64 or
+// 128 CPU cycles, which keeps the total within the 16 bit counter.
+static uint16_t measureCycles(benchFn fn) {
+  uint8_t oldTccr1a = TCCR1A;
+  uint8_t oldTccr1b = TCCR1B;
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TCNT1 = 0;
+  for (uint8_t i = 0; i < BENCH_CALLS; i++) {
+    fn();
+  }
+  uint16_t cycles = TCNT1;
+  TCCR1A = oldTccr1a;
+  TCCR1B = oldTccr1b;
+  interrupts();
+
+  return cycles;
+}
+
+static void report(const char *name, benchFn fn) {
+  uint16_t overhead = measureCycles(benchEmpty);
+  uint16_t cycles = measureCycles(fn);
+
+  Serial.print("gpio,");
+  Serial.print(name);
+  Serial.print(',');
+  Serial.println((cycles - overhead) / (BENCH_CALLS * 2));
+}
+
+void setup() {
+  pinMode(BENCH_PIN, OUTPUT);
+  // the first conversion after power up takes 25 ADC clocks instead of 13
+  analogRead(A0);
+}
+
+void loop() {
+  report("digitalWrite", benchDigitalWrite);
+  report("digitalRead", benchDigitalRead);
+  report("digitalWriteFast", benchDigitalWriteFast);
+  report("pinMode", benchPinMode);
+  report("analogRead", benchAnalogRead);
+  Bean.sleep(5000);
+}
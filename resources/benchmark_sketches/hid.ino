@@ -0,0 +1,59 @@
+// Measures how fast BeanHid types.
+//
+// Results are printed to Virtual Serial as CSV lines:
+//
+//   hid,sendKeys,<keys>,<keys per second>
+//
+// Key reports are sent in the background between calls to loop(), so a run
+// ends once the last report has gone out to the CC2540. The text really is
+// typed on the connected device: give it an empty text field.
+
+#define BENCH_STRINGS 8
+
+static const char benchKeys[] = "abcdefghijklmnopqrstuvwxyz 01234";
+
+static bool measuring = false;
+static uint32_t started;
+static uint32_t lastQueuedAt;
+static uint16_t lastFrame;
+
+void setup() {
+  BeanHid.enable();
+}
+
+void loop() {
+  if (!measuring) {
+    while (Serial.txFramesPending() != 0) {
+    }
+    started = millis();
+    for (uint8_t i = 0; i < BENCH_STRINGS; i++) {
+      BeanHid.sendKeys(benchKeys);
+    }
+    measuring = true;
+    lastFrame = Serial.txLastFrame();
+    lastQueuedAt = millis();
+    return;
+  }
+
+  // the queue is empty once no report has been sent for a while
+  uint16_t frame = Serial.txLastFrame();
+  if (frame != lastFrame) {
+    lastFrame = frame;
+    lastQueuedAt = millis();
+    return;
+  }
+  if (millis() - lastQueuedAt < 10 * BEAN_HID_REPORT_INTERVAL ||
+      Serial.txFramesPending() != 0) {
+    return;
+  }
+
+  uint32_t keys = (uint32_t)BENCH_STRINGS * (sizeof(benchKeys) - 1);
+  Serial.print("hid,sendKeys,");
+  Serial.print(keys);
+  Serial.print(',');
+  Serial.println(keys * 1000 / (lastQueuedAt - started));
+
+  BeanHid.releaseAllKeys();
+  measuring = false;
+  Bean.sleep(5000);
+}
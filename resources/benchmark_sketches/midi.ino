@@ -0,0 +1,83 @@
+// Measures how fast BeanMidi gets messages out to the CC2540.
+//
+// Results are printed to Virtual Serial as CSV lines:
+//
+//   midi,<mode>,<packets per second>,<messages per second>
+//
+// "single" sends every message in its own BLE-MIDI packet, "batch" four
+// messages to a packet and "autoflush" lets setAutoFlush() pack them. Each
+// run lasts until the last packet has gone out, so the rates are what the
+// serial link sustains, not just how fast messages are queued. Enable MIDI
+// receive on the connected device or the CC2540 may drop the packets.
+
+#define BENCH_WINDOW_MS 2000
+#define BENCH_BATCH 4
+
+typedef uint8_t (*benchFn)(uint8_t note);
+
+static uint8_t sendSingle(uint8_t note) {
+  BeanMidi.sendMessage(NOTEON | CHANNEL1, note, 64);
+  return 1;
+}
+
+static uint8_t sendBatch(uint8_t note) {
+  uint8_t messages[BENCH_BATCH * 3];
+  for (uint8_t i = 0; i < BENCH_BATCH; i++) {
+    messages[i * 3] = NOTEON | CHANNEL1;
+    messages[i * 3 + 1] = (note + i) & 0x7F;
+    messages[i * 3 + 2] = 64;
+  }
+  BeanMidi.sendMessage(messages, sizeof(messages));
+  return BENCH_BATCH;
+}
+
+// The auto flush timer runs between calls to loop(), so within the window a
+// packet is only sent once the next message doesn't fit in it.
+static uint8_t loadAutoFlush(uint8_t note) {
+  BeanMidi.loadMessage(NOTEON | CHANNEL1, note, 64);
+  return 1;
+}
+
+static void waitTxIdle(void) {
+  while (Serial.txFramesPending() != 0) {
+  }
+}
+
+static void report(const char *name, benchFn fn) {
+  Serial.flush();
+  waitTxIdle();
+
+  uint16_t firstFrame = Serial.txLastFrame();
+  uint32_t messages = 0;
+  uint8_t note = 0;
+  uint32_t start = millis();
+  while (millis() - start < BENCH_WINDOW_MS) {
+    messages += fn(note);
+    note = (note + 1) & 0x7F;
+  }
+  BeanMidi.sendMessages();
+  uint16_t packets = Serial.txLastFrame() - firstFrame;
+  waitTxIdle();
+  uint32_t elapsed = millis() - start;
+
+  Serial.print("midi,");
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print((uint32_t)packets * 1000 / elapsed);
+  Serial.print(',');
+  Serial.println(messages * 1000 / elapsed);
+}
+
+void setup() {
+  BeanMidi.enable();
+}
+
+void loop() {
+  BeanMidi.setAutoFlush(0);
+  report("single", sendSingle);
+  report("batch", sendBatch);
+  BeanMidi.setAutoFlush(5);
+  report("autoflush", loadAutoFlush);
+  BeanMidi.setAutoFlush(0);
+  Bean.sleep(5000);
+}
@@ -0,0 +1,220 @@
+// Measures the serial transport between the ATmega and the CC2540.
+//
+// Timer1 is borrowed as a free-running cycle counter (prescaler 1), so PWM on
+// pins driven by Timer1 is unavailable while this sketch runs. Results are
+// printed to Virtual Serial as CSV lines:
+//
+//   transport,baud,<rate>
+//   transport,tx_queue,<body bytes>,<cycles>
+//   transport,tx_frame,<body bytes>,<microseconds>
+//   transport,rx_isr,<bytes measured>,<cycles per byte>,<longest RX ISR us>
+//   transport,call,<getter>,<min us>,<mean us>,<max us>
+//
+// tx_queue is what a Virtual Serial write() costs the sketch: framing the
+// message, its CRC and queueing it. tx_frame is how long it then takes to go
+// out, including the CC wake wait and frame pacing.
+//
+// rx_isr needs Virtual Serial data streaming in, e.g. from
+// beanModuleEmulator/BeanCCEmulator.py --bench tx. It compares how far an
+// idle loop gets in a second with and without the stream, so everything the
+// receive path costs per byte is counted, and reports 0 bytes if nothing
+// arrives. It relies on the transport counters, so a core built with
+// -DBEAN_TRANSPORT_STATS=0 always reports 0 bytes.
+//
+// call is the round trip of getters that wait on a reply from the CC2540,
+// with their cached values turned off.
+//
+// The link runs at the fastest rate up to BENCH_BAUD that
+// Serial.negotiateBaud() settles on with the CC2540, reported as baud.
+
+#ifndef BENCH_BAUD
+#define BENCH_BAUD 38400
+#endif
+#define BENCH_RUNS 8
+#define BENCH_WINDOW_MS 1000
+#define BENCH_RX_WAIT_MS 10000
+
+// Each received frame adds SOF, length, two id bytes, four CRC bytes and EOF
+// to its body.
+#define BENCH_FRAME_OVERHEAD 9
+
+static uint8_t benchBuffer[64];
+static volatile uint32_t benchSpins;
+
+static void waitTxIdle(void) {
+  Serial.flush();
+  while (Serial.txFramesPending() != 0) {
+  }
+}
+
+static void reportTx(uint8_t length) {
+  uint16_t best = 0xFFFF;
+  uint32_t frameUs = 0;
+
+  for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+    waitTxIdle();
+    uint8_t oldTccr1a = TCCR1A;
+    uint8_t oldTccr1b = TCCR1B;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+
+    // interrupts stay on for the write, which may wait on the TX queue; the
+    // fastest run is the one no interrupt landed in
+    uint32_t startUs = micros();
+    TCNT1 = 0;
+    Serial.write(benchBuffer, length);
+    uint16_t cycles = TCNT1;
+    TCCR1A = oldTccr1a;
+    TCCR1B = oldTccr1b;
+
+    uint16_t frame = Serial.txLastFrame();
+    while (!Serial.txFrameSent(frame)) {
+    }
+    frameUs += micros() - startUs;
+    if (cycles < best) {
+      best = cycles;
+    }
+  }
+
+  Serial.print("transport,tx_queue,");
+  Serial.print(length);
+  Serial.print(',');
+  Serial.println(best);
+  Serial.print("transport,tx_frame,");
+  Serial.print(length);
+  Serial.print(',');
+  Serial.println(frameUs / BENCH_RUNS);
+}
+
+// Every receive interrupt during the window takes its cycles from this loop.
+static uint32_t spinWindow(void) {
+  uint32_t start = millis();
+  benchSpins = 0;
+  while (millis() - start < BENCH_WINDOW_MS) {
+    benchSpins++;
+  }
+  return benchSpins;
+}
+
+static uint32_t receivedBytes(void) {
+  TransportStats stats = Bean.getTransportStats();
+  return (uint32_t)stats.framesReceived * BENCH_FRAME_OVERHEAD +
+         stats.serialOverflows + Serial.available();
+}
+
+static void drainSerial(void) {
+  while (Serial.read() >= 0) {
+  }
+}
+
+static void reportRx(void) {
+  waitTxIdle();
+  drainSerial();
+
+  uint32_t start = millis();
+  while (Serial.available() == 0 && millis() - start < BENCH_RX_WAIT_MS) {
+  }
+  uint32_t bytes = 0;
+  uint32_t cyclesPerByte = 0;
+  Bean.resetTransportStats();
+
+  if (Serial.available() != 0) {
+    drainSerial();
+    uint32_t before = receivedBytes();
+    uint32_t busy = spinWindow();
+    bytes = receivedBytes() - before;
+
+    // wait for the stream to stop, then measure the same loop idle
+    uint32_t seen;
+    do {
+      seen = receivedBytes();
+      delay(200);
+      drainSerial();
+    } while (receivedBytes() != seen);
+    uint32_t idle = spinWindow();
+
+    if (bytes != 0 && idle > busy) {
+      uint64_t stolen = (uint64_t)(idle - busy) * (F_CPU / 1000) * BENCH_WINDOW_MS;
+      cyclesPerByte = stolen / idle / bytes;
+    }
+  }
+
+  Serial.print("transport,rx_isr,");
+  Serial.print(bytes);
+  Serial.print(',');
+  Serial.print(cyclesPerByte);
+  Serial.print(',');
+  Serial.println(Bean.getTransportStats().maxRxIsrMicros);
+}
+
+typedef void (*benchFn)(void);
+
+static volatile int32_t sink;
+
+static void callTemperature(void) { sink = Bean.getTemperature(); }
+static void callBatteryLevel(void) { sink = Bean.getBatteryLevel(); }
+static void callBatteryVoltage(void) { sink = Bean.getBatteryVoltage(); }
+static void callLed(void) { sink = Bean.getLed().red; }
+static void callAcceleration(void) { sink = Bean.getAcceleration().xAxis; }
+static void callAccelerationRange(void) { sink = Bean.getAccelerationRange(); }
+static void callScratch(void) { sink = Bean.readScratchData(1).length; }
+
+static void reportCall(const char *name, benchFn fn) {
+  uint32_t best = 0xFFFFFFFF;
+  uint32_t worst = 0;
+  uint32_t total = 0;
+
+  waitTxIdle();
+  for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+    uint32_t start = micros();
+    fn();
+    uint32_t us = micros() - start;
+    total += us;
+    if (us < best) {
+      best = us;
+    }
+    if (us > worst) {
+      worst = us;
+    }
+  }
+
+  Serial.print("transport,call,");
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(best);
+  Serial.print(',');
+  Serial.print(total / BENCH_RUNS);
+  Serial.print(',');
+  Serial.println(worst);
+}
+
+void setup() {
+  for (uint8_t i = 0; i < sizeof(benchBuffer); i++) {
+    benchBuffer[i] = (uint8_t)(i * 7 + 3);
+  }
+  // one message per write(), so each one is timed on its own
+  Serial.setWriteCombining(false);
+  Bean.setCacheMaxAge(CACHED_TEMPERATURE, 0);
+  Bean.setCacheMaxAge(CACHED_BATTERY, 0);
+  Bean.setCacheMaxAge(CACHED_LED, 0);
+}
+
+void loop() {
+  Serial.print("transport,baud,");
+  Serial.println(Serial.negotiateBaud(BENCH_BAUD));
+
+  reportTx(1);
+  reportTx(16);
+  reportTx(64);
+
+  reportCall("getTemperature", callTemperature);
+  reportCall("getBatteryLevel", callBatteryLevel);
+  reportCall("getBatteryVoltage", callBatteryVoltage);
+  reportCall("getLed", callLed);
+  reportCall("getAcceleration", callAcceleration);
+  reportCall("getAccelerationRange", callAccelerationRange);
+  reportCall("readScratchData", callScratch);
+
+  reportRx();
+  Bean.sleep(5000);
+}
@@ -1,10 +1,25 @@
 #!/usr/bin/env python
-"""Run all combinations of boards and test sketches."""
+"""Run all combinations of boards and test sketches.
+
+Usage:
+    scripts/compile_all.py: check that everything compiles
+    scripts/compile_all.py --sizes: also report flash and SRAM use per core
+        object, against resources/size_baseline.json
+    scripts/compile_all.py --update-baseline: store the sizes as the new
+        baseline
+"""
 from glob import glob
-from sys import exit
+from sys import argv, exit
 from os import environ
+from shutil import rmtree
+from tempfile import mkdtemp
 import subprocess
 
+import size_report
+
+update_baseline = '--update-baseline' in argv
+sizes = '--sizes' in argv or update_baseline
+
 # http://stackoverflow.com/a/29723536/254187
 RED = '\033[91m'
 END = '\033[0m'
@@ -17,6 +32,7 @@ compiler_configs = [
 
 test_sketches = [
     'resources/test_sketches/*.ino',
+    'resources/benchmark_sketches/*.ino',
     'examples/**/*.ino',
 ]
 
@@ -24,6 +40,9 @@ test_sketch_paths = []
 for pattern in test_sketches:
     test_sketch_paths.extend(glob(pattern))
 
+baseline = size_report.load_baseline() if sizes else {}
+measured = {}
+
 return_code = 0
 bad_sketch_output = []
 for sketch_path in test_sketch_paths:
@@ -32,15 +51,35 @@ for sketch_path in test_sketch_paths:
         # the virtualenv which contains the PlatformIO executable
         env = environ.copy()
         env['PLATFORMIO_CI_SRC'] = sketch_path
+        command = list(compiler)
+        if sizes:
+            build_dir = mkdtemp()
+            command += ['--keep-build-dir', '--build-dir=' + build_dir]
         try:
             # if it succeeds, we don't care about the compile output
-            subprocess.check_output(compiler, env=env,
+            subprocess.check_output(command, env=env,
                                     stderr=subprocess.STDOUT)
             print 'PASS:', sketch_path
+            if sizes:
+                # a sketch is named by its path and board in the baseline
+                key = ' '.join([sketch_path] + compiler[2:])
+                measured[key] = size_report.measure(build_dir)
+                if not size_report.report(key, measured[key],
+                                          baseline.get(key)):
+                    return_code = 1
+                    print '{}TOO BIG: {}{}'.format(RED, sketch_path, END)
         except subprocess.CalledProcessError as e:
             return_code = 1
             print '{}FAIL: {}{}'.format(RED, sketch_path, END)
             bad_sketch_output.append((sketch_path, e.output))
+        finally:
+            if sizes:
+                rmtree(build_dir, ignore_errors=True)
+
+if update_baseline:
+    size_report.save_baseline(measured)
+    print 'Stored the sizes of {} builds in {}'.format(
+        len(measured), size_report.BASELINE_PATH)
 
 print
 for sketch_path, error_output in bad_sketch_output:
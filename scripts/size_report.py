@@ -0,0 +1,193 @@
+#!/usr/bin/env python
+"""Flash and SRAM footprint of built sketches, per object file.
+
+Used by compile_all.py --sizes, or on its own on a kept PlatformIO build
+directory:
+
+    scripts/size_report.py BUILD_DIR
+
+Each symbol linked into firmware.elf is attributed to the object file that
+defines it, so the report shows what every core module (BeanMidi, BeanHID,
+BeanAncs...) costs a sketch.  Code from libc and libgcc, and the few symbols
+without a size, are counted as "(other)".
+"""
+from __future__ import print_function
+
+from os import environ, walk
+from os.path import basename, exists, expanduser, join, sep
+from sys import argv, exit
+import json
+import subprocess
+
+BASELINE_PATH = 'resources/size_baseline.json'
+
+# From resources/platformio/boards/punchthrough-test.json
+MAX_FLASH = 32256
+MAX_RAM = 2048
+
+# Addresses at or above this are in SRAM
+RAM_START = 0x800000
+
+TOOLCHAIN_BIN = expanduser('~/.platformio/packages/toolchain-atmelavr/bin')
+
+
+def tool(name):
+    path = join(TOOLCHAIN_BIN, name)
+    return path if exists(path) else name
+
+
+def nm(path):
+    """Yields (name, size, type, address) for each defined, sized symbol."""
+    output = subprocess.check_output(
+        [tool('avr-nm'), '--defined-only', '--print-size', path],
+        env=environ.copy(), stderr=subprocess.STDOUT)
+    for line in output.decode('latin-1').splitlines():
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        address, size, kind, name = fields
+        yield name, int(size, 16), kind, int(address, 16)
+
+
+def section_of(kind, address):
+    if address < RAM_START:
+        return 'text'
+    return 'bss' if kind in 'bB' else 'data'
+
+
+def find_build(build_dir):
+    """Returns the firmware.elf in build_dir and a list of its objects."""
+    elf = None
+    objects = []
+    for dirpath, dirnames, filenames in walk(build_dir):
+        for f in filenames:
+            if f == 'firmware.elf':
+                elf = join(dirpath, f)
+            elif f.endswith('.o'):
+                objects.append(join(dirpath, f))
+    return elf, objects
+
+
+def object_name(path):
+    """BeanMidi.o and BeanMidi.cpp.o are both "BeanMidi"; sketch code is
+    "(sketch)"."""
+    if sep + 'src' + sep in path:
+        return '(sketch)'
+    return basename(path).split('.')[0]
+
+
+def measure(build_dir):
+    """
+    Returns {'flash', 'ram', 'text', 'data', 'bss', 'objects'}, objects being
+    {name: {'text', 'data', 'bss'}}.  Flash is text + data, as the initial
+    values of data are stored there, and RAM is data + bss.
+    """
+    elf, objects = find_build(build_dir)
+    if elf is None:
+        raise IOError('no firmware.elf in {}'.format(build_dir))
+
+    # which object defines each symbol; a name defined by several objects
+    # (statics, or inline functions the linker keeps one copy of) goes to
+    # the first one whose definition has the linked size
+    owners = {}
+    for path in sorted(objects):
+        name = object_name(path)
+        for symbol, size, kind, address in nm(path):
+            owners.setdefault(symbol, []).append((size, name))
+
+    totals = {'text': 0, 'data': 0, 'bss': 0}
+    per_object = {}
+    for symbol, size, kind, address in nm(elf):
+        section = section_of(kind, address)
+        totals[section] += size
+        candidates = owners.get(symbol, [])
+        owner = '(other)'
+        for candidate_size, candidate in candidates:
+            if candidate_size == size:
+                owner = candidate
+                break
+        else:
+            if candidates:
+                owner = candidates[0][1]
+        counts = per_object.setdefault(owner, {'text': 0, 'data': 0, 'bss': 0})
+        counts[section] += size
+
+    # avr-size is exact where symbol sizes miss padding, vectors and the
+    # startup code; the difference is theirs
+    output = subprocess.check_output([tool('avr-size'), '-A', elf])
+    sections = {}
+    for line in output.decode('latin-1').splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1].isdigit():
+            sections[fields[0]] = int(fields[1])
+    exact = {
+        'text': sections.get('.text', 0),
+        'data': sections.get('.data', 0),
+        'bss': sections.get('.bss', 0) + sections.get('.noinit', 0),
+    }
+    other = per_object.setdefault('(other)', {'text': 0, 'data': 0, 'bss': 0})
+    for section in exact:
+        other[section] += exact[section] - totals[section]
+
+    result = dict(exact)
+    result['flash'] = exact['text'] + exact['data']
+    result['ram'] = exact['data'] + exact['bss']
+    result['objects'] = per_object
+    return result
+
+
+def flash_of(counts):
+    return counts['text'] + counts['data']
+
+
+def ram_of(counts):
+    return counts['data'] + counts['bss']
+
+
+def change(old, new):
+    if old is None:
+        return '{:6d}'.format(new)
+    return '{:6d} {:+6d}'.format(new, new - old)
+
+
+def report(sketch, sizes, baseline=None):
+    """Prints one sketch's footprint, and what changed against baseline.
+    Returns False if the sketch no longer fits."""
+    old = baseline or {}
+    print('{}: flash {} of {}, ram {} of {}'.format(
+        sketch, change(old.get('flash'), sizes['flash']), MAX_FLASH,
+        change(old.get('ram'), sizes['ram']), MAX_RAM))
+
+    old_objects = old.get('objects', {})
+    names = set(sizes['objects']) | set(old_objects)
+    zero = {'text': 0, 'data': 0, 'bss': 0}
+    for name in sorted(names):
+        new_counts = sizes['objects'].get(name, zero)
+        old_counts = old_objects.get(name, zero if baseline else None)
+        if baseline and new_counts == old_counts:
+            continue
+        print('    {:24s} flash {}  ram {}'.format(
+            name,
+            change(old_counts and flash_of(old_counts), flash_of(new_counts)),
+            change(old_counts and ram_of(old_counts), ram_of(new_counts))))
+    return sizes['flash'] <= MAX_FLASH and sizes['ram'] <= MAX_RAM
+
+
+def load_baseline(path=BASELINE_PATH):
+    if not exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def save_baseline(sizes, path=BASELINE_PATH):
+    with open(path, 'w') as f:
+        json.dump(sizes, f, indent=2, sort_keys=True)
+        f.write('\n')
+
+
+if __name__ == '__main__':
+    if len(argv) != 2:
+        print(__doc__)
+        exit(2)
+    exit(0 if report(argv[1], measure(argv[1])) else 1)